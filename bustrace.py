@@ -0,0 +1,362 @@
+#!/usr/bin/env python3
+"""Records, synthesizes and dumps RTU bus traces.
+
+A trace holds timestamped frames in the versioned binary format described
+in lib/ArduinoMock/src/bustrace.h. The native simulator replays a trace
+against the firmware and reports response latencies, dropped and late
+responses and loop stalls:
+
+  bustrace.py record --port /dev/ttyUSB0 --baudrate 19200 -o bus.hct
+  bustrace.py synth burst -o burst.hct
+  bustrace.py dump burst.hct
+  .pio/build/sim/program --replay burst.hct --fast --cpu-scale 20
+
+The recorder only listens, run it on a second adapter on the bus. It
+splits frames on the t3.5 silence and at the length of a complete frame
+with a valid crc, since USB adapters deliver bytes late and in chunks,
+which also makes the recorded start times jitter by a few milliseconds.
+"""
+import argparse
+import collections
+import os
+import select
+import struct
+import sys
+import time
+
+from gateway import char_time, crc16, gap_time, open_port, response_length, rtu_frame
+
+MAGIC = b'HCBT'
+VERSION = 1
+HEADER = struct.Struct('<4sBBHII')
+
+FRAME_RESPONSE = 0x01
+FRAME_CRC_ERROR = 0x02
+
+Frame = collections.namedtuple('Frame', 'time_us flags data')
+
+
+def write_varint(value):
+    data = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            data.append(byte | 0x80)
+        else:
+            data.append(byte)
+            return bytes(data)
+
+
+def read_varint(data, offset):
+    value = shift = 0
+    while True:
+        if offset >= len(data):
+            raise ValueError("trace is truncated")
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, offset
+
+
+class TraceWriter:
+    def __init__(self, file, baudrate):
+        self.file = file
+        self.baudrate = baudrate
+        self.count = 0
+        self.time_us = 0
+        file.write(HEADER.pack(MAGIC, VERSION, 0, 0, baudrate, 0))
+
+    def write(self, time_us, flags, data):
+        if not self.count:
+            self.time_us = time_us
+        delta = max(time_us - self.time_us, 0)
+        self.file.write(write_varint(delta) + bytes([flags]) + write_varint(len(data)) + data)
+        self.time_us += delta
+        self.count += 1
+
+    def close(self):
+        # the frame count is only known at the end
+        self.file.seek(0)
+        self.file.write(HEADER.pack(MAGIC, VERSION, 0, 0, self.baudrate, self.count))
+        self.file.close()
+
+
+class Trace:
+    def __init__(self, data):
+        magic, self.version, _, _, self.baudrate, self.frame_count = HEADER.unpack_from(data)
+        if magic != MAGIC:
+            raise ValueError("not a bus trace")
+        if not 0 < self.version <= VERSION:
+            raise ValueError("unsupported trace version %d" % self.version)
+        self.frames = []
+        offset = HEADER.size
+        time_us = 0
+        while offset < len(data):
+            delta, offset = read_varint(data, offset)
+            if offset >= len(data):
+                raise ValueError("trace is truncated")
+            flags = data[offset]
+            length, offset = read_varint(data, offset + 1)
+            if offset + length > len(data):
+                raise ValueError("trace is truncated")
+            time_us += delta
+            self.frames.append(Frame(time_us, flags, bytes(data[offset:offset + length])))
+            offset += length
+
+    @staticmethod
+    def load(path):
+        with open(path, 'rb') as file:
+            return Trace(file.read())
+
+
+def request_length(buffer):
+    """Returns the length of the RTU request starting buffer, None while unknown."""
+    if len(buffer) < 2:
+        return None
+    function = buffer[1]
+    if function in (1, 2, 3, 4, 5, 6, 8):
+        return 8
+    if function in (15, 16):
+        return 9 + buffer[6] if len(buffer) >= 7 else None
+    return None
+
+
+def expected_response_length(pdu):
+    """Returns the length of the response to a request pdu."""
+    function = pdu[0]
+    if function in (1, 2):
+        return 5 + (struct.unpack_from('>H', pdu, 3)[0] + 7) // 8
+    if function in (3, 4):
+        return 5 + 2 * struct.unpack_from('>H', pdu, 3)[0]
+    return 8
+
+
+class FrameSplitter:
+    """Cuts the bytes seen on the bus into frames.
+
+    A unicast request makes the next frame from the same slave with the
+    same function code its response.
+    """
+
+    def __init__(self, baudrate, emit):
+        self.char = char_time(baudrate)
+        self.gap = gap_time(baudrate)
+        self.emit = emit
+        self.buffer = bytearray()
+        self.start = self.last = 0.0
+        self.expecting = None
+
+    def feed(self, data, now):
+        """data arrived at now, when its last character was complete."""
+        arrival = now - len(data) * self.char
+        if self.buffer and arrival - self.last > self.gap:
+            self.flush()
+        if not self.buffer:
+            self.start = arrival
+        self.buffer += data
+        self.last = now
+        self.cut()
+
+    def idle(self, now):
+        if self.buffer and now - self.last > self.gap:
+            self.flush()
+
+    def frame_length(self):
+        if self.expecting and len(self.buffer) >= 2 and self.buffer[0] == self.expecting[0] \
+                and self.buffer[1] & 0x7F == self.expecting[1]:
+            return response_length(self.buffer)
+        return request_length(self.buffer)
+
+    def cut(self):
+        while True:
+            length = self.frame_length()
+            if not length or len(self.buffer) < length or crc16(self.buffer[:length]):
+                return
+            self.frame(bytes(self.buffer[:length]), 0)
+            del self.buffer[:length]
+            self.start += length * self.char
+
+    def flush(self):
+        frame = bytes(self.buffer)
+        self.buffer.clear()
+        self.frame(frame, FRAME_CRC_ERROR if len(frame) < 4 or crc16(frame) else 0)
+
+    def frame(self, data, flags):
+        response = self.expecting is not None and len(data) >= 2 and data[0] == self.expecting[0] \
+            and data[1] & 0x7F == self.expecting[1]
+        if response:
+            flags |= FRAME_RESPONSE
+            self.expecting = None
+        elif not flags and data[0] != 0:
+            self.expecting = (data[0], data[1])
+        else:
+            self.expecting = None
+        self.emit(self.start, flags, data)
+
+
+def record(port, baudrate, parity, path, duration):
+    fd = open_port(port, baudrate, parity)
+    writer = TraceWriter(open(path, 'wb'), baudrate)
+    origin = time.monotonic()
+    splitter = FrameSplitter(baudrate, lambda start, flags, data: writer.write(
+        int((start - origin) * 1e6), flags, data))
+    deadline = origin + duration if duration else None
+    try:
+        while deadline is None or time.monotonic() < deadline:
+            readable, _, _ = select.select([fd], [], [], splitter.gap)
+            now = time.monotonic()
+            if readable:
+                data = os.read(fd, 256)
+                if data:
+                    splitter.feed(data, now)
+            splitter.idle(now)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if splitter.buffer:
+            splitter.flush()
+        writer.close()
+        os.close(fd)
+    print("%d frames in %s" % (writer.count, path))
+
+
+class Synthesizer:
+    """Builds the master side of a bus workload.
+
+    Each unicast request leaves room for the turnaround of the node and
+    its response before the next frame, like a master waiting for it.
+    """
+    # see Layout in homectrl.py
+    SYSTEM_SETTING_SIZE = 8
+    PIN_SETTING_SIZE = 16
+    MODE, GROUP, CLICK_COMMAND, FADE_TIME = 0, 1, 3, 12
+    GROUP_COMMAND = 0x3
+    DIGITAL_PIN_MODE_OUTPUT = 1
+    COMMAND_FADE_TO_ON = 6
+    COMMAND_FADE_TO_OFF = 7
+
+    def __init__(self, baudrate, slave, pins, turnaround):
+        self.baudrate = baudrate
+        self.slave = slave
+        self.pins = pins
+        self.turnaround = turnaround
+        self.char = char_time(baudrate)
+        self.gap = gap_time(baudrate)
+        self.time = 0.0
+        self.frames = []
+        self.commands = self.block_after(self.SYSTEM_SETTING_SIZE + pins * self.PIN_SETTING_SIZE)
+
+    @staticmethod
+    def block_after(end):
+        return (end + 0xFF) // 0x100 * 0x100
+
+    def setting(self, pin, field):
+        return self.SYSTEM_SETTING_SIZE + pin * self.PIN_SETTING_SIZE + field
+
+    def request(self, slave, pdu):
+        frame = rtu_frame(slave, pdu)
+        self.frames.append((int(self.time * 1e6), 0, frame))
+        self.time += len(frame) * self.char + self.gap
+        if slave:
+            self.time += self.turnaround + expected_response_length(pdu) * self.char + self.gap
+
+    def write_registers(self, address, values):
+        self.request(self.slave, struct.pack('>BHHB', 16, address, len(values), 2 * len(values))
+                     + struct.pack('>%dH' % len(values), *values))
+
+    def group_command(self, group, command):
+        self.request(0, struct.pack('>BHH', 6, self.commands + self.GROUP_COMMAND, group << 8 | command))
+
+    def poll(self):
+        self.request(self.slave, struct.pack('>BHH', 4, 0, 8))
+        self.request(self.slave, struct.pack('>BHH', 1, 0, self.pins))
+
+    def poll_until(self, end, interval):
+        while self.time < end:
+            next_poll = self.time + interval
+            self.poll()
+            self.time = max(self.time, next_poll)
+
+    def configure_outputs(self, fade_time):
+        for pin in range(self.pins):
+            self.write_registers(self.setting(pin, self.MODE), [self.DIGITAL_PIN_MODE_OUTPUT, 1])
+            self.write_registers(self.setting(pin, self.FADE_TIME), [fade_time])
+
+    def write_burst(self, value):
+        # changes three EEPROM bytes per pin
+        for pin in range(self.pins):
+            self.write_registers(self.setting(pin, self.CLICK_COMMAND), [value, value, value])
+
+
+def synth(scenario, baudrate, slave, pins, duration, interval, turnaround):
+    synthesizer = Synthesizer(baudrate, slave, pins, turnaround)
+    if scenario == 'poll':
+        synthesizer.poll_until(duration, interval)
+    elif scenario == 'burst':
+        # group 1 fades while its settings are rewritten, repeated with
+        # the fade back off
+        synthesizer.configure_outputs(fade_time=20)
+        phase = duration / 4
+        for step, command in enumerate((Synthesizer.COMMAND_FADE_TO_ON, Synthesizer.COMMAND_FADE_TO_OFF)):
+            synthesizer.poll_until((2 * step + 1) * phase, interval)
+            synthesizer.group_command(1, command)
+            synthesizer.write_burst(3 if command == Synthesizer.COMMAND_FADE_TO_ON else 2)
+        synthesizer.poll_until(duration, interval)
+    return synthesizer.frames
+
+
+def dump(path):
+    trace = Trace.load(path)
+    print("version %d, %d baud, %d frames" % (trace.version, trace.baudrate, len(trace.frames)))
+    for frame in trace.frames:
+        kind = 'rsp' if frame.flags & FRAME_RESPONSE else 'req'
+        error = ' crc error' if frame.flags & FRAME_CRC_ERROR else ''
+        print("%12.6f %s %s%s" % (frame.time_us / 1e6, kind, frame.data.hex(), error))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='record, synthesize and dump RTU bus traces')
+    commands = parser.add_subparsers(dest='command', required=True)
+    record_parser = commands.add_parser('record', help='record the frames on a bus')
+    record_parser.add_argument('--port', required=True)
+    record_parser.add_argument('--baudrate', type=int, default=19200)
+    record_parser.add_argument('--parity', choices='NEO', default='N')
+    record_parser.add_argument('--duration', type=float, help='seconds, until interrupted by default')
+    record_parser.add_argument('-o', '--output', required=True)
+    synth_parser = commands.add_parser('synth', help='synthesize a master workload')
+    synth_parser.add_argument('scenario', choices=('poll', 'burst'),
+                              help='poll: inputs and coils; burst: poll, fade a group and rewrite settings')
+    synth_parser.add_argument('--baudrate', type=int, default=19200)
+    synth_parser.add_argument('--slave', type=int, default=1)
+    synth_parser.add_argument('--pins', type=int, default=12)
+    synth_parser.add_argument('--duration', type=float, default=4.0)
+    synth_parser.add_argument('--interval', type=float, default=0.1, help='poll interval in seconds')
+    synth_parser.add_argument('--turnaround', type=float, default=0.005,
+                              help='time the master grants the node to answer, in seconds')
+    synth_parser.add_argument('-o', '--output', required=True)
+    dump_parser = commands.add_parser('dump', help='print the frames of a trace')
+    dump_parser.add_argument('trace')
+    args = parser.parse_args()
+
+    if args.command == 'record':
+        record(args.port, args.baudrate, args.parity, args.output, args.duration)
+    elif args.command == 'synth':
+        frames = synth(args.scenario, args.baudrate, args.slave, args.pins, args.duration,
+                       args.interval, args.turnaround)
+        writer = TraceWriter(open(args.output, 'wb'), args.baudrate)
+        for time_us, flags, data in frames:
+            writer.write(time_us, flags, data)
+        writer.close()
+        print("%d frames in %s" % (writer.count, args.output))
+    else:
+        try:
+            dump(args.trace)
+        except ValueError as error:
+            sys.exit("%s: %s" % (args.trace, error))
+
+
+if __name__ == '__main__':
+    main()
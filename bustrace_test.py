@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""Tests of the bus trace format and the frame splitter of bustrace.py, run with
+python3 -m unittest bustrace_test
+"""
+import os
+import struct
+import tempfile
+import unittest
+
+from bustrace import (FRAME_CRC_ERROR, FRAME_RESPONSE, FrameSplitter, Trace, TraceWriter, synth,
+                      write_varint)
+from gateway import char_time, read_request, rtu_frame
+
+
+class TraceTest(unittest.TestCase):
+    def test_varint(self):
+        self.assertEqual(write_varint(0), b'\x00')
+        self.assertEqual(write_varint(300), b'\xac\x02')
+
+    def test_written_frames_read_back(self):
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, 'bus.hct')
+            writer = TraceWriter(open(path, 'wb'), 19200)
+            writer.write(5000, 0, rtu_frame(1, read_request(3, 0, 1)))
+            writer.write(5300, FRAME_RESPONSE, rtu_frame(1, b'\x03\x02\x00\x2a'))
+            writer.close()
+            trace = Trace.load(path)
+        self.assertEqual((trace.version, trace.baudrate, trace.frame_count), (1, 19200, 2))
+        # times start at the first frame
+        self.assertEqual([frame.time_us for frame in trace.frames], [0, 300])
+        self.assertEqual(trace.frames[1].flags, FRAME_RESPONSE)
+        self.assertEqual(trace.frames[1].data, rtu_frame(1, b'\x03\x02\x00\x2a'))
+
+    def test_damaged_traces_are_rejected(self):
+        header = struct.pack('<4sBBHII', b'HCBT', 2, 0, 0, 19200, 0)
+        with self.assertRaises(ValueError):
+            Trace(header)
+        header = struct.pack('<4sBBHII', b'HCBT', 1, 0, 0, 19200, 0)
+        with self.assertRaises(ValueError):
+            Trace(header + b'\x00\x00\x08\x01\x03')
+
+    def test_burst_workload(self):
+        frames = synth('burst', 19200, 1, 12, 4.0, 0.1, 0.005)
+        broadcasts = [data for _, _, data in frames if data[0] == 0]
+        self.assertEqual(len(broadcasts), 2)
+        times = [time_us for time_us, _, _ in frames]
+        self.assertEqual(times, sorted(times))
+
+
+class SplitterTest(unittest.TestCase):
+    def setUp(self):
+        self.frames = []
+        self.splitter = FrameSplitter(19200, lambda start, flags, data: self.frames.append((start, flags, data)))
+        self.char = char_time(19200)
+
+    def test_frames_are_cut_at_their_length(self):
+        request = rtu_frame(1, read_request(3, 0, 1))
+        response = rtu_frame(1, b'\x03\x02\x00\x2a')
+        other = rtu_frame(2, read_request(4, 0, 2))
+        self.splitter.feed(request[:5], 1.0)
+        self.splitter.feed(request[5:], 1.0 + 3 * self.char)
+        # an adapter delivers the response and the next request in one chunk
+        self.splitter.feed(response + other, 1.1)
+        self.assertEqual([(flags, data) for _, flags, data in self.frames],
+                         [(0, request), (FRAME_RESPONSE, response), (0, other)])
+        self.assertAlmostEqual(self.frames[0][0], 1.0 - 5 * self.char)
+
+    def test_noise_is_flushed_on_silence(self):
+        self.splitter.feed(b'\x01\x03\x00', 1.0)
+        self.splitter.idle(1.001)
+        self.assertEqual(self.frames, [])
+        self.splitter.idle(1.01)
+        self.assertEqual(self.frames[0][1:], (FRAME_CRC_ERROR, b'\x01\x03\x00'))
+        # a broken request is not answered
+        response = rtu_frame(1, b'\x03\x02\x00\x2a')
+        self.splitter.feed(response, 1.1)
+        self.splitter.idle(1.2)
+        self.assertEqual(self.frames[1][1], 0)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,610 @@
+#!/usr/bin/env python3
+"""Caching Modbus TCP gateway for the RS-485 bus.
+
+The gateway owns the serial line and serves Modbus TCP to any number of
+local clients. Reads (function codes 1 - 4) are answered from a register
+mirror per node while the mirrored values are younger than the staleness
+window, and identical reads that are already waiting for the bus share one
+frame. A background poller keeps configured ranges fresh. Writes and all
+other function codes go to the bus ahead of client reads and polls, and a
+write to a node drops its mirror, since a command register can change any
+other register of the node. The button counters are neither mirrored nor
+polled, in read and clear mode a read changes them.
+
+usage:
+  gateway.py --port /dev/ttyUSB0 --listen 127.0.0.1:5020 --poll 1:1:0:12:0.5
+  gateway.py --bench
+
+The port can be the pseudo-terminal link of the native simulator.
+"""
+import argparse
+import array
+import asyncio
+import fcntl
+import logging
+import os
+import random
+import struct
+import sys
+import termios
+import time
+
+PRIORITY_WRITE = 0
+PRIORITY_READ = 1
+PRIORITY_POLL = 2
+
+READ_BITS = (1, 2)
+READ_REGISTERS = (3, 4)
+WRITES = (5, 6, 15, 16)
+# the subfunction and its data are echoed, see diag.h
+DIAGNOSTICS = 8
+
+EXCEPTION_ILLEGAL_FUNCTION = 0x01
+EXCEPTION_ILLEGAL_DATA_VALUE = 0x03
+EXCEPTION_TARGET_FAILED = 0x0B
+
+# input registers of the per pin records with the button counters, up to the
+# profile block of a node with 20 pins or less, see Layout in homectrl.py. In
+# read and clear mode (holding register 0x101) every read of them clears them
+COUNTER_START = 8
+COUNTER_END = 0x100
+
+# the rates of link.h, the ones without a termios constant are set through
+# termios2 on Linux
+BAUD_RATES = {9600: termios.B9600, 19200: termios.B19200, 38400: termios.B38400,
+              57600: termios.B57600, 76800: None, 115200: termios.B115200, 250000: None}
+# struct termios2 from asm/termbits.h, c_ispeed and c_ospeed are ints 9 and 10
+TCGETS2 = 0x802C542A
+TCSETS2 = 0x402C542B
+BOTHER = 0o010000
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def rtu_frame(slave, pdu):
+    frame = bytes([slave]) + pdu
+    return frame + struct.pack('<H', crc16(frame))
+
+
+def response_length(buffer):
+    """Returns the length of the RTU response starting buffer, None while unknown.
+
+    0 for function codes whose frames only end with t3.5 of silence.
+    """
+    if len(buffer) < 2:
+        return None
+    function = buffer[1]
+    if function & 0x80:
+        return 5
+    if function in READ_BITS + READ_REGISTERS:
+        return 5 + buffer[2] if len(buffer) >= 3 else None
+    if function in WRITES + (DIAGNOSTICS,):
+        return 8
+    return 0
+
+
+def char_time(baudrate):
+    # start bit, 8 data bits, parity or second stop bit, stop bit
+    return 11.0 / baudrate
+
+
+def gap_time(baudrate):
+    # t3.5, fixed at 1750 us above 19200 baud like link.h
+    return 0.00175 if baudrate > 19200 else 3.5 * char_time(baudrate)
+
+
+def open_port(path, baudrate, parity='N'):
+    """Opens a serial port or pseudo-terminal raw and non-blocking, returns the fd."""
+    if baudrate not in BAUD_RATES:
+        raise ValueError("unsupported baud rate %d, one of %s" % (baudrate, sorted(BAUD_RATES)))
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+    if os.isatty(fd):
+        attrs = termios.tcgetattr(fd)
+        attrs[0] = 0
+        attrs[1] = 0
+        attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+        if parity != 'N':
+            attrs[2] |= termios.PARENB | (termios.PARODD if parity == 'O' else 0)
+        attrs[3] = 0
+        attrs[4] = attrs[5] = BAUD_RATES[baudrate] or termios.B38400
+        termios.tcsetattr(fd, termios.TCSANOW, attrs)
+        if BAUD_RATES[baudrate] is None:
+            set_other_baudrate(fd, baudrate)
+    return fd
+
+
+def set_other_baudrate(fd, baudrate):
+    if not sys.platform.startswith('linux'):
+        raise ValueError("%d baud needs termios2, Linux only" % baudrate)
+    attrs = array.array('i', [0] * 64)
+    fcntl.ioctl(fd, TCGETS2, attrs)
+    attrs[2] = attrs[2] & ~termios.CBAUD | BOTHER
+    attrs[9] = attrs[10] = baudrate
+    fcntl.ioctl(fd, TCSETS2, attrs)
+
+
+class ModbusError(Exception):
+    def __init__(self, code):
+        super().__init__("modbus exception %d" % code)
+        self.code = code
+
+
+class SerialLink:
+    """RTU master side of a serial port or pseudo-terminal."""
+
+    def __init__(self, path, baudrate=19200, parity='N', timeout=0.5):
+        self.baudrate = baudrate
+        self.timeout = timeout
+        self.fd = open_port(path, baudrate, parity)
+        self.buffer = bytearray()
+        self.data = asyncio.Event()
+        asyncio.get_running_loop().add_reader(self.fd, self.readable)
+
+    def readable(self):
+        try:
+            self.buffer += os.read(self.fd, 256)
+        except BlockingIOError:
+            pass
+        self.data.set()
+
+    def close(self):
+        asyncio.get_running_loop().remove_reader(self.fd)
+        os.close(self.fd)
+
+    async def exchange(self, frame):
+        """Sends frame, returns the response frame or None for a broadcast."""
+        self.buffer.clear()
+        os.write(self.fd, frame)
+        if frame[0] == 0:
+            # broadcasts are not answered, give the nodes the turnaround
+            await asyncio.sleep(len(frame) * char_time(self.baudrate) + gap_time(self.baudrate))
+            return None
+        deadline = time.monotonic() + len(frame) * char_time(self.baudrate) + self.timeout
+        while True:
+            length = response_length(self.buffer)
+            if length and len(self.buffer) >= length:
+                response = bytes(self.buffer[:length])
+                await asyncio.sleep(gap_time(self.baudrate))
+                return response
+            self.data.clear()
+            if length == 0:
+                try:
+                    await asyncio.wait_for(self.data.wait(), gap_time(self.baudrate))
+                except asyncio.TimeoutError:
+                    response = bytes(self.buffer)
+                    self.buffer.clear()
+                    return response
+                continue
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                await self.settle()
+                raise asyncio.TimeoutError()
+            try:
+                await asyncio.wait_for(self.data.wait(), remaining)
+            except asyncio.TimeoutError:
+                pass
+
+    async def settle(self):
+        """Waits for t3.5 of silence, so a late response does not run into the next frame."""
+        while True:
+            self.data.clear()
+            try:
+                await asyncio.wait_for(self.data.wait(), gap_time(self.baudrate))
+            except asyncio.TimeoutError:
+                self.buffer.clear()
+                return
+
+
+class SimulatedNode:
+    """In-process stand-in for a node, for tests and the benchmark.
+
+    Serves coils, holding and input registers from dicts and takes as long
+    as the request and response would on a real line at baudrate.
+    """
+
+    def __init__(self, slave_id=1, baudrate=19200, number_of_pins=12, turnaround=0.002):
+        self.slave_id = slave_id
+        self.baudrate = baudrate
+        self.turnaround = turnaround
+        self.coils = {i: 0 for i in range(number_of_pins)}
+        self.holding = {i: 0 for i in range(0x10C)}
+        self.input = {i: 0 for i in range(8 + 12 * number_of_pins)}
+        self.input[0] = number_of_pins
+        self.requests = []
+        self.silent = False
+
+    def answer(self, pdu):
+        function = pdu[0]
+        if function in READ_BITS + READ_REGISTERS:
+            start, count = struct.unpack('>HH', pdu[1:5])
+            table = self.coils if function in READ_BITS else self.holding if function == 3 else self.input
+            if any(address not in table for address in range(start, start + count)):
+                return bytes([function | 0x80, 0x02])
+            values = [table[address] for address in range(start, start + count)]
+            if function in READ_BITS:
+                return pack_bits_response(function, values)
+            return struct.pack('>BB%dH' % count, function, 2 * count, *values)
+        if function == 5:
+            address, value = struct.unpack('>HH', pdu[1:5])
+            self.coils[address] = 1 if value == 0xFF00 else 0
+            return pdu
+        if function == 6:
+            address, value = struct.unpack('>HH', pdu[1:5])
+            self.holding[address] = value
+            return pdu
+        if function == 16:
+            start, count = struct.unpack('>HH', pdu[1:5])
+            for i, value in enumerate(struct.unpack('>%dH' % count, pdu[6:6 + 2 * count])):
+                self.holding[start + i] = value
+            return pdu[:5]
+        return bytes([function | 0x80, EXCEPTION_ILLEGAL_FUNCTION])
+
+    async def exchange(self, frame):
+        slave, pdu = frame[0], frame[1:-2]
+        self.requests.append((slave, bytes(pdu)))
+        await asyncio.sleep(len(frame) * char_time(self.baudrate))
+        if slave not in (0, self.slave_id):
+            raise asyncio.TimeoutError()
+        response = self.answer(pdu)
+        if slave == 0:
+            await asyncio.sleep(self.turnaround)
+            return None
+        if self.silent:
+            await asyncio.sleep(self.turnaround)
+            raise asyncio.TimeoutError()
+        response = rtu_frame(slave, response)
+        await asyncio.sleep(self.turnaround + len(response) * char_time(self.baudrate) + gap_time(self.baudrate))
+        return response
+
+
+def pack_bits_response(function, values):
+    packed = bytearray((len(values) + 7) // 8)
+    for i, value in enumerate(values):
+        if value:
+            packed[i // 8] |= 1 << (i % 8)
+    return bytes([function, len(packed)]) + bytes(packed)
+
+
+def read_request(function, start, count):
+    return struct.pack('>BHH', function, start, count)
+
+
+def parse_read_response(pdu, count):
+    function = pdu[0]
+    if function in READ_BITS:
+        return [(pdu[2 + i // 8] >> (i % 8)) & 1 for i in range(count)]
+    return list(struct.unpack('>%dH' % count, pdu[2:2 + 2 * count]))
+
+
+def build_read_response(function, values):
+    if function in READ_BITS:
+        return pack_bits_response(function, values)
+    return struct.pack('>BB%dH' % len(values), function, 2 * len(values), *values)
+
+
+class Mirror:
+    """Register values of one node by (function code, address), with the time they were read."""
+
+    def __init__(self):
+        self.values = {}
+
+    def update(self, function, start, values, now):
+        # input and holding registers, coils and discrete inputs are separate tables
+        for i, value in enumerate(values):
+            self.values[(function, start + i)] = (value, now)
+
+    def get(self, function, start, count, now, staleness):
+        values = []
+        for address in range(start, start + count):
+            entry = self.values.get((function, address))
+            if entry is None or now - entry[1] > staleness:
+                return None
+            values.append(entry[0])
+        return values
+
+    def clear(self):
+        self.values.clear()
+
+
+class Gateway:
+    def __init__(self, link, staleness=0.5, counter_end=COUNTER_END):
+        self.link = link
+        self.staleness = staleness
+        self.counter_end = counter_end
+        self.mirrors = {}
+        self.queue = asyncio.PriorityQueue()
+        self.sequence = 0
+        self.pending = {}
+        self.worker = None
+        self.pollers = []
+        self.started = time.monotonic()
+        self.stats = dict(frames=0, timeouts=0, mismatched=0, hits=0, misses=0, coalesced=0, writes=0, bus_time=0.0)
+
+    def start(self):
+        self.worker = asyncio.get_running_loop().create_task(self.run())
+
+    async def stop(self):
+        for task in self.pollers + [self.worker]:
+            if task:
+                task.cancel()
+        await asyncio.gather(*[t for t in self.pollers + [self.worker] if t], return_exceptions=True)
+
+    def mirror(self, slave):
+        return self.mirrors.setdefault(slave, Mirror())
+
+    def submit(self, priority, slave, pdu):
+        future = asyncio.get_running_loop().create_future()
+        self.sequence += 1
+        self.queue.put_nowait((priority, self.sequence, slave, pdu, future))
+        return future
+
+    async def run(self):
+        """The only task talking to the bus, one frame at a time by priority."""
+        while True:
+            priority, _, slave, pdu, future = await self.queue.get()
+            if future.cancelled():
+                continue
+            start = time.monotonic()
+            try:
+                response = await self.link.exchange(rtu_frame(slave, pdu))
+                if response is None:
+                    future.set_result(None)
+                elif len(response) < 4 or crc16(response[:-2]) != struct.unpack('<H', response[-2:])[0]:
+                    raise asyncio.TimeoutError()
+                elif response[0] != slave or response[1] & 0x7F != pdu[0]:
+                    # the answer of another exchange, a node or the gateway
+                    # having lost track of the line
+                    self.stats['mismatched'] += 1
+                    raise asyncio.TimeoutError()
+                else:
+                    future.set_result(response[1:-2])
+            except asyncio.TimeoutError:
+                self.stats['timeouts'] += 1
+                future.set_exception(ModbusError(EXCEPTION_TARGET_FAILED))
+            finally:
+                self.stats['frames'] += 1
+                self.stats['bus_time'] += time.monotonic() - start
+
+    def reads_counters(self, function, start, count):
+        return function == 4 and start < self.counter_end and start + count > COUNTER_START
+
+    async def read(self, slave, function, start, count, priority=PRIORITY_READ, staleness=None):
+        """Returns the values of a read, from the mirror when fresh enough.
+
+        Reads of the counters always go to the bus and are neither mirrored
+        nor shared, in read and clear mode each of them takes the counts.
+        """
+        if self.reads_counters(function, start, count):
+            self.stats['misses'] += 1
+            pdu = await self.submit(priority, slave, read_request(function, start, count))
+            if pdu[0] & 0x80:
+                raise ModbusError(pdu[1])
+            return parse_read_response(pdu, count)
+        staleness = self.staleness if staleness is None else staleness
+        values = self.mirror(slave).get(function, start, count, time.monotonic(), staleness)
+        if values is not None:
+            self.stats['hits'] += 1
+            return values
+        key = (slave, function, start, count)
+        fetch = self.pending.get(key)
+        if fetch is None:
+            self.stats['misses'] += 1
+            fetch = asyncio.get_running_loop().create_task(self.fetch(priority, slave, function, start, count))
+            self.pending[key] = fetch
+            fetch.add_done_callback(lambda task: self.fetched(key, task))
+        else:
+            self.stats['coalesced'] += 1
+        # a waiter that goes away does not cancel the read of the others
+        return await asyncio.shield(fetch)
+
+    async def fetch(self, priority, slave, function, start, count):
+        pdu = await self.submit(priority, slave, read_request(function, start, count))
+        if pdu[0] & 0x80:
+            raise ModbusError(pdu[1])
+        values = parse_read_response(pdu, count)
+        self.mirror(slave).update(function, start, values, time.monotonic())
+        return values
+
+    def fetched(self, key, task):
+        del self.pending[key]
+        if not task.cancelled():
+            # retrieved here so a read without waiters left is not logged
+            task.exception()
+
+    async def write(self, slave, pdu):
+        """Sends a write or any other request ahead of reads and polls."""
+        self.stats['writes'] += 1
+        response = await self.submit(PRIORITY_WRITE, slave, pdu)
+        if slave == 0:
+            for mirror in self.mirrors.values():
+                mirror.clear()
+        else:
+            self.mirror(slave).clear()
+        return response
+
+    async def request(self, slave, pdu):
+        """Answers one client request PDU."""
+        function = pdu[0]
+        try:
+            if function in READ_BITS + READ_REGISTERS and slave != 0:
+                if len(pdu) != 5:
+                    raise ModbusError(EXCEPTION_ILLEGAL_DATA_VALUE)
+                start, count = struct.unpack('>HH', pdu[1:5])
+                values = await self.read(slave, function, start, count)
+                return build_read_response(function, values)
+            return await self.write(slave, pdu)
+        except ModbusError as e:
+            return bytes([function | 0x80, e.code])
+
+    def poll(self, slave, function, start, count, interval):
+        """Refreshes a range every interval at the lowest priority.
+
+        The counters are not polled, nobody would see the counts a poll
+        clears in read and clear mode.
+        """
+        if self.reads_counters(function, start, count):
+            raise ValueError("the counters at input registers %d - %d are not polled" % (COUNTER_START, self.counter_end - 1))
+        async def poller():
+            while True:
+                try:
+                    await self.read(slave, function, start, count, PRIORITY_POLL, staleness=interval / 2)
+                except ModbusError as e:
+                    logging.warning("poll %d:%d:%d:%d: %s", slave, function, start, count, e)
+                await asyncio.sleep(interval)
+        self.pollers.append(asyncio.get_running_loop().create_task(poller()))
+
+    def utilization(self):
+        return self.stats['bus_time'] / max(time.monotonic() - self.started, 1e-9)
+
+
+class TcpServer:
+    """Modbus TCP front end, requests of a connection are answered as they complete."""
+
+    def __init__(self, gateway):
+        self.gateway = gateway
+
+    async def start(self, host, port):
+        self.server = await asyncio.start_server(self.client, host, port)
+        return self.server.sockets[0].getsockname()[1]
+
+    async def client(self, reader, writer):
+        tasks = set()
+        try:
+            while True:
+                header = await reader.readexactly(7)
+                transaction, protocol, length, unit = struct.unpack('>HHHB', header)
+                pdu = await reader.readexactly(length - 1)
+                if protocol != 0:
+                    continue
+                task = asyncio.get_running_loop().create_task(self.answer(writer, transaction, unit, pdu))
+                tasks.add(task)
+                task.add_done_callback(tasks.discard)
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        finally:
+            for task in tasks:
+                task.cancel()
+            writer.close()
+
+    async def answer(self, writer, transaction, unit, pdu):
+        response = await self.gateway.request(unit, pdu)
+        if response is None:
+            # broadcasts are confirmed to the client with the request
+            response = pdu[:5]
+        writer.write(struct.pack('>HHHB', transaction, 0, len(response) + 1, unit) + response)
+        await writer.drain()
+
+
+class TcpClient:
+    """Minimal Modbus TCP master, for the benchmark and tests."""
+
+    def __init__(self):
+        self.transaction = 0
+
+    async def connect(self, host, port):
+        self.reader, self.writer = await asyncio.open_connection(host, port)
+
+    async def request(self, unit, pdu):
+        self.transaction = (self.transaction + 1) & 0xFFFF
+        self.writer.write(struct.pack('>HHHB', self.transaction, 0, len(pdu) + 1, unit) + pdu)
+        header = await self.reader.readexactly(7)
+        transaction, _, length, _ = struct.unpack('>HHHB', header)
+        return await self.reader.readexactly(length - 1)
+
+    def close(self):
+        self.writer.close()
+
+
+async def bench(clients, duration, staleness, baudrate, write_ratio):
+    """Runs clients against a simulated node through the gateway."""
+    node = SimulatedNode(baudrate=baudrate)
+    gateway = Gateway(node, staleness)
+    gateway.start()
+    gateway.poll(1, 1, 0, 12, 0.5)
+    server = TcpServer(gateway)
+    port = await server.start('127.0.0.1', 0)
+    latencies = []
+
+    async def client():
+        connection = TcpClient()
+        await connection.connect('127.0.0.1', port)
+        deadline = time.monotonic() + duration
+        while time.monotonic() < deadline:
+            if random.random() < write_ratio:
+                pdu = struct.pack('>BHH', 5, random.randrange(12), 0xFF00)
+            elif random.random() < 0.5:
+                pdu = read_request(4, 0, 8)
+            else:
+                pdu = read_request(1, 0, 12)
+            start = time.monotonic()
+            await connection.request(1, pdu)
+            latencies.append(time.monotonic() - start)
+            await asyncio.sleep(random.uniform(0, 0.05))
+        connection.close()
+
+    await asyncio.gather(*[client() for _ in range(clients)])
+    server.server.close()
+    await gateway.stop()
+    latencies.sort()
+    stats = gateway.stats
+    print("staleness %4.2f s: %5d requests, latency p50 %6.1f ms p95 %6.1f ms max %6.1f ms, "
+          "%4d frames, bus %3.0f %%, %d hits %d coalesced %d misses"
+          % (staleness, len(latencies), 1000 * latencies[len(latencies) // 2],
+             1000 * latencies[int(len(latencies) * 0.95)], 1000 * latencies[-1],
+             stats['frames'], 100 * gateway.utilization(), stats['hits'], stats['coalesced'], stats['misses']))
+
+
+def parse_poll(value):
+    slave, function, start, count, interval = value.split(':')
+    return int(slave), int(function), int(start), int(count), float(interval)
+
+
+async def serve(args):
+    link = SerialLink(args.port, args.baudrate, args.parity, args.timeout)
+    gateway = Gateway(link, args.staleness, args.counter_end)
+    gateway.start()
+    for poll in args.poll:
+        gateway.poll(*poll)
+    host, port = args.listen.rsplit(':', 1)
+    server = TcpServer(gateway)
+    await server.start(host, int(port))
+    logging.info("modbus tcp on %s", args.listen)
+    while True:
+        await asyncio.sleep(args.stats_interval)
+        logging.info("bus %.0f %%, %s", 100 * gateway.utilization(), gateway.stats)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", help="serial port, or the pty link of the native simulator", default='/dev/ttyUSB0')
+    parser.add_argument("--baudrate", type=int, choices=sorted(BAUD_RATES), default=19200)
+    parser.add_argument("--parity", choices=['N', 'E', 'O'], default='N')
+    parser.add_argument("--timeout", help="response timeout in seconds", type=float, default=0.2)
+    parser.add_argument("--listen", help="HOST:PORT of the Modbus TCP server", default='127.0.0.1:5020')
+    parser.add_argument("--staleness", help="seconds a mirrored value answers reads", type=float, default=0.5)
+    parser.add_argument("--poll", help="refresh SLAVE:FUNCTION:START:COUNT every INTERVAL seconds", type=parse_poll,
+                        action='append', default=[], metavar='SLAVE:FUNCTION:START:COUNT:INTERVAL')
+    parser.add_argument("--counter-end", dest='counter_end', help="end of the counter input registers, 0x300 for the 48 pin Mega",
+                        type=lambda value: int(value, 0), default=COUNTER_END)
+    parser.add_argument("--stats-interval", dest='stats_interval', type=float, default=60)
+    parser.add_argument("--bench", help="benchmark against a simulated node and exit", action="store_true")
+    parser.add_argument("--bench-clients", dest='benchclients', type=int, default=8)
+    parser.add_argument("--bench-duration", dest='benchduration', type=float, default=10)
+    args = parser.parse_args()
+    logging.basicConfig(level=logging.INFO)
+    if args.bench:
+        for staleness in (0, 0.1, 0.5):
+            asyncio.run(bench(args.benchclients, args.benchduration, staleness, args.baudrate, 0.05))
+        return
+    asyncio.run(serve(args))
+
+
+if __name__ == '__main__':
+    main()
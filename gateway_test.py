@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""Tests of gateway.py against the in-process SimulatedNode, run with
+python3 -m unittest gateway_test
+"""
+import asyncio
+import os
+import struct
+import sys
+import unittest
+
+from gateway import (Gateway, ModbusError, SimulatedNode, TcpClient, TcpServer, PRIORITY_POLL,
+                     crc16, open_port, read_request, rtu_frame, response_length, EXCEPTION_TARGET_FAILED)
+
+
+class FrameTest(unittest.TestCase):
+    def test_crc(self):
+        # read holding registers 0 - 1 of slave 1
+        self.assertEqual(rtu_frame(1, read_request(3, 0, 2)), bytes.fromhex('010300000002c40b'))
+        self.assertEqual(crc16(bytes.fromhex('010300000002c40b')), 0)
+
+    def test_response_length(self):
+        self.assertIsNone(response_length(b'\x01'))
+        self.assertIsNone(response_length(b'\x01\x03'))
+        self.assertEqual(response_length(b'\x01\x03\x04'), 9)
+        self.assertEqual(response_length(b'\x01\x83'), 5)
+        self.assertEqual(response_length(b'\x01\x10'), 8)
+        self.assertEqual(response_length(b'\x01\x08'), 8)
+        # ends on silence
+        self.assertEqual(response_length(b'\x01\x11'), 0)
+
+
+class PortTest(unittest.TestCase):
+    def setUp(self):
+        self.master, self.slave = os.openpty()
+
+    def tearDown(self):
+        os.close(self.master)
+        os.close(self.slave)
+
+    @unittest.skipUnless(sys.platform.startswith('linux'), "termios2")
+    def test_rates_without_a_termios_constant(self):
+        for baudrate in (76800, 250000):
+            os.close(open_port(os.ttyname(self.slave), baudrate))
+
+    def test_unsupported_rates_are_refused(self):
+        with self.assertRaises(ValueError):
+            open_port(os.ttyname(self.slave), 14400)
+
+
+class ReplayLink:
+    """Answers every request with the same frame."""
+
+    def __init__(self, response):
+        self.response = response
+
+    async def exchange(self, frame):
+        return self.response
+
+
+class ResponseCheckTest(unittest.IsolatedAsyncioTestCase):
+    async def answer(self, response, slave=1, pdu=read_request(4, 3, 1)):
+        gateway = Gateway(ReplayLink(response))
+        gateway.start()
+        try:
+            return await gateway.request(slave, pdu), gateway.stats['mismatched']
+        finally:
+            await gateway.stop()
+
+    async def test_responses_match_the_request(self):
+        self.assertEqual(await self.answer(rtu_frame(1, b'\x04\x02\x00\x2a')), (b'\x04\x02\x00\x2a', 0))
+        self.assertEqual(await self.answer(rtu_frame(1, b'\x84\x02')), (b'\x84\x02', 0))
+        failed = bytes([0x84, EXCEPTION_TARGET_FAILED])
+        # another slave, another function
+        self.assertEqual(await self.answer(rtu_frame(2, b'\x04\x02\x00\x2a')), (failed, 1))
+        self.assertEqual(await self.answer(rtu_frame(1, b'\x03\x02\x00\x2a')), (failed, 1))
+
+
+class GatewayTest(unittest.IsolatedAsyncioTestCase):
+    async def asyncSetUp(self):
+        self.node = SimulatedNode(baudrate=115200, turnaround=0.001)
+        self.node.input[3] = 42
+        self.gateway = Gateway(self.node, staleness=0.2)
+        self.gateway.start()
+
+    async def asyncTearDown(self):
+        await self.gateway.stop()
+
+    async def test_fresh_reads_come_from_the_mirror(self):
+        self.assertEqual(await self.gateway.read(1, 4, 0, 8), [12, 0, 0, 42, 0, 0, 0, 0])
+        self.node.input[3] = 43
+        self.assertEqual((await self.gateway.read(1, 4, 2, 2))[1], 42)
+        self.assertEqual(len(self.node.requests), 1)
+        await asyncio.sleep(0.25)
+        self.assertEqual((await self.gateway.read(1, 4, 2, 2))[1], 43)
+        self.assertEqual(len(self.node.requests), 2)
+
+    async def test_identical_reads_share_a_frame(self):
+        results = await asyncio.gather(*[self.gateway.read(1, 4, 0, 8) for _ in range(5)])
+        self.assertEqual(len(self.node.requests), 1)
+        self.assertEqual(self.gateway.stats['coalesced'], 4)
+        self.assertTrue(all(result == results[0] for result in results))
+
+    async def test_writes_go_before_polls_and_drop_the_mirror(self):
+        await self.gateway.read(1, 1, 0, 12)
+        polls = [asyncio.ensure_future(self.gateway.read(1, 4, i, 1, PRIORITY_POLL)) for i in range(4)]
+        # the polls are queued and the first one takes the bus
+        while len(self.node.requests) < 2:
+            await asyncio.sleep(0)
+        await asyncio.gather(*polls, self.gateway.request(1, struct.pack('>BHH', 5, 3, 0xFF00)))
+        functions = [pdu[0] for _, pdu in self.node.requests[1:]]
+        self.assertEqual(functions, [4, 5, 4, 4, 4])
+        self.assertEqual((await self.gateway.read(1, 1, 0, 12))[3], 1)
+        self.assertEqual(len(self.node.requests), 7)
+
+    async def test_counters_always_go_to_the_bus(self):
+        self.node.input[10] = 5
+        self.assertEqual(await self.gateway.read(1, 4, 8, 12), [0, 0, 5] + [0] * 9)
+        self.node.input[10] = 0
+        self.assertEqual((await self.gateway.read(1, 4, 8, 12))[2], 0)
+        self.assertEqual(len(self.node.requests), 2)
+        with self.assertRaises(ValueError):
+            self.gateway.poll(1, 4, 0, 12, 0.5)
+        # the holding registers of the same addresses are mirrored
+        await self.gateway.read(1, 3, 8, 12)
+        await self.gateway.read(1, 3, 8, 12)
+        self.assertEqual(len(self.node.requests), 3)
+
+    async def test_exceptions_and_timeouts(self):
+        self.assertEqual(await self.gateway.request(1, read_request(4, 0x1000, 1)), b'\x84\x02')
+        self.node.silent = True
+        self.assertEqual(await self.gateway.request(1, read_request(4, 0, 1)), bytes([0x84, EXCEPTION_TARGET_FAILED]))
+        with self.assertRaises(ModbusError):
+            await self.gateway.read(1, 3, 0, 1)
+        self.assertEqual(self.gateway.stats['timeouts'], 2)
+
+    async def test_modbus_tcp(self):
+        server = TcpServer(self.gateway)
+        port = await server.start('127.0.0.1', 0)
+        client = TcpClient()
+        await client.connect('127.0.0.1', port)
+        self.assertEqual(await client.request(1, read_request(4, 3, 1)), b'\x04\x02\x00\x2a')
+        self.assertEqual(await client.request(1, struct.pack('>BHH', 6, 1, 7)), struct.pack('>BHH', 6, 1, 7))
+        self.assertEqual(self.node.holding[1], 7)
+        # broadcasts are confirmed with the request
+        self.assertEqual(await client.request(0, struct.pack('>BHH', 6, 0x103, 0x0102)), struct.pack('>BHH', 6, 0x103, 0x0102))
+        client.close()
+        server.server.close()
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -2,7 +2,9 @@
 import minimalmodbus
 import time
 import argparse
+import json
 import logging
+import struct
 
 SYSTEM_SETTING_SIZE = 8
 
@@ -12,7 +14,17 @@ class DigitalPinSetting:
                 "click_command", "single_click_command", "long_click_command",
                 "double_click_command", "signal_rise_command",
                 "signal_fall_command", "release_command",
-                "pwm_on_value"]
+                "pwm_on_value", "group_mask", "fade_time",
+                "dimming_curve", "auto_off_time", "timer_options"]
+    # the output state, changed by the node itself and kept in the persist
+    # journal rather than with the settings, see config.h
+    RUNTIME_SETTINGS = ("output_value", "pwm_on_value")
+    # the names of the thresholds of analog inputs, see analog.h
+    ALIASES = {"analog_rise_level": "fade_time", "analog_fall_level": "auto_off_time"}
+
+    @staticmethod
+    def index(setting):
+        return DigitalPinSetting.SETTINGS.index(DigitalPinSetting.ALIASES.get(setting, setting))
 
     def __init__(self, instrument, pinindex):
         self.instrument=instrument
@@ -20,7 +32,7 @@ class DigitalPinSetting:
         self.address = SYSTEM_SETTING_SIZE + pinindex * DigitalPinSetting.SETTINGS_SIZE
 
     def set(self, setting, value):
-        idx = DigitalPinSetting.SETTINGS.index(setting);
+        idx = DigitalPinSetting.index(setting);
         self.instrument.write_register(self.address + idx, value)
 
     def print(self):
@@ -30,8 +42,11 @@ class DigitalPinSetting:
 
 class ButtonCounters:
     COUNTER_OFFSET=8
-    COUNTER_SIZE=8
-    COUNTERS = ["pin_number", "click_cnt", "single_click_cnt", "double_click_cnt", "long_press_cnt", "release_cnt"]
+    COUNTER_SIZE=12
+    COUNTERS = ["click_cnt", "single_click_cnt", "double_click_cnt", "long_press_cnt", "release_cnt"]
+    MODE_REGISTER = 0x101
+    MODE_READ = 0
+    MODE_READ_AND_CLEAR = 1
 
     def __init__(self, instrument, pinindex):
         self.instrument=instrument
@@ -40,15 +55,458 @@ class ButtonCounters:
 
     def print(self):
         val = self.instrument.read_registers(self.address, ButtonCounters.COUNTER_SIZE, functioncode=4)
-        for i, setting in enumerate(ButtonCounters.COUNTERS): 
-            print("pin %d %s: %x" % (self.pinindex, setting, val[i]));
+        print("pin %d pin_number: %d" % (self.pinindex, val[0]))
+        print("pin %d auto_off_remaining_s: %d" % (self.pinindex, val[1]))
+        for i, setting in enumerate(ButtonCounters.COUNTERS):
+            # 32 bit counters, low word first
+            print("pin %d %s: %d" % (self.pinindex, setting, val[2 + 2 * i] | val[3 + 2 * i] << 16));
+
+
+class Layout:
+    """Register blocks of a node.
+
+    The blocks after the per pin registers start at the next BLOCK_SIZE
+    boundary, see REGISTER_BLOCK_AFTER in main.cpp. The register constants
+    in this file are those of a node with up to 15 pins, command() and
+    input() move them into the blocks of the node.
+    """
+    BLOCK_SIZE = 0x100
+    COMMANDS = 0x100
+    PROFILE = 0x100
+    EVENTS = 0x200
+
+    def __init__(self, number_of_pins):
+        self.commands = Layout.block_after(SYSTEM_SETTING_SIZE + number_of_pins * DigitalPinSetting.SETTINGS_SIZE)
+        self.profile = Layout.block_after(ButtonCounters.COUNTER_OFFSET + number_of_pins * ButtonCounters.COUNTER_SIZE)
+        self.events = self.profile + Layout.BLOCK_SIZE
+
+    @staticmethod
+    def block_after(end):
+        return (end + Layout.BLOCK_SIZE - 1) // Layout.BLOCK_SIZE * Layout.BLOCK_SIZE
+
+    def command(self, register):
+        return self.commands + register - Layout.COMMANDS
+
+    def input(self, register):
+        if register >= Layout.EVENTS:
+            return self.events + register - Layout.EVENTS
+        return self.profile + register - Layout.PROFILE
+
+def layout(instrument):
+    """Returns the layout of the node behind instrument, read once."""
+    if not hasattr(instrument, 'layout'):
+        instrument.layout = Layout(instrument.read_register(0, functioncode=4))
+    return instrument.layout
+
+class Profile:
+    OFFSET = 0x100
+    RESET_REGISTER = 0x100
+    SLOTS = ["loop", "request", "cb_read_coil", "cb_write_coil",
+             "cb_read_holding_register", "cb_write_holding_register",
+             "cb_read_input_register", "eeprom_write"]
+    STATS = ["count", "min_us", "max_us", "mean_us"]
+    HISTOGRAM_BUCKETS = 16
+
+    def __init__(self, instrument):
+        self.instrument = instrument
+
+    def print(self):
+        offset = layout(self.instrument).input(Profile.OFFSET)
+        slots = self.instrument.read_register(offset, functioncode=4)
+        size = 1 + len(Profile.STATS) * slots + Profile.HISTOGRAM_BUCKETS
+        val = self.instrument.read_registers(offset, size, functioncode=4)
+        for slot in range(0, slots):
+            name = Profile.SLOTS[slot] if slot < len(Profile.SLOTS) else "slot %d" % slot
+            stats = val[1 + slot * len(Profile.STATS):1 + (slot + 1) * len(Profile.STATS)]
+            print("%s: %s" % (name, " ".join("%s=%d" % s for s in zip(Profile.STATS, stats))))
+        histogram = val[1 + len(Profile.STATS) * slots:]
+        for bucket, count in enumerate(histogram):
+            print("loop %6d-%6d us: %d" % (1 << bucket if bucket else 0, (2 << bucket) - 1, count))
+
+    def reset(self):
+        self.instrument.write_register(layout(self.instrument).command(Profile.RESET_REGISTER), 1)
+
+class Events:
+    OFFSET = 0x200
+    QUEUE_OFFSET = 0x204
+    ENTRY_SIZE = 4
+    ACKNOWLEDGE_REGISTER = 0x102
+    TYPES = ["none", "click", "single_click", "double_click", "long_click", "release",
+             "rise", "fall", "output_value", "output_state"]
+
+    def __init__(self, instrument):
+        self.instrument = instrument
+
+    def poll(self):
+        registers = layout(self.instrument)
+        sequence, count, dropped = self.instrument.read_registers(registers.input(Events.OFFSET), 3, functioncode=4)
+        if dropped:
+            print("%d events dropped" % dropped)
+        if count == 0:
+            return
+        val = self.instrument.read_registers(registers.input(Events.QUEUE_OFFSET), count * Events.ENTRY_SIZE, functioncode=4)
+        for i in range(0, count):
+            entry = val[i * Events.ENTRY_SIZE:(i + 1) * Events.ENTRY_SIZE]
+            print("event %d at %d ms: pin %d %s %d" % ((sequence + i) & 0xFFFF, entry[2] | entry[3] << 16,
+                                                       entry[0] & 0xFF, Events.TYPES[entry[0] >> 8], entry[1]))
+        self.instrument.write_register(registers.command(Events.ACKNOWLEDGE_REGISTER), (sequence + count) & 0xFFFF)
+
+class GroupCommand:
+    GROUP_COMMAND_REGISTER = 0x103
+    ARM_REGISTER = 0x104
+    COMMIT_REGISTER = 0x105
+    BROADCAST_ADDRESS = 0
+
+    def __init__(self, instrument):
+        self.instrument = instrument
+
+    def broadcast(self, register, value):
+        # slave id 0: every node acts on the frame and none answers. Nodes
+        # with another register layout, see Layout, miss it.
+        register = layout(self.instrument).command(register)
+        address = self.instrument.address
+        self.instrument.address = GroupCommand.BROADCAST_ADDRESS
+        try:
+            self.instrument.write_register(register, value, functioncode=6)
+        finally:
+            self.instrument.address = address
+
+    def send(self, group, command, arm=False):
+        register = GroupCommand.ARM_REGISTER if arm else GroupCommand.GROUP_COMMAND_REGISTER
+        self.broadcast(register, group << 8 | command)
+
+    def commit(self, apply=True):
+        self.broadcast(GroupCommand.COMMIT_REGISTER, 1 if apply else 0)
+
+class Scenes:
+    RECALL_REGISTER = 0x106
+    CAPTURE_REGISTER = 0x107
+    COUNT = 8
+
+    def __init__(self, instrument):
+        self.instrument = instrument
+
+    def recall(self, scene):
+        self.instrument.write_register(layout(self.instrument).command(Scenes.RECALL_REGISTER), scene)
+
+    def capture(self, scene):
+        self.instrument.write_register(layout(self.instrument).command(Scenes.CAPTURE_REGISTER), scene)
+
+class Link:
+    CONFIG_NEXT_REGISTER = 3
+    APPLY_REGISTER = 0x108
+    CONFIRM_REGISTER = 0x109
+    # index is the baud rate field of the link config, see link.h
+    BAUD_RATES = [19200, 9600, 38400, 57600, 76800, 115200, 250000]
+    PARITIES = ['N', 'E', 'O']
+
+    def __init__(self, instrument):
+        self.instrument = instrument
+
+    @staticmethod
+    def config(baudrate, parity):
+        return Link.BAUD_RATES.index(baudrate) | Link.PARITIES.index(parity) << 4
+
+    def switch(self, baudrate, parity='N'):
+        # the node answers the apply on the old link, then waits
+        # LINK_TRIAL_TIMEOUT for the confirm on the new one
+        registers = layout(self.instrument)
+        self.instrument.write_register(Link.CONFIG_NEXT_REGISTER, Link.config(baudrate, parity))
+        self.instrument.write_register(registers.command(Link.APPLY_REGISTER), 1)
+        time.sleep(0.1)
+        self.instrument.serial.baudrate = baudrate
+        self.instrument.serial.parity = parity
+        self.instrument.write_register(registers.command(Link.CONFIRM_REGISTER), 1)
+
+class Diagnostics:
+    """Bus diagnostics of a node, see diag.h.
+
+    The counters are those of the Modbus Diagnostics function (0x08),
+    counted since boot or the last clear, 16 bit and wrapping.
+    """
+    OFFSET = 0x300
+    FUNCTION_CODE = 8
+    CLEAR_COUNTERS = 0x0A
+    COUNTERS = ["bus_messages", "crc_errors", "exceptions", "slave_messages", "no_responses", "overruns"]
+    SIZE = 8
+
+    def __init__(self, instrument):
+        self.instrument = instrument
+
+    def read(self):
+        val = self.instrument.read_registers(layout(self.instrument).input(Diagnostics.OFFSET),
+                                             Diagnostics.SIZE, functioncode=4)
+        counters = dict(zip(Diagnostics.COUNTERS, val))
+        # 32 bit, low word first
+        counters["max_poll_gap_us"] = val[6] | val[7] << 16
+        return counters
+
+    def print(self):
+        for name, value in self.read().items():
+            print("%s: %d" % (name, value))
+
+    def clear(self, broadcast=False):
+        # slave id 0 clears every node on the bus, none answers
+        address = self.instrument.address
+        if broadcast:
+            self.instrument.address = GroupCommand.BROADCAST_ADDRESS
+        try:
+            self.instrument._perform_command(Diagnostics.FUNCTION_CODE, struct.pack('>HH', Diagnostics.CLEAR_COUNTERS, 0))
+        finally:
+            self.instrument.address = address
+
+class Analog:
+    """Latest 12 bit values of the analog inputs, 0 for other pins."""
+    OFFSET = 0x400
+
+    def __init__(self, instrument, number_of_pins):
+        self.instrument = instrument
+        self.number_of_pins = number_of_pins
+
+    def print(self):
+        val = self.instrument.read_registers(layout(self.instrument).input(Analog.OFFSET),
+                                             self.number_of_pins, functioncode=4)
+        for i, value in enumerate(val):
+            print("pin %d analog: %d" % (i, value))
+
+class BusSweep:
+    COUNTER_FRAME_SIZE = 120
+
+    def __init__(self, port, slave_ids, baudrate, debug=False):
+        self.baudrate = baudrate
+        self.nodes = []
+        for slave_id in slave_ids:
+            instrument = minimalmodbus.Instrument(port, slave_id, debug=debug)
+            instrument.serial.baudrate = baudrate
+            pins = instrument.read_register(0, functioncode=4)
+            instrument.layout = Layout(pins)
+            self.nodes.append((instrument, pins))
+
+    def switch(self, baudrate, parity='N'):
+        # every node is switched and confirmed before the next one is
+        # addressed on the old link
+        for instrument, _ in self.nodes:
+            instrument.serial.baudrate = self.baudrate
+            Link(instrument).switch(baudrate, parity)
+        self.baudrate = baudrate
+
+    def sweep(self):
+        """Reads the coils and all counters of every node, returns the number of frames."""
+        frames = 0
+        for instrument, pins in self.nodes:
+            instrument.read_bits(0, pins, functioncode=1)
+            frames += 1
+            size = pins * ButtonCounters.COUNTER_SIZE
+            for offset in range(0, size, BusSweep.COUNTER_FRAME_SIZE):
+                instrument.read_registers(ButtonCounters.COUNTER_OFFSET + offset,
+                                          min(BusSweep.COUNTER_FRAME_SIZE, size - offset), functioncode=4)
+                frames += 1
+        return frames
+
+    def diagnostics(self):
+        """Reads the diagnostics of every node and names the one most likely to degrade the bus.
 
+        Every node counts every frame on the bus, a node that counted fewer
+        than the others missed frames. Missed frames, crc errors, overruns
+        and unanswered requests add up to the score of a node, the longest
+        poll gap breaks ties.
+        """
+        results = []
+        for instrument, _ in self.nodes:
+            try:
+                results.append((instrument.address, Diagnostics(instrument).read()))
+            except (IOError, ValueError) as e:
+                print("node %d: %s" % (instrument.address, e))
+        if not results:
+            return None
+        most_messages = max(counters["bus_messages"] for _, counters in results)
+        print("%5s %8s %6s %6s %6s %6s %8s %6s %12s" % ("node", "messages", "missed", "crc", "except",
+                                                        "no_rsp", "overruns", "slave", "max_gap_us"))
+        worst = None
+        for address, counters in results:
+            missed = most_messages - counters["bus_messages"]
+            score = (missed + counters["crc_errors"] + counters["overruns"] + counters["no_responses"],
+                     counters["max_poll_gap_us"])
+            print("%5d %8d %6d %6d %6d %6d %8d %6d %12d" % (address, counters["bus_messages"], missed,
+                                                            counters["crc_errors"], counters["exceptions"],
+                                                            counters["no_responses"], counters["overruns"],
+                                                            counters["slave_messages"], counters["max_poll_gap_us"]))
+            if worst is None or score > worst[1]:
+                worst = (address, score)
+        if worst[1][0]:
+            print("node %d degrades the bus the most" % worst[0])
+        return worst[0]
+
+    def bench(self, baudrates, duration, parity='N'):
+        start_baudrate = self.baudrate
+        try:
+            for baudrate in baudrates:
+                self.switch(baudrate, parity)
+                frames = sweeps = errors = 0
+                start = time.monotonic()
+                while time.monotonic() - start < duration:
+                    try:
+                        frames += self.sweep()
+                        sweeps += 1
+                    except (IOError, ValueError):
+                        errors += 1
+                elapsed = time.monotonic() - start
+                print("%6d baud: %7.1f frames/s, %6.1f ms per sweep of %d nodes, %d errors" %
+                      (baudrate, frames / elapsed, 1000.0 * elapsed / max(sweeps, 1), len(self.nodes), errors))
+        finally:
+            self.switch(start_baudrate)
+
+class NodeConfig:
+    """Declarative configuration of a node.
+
+    The description is a YAML or JSON mapping with an optional slave_id and
+    link_config_next and a pins mapping from pin index to settings by name,
+    see DigitalPinSetting.SETTINGS. Settings it leaves out keep their value
+    on the node. The changes are written in staged commits of up to
+    STAGED_PINS pins each, see config.h.
+    """
+    STAGE_REGISTER = 0x10A
+    COMMIT_REGISTER = 0x10B
+    SLAVE_ID_REGISTER = 1
+    # the most registers one read holding registers and one write multiple
+    # registers frame carry
+    MAX_READ = 125
+    MAX_WRITE = 123
+    # unchanged registers between two changed ranges are rewritten rather
+    # than spending a frame on each range
+    MAX_GAP = 4
+    COMMIT_TIMEOUT = 5
+    # pins one commit can change, CONFIG_STAGED_PINS in config.h
+    STAGED_PINS = 4
+
+    def __init__(self, instrument, number_of_pins):
+        self.instrument = instrument
+        self.size = SYSTEM_SETTING_SIZE + number_of_pins * DigitalPinSetting.SETTINGS_SIZE
+        self.number_of_pins = number_of_pins
+        self.frames = 0
+
+    @staticmethod
+    def load(path):
+        with open(path) as f:
+            if path.endswith('.json'):
+                return json.load(f)
+            import yaml
+            return yaml.safe_load(f)
+
+    def target(self, description):
+        """Returns the register values the description asks for, by address."""
+        values = {}
+        if 'slave_id' in description:
+            values[NodeConfig.SLAVE_ID_REGISTER] = description['slave_id']
+        if 'link_config_next' in description:
+            values[Link.CONFIG_NEXT_REGISTER] = description['link_config_next']
+        for pinindex, settings in description.get('pins', {}).items():
+            pinindex = int(pinindex)
+            if pinindex < 0 or pinindex >= self.number_of_pins:
+                raise ValueError("pin %d out of range" % pinindex)
+            address = SYSTEM_SETTING_SIZE + pinindex * DigitalPinSetting.SETTINGS_SIZE
+            for setting, value in settings.items():
+                values[address + DigitalPinSetting.index(setting)] = value
+        return values
+
+    def read(self):
+        values = []
+        for address in range(0, self.size, NodeConfig.MAX_READ):
+            values += self.instrument.read_registers(address, min(NodeConfig.MAX_READ, self.size - address), functioncode=3)
+            self.frames += 1
+        return values
+
+    @staticmethod
+    def diff(current, target):
+        return [(address, current[address], value) for address, value in sorted(target.items())
+                if current[address] != value]
+
+    @staticmethod
+    def is_runtime(address):
+        """Whether address is a byte the node changes by itself."""
+        if address < SYSTEM_SETTING_SIZE:
+            return False
+        setting = (address - SYSTEM_SETTING_SIZE) % DigitalPinSetting.SETTINGS_SIZE
+        return DigitalPinSetting.SETTINGS[setting] in DigitalPinSetting.RUNTIME_SETTINGS
+
+    @staticmethod
+    def ranges(changes, current):
+        """Merges the changes into (address, values) runs for single frames."""
+        ranges = []
+        for address, _, value in changes:
+            if ranges:
+                start, values = ranges[-1]
+                gap = address - start - len(values)
+                # the node settings between the slave id and the pins are
+                # read only, and rewriting a runtime byte with the value
+                # read before would undo what the node did since
+                if (gap <= NodeConfig.MAX_GAP and start >= SYSTEM_SETTING_SIZE and
+                        len(values) + gap < NodeConfig.MAX_WRITE and
+                        not any(NodeConfig.is_runtime(a) for a in range(address - gap, address))):
+                    values += current[start + len(values):address] + [value]
+                    continue
+            ranges.append((address, [value]))
+        return ranges
+
+    @staticmethod
+    def batches(changes):
+        """Splits the changes into commits of at most STAGED_PINS pins."""
+        batches = [[]]
+        pins = set()
+        for change in changes:
+            if change[0] >= SYSTEM_SETTING_SIZE:
+                pinindex = (change[0] - SYSTEM_SETTING_SIZE) // DigitalPinSetting.SETTINGS_SIZE
+                if pinindex not in pins and len(pins) == NodeConfig.STAGED_PINS:
+                    batches.append([])
+                    pins = set()
+                pins.add(pinindex)
+            batches[-1].append(change)
+        return batches
+
+    def print_diff(self, changes):
+        for address, old, new in changes:
+            if address < SYSTEM_SETTING_SIZE:
+                name = "slave_id" if address == NodeConfig.SLAVE_ID_REGISTER else "link_config_next"
+            else:
+                pinindex, setting = divmod(address - SYSTEM_SETTING_SIZE, DigitalPinSetting.SETTINGS_SIZE)
+                name = "pin %d %s" % (pinindex, DigitalPinSetting.SETTINGS[setting])
+            print("%s: %x -> %x" % (name, old, new))
+
+    def commit(self, changes, current):
+        registers = layout(self.instrument)
+        self.instrument.write_register(registers.command(NodeConfig.STAGE_REGISTER), 1)
+        self.frames += 1
+        for address, values in NodeConfig.ranges(changes, current):
+            self.instrument.write_registers(address, values)
+            self.frames += 1
+        self.instrument.write_register(registers.command(NodeConfig.COMMIT_REGISTER), 1)
+        self.frames += 1
+        # the node reads back 1 until the image is in the EEPROM. A new slave
+        # id is only stored, the node keeps answering at its current address
+        deadline = time.monotonic() + NodeConfig.COMMIT_TIMEOUT
+        while self.instrument.read_register(registers.command(NodeConfig.COMMIT_REGISTER), functioncode=3):
+            self.frames += 1
+            if time.monotonic() > deadline:
+                raise TimeoutError("settings not stored")
+        self.frames += 1
+
+    def apply(self, description, check=False):
+        start = time.monotonic()
+        self.frames = 0
+        current = self.read()
+        changes = NodeConfig.diff(current, self.target(description))
+        self.print_diff(changes)
+        if changes and not check:
+            for batch in NodeConfig.batches(changes):
+                self.commit(batch, current)
+        print("%d changes, %d frames, %.3f s" % (len(changes), self.frames, time.monotonic() - start))
 
 class HomeControl:
-    def __init__(self, debug=False):
-        self.instrument = minimalmodbus.Instrument('/dev/tty.usbserial-143320', 1, debug=debug)
-        self.instrument.serial.baudrate = 19200
+    def __init__(self, port='/dev/tty.usbserial-143320', slave_id=1, baudrate=19200, debug=False):
+        self.instrument = minimalmodbus.Instrument(port, slave_id, debug=debug)
+        self.instrument.serial.baudrate = baudrate
         self.number_of_pins = self.instrument.read_register(0, functioncode=4);
+        self.instrument.layout = Layout(self.number_of_pins)
 
     def uptime(self):
         print("uptime: %d seconds" % (self.instrument.read_long(1, functioncode=4, signed=False, byteorder=minimalmodbus.BYTEORDER_LITTLE_SWAP) / 1000))
@@ -59,54 +517,166 @@ class HomeControl:
             print("coil %d: %d" % (i, val));
 
     def dump_holding_registers(self):
+        val = NodeConfig(self.instrument, self.number_of_pins).read()
         for i in range(0, self.number_of_pins):
-            DigitalPinSetting(self.instrument, i).print()
+            address = SYSTEM_SETTING_SIZE + i * DigitalPinSetting.SETTINGS_SIZE
+            for setting, value in zip(DigitalPinSetting.SETTINGS, val[address:address + DigitalPinSetting.SETTINGS_SIZE]):
+                print("pin %d %s: %x" % (i, setting, value))
 
     def dump_input_registers(self):
+        val = self.instrument.read_registers(0, 8, functioncode=4)
         for i in range(0, 8):
-            val = self.instrument.read_register(i, functioncode=4)
-            print("input register %d: %x" % (i, val));
+            print("input register %d: %x" % (i, val[i]));
         for i in range(0, self.number_of_pins):
             ButtonCounters(self.instrument, i).print()
 
+    def dump_profile(self):
+        Profile(self.instrument).print()
+
+    def group_command(self):
+        return GroupCommand(self.instrument)
+
+    def scenes(self):
+        return Scenes(self.instrument)
+
+    def poll_events(self):
+        Events(self.instrument).poll()
+
+    def reset_profile(self):
+        Profile(self.instrument).reset()
+
+    def dump_analog(self):
+        Analog(self.instrument, self.number_of_pins).print()
+
+    def dump_diagnostics(self):
+        Diagnostics(self.instrument).print()
+
+    def clear_diagnostics(self, broadcast):
+        Diagnostics(self.instrument).clear(broadcast)
+
     def pinsetting(self, pinindex):
         if (pinindex >= self.number_of_pins or pinindex < 0):
             raise ValueError("pinindex out of range");
         return DigitalPinSetting(self.instrument, pinindex);
 
+    def set_counter_mode(self, read_and_clear):
+        mode = ButtonCounters.MODE_READ_AND_CLEAR if read_and_clear else ButtonCounters.MODE_READ
+        self.instrument.write_register(layout(self.instrument).command(ButtonCounters.MODE_REGISTER), mode)
+
+    def configure(self, path, check):
+        NodeConfig(self.instrument, self.number_of_pins).apply(NodeConfig.load(path), check)
+
+    def set_link(self, baudrate, parity):
+        Link(self.instrument).switch(baudrate, parity)
+
     def set_coil(self,pinindex, value):
         self.instrument.write_bit(pinindex, value);
 
-logging.basicConfig(level=logging.DEBUG);
-parser = argparse.ArgumentParser()
-parser.add_argument("--dumpcoils", help="dump coils", action="store_true")
-parser.add_argument("--dumpholdingregisters", help="dump holding registers", action="store_true")
-parser.add_argument("--dumpinputregisters", help="dump input registers", action="store_true")
-parser.add_argument("--pin-index", dest='pinindex', help="pin index", type=int)
-parser.add_argument("--uptime", help="print uptime", action="store_true")
-parser.add_argument("--debug", help="debug", action="store_true", default=False)
-group = parser.add_mutually_exclusive_group();
-group.add_argument("--pin-setting", dest='pinsetting')
-group.add_argument("--set-coil", dest='setcoil', action='store_true');
-parser.add_argument("val", type=int, nargs='?')
-args = parser.parse_args()
-
-homectrl = HomeControl(args.debug);
-
-if(args.dumpcoils):
-    homectrl.dump_coils()
-    
-if(args.dumpholdingregisters):
-    homectrl.dump_holding_registers()
-    
-if(args.dumpinputregisters):
-    homectrl.dump_input_registers()
-
-if(args.pinsetting):
-    homectrl.pinsetting(args.pinindex).set(args.pinsetting, args.val)
-
-if(args.setcoil):
-    homectrl.set_coil(args.pinindex, args.val);
-
-if(args.uptime):
-    homectrl.uptime()
+if __name__ == '__main__':
+    logging.basicConfig(level=logging.DEBUG);
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", help="serial port, or the pty link of the native simulator", default='/dev/tty.usbserial-143320')
+    parser.add_argument("--baudrate", help="serial baud rate", type=int, default=19200)
+    parser.add_argument("--slave-id", dest='slaveid', help="modbus slave id", type=int, default=1)
+    parser.add_argument("--dumpcoils", help="dump coils", action="store_true")
+    parser.add_argument("--dumpholdingregisters", help="dump holding registers", action="store_true")
+    parser.add_argument("--dumpinputregisters", help="dump input registers", action="store_true")
+    parser.add_argument("--pin-index", dest='pinindex', help="pin index", type=int)
+    parser.add_argument("--uptime", help="print uptime", action="store_true")
+    parser.add_argument("--profile", help="dump loop and modbus timing statistics", action="store_true")
+    parser.add_argument("--reset-profile", dest='resetprofile', help="reset timing statistics", action="store_true")
+    parser.add_argument("--read-and-clear", dest='readandclear', help="clear the counters once they are read, 1 to enable, 0 to disable", type=int, choices=[0, 1])
+    parser.add_argument("--events", help="print and acknowledge the queued events", action="store_true")
+    parser.add_argument("--group-command", dest='groupcommand', help="broadcast COMMAND to GROUP on all nodes", type=int, nargs=2, metavar=('GROUP', 'COMMAND'))
+    parser.add_argument("--arm", help="arm the group command until --commit instead of applying it", action="store_true")
+    parser.add_argument("--commit", help="broadcast the commit of the armed group commands", action="store_true")
+    parser.add_argument("--discard", help="broadcast the discard of the armed group commands", action="store_true")
+    parser.add_argument("--recall-scene", dest='recallscene', help="recall a scene", type=int, choices=range(0, Scenes.COUNT))
+    parser.add_argument("--capture-scene", dest='capturescene', help="store the current output levels as a scene", type=int, choices=range(0, Scenes.COUNT))
+    parser.add_argument("--set-link", dest='setlink', help="switch the node to BAUDRATE and PARITY, confirmed over the new link", nargs=2, metavar=('BAUDRATE', 'PARITY'))
+    parser.add_argument("--bench-sweep", dest='benchsweep', help="poll coils and counters of SLAVE_ID ... at every baud rate and report frames/s", type=int, nargs='+', metavar='SLAVE_ID')
+    parser.add_argument("--bench-baudrates", dest='benchbaudrates', help="baud rates for --bench-sweep", type=int, nargs='+', default=Link.BAUD_RATES)
+    parser.add_argument("--bench-duration", dest='benchduration', help="seconds per baud rate for --bench-sweep", type=float, default=10)
+    parser.add_argument("--analog", help="dump the values of the analog inputs", action="store_true")
+    parser.add_argument("--diagnostics", help="dump the bus diagnostics counters", action="store_true")
+    parser.add_argument("--diag-sweep", dest='diagsweep', help="read the bus diagnostics of SLAVE_ID ... in one pass and name the node degrading the bus", type=int, nargs='+', metavar='SLAVE_ID')
+    parser.add_argument("--clear-diagnostics", dest='cleardiagnostics', help="clear the bus diagnostics counters of the node, after --diag-sweep those of every node", action="store_true")
+    parser.add_argument("--config", help="bring the node to the YAML or JSON description in CONFIG in staged commits", metavar='CONFIG')
+    parser.add_argument("--check", help="only print what --config would change", action="store_true")
+    parser.add_argument("--debug", help="debug", action="store_true", default=False)
+    group = parser.add_mutually_exclusive_group();
+    group.add_argument("--pin-setting", dest='pinsetting')
+    group.add_argument("--set-coil", dest='setcoil', action='store_true');
+    parser.add_argument("val", type=int, nargs='?')
+    args = parser.parse_args()
+
+    if(args.benchsweep):
+        BusSweep(args.port, args.benchsweep, args.baudrate, args.debug).bench(args.benchbaudrates, args.benchduration)
+        exit(0)
+
+    if(args.diagsweep):
+        sweep = BusSweep(args.port, args.diagsweep, args.baudrate, args.debug)
+        sweep.diagnostics()
+        if(args.cleardiagnostics):
+            # one broadcast, so that the next sweep compares the same time span
+            Diagnostics(sweep.nodes[0][0]).clear(broadcast=True)
+        exit(0)
+
+    homectrl = HomeControl(args.port, args.slaveid, args.baudrate, args.debug);
+
+    if(args.dumpcoils):
+        homectrl.dump_coils()
+
+    if(args.dumpholdingregisters):
+        homectrl.dump_holding_registers()
+
+    if(args.config):
+        homectrl.configure(args.config, args.check)
+
+    if(args.readandclear is not None):
+        homectrl.set_counter_mode(args.readandclear)
+
+    if(args.dumpinputregisters):
+        homectrl.dump_input_registers()
+
+    if(args.pinsetting):
+        homectrl.pinsetting(args.pinindex).set(args.pinsetting, args.val)
+
+    if(args.setlink):
+        homectrl.set_link(int(args.setlink[0]), args.setlink[1])
+
+    if(args.setcoil):
+        homectrl.set_coil(args.pinindex, args.val);
+
+    if(args.uptime):
+        homectrl.uptime()
+
+    if(args.profile):
+        homectrl.dump_profile()
+
+    if(args.resetprofile):
+        homectrl.reset_profile()
+
+    if(args.analog):
+        homectrl.dump_analog()
+
+    if(args.diagnostics):
+        homectrl.dump_diagnostics()
+
+    if(args.cleardiagnostics):
+        homectrl.clear_diagnostics(False)
+
+    if(args.events):
+        homectrl.poll_events()
+
+    if(args.groupcommand):
+        homectrl.group_command().send(args.groupcommand[0], args.groupcommand[1], args.arm)
+
+    if(args.commit or args.discard):
+        homectrl.group_command().commit(args.commit)
+
+    if(args.capturescene is not None):
+        homectrl.scenes().capture(args.capturescene)
+
+    if(args.recallscene is not None):
+        homectrl.scenes().recall(args.recallscene)
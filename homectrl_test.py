@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""Tests of the change planning of NodeConfig in homectrl.py, run with
+python3 -m unittest homectrl_test
+"""
+import sys
+import types
+import unittest
+
+try:
+    import minimalmodbus  # noqa: F401
+except ImportError:
+    # planning the changes needs no serial port
+    sys.modules['minimalmodbus'] = types.ModuleType('minimalmodbus')
+
+from homectrl import SYSTEM_SETTING_SIZE, DigitalPinSetting, NodeConfig
+
+
+def address(pinindex, setting):
+    return SYSTEM_SETTING_SIZE + pinindex * DigitalPinSetting.SETTINGS_SIZE + DigitalPinSetting.index(setting)
+
+
+class NodeConfigTest(unittest.TestCase):
+    def setUp(self):
+        self.current = list(range(0x100, 0x100 + SYSTEM_SETTING_SIZE + 12 * DigitalPinSetting.SETTINGS_SIZE))
+
+    def changes(self, *addresses):
+        return NodeConfig.diff(self.current, {a: 0xFF for a in addresses})
+
+    def test_diff_leaves_out_unchanged_values(self):
+        target = {1: 9, address(0, 'mode'): self.current[address(0, 'mode')]}
+        self.assertEqual(NodeConfig.diff(self.current, target), [(1, self.current[1], 9)])
+
+    def test_gaps_are_merged(self):
+        click, double_click = address(0, 'click_command'), address(0, 'double_click_command')
+        self.assertEqual(NodeConfig.ranges(self.changes(click, double_click), self.current),
+                         [(click, [0xFF] + self.current[click + 1:double_click] + [0xFF])])
+        # more than MAX_GAP apart
+        release = address(0, 'release_command')
+        self.assertEqual(len(NodeConfig.ranges(self.changes(click, release), self.current)), 2)
+
+    def test_runtime_bytes_are_not_rewritten(self):
+        changes = self.changes(address(0, 'group'), address(0, 'click_command'))
+        self.assertEqual(len(NodeConfig.ranges(changes, self.current)), 2)
+        changes = self.changes(address(3, 'release_command'), address(3, 'group_mask'))
+        self.assertEqual(len(NodeConfig.ranges(changes, self.current)), 2)
+        # unless they are changes themselves
+        changes = self.changes(address(0, 'group'), address(0, 'output_value'))
+        self.assertEqual(len(NodeConfig.ranges(changes, self.current)), 1)
+
+    def test_node_settings_are_not_merged(self):
+        changes = self.changes(NodeConfig.SLAVE_ID_REGISTER, 3, address(0, 'mode'))
+        self.assertEqual([start for start, _ in NodeConfig.ranges(changes, self.current)],
+                         [NodeConfig.SLAVE_ID_REGISTER, 3, address(0, 'mode')])
+
+    def test_ranges_fit_a_frame(self):
+        changes = self.changes(*range(SYSTEM_SETTING_SIZE, SYSTEM_SETTING_SIZE + 130))
+        ranges = NodeConfig.ranges(changes, self.current)
+        self.assertEqual([len(values) for _, values in ranges], [NodeConfig.MAX_WRITE, 130 - NodeConfig.MAX_WRITE])
+        self.assertEqual(ranges[1][0], SYSTEM_SETTING_SIZE + NodeConfig.MAX_WRITE)
+
+    def test_batches_stage_a_limited_number_of_pins(self):
+        changes = self.changes(NodeConfig.SLAVE_ID_REGISTER, *[address(pinindex, setting)
+                                                             for pinindex in range(6) for setting in ('mode', 'group')])
+        batches = NodeConfig.batches(changes)
+        self.assertEqual([len(batch) for batch in batches], [1 + 2 * NodeConfig.STAGED_PINS, 4])
+        self.assertEqual(batches[1][0][0], address(NodeConfig.STAGED_PINS, 'mode'))
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,112 @@
+#ifndef ARDUINO_MOCK_h
+#define ARDUINO_MOCK_h
+
+/**
+ * Minimal host implementation of the Arduino core API used by the firmware
+ * and its libraries. Only compiled for the native environment.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+
+// the variant of the board profile, see board.h
+#ifdef BOARD_MEGA
+#define NUM_DIGITAL_PINS 70
+#else
+#define NUM_DIGITAL_PINS 20
+#endif
+
+#define SERIAL_8N1 0x06
+#define SERIAL_8N2 0x0E
+#define SERIAL_8E1 0x26
+#define SERIAL_8O1 0x36
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+      n += write(*buffer++);
+    }
+    return n;
+  }
+  size_t print(const char *s) { return write((const uint8_t *) s, strlen(s)); }
+  size_t print(long value, int base = DEC) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%ld", value);
+    return print(buf);
+  }
+  size_t print(int value, int base = DEC) { return print((long) value, base); }
+  size_t print(unsigned int value, int base = DEC) { return print((long) value, base); }
+  size_t print(unsigned long value, int base = DEC) { return print((long) value, base); }
+  size_t print(uint8_t value, int base = DEC) { return print((long) value, base); }
+  size_t println() { return write('\n'); }
+  template <typename T> size_t println(T value) { return print(value) + println(); }
+  template <typename T> size_t println(T value, int base) { return print(value, base) + println(); }
+  virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+protected:
+  unsigned long _timeout = 1000;
+};
+
+// bytes the receive buffer holds
+#define SERIAL_RX_BUFFER_SIZE 512
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud, uint8_t config = SERIAL_8N1) { _baud = baud; _config = config; }
+  void end() {}
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t c) override;
+  using Print::write;
+  operator bool() { return true; }
+  unsigned long baud() const { return _baud; }
+  uint8_t config() const { return _config; }
+private:
+  unsigned long _baud = 0;
+  uint8_t _config = SERIAL_8N1;
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef ARDUINO_MOCK_CONTROL_h
+#define ARDUINO_MOCK_CONTROL_h
+
+/**
+ * Hooks for the host Arduino core: the clock (manually advanced in tests,
+ * wall clock in the simulator), the simulated pin levels, the bytes
+ * flowing through Serial and emulated timer interrupts.
+ */
+
+#include <Arduino.h>
+
+void mock_set_micros(unsigned long us);
+void mock_advance_millis(unsigned long ms);
+void mock_advance_micros(unsigned long us);
+void mock_use_realtime_clock();
+
+void mock_set_pin(uint8_t pin, uint8_t value);
+uint8_t mock_get_pin(uint8_t pin);
+uint8_t mock_get_pin_mode(uint8_t pin);
+int mock_get_analog(uint8_t pin);
+extern uint8_t mock_trace_outputs;
+
+void mock_serial_reset();
+void mock_serial_feed(const uint8_t *data, size_t length);
+size_t mock_serial_take(uint8_t *data, size_t max_length);
+void mock_serial_attach(int fd);
+
+/**
+ * Emulated timer interrupts. The host main loop calls mock_run_timers()
+ * between loop() passes, which runs every attached handler once for each
+ * elapsed period.
+ */
+void mock_attach_timer(void (*handler)(), unsigned long period_us);
+void mock_run_timers();
+// the tick of the fade engine, see src/fade.h
+void fade_host_timer_attach(void (*tick)(), unsigned long period_us);
+
+void mock_reset();
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef EEPROM_MOCK_h
+#define EEPROM_MOCK_h
+
+/**
+ * Host EEPROM backed by a RAM array. Counts byte accesses so tests and
+ * benchmarks can verify which code paths touch EEPROM.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef E2END
+#ifdef BOARD_MEGA
+#define E2END 0xFFF
+#else
+#define E2END 0x3FF
+#endif
+#endif
+
+#define eeprom_is_ready() (1)
+
+class EEPROMClass {
+public:
+  uint8_t read(int idx) {
+    reads++;
+    return data[idx];
+  }
+  void write(int idx, uint8_t value) {
+    writes++;
+    data[idx] = value;
+  }
+  void update(int idx, uint8_t value) {
+    if (read(idx) != value) {
+      write(idx, value);
+    }
+  }
+  template <typename T> T &get(int idx, T &t) {
+    uint8_t *ptr = (uint8_t *) &t;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      ptr[i] = read(idx + i);
+    }
+    return t;
+  }
+  template <typename T> const T &put(int idx, const T &t) {
+    const uint8_t *ptr = (const uint8_t *) &t;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      update(idx + i, ptr[i]);
+    }
+    return t;
+  }
+  uint16_t length() { return E2END + 1; }
+
+  void clear(uint8_t value = 0xFF) {
+    memset(data, value, sizeof(data));
+    reset_counters();
+  }
+  void reset_counters() {
+    reads = 0;
+    writes = 0;
+  }
+
+  uint8_t data[E2END + 1];
+  unsigned long reads;
+  unsigned long writes;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,229 @@
+#include <Arduino.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+static unsigned long current_micros;
+static uint8_t realtime_clock;
+static struct timespec clock_start;
+static uint8_t pin_levels[NUM_DIGITAL_PINS];
+static uint8_t pin_modes[NUM_DIGITAL_PINS];
+static int analog_values[NUM_DIGITAL_PINS];
+
+#define SERIAL_BUFFER_SIZE 512
+static uint8_t rx_buffer[SERIAL_RX_BUFFER_SIZE];
+static size_t rx_head, rx_tail;
+static uint8_t tx_buffer[SERIAL_BUFFER_SIZE];
+static size_t tx_length;
+static int serial_fd = -1;
+
+#define MOCK_MAX_TIMERS 4
+
+typedef struct {
+  void (*handler)();
+  unsigned long period;
+  unsigned long last_run;
+} mock_timer_t;
+
+static mock_timer_t timers[MOCK_MAX_TIMERS];
+static uint8_t timer_count;
+
+uint8_t mock_trace_outputs;
+
+unsigned long micros() {
+  if (realtime_clock) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long) ((now.tv_sec - clock_start.tv_sec) * 1000000L
+                            + (now.tv_nsec - clock_start.tv_nsec) / 1000L);
+  }
+  return current_micros;
+}
+
+unsigned long millis() {
+  return micros() / 1000;
+}
+
+void delay(unsigned long ms) {
+  if (realtime_clock) {
+    usleep(ms * 1000);
+  } else {
+    current_micros += ms * 1000;
+  }
+}
+
+void delayMicroseconds(unsigned int us) {
+  if (realtime_clock) {
+    usleep(us);
+  } else {
+    current_micros += us;
+  }
+}
+
+void mock_use_realtime_clock() {
+  clock_gettime(CLOCK_MONOTONIC, &clock_start);
+  realtime_clock = 1;
+}
+
+void mock_attach_timer(void (*handler)(), unsigned long period_us) {
+  if (timer_count == MOCK_MAX_TIMERS) {
+    return;
+  }
+  timers[timer_count].handler = handler;
+  timers[timer_count].period = period_us;
+  timers[timer_count].last_run = micros();
+  timer_count++;
+}
+
+void fade_host_timer_attach(void (*tick)(), unsigned long period_us) {
+  mock_attach_timer(tick, period_us);
+}
+
+void mock_run_timers() {
+  unsigned long now = micros();
+  for (uint8_t i = 0; i < timer_count; i++) {
+    while (now - timers[i].last_run >= timers[i].period) {
+      timers[i].handler();
+      timers[i].last_run += timers[i].period;
+    }
+  }
+}
+
+void mock_set_micros(unsigned long us) {
+  current_micros = us;
+}
+
+void mock_advance_millis(unsigned long ms) {
+  current_micros += ms * 1000;
+}
+
+void mock_advance_micros(unsigned long us) {
+  current_micros += us;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  pin_modes[pin] = mode;
+  if (mode == INPUT_PULLUP) {
+    pin_levels[pin] = HIGH;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (mock_trace_outputs && pin_levels[pin] != (value ? HIGH : LOW)) {
+    fprintf(stderr, "pin %d: %d\n", pin, value ? HIGH : LOW);
+  }
+  pin_levels[pin] = value ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) {
+  return pin_levels[pin];
+}
+
+void analogWrite(uint8_t pin, int value) {
+  if (mock_trace_outputs && analog_values[pin] != value) {
+    fprintf(stderr, "pin %d: pwm %d\n", pin, value);
+  }
+  analog_values[pin] = value;
+  pin_levels[pin] = value > 127 ? HIGH : LOW;
+}
+
+void mock_set_pin(uint8_t pin, uint8_t value) {
+  pin_levels[pin] = value;
+}
+
+uint8_t mock_get_pin(uint8_t pin) {
+  return pin_levels[pin];
+}
+
+uint8_t mock_get_pin_mode(uint8_t pin) {
+  return pin_modes[pin];
+}
+
+int mock_get_analog(uint8_t pin) {
+  return analog_values[pin];
+}
+
+static void serial_receive() {
+  if (serial_fd < 0) {
+    return;
+  }
+  if (rx_tail == rx_head) {
+    rx_head = rx_tail = 0;
+  }
+  ssize_t n = ::read(serial_fd, rx_buffer + rx_head, SERIAL_RX_BUFFER_SIZE - rx_head);
+  if (n > 0) {
+    rx_head += n;
+  }
+}
+
+int HardwareSerial::available() {
+  serial_receive();
+  return rx_head - rx_tail;
+}
+
+int HardwareSerial::read() {
+  if (rx_tail == rx_head) {
+    return -1;
+  }
+  return rx_buffer[rx_tail++];
+}
+
+int HardwareSerial::peek() {
+  if (rx_tail == rx_head) {
+    return -1;
+  }
+  return rx_buffer[rx_tail];
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (serial_fd >= 0) {
+    while (::write(serial_fd, &c, 1) < 0 && errno == EAGAIN) {
+    }
+    return 1;
+  }
+  if (tx_length < SERIAL_BUFFER_SIZE) {
+    tx_buffer[tx_length++] = c;
+  }
+  return 1;
+}
+
+void mock_serial_attach(int fd) {
+  serial_fd = fd;
+}
+
+void mock_serial_reset() {
+  rx_head = rx_tail = 0;
+  tx_length = 0;
+}
+
+void mock_serial_feed(const uint8_t *data, size_t length) {
+  if (rx_tail == rx_head) {
+    rx_head = rx_tail = 0;
+  }
+  while (length-- && rx_head < SERIAL_RX_BUFFER_SIZE) {
+    rx_buffer[rx_head++] = *data++;
+  }
+}
+
+size_t mock_serial_take(uint8_t *data, size_t max_length) {
+  size_t n = tx_length < max_length ? tx_length : max_length;
+  memcpy(data, tx_buffer, n);
+  memmove(tx_buffer, tx_buffer + n, tx_length - n);
+  tx_length -= n;
+  return n;
+}
+
+void mock_reset() {
+  current_micros = 0;
+  timer_count = 0;
+  memset(pin_levels, 0, sizeof(pin_levels));
+  memset(pin_modes, 0, sizeof(pin_modes));
+  memset(analog_values, 0, sizeof(analog_values));
+  mock_serial_reset();
+  EEPROM.clear();
+}
@@ -0,0 +1,91 @@
+#include <bustrace.h>
+#include <string.h>
+
+static uint32_t read_le(const uint8_t *data, uint8_t size) {
+  uint32_t value = 0;
+  for (uint8_t i = size; i-- > 0;) {
+    value = value << 8 | data[i];
+  }
+  return value;
+}
+
+static int read_varint(FILE *file, uint64_t *value) {
+  *value = 0;
+  for (uint8_t shift = 0; shift < 64; shift += 7) {
+    int c = fgetc(file);
+    if (c == EOF) {
+      return BUSTRACE_ERROR_TRUNCATED;
+    }
+    *value |= (uint64_t) (c & 0x7F) << shift;
+    if (!(c & 0x80)) {
+      return BUSTRACE_OK;
+    }
+  }
+  return BUSTRACE_ERROR_LENGTH;
+}
+
+int bustrace_open(bustrace_t *trace, FILE *file) {
+  uint8_t header[BUSTRACE_HEADER_SIZE];
+  memset(trace, 0, sizeof(*trace));
+  trace->file = file;
+  if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
+    return BUSTRACE_ERROR_TRUNCATED;
+  }
+  if (memcmp(header, BUSTRACE_MAGIC, 4)) {
+    return BUSTRACE_ERROR_MAGIC;
+  }
+  trace->version = header[4];
+  if (trace->version == 0 || trace->version > BUSTRACE_VERSION) {
+    return BUSTRACE_ERROR_VERSION;
+  }
+  trace->baudrate = read_le(header + 8, 4);
+  trace->frame_count = read_le(header + 12, 4);
+  return BUSTRACE_OK;
+}
+
+int bustrace_next(bustrace_t *trace, bustrace_frame_t *frame) {
+  uint64_t delta, length;
+  int c = fgetc(trace->file);
+  if (c == EOF) {
+    return BUSTRACE_END;
+  }
+  ungetc(c, trace->file);
+  int status = read_varint(trace->file, &delta);
+  if (status != BUSTRACE_OK) {
+    return status;
+  }
+  c = fgetc(trace->file);
+  if (c == EOF) {
+    return BUSTRACE_ERROR_TRUNCATED;
+  }
+  status = read_varint(trace->file, &length);
+  if (status != BUSTRACE_OK) {
+    return status;
+  }
+  if (length > BUSTRACE_MAX_FRAME) {
+    return BUSTRACE_ERROR_LENGTH;
+  }
+  if (fread(frame->data, 1, length, trace->file) != length) {
+    return BUSTRACE_ERROR_TRUNCATED;
+  }
+  trace->time_us += delta;
+  trace->frames_read++;
+  frame->time_us = trace->time_us;
+  frame->flags = c;
+  frame->length = length;
+  return BUSTRACE_OK;
+}
+
+const char *bustrace_error(int status) {
+  switch (status) {
+  case BUSTRACE_ERROR_MAGIC:
+    return "not a bus trace";
+  case BUSTRACE_ERROR_VERSION:
+    return "unsupported trace version";
+  case BUSTRACE_ERROR_TRUNCATED:
+    return "trace is truncated";
+  case BUSTRACE_ERROR_LENGTH:
+    return "frame length out of range";
+  }
+  return "ok";
+}
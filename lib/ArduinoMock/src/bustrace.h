@@ -0,0 +1,71 @@
+#ifndef BUSTRACE_h
+#define BUSTRACE_h
+
+/**
+ * Bus trace files: timestamped RTU frames recorded from a live bus or
+ * synthesized by bustrace.py and replayed by the simulator with --replay.
+ *
+ * All fields are little endian.
+ *
+ * header:
+ *   0  char[4] "HCBT"
+ *   4  uint8   version, readers reject versions newer than BUSTRACE_VERSION
+ *   5  uint8   flags, none defined
+ *   6  uint16  reserved
+ *   8  uint32  baud rate of the bus
+ *   12 uint32  number of frames, 0 when the recorder was not stopped cleanly
+ *
+ * followed by one record per frame:
+ *   varint  microseconds from the start of the previous frame, 0 for the
+ *           first
+ *   uint8   BUSTRACE_FRAME_* flags
+ *   varint  length
+ *   length bytes, slave id to crc
+ *
+ * varints are LEB128, 7 bits per byte with the low bits first and bit 7
+ * set on every byte but the last.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define BUSTRACE_MAGIC "HCBT"
+#define BUSTRACE_VERSION 1
+#define BUSTRACE_HEADER_SIZE 16
+// RTU frames are at most 256 bytes
+#define BUSTRACE_MAX_FRAME 256
+
+// sent by a slave, everything else is a master request
+#define BUSTRACE_FRAME_RESPONSE 0x01
+// the recorder saw a crc mismatch, the bytes are kept as captured
+#define BUSTRACE_FRAME_CRC_ERROR 0x02
+
+#define BUSTRACE_OK 0
+#define BUSTRACE_END 1
+#define BUSTRACE_ERROR_MAGIC -1
+#define BUSTRACE_ERROR_VERSION -2
+#define BUSTRACE_ERROR_TRUNCATED -3
+#define BUSTRACE_ERROR_LENGTH -4
+
+typedef struct {
+  FILE *file;
+  uint8_t version;
+  uint32_t baudrate;
+  uint32_t frame_count;
+  // start of the last frame read
+  uint64_t time_us;
+  uint32_t frames_read;
+} bustrace_t;
+
+typedef struct {
+  uint64_t time_us;
+  uint8_t flags;
+  uint16_t length;
+  uint8_t data[BUSTRACE_MAX_FRAME];
+} bustrace_frame_t;
+
+int bustrace_open(bustrace_t *trace, FILE *file);
+int bustrace_next(bustrace_t *trace, bustrace_frame_t *frame);
+const char *bustrace_error(int status);
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef UNIT_TEST
+/**
+ * Entry point of the native simulator. Runs setup() and loop() like the
+ * Arduino core does, with Serial connected to a pseudo-terminal so Modbus
+ * masters such as homectrl.py can talk to the firmware.
+ *
+ * usage: program [--eeprom file] [--link path] [--trace]
+ *        program --replay trace [--eeprom file] [--slave id] [--fast] [--cpu-scale n]
+ *
+ * --eeprom: load the EEPROM image from file and write it back on changes,
+ *   a replay only loads it
+ * --link: create a symlink to the pseudo-terminal at path
+ * --trace: print output pin changes on stderr
+ * --replay: feed the frames of a bus trace to Serial instead, print the
+ *   response latencies and loop stalls and exit, see host_replay.cpp
+ * --slave: slave id of the replayed node, 1 by default
+ * --fast: replay as fast as possible instead of at original speed
+ * --cpu-scale: slowdown of the node against the host, 1 by default
+ *
+ * Lines on stdin of the form "pin <number> <level>" set input pin levels.
+ */
+
+#include <Arduino.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define HOST_LOOP_SLEEP_US 100
+#define HOST_EEPROM_SYNC_MS 1000
+
+void setup();
+void loop();
+int host_replay(const char *path, uint8_t slave_id, uint8_t fast, unsigned cpu_scale);
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int signal) {
+  running = 0;
+}
+
+static int open_pty(const char *link_path) {
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+    perror("pty");
+    return -1;
+  }
+  struct termios tio;
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(fd, TCSANOW, &tio);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  const char *name = ptsname(fd);
+  if (link_path) {
+    unlink(link_path);
+    if (symlink(name, link_path) < 0) {
+      perror("symlink");
+    }
+  }
+  fprintf(stderr, "modbus rtu on %s\n", link_path ? link_path : name);
+  return fd;
+}
+
+static void load_eeprom(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return;
+  }
+  if (fread(EEPROM.data, 1, sizeof(EEPROM.data), file) != sizeof(EEPROM.data)) {
+    fprintf(stderr, "eeprom image %s is short\n", path);
+  }
+  fclose(file);
+}
+
+static void save_eeprom(const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    perror(path);
+    return;
+  }
+  fwrite(EEPROM.data, 1, sizeof(EEPROM.data), file);
+  fclose(file);
+}
+
+static void read_commands() {
+  static char line[64];
+  static size_t length;
+  char c;
+  while (read(STDIN_FILENO, &c, 1) == 1) {
+    if (c != '\n' && length < sizeof(line) - 1) {
+      line[length++] = c;
+      continue;
+    }
+    line[length] = 0;
+    length = 0;
+    int pin, level;
+    if (sscanf(line, "pin %d %d", &pin, &level) == 2 && pin >= 0 && pin < NUM_DIGITAL_PINS) {
+      mock_set_pin(pin, level ? HIGH : LOW);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *eeprom_path = 0;
+  const char *link_path = 0;
+  const char *replay_path = 0;
+  int slave_id = 1;
+  uint8_t fast = 0;
+  int cpu_scale = 1;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--eeprom") && i + 1 < argc) {
+      eeprom_path = argv[++i];
+    } else if (!strcmp(argv[i], "--link") && i + 1 < argc) {
+      link_path = argv[++i];
+    } else if (!strcmp(argv[i], "--trace")) {
+      mock_trace_outputs = 1;
+    } else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+      replay_path = argv[++i];
+    } else if (!strcmp(argv[i], "--slave") && i + 1 < argc) {
+      slave_id = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--fast")) {
+      fast = 1;
+    } else if (!strcmp(argv[i], "--cpu-scale") && i + 1 < argc) {
+      cpu_scale = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--eeprom file] [--link path] [--trace]\n"
+              "       %s --replay trace [--eeprom file] [--slave id] [--fast] [--cpu-scale n]\n",
+              argv[0], argv[0]);
+      return 1;
+    }
+  }
+  if (replay_path) {
+    if (slave_id < 1 || slave_id > 247 || cpu_scale < 1) {
+      fprintf(stderr, "slave id or cpu scale out of range\n");
+      return 1;
+    }
+    mock_reset();
+    if (!fast) {
+      mock_use_realtime_clock();
+    }
+    if (eeprom_path) {
+      load_eeprom(eeprom_path);
+    }
+    return host_replay(replay_path, slave_id, fast, cpu_scale);
+  }
+  int fd = open_pty(link_path);
+  if (fd < 0) {
+    return 1;
+  }
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+  mock_reset();
+  mock_use_realtime_clock();
+  mock_serial_attach(fd);
+  if (eeprom_path) {
+    load_eeprom(eeprom_path);
+  }
+  setup();
+
+  unsigned long last_sync = millis();
+  unsigned long synced_writes = EEPROM.writes;
+  while (running) {
+    loop();
+    mock_run_timers();
+    read_commands();
+    if (eeprom_path && EEPROM.writes != synced_writes && millis() - last_sync >= HOST_EEPROM_SYNC_MS) {
+      save_eeprom(eeprom_path);
+      synced_writes = EEPROM.writes;
+      last_sync = millis();
+    }
+    usleep(HOST_LOOP_SLEEP_US);
+  }
+  if (eeprom_path) {
+    save_eeprom(eeprom_path);
+  }
+  if (link_path) {
+    unlink(link_path);
+  }
+  return 0;
+}
+#endif
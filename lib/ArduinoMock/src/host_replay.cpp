@@ -0,0 +1,244 @@
+#ifndef UNIT_TEST
+/**
+ * Replay of a bus trace against the firmware, started by the simulator
+ * with --replay. See bustrace.h for the file format and bustrace.py for
+ * recording and synthesizing traces.
+ *
+ * Every frame of the trace goes into Serial one byte per character time
+ * at its recorded offset, except the responses of the replayed node,
+ * which the firmware answers itself. A request to the node counts as
+ * answered when the firmware writes a response before the next frame of
+ * the trace starts, as late when that response is still on the wire at
+ * the start of the next frame and as dropped when there is none.
+ *
+ * At original speed the wall clock drives micros(). As fast as possible
+ * the clock advances by the cost of every loop pass: the host time of
+ * the pass times the cpu scale, plus REPLAY_EEPROM_WRITE_US for every
+ * EEPROM byte written. At original speed a pass sleeps until it has
+ * taken its cost. The cpu scale is the slowdown of the node against the
+ * host, calibrate it by comparing the loop profile of a replay with the
+ * profile registers of a node.
+ */
+
+#include <Arduino.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <algorithm>
+#include <bustrace.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// time between setup() and the first frame
+#define REPLAY_START_US 100000UL
+// time after the last frame to collect its response
+#define REPLAY_TAIL_US 100000UL
+// the ATmega blocks for 3.3 ms on an EEPROM byte write
+#define REPLAY_EEPROM_WRITE_US 3300UL
+// loop passes longer than this count as stalls
+#define REPLAY_STALL_US 1000UL
+// start bit, 8 data bits, parity or second stop bit, stop bit
+#define REPLAY_CHAR_BITS 11
+
+void setup();
+void loop();
+
+typedef struct {
+  uint32_t requests;
+  uint32_t broadcasts;
+  uint32_t others;
+  uint32_t responses;
+  uint32_t exceptions;
+  uint32_t dropped;
+  uint32_t late;
+  uint32_t stray_bytes;
+  unsigned long passes;
+  unsigned long stalls;
+  unsigned long stall_us;
+  unsigned long max_pass_us;
+  std::vector<unsigned long> latencies;
+} replay_stats_t;
+
+typedef struct {
+  uint8_t active;
+  uint8_t answered;
+  unsigned long end;
+  unsigned long response_start;
+  uint16_t response_length;
+} replay_request_t;
+
+static uint8_t replay_fast;
+static unsigned replay_cpu_scale;
+static unsigned long char_us;
+static replay_stats_t stats;
+static replay_request_t request;
+
+static uint64_t host_ns(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void run_pass() {
+  unsigned long start = micros();
+  unsigned long writes = EEPROM.writes;
+  // cpu time, so that preemption of the simulator does not count
+  uint64_t host_start = host_ns(CLOCK_THREAD_CPUTIME_ID);
+  loop();
+  mock_run_timers();
+  unsigned long cost = (host_ns(CLOCK_THREAD_CPUTIME_ID) - host_start) * replay_cpu_scale / 1000
+    + (EEPROM.writes - writes) * REPLAY_EEPROM_WRITE_US;
+  if (replay_fast) {
+    mock_advance_micros(cost ? cost : 1);
+  } else {
+    unsigned long spent = micros() - start;
+    if (cost > spent) {
+      usleep(cost - spent);
+    }
+  }
+  cost = micros() - start;
+  stats.passes++;
+  stats.max_pass_us = std::max(stats.max_pass_us, cost);
+  if (cost > REPLAY_STALL_US) {
+    stats.stalls++;
+    stats.stall_us += cost;
+  }
+
+  uint8_t response[BUSTRACE_MAX_FRAME];
+  size_t length = mock_serial_take(response, sizeof(response));
+  if (!length) {
+    return;
+  }
+  if (!request.active) {
+    stats.stray_bytes += length;
+    return;
+  }
+  if (!request.answered) {
+    request.answered = 1;
+    // written during the pass that just ended
+    request.response_start = micros();
+    if (length > 1 && (response[1] & 0x80)) {
+      stats.exceptions++;
+    }
+  }
+  request.response_length += length;
+}
+
+static void run_until(unsigned long time) {
+  while ((long) (time - micros()) > 0) {
+    run_pass();
+  }
+}
+
+static void close_request(unsigned long next_frame) {
+  if (!request.active) {
+    return;
+  }
+  request.active = 0;
+  if (!request.answered) {
+    stats.dropped++;
+    return;
+  }
+  stats.responses++;
+  stats.latencies.push_back(request.response_start - request.end);
+  if (request.response_start + request.response_length * char_us > next_frame) {
+    stats.late++;
+  }
+}
+
+static uint8_t crc_ok(const bustrace_frame_t *frame) {
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < frame->length; i++) {
+    crc ^= frame->data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+  }
+  return frame->length >= 4 && crc == 0;
+}
+
+static unsigned long percentile(const std::vector<unsigned long> &sorted, unsigned p) {
+  return sorted.empty() ? 0 : sorted[(sorted.size() - 1) * p / 100];
+}
+
+static void print_report(const char *path, const bustrace_t *trace, unsigned long bus_us, double host_s) {
+  std::vector<unsigned long> sorted(stats.latencies);
+  std::sort(sorted.begin(), sorted.end());
+  printf("trace %s: version %u, %u frames, %u baud\n", path, trace->version, trace->frames_read, trace->baudrate);
+  printf("replay %s, cpu scale %u: %.3f s of bus time in %.3f s\n",
+         replay_fast ? "as fast as possible" : "at original speed", replay_cpu_scale, bus_us / 1e6, host_s);
+  printf("requests %u, broadcasts %u, other frames %u\n", stats.requests, stats.broadcasts, stats.others);
+  printf("responses %u, exceptions %u, dropped %u, late %u, stray bytes %u\n",
+         stats.responses, stats.exceptions, stats.dropped, stats.late, stats.stray_bytes);
+  printf("latency us: p50 %lu, p90 %lu, p99 %lu, max %lu\n", percentile(sorted, 50), percentile(sorted, 90),
+         percentile(sorted, 99), sorted.empty() ? 0 : sorted.back());
+  printf("loop passes %lu, max %lu us, %lu over %lu us for %lu us\n", stats.passes, stats.max_pass_us,
+         stats.stalls, REPLAY_STALL_US, stats.stall_us);
+  printf("eeprom writes %lu\n", EEPROM.writes);
+}
+
+int host_replay(const char *path, uint8_t slave_id, uint8_t fast, unsigned cpu_scale) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    return 1;
+  }
+  bustrace_t trace;
+  std::vector<bustrace_frame_t> frames;
+  bustrace_frame_t frame;
+  int status = bustrace_open(&trace, file);
+  while (status == BUSTRACE_OK && (status = bustrace_next(&trace, &frame)) == BUSTRACE_OK) {
+    frames.push_back(frame);
+  }
+  fclose(file);
+  if (status != BUSTRACE_END) {
+    fprintf(stderr, "%s: %s\n", path, bustrace_error(status));
+    return 1;
+  }
+  if (frames.empty() || !trace.baudrate) {
+    fprintf(stderr, "%s: no frames\n", path);
+    return 1;
+  }
+
+  replay_fast = fast;
+  replay_cpu_scale = cpu_scale;
+  char_us = (REPLAY_CHAR_BITS * 1000000UL + trace.baudrate - 1) / trace.baudrate;
+  uint64_t host_start = host_ns(CLOCK_MONOTONIC);
+  setup();
+  unsigned long origin = micros() + REPLAY_START_US - frames[0].time_us;
+  EEPROM.reset_counters();
+  mock_serial_take(frame.data, sizeof(frame.data));
+
+  for (size_t i = 0; i < frames.size(); i++) {
+    const bustrace_frame_t *f = &frames[i];
+    if ((f->flags & BUSTRACE_FRAME_RESPONSE) && f->data[0] == slave_id) {
+      // the firmware answers in place of the recorded node
+      continue;
+    }
+    unsigned long start = origin + f->time_us;
+    run_until(start);
+    close_request(start);
+    for (uint16_t k = 0; k < f->length; k++) {
+      run_until(start + (k + 1) * char_us);
+      mock_serial_feed(&f->data[k], 1);
+    }
+    if (f->flags & BUSTRACE_FRAME_RESPONSE || !crc_ok(f)) {
+      stats.others++;
+    } else if (f->data[0] == 0) {
+      stats.broadcasts++;
+    } else if (f->data[0] == slave_id) {
+      stats.requests++;
+      request = {1, 0, start + f->length * char_us, 0, 0};
+    } else {
+      stats.others++;
+    }
+  }
+  unsigned long end = micros() + REPLAY_TAIL_US;
+  run_until(end);
+  close_request(end);
+
+  print_report(path, &trace, end - origin - frames[0].time_us, (host_ns(CLOCK_MONOTONIC) - host_start) / 1e9);
+  return 0;
+}
+#endif
@@ -0,0 +1,12 @@
+#ifndef ATOMIC_MOCK_h
+#define ATOMIC_MOCK_h
+
+#include <stdint.h>
+
+// avr-libc ATOMIC_BLOCK: host builds have no interrupts to hold off, the
+// block runs once
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type) for (uint8_t atomic_once = 1; atomic_once; atomic_once = 0)
+
+#endif
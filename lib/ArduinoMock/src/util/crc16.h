@@ -0,0 +1,15 @@
+#ifndef CRC16_MOCK_h
+#define CRC16_MOCK_h
+
+#include <stdint.h>
+
+// avr-libc _crc16_update: polynomial 0xA001, as used by Modbus
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t data) {
+  crc ^= data;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+  return crc;
+}
+
+#endif
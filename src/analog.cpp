@@ -0,0 +1,174 @@
+#include "Arduino.h"
+#include <string.h>
+#include <util/atomic.h>
+#include <homectrl.h>
+#include <analog.h>
+
+static analog_filter_t analog_filters[NR_OF_DIGITAL_PINS];
+static volatile uint16_t analog_values[NR_OF_DIGITAL_PINS];
+static volatile pin_mask_t analog_ready;
+
+uint8_t analog_filter_push(analog_filter_t *filter, uint16_t sample, uint16_t *value) {
+  filter->sum += sample;
+  if (++filter->count < ANALOG_OVERSAMPLING) {
+    return 0;
+  }
+  // the sum of 4^n samples has 2n bits more, n of them are resolution
+  *value = filter->sum >> ANALOG_EXTRA_BITS;
+  filter->sum = 0;
+  filter->count = 0;
+  return 1;
+}
+
+uint8_t analog_threshold(uint8_t state, uint16_t value, uint8_t rise_level, uint8_t fall_level) {
+  uint16_t rise = (uint16_t) rise_level * ANALOG_LEVEL_STEP;
+  uint16_t fall = (uint16_t) fall_level * ANALOG_LEVEL_STEP;
+  if (fall > rise) {
+    fall = rise;
+  }
+  if (value >= rise) {
+    return 1;
+  }
+  if (value < fall) {
+    return 0;
+  }
+  return state;
+}
+
+void analog_push(uint8_t index, uint16_t sample) {
+  uint16_t value;
+  if (analog_filter_push(&analog_filters[index], sample, &value)) {
+    analog_values[index] = value;
+    analog_ready |= ((pin_mask_t) 1) << index;
+  }
+}
+
+pin_mask_t analog_take_ready() {
+  pin_mask_t ready;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    ready = analog_ready;
+    analog_ready = 0;
+  }
+  return ready;
+}
+
+uint16_t analog_value(uint8_t index) {
+  uint16_t value;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    value = analog_values[index];
+  }
+  return value;
+}
+
+static void analog_reset() {
+  memset(analog_filters, 0, sizeof(analog_filters));
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    analog_values[i] = 0;
+  }
+  analog_ready = 0;
+}
+
+#if defined(__AVR__)
+// ADC clock between 50 and 200 kHz for the full 10 bit
+#if F_CPU > 12800000UL
+#define ANALOG_PRESCALER (_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0))
+#else
+#define ANALOG_PRESCALER (_BV(ADPS2) | _BV(ADPS1))
+#endif
+
+static uint8_t analog_channel_count;
+static uint8_t analog_channel_index[BOARD_ANALOG_INPUTS];
+static uint8_t analog_channel_input[BOARD_ANALOG_INPUTS];
+// channel of the running conversion and of the one the multiplexer is set to
+static volatile uint8_t analog_running;
+static volatile uint8_t analog_next;
+
+static inline void analog_select(uint8_t input) {
+  // AVcc reference, result right adjusted
+  ADMUX = _BV(REFS0) | (input & 0x07);
+#ifdef MUX5
+  if (input & 0x08) {
+    ADCSRB |= _BV(MUX5);
+  } else {
+    ADCSRB &= ~_BV(MUX5);
+  }
+#endif
+}
+
+static void analog_disable_digital_input(uint8_t input) {
+#ifdef ADC7D
+  if (input < 8) {
+    DIDR0 |= _BV(input);
+  }
+#else
+  // the ATmega328 has no digital input on ADC6 and ADC7
+  if (input < 6) {
+    DIDR0 |= _BV(input);
+  }
+#endif
+#ifdef DIDR2
+  if (input >= 8) {
+    DIDR2 |= _BV(input - 8);
+  }
+#endif
+}
+
+pin_mask_t analog_begin(pin_mask_t pins) {
+  uint8_t old_sreg = SREG;
+  cli();
+  ADCSRA = 0;
+  analog_reset();
+  analog_channel_count = 0;
+  DIDR0 = 0;
+#ifdef DIDR2
+  DIDR2 = 0;
+#endif
+  pin_mask_t converted = 0;
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    uint8_t input = board_analog_input(digital_pins_numbers[i]);
+    if (!(pins & (((pin_mask_t) 1) << i)) || input == BOARD_NO_ANALOG_INPUT) {
+      continue;
+    }
+    analog_channel_index[analog_channel_count] = i;
+    analog_channel_input[analog_channel_count++] = input;
+    analog_disable_digital_input(input);
+    converted |= ((pin_mask_t) 1) << i;
+  }
+  if (analog_channel_count) {
+    analog_running = 0;
+    analog_next = 0;
+    analog_select(analog_channel_input[0]);
+    // free running
+    ADCSRB &= ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0));
+    ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIF) | _BV(ADIE) | ANALOG_PRESCALER;
+  }
+  SREG = old_sreg;
+  return converted;
+}
+
+ISR(ADC_vect) {
+  uint16_t sample = ADC;
+  uint8_t channel = analog_running;
+  // the next conversion started with the multiplexer as it was, the
+  // switch takes effect for the one after
+  analog_running = analog_next;
+  if (++analog_next == analog_channel_count) {
+    analog_next = 0;
+  }
+  analog_select(analog_channel_input[analog_next]);
+  analog_push(analog_channel_index[channel], sample);
+}
+#else
+pin_mask_t analog_begin(pin_mask_t pins) {
+  // host builds feed samples through analog_push()
+  analog_reset();
+  pin_mask_t converted = 0;
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    if ((pins & (((pin_mask_t) 1) << i)) &&
+        board_analog_input(digital_pins_numbers[i]) != BOARD_NO_ANALOG_INPUT) {
+      converted |= ((pin_mask_t) 1) << i;
+    }
+  }
+  return converted;
+}
+#endif
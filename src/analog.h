@@ -0,0 +1,79 @@
+#ifndef ANALOG_h
+#define ANALOG_h
+
+#include <stdint.h>
+#include <homectrl.h>
+
+/**
+ * Interrupt driven analog inputs.
+ *
+ * Pins in DIGITAL_PIN_MODE_ANALOG are converted by the ADC in free
+ * running mode: the conversion complete interrupt stores the result and
+ * moves the multiplexer on to the next channel, round robin, so loop()
+ * never waits for a conversion the way it does with analogRead(). The
+ * multiplexer is switched while the following conversion already runs,
+ * the interrupt keeps track of which channel a result belongs to.
+ *
+ * Every ANALOG_OVERSAMPLING 10 bit samples of a channel are summed and
+ * decimated into one 12 bit value. The ADC noise of about one count
+ * dithers the samples, which is what the two extra bits resolve. At 16 MHz
+ * the ADC runs at 125 kHz and converts about 9600 samples per second,
+ * with two channels a new value is ready every 3.3 ms.
+ *
+ * Values cross the thresholds with hysteresis: a channel rises once its
+ * value reaches analog_rise_level and falls once it drops below
+ * analog_fall_level, both in steps of ANALOG_LEVEL_STEP. A fall level
+ * above the rise level counts as the rise level. Rising and falling fire
+ * signal_rise_command and signal_fall_command to the group of the pin,
+ * like the edges of a signal input, and the coil of the pin reads the
+ * threshold state. The first value of a channel sets its state without
+ * firing.
+ */
+
+#define ANALOG_SAMPLE_BITS 10
+// extra bits resolved by oversampling
+#define ANALOG_EXTRA_BITS 2
+// 4^ANALOG_EXTRA_BITS samples for each value
+#define ANALOG_OVERSAMPLING (1 << (2 * ANALOG_EXTRA_BITS))
+#define ANALOG_VALUE_BITS (ANALOG_SAMPLE_BITS + ANALOG_EXTRA_BITS)
+#define ANALOG_LEVEL_STEP (1 << (ANALOG_VALUE_BITS - 8))
+
+typedef struct {
+  uint16_t sum;
+  uint8_t count;
+} analog_filter_t;
+
+/**
+ * Adds a sample to filter. Returns 1 with the decimated value in value
+ * once ANALOG_OVERSAMPLING samples are summed, 0 before.
+ */
+uint8_t analog_filter_push(analog_filter_t *filter, uint16_t sample, uint16_t *value);
+
+/**
+ * Returns the threshold state after value, state is the one before.
+ */
+uint8_t analog_threshold(uint8_t state, uint16_t value, uint8_t rise_level, uint8_t fall_level);
+
+/**
+ * Starts converting the pins with an analog input, 0 stops the ADC.
+ * Resets every filter and value. Returns the pins that are converted.
+ */
+pin_mask_t analog_begin(pin_mask_t pins);
+
+/**
+ * Adds a sample of pin index, called by the interrupt. Host builds feed
+ * samples through it.
+ */
+void analog_push(uint8_t index, uint16_t sample);
+
+/**
+ * Returns the pins with a new value since the last call.
+ */
+pin_mask_t analog_take_ready();
+
+/**
+ * Returns the latest value of pin index, 0 before the first.
+ */
+uint16_t analog_value(uint8_t index);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef BOARD_h
+#define BOARD_h
+
+#include <stdint.h>
+
+/**
+ * Board profiles.
+ *
+ * A profile fixes at compile time the Arduino pins of the channels, the
+ * pins dimming may drive with a hardware PWM timer, the number of I/O
+ * ports the channels span, the pins with an ADC input and the EEPROM
+ * size. homectrl.h takes the pin
+ * count from it, the settings layout and the register blocks follow from
+ * the pin count.
+ *
+ * BOARD_MEGA (or an ATmega2560 build) selects the Mega profile, anything
+ * else the pro mini. BOARD_PIN_COUNT limits a profile to its first pins,
+ * e.g. to benchmark a 24 channel Mega.
+ */
+
+#if defined(BOARD_MEGA) || defined(__AVR_ATmega2560__)
+// 0, 1 serial, 8 RS485_CTRL_PIN
+#define BOARD_PINS \
+  2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 13, \
+  22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, \
+  40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58
+#define BOARD_MAX_PINS 48
+// Timer0, 1, 3, 4 and 5, Timer2 runs the software PWM
+#define BOARD_PWM_PINS 2, 3, 4, 5, 6, 7, 11, 12, 13, 44, 45, 46
+// PORTA, B, C, D, E, F, G, H and L
+#define BOARD_PORTS 9
+// A0 - A15
+#define BOARD_ANALOG_FIRST_PIN 54
+#define BOARD_ANALOG_INPUTS 16
+#define BOARD_EEPROM_SIZE 4096
+#else
+#define BOARD_PINS 10, 11, 12, 13, 14, 15, 16, 17, 9, 6, 5, 3
+#define BOARD_MAX_PINS 12
+// Timer0 and Timer1, Timer2 runs the software PWM
+#define BOARD_PWM_PINS 5, 6, 9, 10
+// PORTB, C and D
+#define BOARD_PORTS 3
+// A0 - A7, A6 and A7 have no digital function and are no channels
+#define BOARD_ANALOG_FIRST_PIN 14
+#define BOARD_ANALOG_INPUTS 8
+#define BOARD_EEPROM_SIZE 1024
+#endif
+
+#ifndef BOARD_PIN_COUNT
+#define BOARD_PIN_COUNT BOARD_MAX_PINS
+#endif
+
+constexpr uint8_t board_pins[] = {BOARD_PINS};
+constexpr uint8_t board_pwm_pins[] = {BOARD_PWM_PINS};
+
+static_assert(sizeof(board_pins) == BOARD_MAX_PINS, "BOARD_MAX_PINS does not match BOARD_PINS");
+static_assert(BOARD_PIN_COUNT > 0 && BOARD_PIN_COUNT <= BOARD_MAX_PINS, "BOARD_PIN_COUNT exceeds the profile");
+// pin_mask_t holds one bit per channel
+static_assert(BOARD_PIN_COUNT <= 64, "more channels than a pin_mask_t holds");
+
+#define BOARD_NO_ANALOG_INPUT 0xFF
+
+/**
+ * Returns the ADC input of pin, BOARD_NO_ANALOG_INPUT for pins without.
+ */
+constexpr uint8_t board_analog_input(uint8_t pin) {
+  return pin >= BOARD_ANALOG_FIRST_PIN && pin < BOARD_ANALOG_FIRST_PIN + BOARD_ANALOG_INPUTS
+    ? pin - BOARD_ANALOG_FIRST_PIN : BOARD_NO_ANALOG_INPUT;
+}
+
+constexpr uint8_t board_has_hardware_pwm(uint8_t pin, uint8_t i = 0) {
+  return i < sizeof(board_pwm_pins) &&
+    (board_pwm_pins[i] == pin || board_has_hardware_pwm(pin, i + 1));
+}
+
+#endif
@@ -0,0 +1,114 @@
+#include "Arduino.h"
+#include <homectrl.h>
+#include <capture.h>
+
+static capture_event_t capture_queue[CAPTURE_QUEUE_SIZE];
+static volatile uint8_t capture_head;
+static volatile uint8_t capture_tail;
+
+volatile uint16_t capture_overflow_count;
+
+void capture_push(uint8_t index, uint8_t level) {
+  uint8_t head = capture_head;
+  uint8_t next = (head + 1) & (CAPTURE_QUEUE_SIZE - 1);
+  if (next == capture_tail) {
+    capture_overflow_count++;
+    return;
+  }
+  capture_queue[head].timestamp = millis();
+  capture_queue[head].index = index;
+  capture_queue[head].level = level;
+  // the queue is not volatile, the entry must be complete before the
+  // head publishes it
+  __asm__ __volatile__("" ::: "memory");
+  capture_head = next;
+}
+
+uint8_t capture_pop(capture_event_t *event) {
+  uint8_t tail = capture_tail;
+  if (tail == capture_head) {
+    return 0;
+  }
+  *event = capture_queue[tail];
+  // and read before the tail hands the slot back to the interrupt
+  __asm__ __volatile__("" ::: "memory");
+  capture_tail = (tail + 1) & (CAPTURE_QUEUE_SIZE - 1);
+  return 1;
+}
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+// PCINT group 0, 1 and 2 cover PORTB, PORTC and PORTD bit for bit
+#define CAPTURE_GROUPS 3
+#define CAPTURE_NO_PIN 0xFF
+
+static volatile uint8_t *capture_ports[CAPTURE_GROUPS];
+static uint8_t capture_pin_index[CAPTURE_GROUPS][8];
+static volatile uint8_t capture_last_levels[CAPTURE_GROUPS];
+
+pin_mask_t capture_begin(pin_mask_t pins) {
+  uint8_t old_sreg = SREG;
+  cli();
+  PCICR = 0;
+  for (uint8_t group = 0; group < CAPTURE_GROUPS; group++) {
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      capture_pin_index[group][bit] = CAPTURE_NO_PIN;
+    }
+  }
+  PCMSK0 = 0;
+  PCMSK1 = 0;
+  PCMSK2 = 0;
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    if (!(pins & (((pin_mask_t) 1) << i))) {
+      continue;
+    }
+    uint8_t pin = digital_pins_numbers[i];
+    uint8_t group = digitalPinToPCICRbit(pin);
+    uint8_t bit = digitalPinToPCMSKbit(pin);
+    capture_ports[group] = portInputRegister(digitalPinToPort(pin));
+    capture_pin_index[group][bit] = i;
+    *digitalPinToPCMSK(pin) |= _BV(bit);
+    PCICR |= _BV(group);
+  }
+  for (uint8_t group = 0; group < CAPTURE_GROUPS; group++) {
+    if (PCICR & _BV(group)) {
+      capture_last_levels[group] = *capture_ports[group];
+    }
+  }
+  PCIFR = _BV(PCIF0) | _BV(PCIF1) | _BV(PCIF2);
+  SREG = old_sreg;
+  return pins;
+}
+
+static inline void capture_group(uint8_t group, uint8_t mask) {
+  uint8_t levels = *capture_ports[group];
+  uint8_t changed = (levels ^ capture_last_levels[group]) & mask;
+  capture_last_levels[group] = levels;
+  for (uint8_t bit = 0; changed; bit++, changed >>= 1) {
+    if (changed & 1) {
+      capture_push(capture_pin_index[group][bit], (levels >> bit) & 1);
+    }
+  }
+}
+
+ISR(PCINT0_vect) {
+  capture_group(0, PCMSK0);
+}
+
+ISR(PCINT1_vect) {
+  capture_group(1, PCMSK1);
+}
+
+ISR(PCINT2_vect) {
+  capture_group(2, PCMSK2);
+}
+#elif defined(__AVR__)
+pin_mask_t capture_begin(pin_mask_t pins) {
+  // no pin change mapping for this MCU, the pins stay polled
+  return 0;
+}
+#else
+pin_mask_t capture_begin(pin_mask_t pins) {
+  // host builds feed edges through capture_push()
+  return pins;
+}
+#endif
@@ -0,0 +1,33 @@
+#ifndef CAPTURE_h
+#define CAPTURE_h
+
+#include <stdint.h>
+#include <homectrl.h>
+
+/**
+ * Interrupt driven capture of signal inputs.
+ *
+ * Pins with DIGITAL_PIN_CAPTURE_MASK set in their mode get their pin
+ * change interrupt enabled. The interrupt pushes every edge with its
+ * millis() timestamp into a single producer/single consumer ring buffer
+ * that the main loop drains, so pulses shorter than a loop pass are not
+ * lost. The ring indices are single bytes, which the AVR reads and writes
+ * atomically, so neither side needs to block interrupts.
+ */
+
+// must be a power of two
+#define CAPTURE_QUEUE_SIZE 16
+
+typedef struct {
+  unsigned long timestamp;
+  uint8_t index;
+  uint8_t level;
+} capture_event_t;
+
+extern volatile uint16_t capture_overflow_count;
+
+pin_mask_t capture_begin(pin_mask_t pins);
+void capture_push(uint8_t index, uint8_t level);
+uint8_t capture_pop(capture_event_t *event);
+
+#endif
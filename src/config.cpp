@@ -0,0 +1,110 @@
+#include "Arduino.h"
+#include <EEPROM.h>
+#include <stddef.h>
+#include <string.h>
+#include <util/crc16.h>
+#include <homectrl.h>
+#include <config.h>
+#include <profile.h>
+
+config_shadow_t config_shadow;
+static uint8_t staging;
+static uint8_t store_pending;
+static uint16_t store_cursor;
+
+#define CRC_OFFSET offsetof(settings_t, crc)
+
+uint8_t config_is_runtime_byte(uint16_t index) {
+  if (index < sizeof(settings_t)) {
+    return 0;
+  }
+  uint8_t offset = (index - sizeof(settings_t)) % sizeof(digital_pin_setting_t);
+  return offset == offsetof(digital_pin_setting_t, output_value) ||
+    offset == offsetof(digital_pin_setting_t, pwm_on_value);
+}
+
+static uint8_t is_crc_byte(uint16_t index) {
+  return index == CRC_OFFSET || index == CRC_OFFSET + 1;
+}
+
+uint16_t config_crc(const settings_t *settings, const digital_pin_setting_t *pins) {
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < CONFIG_IMAGE_SIZE; i++) {
+    if (is_crc_byte(i) || config_is_runtime_byte(i)) {
+      continue;
+    }
+    uint8_t value = i < sizeof(settings_t) ? ((const uint8_t *) settings)[i]
+      : ((const uint8_t *) pins)[i - sizeof(settings_t)];
+    crc = _crc16_update(crc, value);
+  }
+  return crc;
+}
+
+void config_stage() {
+  config_shadow.slave_id = node_settings.slave_id;
+  config_shadow.link_config_next = node_settings.link_config_next;
+  config_shadow.pin_count = 0;
+  staging = 1;
+}
+
+digital_pin_setting_t *config_staged_pin(uint8_t index) {
+  for (uint8_t i = 0; i < config_shadow.pin_count; i++) {
+    if (config_shadow.pin_index[i] == index) {
+      return &config_shadow.pins[i];
+    }
+  }
+  if (config_shadow.pin_count == CONFIG_STAGED_PINS) {
+    return NULL;
+  }
+  uint8_t i = config_shadow.pin_count++;
+  config_shadow.pin_index[i] = index;
+  config_shadow.pins[i] = digital_pin_settings[index];
+  return &config_shadow.pins[i];
+}
+
+void config_discard() {
+  staging = 0;
+}
+
+uint8_t config_staging() {
+  return staging;
+}
+
+void config_store() {
+  store_pending = 1;
+  store_cursor = 0;
+}
+
+uint8_t config_store_pending() {
+  return store_pending;
+}
+
+static uint8_t live_byte(uint16_t index) {
+  if (index < sizeof(settings_t)) {
+    return ((const uint8_t *) &node_settings)[index];
+  }
+  return ((const uint8_t *) digital_pin_settings)[index - sizeof(settings_t)];
+}
+
+void config_loop() {
+  // a write still in progress would make EEPROM.write() busy wait
+  if (!store_pending || !eeprom_is_ready()) {
+    return;
+  }
+  // the crc goes last, after every byte it covers
+  while (store_cursor < CONFIG_IMAGE_SIZE + 2) {
+    uint16_t index = store_cursor < CONFIG_IMAGE_SIZE ? store_cursor : CRC_OFFSET + store_cursor - CONFIG_IMAGE_SIZE;
+    store_cursor++;
+    if ((store_cursor <= CONFIG_IMAGE_SIZE && is_crc_byte(index)) || config_is_runtime_byte(index)) {
+      continue;
+    }
+    uint8_t value = live_byte(index);
+    if (EEPROM.read(SETTINGS_OFFSET + index) != value) {
+      unsigned long start = micros();
+      EEPROM.write(SETTINGS_OFFSET + index, value);
+      profile_record(PROFILE_EEPROM_WRITE, micros() - start);
+      return;
+    }
+  }
+  store_pending = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef CONFIG_h
+#define CONFIG_h
+
+#include <stdint.h>
+#include <homectrl.h>
+
+/**
+ * Staged configuration.
+ *
+ * While staging, holding register writes to the settings image land in
+ * config_shadow instead of the live settings, without validation or side
+ * effects. The shadow holds the slave id, link_config_next and the
+ * records of at most CONFIG_STAGED_PINS pins rather than a whole image,
+ * 71 bytes instead of 200 on the pro mini and 776 on the Mega. A write
+ * to one more pin fails with STATUS_SLAVE_DEVICE_FAILURE, larger changes
+ * take several commits. The commit validates the staged bytes that
+ * differ from the live ones, applies them at once and queues the image
+ * for writing.
+ *
+ * config_loop() then writes one changed byte per pass, comparing the live
+ * image with the EEPROM, and the CRC last. A pass returns without writing
+ * while the EEPROM is still busy with the previous byte. The runtime bytes
+ * output_value and pwm_on_value belong to the persist journal, they are
+ * neither written by the pass nor covered by the CRC.
+ *
+ * The CRC is the Modbus CRC16 over settings_t without the crc field and
+ * all pin settings without the runtime bytes. A node booting with a CRC
+ * that does not match, for example after losing power halfway through
+ * a pass, falls back to the default settings.
+ */
+
+typedef struct __attribute__((__packed__)) {
+  settings_t settings;
+  digital_pin_setting_t pins[NR_OF_DIGITAL_PINS];
+} config_image_t;
+
+#define CONFIG_IMAGE_SIZE sizeof(config_image_t)
+
+#ifndef CONFIG_STAGED_PINS
+#define CONFIG_STAGED_PINS 4
+#endif
+
+typedef struct {
+  uint8_t slave_id;
+  uint8_t link_config_next;
+  uint8_t pin_count;
+  uint8_t pin_index[CONFIG_STAGED_PINS];
+  digital_pin_setting_t pins[CONFIG_STAGED_PINS];
+} config_shadow_t;
+
+extern config_shadow_t config_shadow;
+
+uint16_t config_crc(const settings_t *settings, const digital_pin_setting_t *pins);
+uint8_t config_is_runtime_byte(uint16_t index);
+
+void config_stage();
+void config_discard();
+uint8_t config_staging();
+
+/**
+ * Returns the staged record of pin index, a copy of the live one on first
+ * use. Returns NULL if CONFIG_STAGED_PINS other pins are staged already.
+ */
+digital_pin_setting_t *config_staged_pin(uint8_t index);
+
+/**
+ * Queues the live settings for writing. The crc in node_settings must
+ * already be up to date.
+ */
+void config_store();
+uint8_t config_store_pending();
+void config_loop();
+
+#endif
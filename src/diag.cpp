@@ -0,0 +1,272 @@
+#include "Arduino.h"
+#include <string.h>
+#include <util/crc16.h>
+#include <homectrl.h>
+#include <link.h>
+#include <diag.h>
+
+enum diag_state {
+  // between frames
+  DIAG_IDLE = 0,
+  // the first two bytes of a frame are held back
+  DIAG_HEAD,
+  // the slave reads the frame
+  DIAG_PASS,
+  // a Diagnostics request for this node, never handed on
+  DIAG_REQUEST,
+};
+
+diag_counters_t diag_counters;
+DiagStream diag_serial;
+
+static uint8_t slave_id = DEFAULT_SLAVE_ID;
+static uint8_t state;
+static uint8_t frame[DIAG_REQUEST_SIZE];
+static uint8_t frame_length;
+// bytes of frame handed to the slave in DIAG_PASS
+static uint8_t handed_on;
+static uint16_t frame_crc;
+static uint8_t overrun;
+// bytes the slave wrote since the frame started
+static uint8_t response_length;
+static uint8_t response_pending;
+// Serial.available() as last seen, it grows when bytes arrive
+static int serial_available;
+static unsigned long last_arrival;
+static unsigned long last_poll;
+static uint8_t polled;
+static uint8_t timing_config = 0xFF;
+static uint16_t t35_us;
+
+static void track_arrivals() {
+  int available = Serial.available();
+  if (available > serial_available) {
+    last_arrival = micros();
+    if (available >= SERIAL_RX_BUFFER_SIZE - 1) {
+      overrun = 1;
+    }
+  }
+  serial_available = available;
+}
+
+static void start_frame() {
+  if (response_pending) {
+    response_pending = 0;
+    diag_counters.no_responses++;
+  }
+  state = DIAG_HEAD;
+  frame_length = 0;
+  handed_on = 0;
+  frame_crc = 0xFFFF;
+  response_length = 0;
+}
+
+static void observe(uint8_t c) {
+  serial_available--;
+  frame_crc = _crc16_update(frame_crc, c);
+  if (frame_length < DIAG_REQUEST_SIZE) {
+    frame[frame_length] = c;
+  }
+  if (frame_length < 0xFF) {
+    frame_length++;
+  }
+}
+
+static void send_response(const uint8_t *response, uint8_t length) {
+  uint8_t buffer[DIAG_REQUEST_SIZE];
+  memcpy(buffer, response, length);
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < length; i++) {
+    crc = _crc16_update(crc, buffer[i]);
+  }
+  buffer[length++] = crc & 0xFF;
+  buffer[length++] = crc >> 8;
+  digitalWrite(RS485_CTRL_PIN, HIGH);
+  Serial.write(buffer, length);
+  Serial.flush();
+  digitalWrite(RS485_CTRL_PIN, LOW);
+}
+
+static uint16_t counter(uint16_t sub_function) {
+  switch (sub_function) {
+  case DIAG_BUS_MESSAGE_COUNT:
+    return diag_counters.bus_messages;
+  case DIAG_BUS_COMMUNICATION_ERROR_COUNT:
+    return diag_counters.crc_errors;
+  case DIAG_BUS_EXCEPTION_ERROR_COUNT:
+    return diag_counters.exceptions;
+  case DIAG_SLAVE_MESSAGE_COUNT:
+    return diag_counters.slave_messages;
+  case DIAG_SLAVE_NO_RESPONSE_COUNT:
+    return diag_counters.no_responses;
+  default:
+    return diag_counters.overruns;
+  }
+}
+
+static void answer_request() {
+  uint16_t sub_function = frame[2] << 8 | frame[3];
+  uint16_t data = frame[4] << 8 | frame[5];
+  uint8_t status = STATUS_OK;
+  if (frame_length != DIAG_REQUEST_SIZE) {
+    status = STATUS_ILLEGAL_DATA_VALUE;
+  } else if (sub_function == DIAG_RETURN_QUERY_DATA) {
+  } else if (sub_function == DIAG_RESTART_COMMUNICATIONS || sub_function == DIAG_CLEAR_COUNTERS) {
+    diag_clear();
+  } else if (sub_function == DIAG_RETURN_DIAGNOSTIC_REGISTER ||
+             (sub_function >= DIAG_BUS_MESSAGE_COUNT && sub_function <= DIAG_SLAVE_NO_RESPONSE_COUNT) ||
+             sub_function == DIAG_BUS_CHARACTER_OVERRUN_COUNT) {
+    if (data != 0) {
+      status = STATUS_ILLEGAL_DATA_VALUE;
+    } else if (sub_function != DIAG_RETURN_DIAGNOSTIC_REGISTER) {
+      data = counter(sub_function);
+    }
+  } else {
+    status = STATUS_ILLEGAL_FUNCTION;
+  }
+  if (frame[0] == 0) {
+    return;
+  }
+  if (status != STATUS_OK) {
+    diag_counters.exceptions++;
+    uint8_t response[] = {slave_id, FC_DIAGNOSTICS | 0x80, status};
+    send_response(response, sizeof(response));
+    return;
+  }
+  uint8_t response[] = {slave_id, FC_DIAGNOSTICS, frame[2], frame[3], (uint8_t) (data >> 8), (uint8_t) data};
+  send_response(response, sizeof(response));
+}
+
+static void end_frame() {
+  uint8_t frame_state = state;
+  state = DIAG_IDLE;
+  diag_counters.bus_messages++;
+  if (overrun) {
+    overrun = 0;
+    diag_counters.overruns++;
+  }
+  if (frame_length < 4 || frame_crc != 0) {
+    diag_counters.crc_errors++;
+    return;
+  }
+  if (frame[0] != slave_id && frame[0] != 0) {
+    return;
+  }
+  diag_counters.slave_messages++;
+  if (frame[0] == 0) {
+    diag_counters.no_responses++;
+  } else if (frame_state == DIAG_PASS && response_length == 0) {
+    // the slave may answer after the frame end was noticed here
+    response_pending = 1;
+  }
+  if (frame_state == DIAG_REQUEST) {
+    answer_request();
+  }
+}
+
+/**
+ * Notices the end of the current frame and takes the bytes that are not
+ * handed to the slave straight away.
+ */
+static void receive() {
+  uint8_t config = link_active_config();
+  if (config != timing_config) {
+    link_timing_t timing;
+    link_timing(config, &timing);
+    t35_us = timing.t35_us;
+    timing_config = config;
+  }
+  track_arrivals();
+  // in DIAG_PASS the frame only ends once the slave has read all of it
+  if (state != DIAG_IDLE && micros() - last_arrival > t35_us &&
+      !(state == DIAG_PASS && (handed_on < 2 || serial_available > 0))) {
+    end_frame();
+  }
+  while (state != DIAG_PASS && serial_available > 0) {
+    if (state == DIAG_IDLE) {
+      start_frame();
+    }
+    observe(Serial.read());
+    if (state == DIAG_HEAD && frame_length == 2) {
+      uint8_t for_node = frame[0] == slave_id || frame[0] == 0;
+      state = for_node && frame[1] == FC_DIAGNOSTICS ? DIAG_REQUEST : DIAG_PASS;
+    }
+  }
+}
+
+int DiagStream::available() {
+  receive();
+  if (state != DIAG_PASS) {
+    return 0;
+  }
+  return 2 - handed_on + serial_available;
+}
+
+int DiagStream::read() {
+  receive();
+  if (state != DIAG_PASS) {
+    return -1;
+  }
+  if (handed_on < 2) {
+    return frame[handed_on++];
+  }
+  int c = Serial.read();
+  if (c >= 0) {
+    observe(c);
+  }
+  return c;
+}
+
+int DiagStream::peek() {
+  receive();
+  if (state != DIAG_PASS) {
+    return -1;
+  }
+  return handed_on < 2 ? frame[handed_on] : Serial.peek();
+}
+
+size_t DiagStream::write(uint8_t c) {
+  if (response_length == 0) {
+    // the response starts t3.5 after the request at the earliest
+    unsigned long silence = micros() - last_arrival;
+    if (silence < t35_us) {
+      delayMicroseconds(t35_us - silence);
+    }
+  }
+  if (response_length < 0xFF) {
+    response_length++;
+  }
+  if (response_length == 2 && (c & 0x80)) {
+    diag_counters.exceptions++;
+  }
+  response_pending = 0;
+  return Serial.write(c);
+}
+
+void DiagStream::flush() {
+  Serial.flush();
+}
+
+void diag_begin(uint8_t id) {
+  slave_id = id;
+  state = DIAG_IDLE;
+  overrun = 0;
+  response_pending = 0;
+  serial_available = 0;
+  diag_clear();
+}
+
+void diag_poll() {
+  unsigned long now = micros();
+  if (polled && now - last_poll > diag_counters.max_poll_gap_us) {
+    diag_counters.max_poll_gap_us = now - last_poll;
+  }
+  polled = 1;
+  last_poll = now;
+  receive();
+}
+
+void diag_clear() {
+  memset(&diag_counters, 0, sizeof(diag_counters));
+  polled = 0;
+}
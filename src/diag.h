@@ -0,0 +1,94 @@
+#ifndef DIAG_h
+#define DIAG_h
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/**
+ * Bus diagnostics.
+ *
+ * diag_serial stands between Serial and ModbusSlave and sees every byte
+ * the slave reads and writes. It cuts the received bytes into frames on
+ * the t3.5 silence of the link, runs the crc over them and keeps the
+ * counters of the Modbus Diagnostics function (0x08). ModbusSlave does
+ * not know that function, so diag_serial holds back the first two bytes
+ * of every frame until the function code is known and answers the
+ * Diagnostics requests for this node itself; the slave never sees them.
+ * Every other frame is handed on unchanged, one character later. The
+ * first byte the slave answers with waits until t3.5 has passed since the
+ * last byte of the request, see link.h.
+ *
+ * The Arduino core drops received bytes while its ring buffer is full. A
+ * frame during which the buffer filled up counts as an overrun, it also
+ * fails its crc.
+ *
+ * The counters are 16 bit and wrap, like the Diagnostics function
+ * reports them. A frame for this node the slave did not answer before
+ * the next frame started counts as not answered, broadcasts always do.
+ */
+
+#define FC_DIAGNOSTICS 0x08
+
+// supported sub-functions, any other is answered with an illegal function
+#define DIAG_RETURN_QUERY_DATA 0x00
+// clears the counters, the node has no listen only mode to leave
+#define DIAG_RESTART_COMMUNICATIONS 0x01
+// always 0
+#define DIAG_RETURN_DIAGNOSTIC_REGISTER 0x02
+#define DIAG_CLEAR_COUNTERS 0x0A
+#define DIAG_BUS_MESSAGE_COUNT 0x0B
+#define DIAG_BUS_COMMUNICATION_ERROR_COUNT 0x0C
+#define DIAG_BUS_EXCEPTION_ERROR_COUNT 0x0D
+#define DIAG_SLAVE_MESSAGE_COUNT 0x0E
+#define DIAG_SLAVE_NO_RESPONSE_COUNT 0x0F
+#define DIAG_BUS_CHARACTER_OVERRUN_COUNT 0x12
+
+// slave id, function, sub-function, data and crc
+#define DIAG_REQUEST_SIZE 8
+
+#ifndef SERIAL_RX_BUFFER_SIZE
+#define SERIAL_RX_BUFFER_SIZE 64
+#endif
+
+typedef struct {
+  // every frame seen on the bus
+  uint16_t bus_messages;
+  uint16_t crc_errors;
+  // exception responses of this node
+  uint16_t exceptions;
+  // frames with a valid crc for this node or broadcast
+  uint16_t slave_messages;
+  uint16_t no_responses;
+  uint16_t overruns;
+  // longest time between two diag_poll() calls
+  uint32_t max_poll_gap_us;
+} diag_counters_t;
+
+extern diag_counters_t diag_counters;
+
+class DiagStream : public Stream {
+public:
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t c) override;
+  using Print::write;
+  void flush() override;
+};
+
+extern DiagStream diag_serial;
+
+/**
+ * Starts counting at boot. slave_id is the id the Diagnostics requests
+ * are answered for, the one the slave was constructed with.
+ */
+void diag_begin(uint8_t slave_id);
+
+/**
+ * Call right before slave.poll(). Measures the poll gap and answers a
+ * Diagnostics request once its frame is complete.
+ */
+void diag_poll();
+void diag_clear();
+
+#endif
@@ -0,0 +1,226 @@
+#include "Arduino.h"
+#include <avr/pgmspace.h>
+#include <dimming.h>
+#include <softpwm.h>
+
+/**
+ * 16 bit output levels for every 8 bit output value. Generated from
+ * round(f(value / 255) * 65535).
+ */
+
+// CIE 1931 lightness: L* = 100 * x, Y = L* / 903.3 below L* 8, ((L* + 16) / 116)^3 above
+static const uint16_t dimming_curve_cie1931[256] PROGMEM = {
+      0,    28,    57,    85,   114,   142,   171,   199,
+    228,   256,   285,   313,   341,   370,   398,   427,
+    455,   484,   512,   541,   569,   598,   627,   658,
+    689,   721,   755,   789,   825,   861,   899,   937,
+    977,  1018,  1060,  1103,  1147,  1192,  1239,  1287,
+   1336,  1386,  1437,  1490,  1544,  1599,  1656,  1714,
+   1773,  1834,  1896,  1959,  2024,  2090,  2157,  2226,
+   2297,  2369,  2442,  2517,  2593,  2671,  2751,  2832,
+   2914,  2999,  3085,  3172,  3261,  3352,  3444,  3538,
+   3634,  3732,  3831,  3932,  4035,  4139,  4245,  4354,
+   4464,  4575,  4689,  4804,  4922,  5041,  5162,  5285,
+   5410,  5537,  5666,  5797,  5930,  6065,  6202,  6341,
+   6482,  6626,  6771,  6918,  7068,  7220,  7373,  7529,
+   7687,  7848,  8010,  8175,  8342,  8512,  8683,  8857,
+   9033,  9212,  9393,  9576,  9762,  9949, 10140, 10333,
+  10528, 10725, 10926, 11128, 11333, 11541, 11751, 11963,
+  12179, 12396, 12617, 12840, 13065, 13293, 13524, 13757,
+  13993, 14232, 14474, 14718, 14965, 15215, 15467, 15722,
+  15980, 16241, 16505, 16771, 17041, 17313, 17588, 17866,
+  18147, 18431, 18717, 19007, 19300, 19596, 19894, 20196,
+  20501, 20809, 21119, 21433, 21750, 22071, 22394, 22720,
+  23050, 23383, 23719, 24058, 24400, 24746, 25095, 25447,
+  25802, 26161, 26523, 26888, 27257, 27629, 28004, 28383,
+  28765, 29151, 29540, 29932, 30328, 30728, 31131, 31537,
+  31947, 32360, 32777, 33198, 33622, 34050, 34481, 34916,
+  35355, 35797, 36243, 36693, 37146, 37603, 38064, 38529,
+  38997, 39469, 39945, 40425, 40908, 41396, 41887, 42382,
+  42881, 43384, 43891, 44401, 44916, 45435, 45957, 46484,
+  47015, 47549, 48088, 48631, 49178, 49728, 50283, 50843,
+  51406, 51973, 52545, 53120, 53700, 54284, 54873, 55465,
+  56062, 56663, 57269, 57878, 58492, 59111, 59733, 60360,
+  60992, 61627, 62268, 62912, 63561, 64215, 64873, 65535,
+};
+
+// gamma 2.2: Y = x^2.2
+static const uint16_t dimming_curve_gamma22[256] PROGMEM = {
+      0,     0,     2,     4,     7,    11,    17,    24,
+     32,    42,    53,    65,    79,    94,   111,   129,
+    148,   169,   192,   216,   242,   270,   299,   330,
+    362,   396,   432,   469,   508,   549,   591,   635,
+    681,   729,   779,   830,   883,   938,   995,  1053,
+   1113,  1175,  1239,  1305,  1373,  1443,  1514,  1587,
+   1663,  1740,  1819,  1900,  1983,  2068,  2155,  2243,
+   2334,  2427,  2521,  2618,  2717,  2817,  2920,  3024,
+   3131,  3240,  3350,  3463,  3578,  3694,  3813,  3934,
+   4057,  4182,  4309,  4438,  4570,  4703,  4838,  4976,
+   5115,  5257,  5401,  5547,  5695,  5845,  5998,  6152,
+   6309,  6468,  6629,  6792,  6957,  7124,  7294,  7466,
+   7640,  7816,  7994,  8175,  8358,  8543,  8730,  8919,
+   9111,  9305,  9501,  9699,  9900, 10102, 10307, 10515,
+  10724, 10936, 11150, 11366, 11585, 11806, 12029, 12254,
+  12482, 12712, 12944, 13179, 13416, 13655, 13896, 14140,
+  14386, 14635, 14885, 15138, 15394, 15652, 15912, 16174,
+  16439, 16706, 16975, 17247, 17521, 17798, 18077, 18358,
+  18642, 18928, 19216, 19507, 19800, 20095, 20393, 20694,
+  20996, 21301, 21609, 21919, 22231, 22546, 22863, 23182,
+  23504, 23829, 24156, 24485, 24817, 25151, 25487, 25826,
+  26168, 26512, 26858, 27207, 27558, 27912, 28268, 28627,
+  28988, 29351, 29717, 30086, 30457, 30830, 31206, 31585,
+  31966, 32349, 32735, 33124, 33514, 33908, 34304, 34702,
+  35103, 35507, 35913, 36321, 36732, 37146, 37562, 37981,
+  38402, 38825, 39252, 39680, 40112, 40546, 40982, 41421,
+  41862, 42306, 42753, 43202, 43654, 44108, 44565, 45025,
+  45487, 45951, 46418, 46888, 47360, 47835, 48313, 48793,
+  49275, 49761, 50249, 50739, 51232, 51728, 52226, 52727,
+  53230, 53736, 54245, 54756, 55270, 55787, 56306, 56828,
+  57352, 57879, 58409, 58941, 59476, 60014, 60554, 61097,
+  61642, 62190, 62741, 63295, 63851, 64410, 64971, 65535,
+};
+
+#ifdef DIMMING_CUSTOM_CURVE_FILE
+#include DIMMING_CUSTOM_CURVE_FILE
+#else
+// custom curve, defaults to gamma 2.8. Build with
+// -DDIMMING_CUSTOM_CURVE_FILE='"file.h"' to provide a table for the installation.
+static const uint16_t dimming_curve_custom[256] PROGMEM = {
+      0,     0,     0,     0,     1,     1,     2,     3,
+      4,     6,     8,    10,    13,    16,    19,    24,
+     28,    33,    39,    46,    53,    60,    69,    78,
+     88,    98,   110,   122,   135,   149,   164,   179,
+    196,   214,   232,   252,   273,   295,   317,   341,
+    366,   393,   420,   449,   478,   510,   542,   575,
+    610,   647,   684,   723,   764,   806,   849,   894,
+    940,   988,  1037,  1088,  1140,  1194,  1250,  1307,
+   1366,  1427,  1489,  1553,  1619,  1686,  1756,  1827,
+   1900,  1975,  2051,  2130,  2210,  2293,  2377,  2463,
+   2552,  2642,  2734,  2829,  2925,  3024,  3124,  3227,
+   3332,  3439,  3548,  3660,  3774,  3890,  4008,  4128,
+   4251,  4376,  4504,  4634,  4766,  4901,  5038,  5177,
+   5319,  5464,  5611,  5760,  5912,  6067,  6224,  6384,
+   6546,  6711,  6879,  7049,  7222,  7397,  7576,  7757,
+   7941,  8128,  8317,  8509,  8704,  8902,  9103,  9307,
+   9514,  9723,  9936, 10151, 10370, 10591, 10816, 11043,
+  11274, 11507, 11744, 11984, 12227, 12473, 12722, 12975,
+  13230, 13489, 13751, 14017, 14285, 14557, 14833, 15111,
+  15393, 15678, 15967, 16259, 16554, 16853, 17155, 17461,
+  17770, 18083, 18399, 18719, 19042, 19369, 19700, 20034,
+  20372, 20713, 21058, 21407, 21759, 22115, 22475, 22838,
+  23206, 23577, 23952, 24330, 24713, 25099, 25489, 25884,
+  26282, 26683, 27089, 27499, 27913, 28330, 28752, 29178,
+  29608, 30041, 30479, 30921, 31367, 31818, 32272, 32730,
+  33193, 33660, 34131, 34606, 35085, 35569, 36057, 36549,
+  37046, 37547, 38052, 38561, 39075, 39593, 40116, 40643,
+  41175, 41711, 42251, 42796, 43346, 43899, 44458, 45021,
+  45588, 46161, 46737, 47319, 47905, 48495, 49091, 49691,
+  50295, 50905, 51519, 52138, 52761, 53390, 54023, 54661,
+  55303, 55951, 56604, 57261, 57923, 58590, 59262, 59939,
+  60621, 61308, 62000, 62697, 63399, 64106, 64818, 65535,
+};
+#endif
+
+static const uint16_t * const dimming_curves[] PROGMEM = {
+  0,
+  dimming_curve_cie1931,
+  dimming_curve_gamma22,
+  dimming_curve_custom,
+};
+
+uint8_t validate_dimming_curve(uint8_t curve) {
+  return curve <= DIMMING_CURVE_CUSTOM;
+}
+
+uint16_t dimming_level(uint8_t curve, uint8_t value) {
+  if (curve == DIMMING_CURVE_LINEAR || curve > DIMMING_CURVE_CUSTOM) {
+    return ((uint16_t) value << 8) | value;
+  }
+  const uint16_t *table = (const uint16_t *) pgm_read_ptr(&dimming_curves[curve]);
+  return pgm_read_word(&table[value]);
+}
+
+#ifdef __AVR__
+static uint8_t write_timer1(uint8_t pin, uint16_t level) {
+  uint8_t timer = digitalPinToTimer(pin);
+  volatile uint16_t *ocr;
+  uint8_t com;
+  if (timer == TIMER1A) {
+    ocr = &OCR1A;
+    com = _BV(COM1A1);
+  } else if (timer == TIMER1B) {
+    ocr = &OCR1B;
+    com = _BV(COM1B1);
+  } else {
+    return 0;
+  }
+  uint16_t duty = level >> (16 - DIMMING_TIMER1_BITS);
+  if (duty == 0) {
+    // a compare value of 0 still gives a one cycle pulse every period
+    TCCR1A &= ~com;
+    digitalWrite(pin, LOW);
+  } else {
+    *ocr = duty;
+    TCCR1A |= com;
+  }
+  return 1;
+}
+
+static uint8_t has_soft_pwm(uint8_t pin) {
+  // Timer2 runs the software PWM, see softpwm.h and board.h
+  return !board_has_hardware_pwm(pin);
+}
+
+static uint8_t write_soft_pwm(uint8_t pin, uint16_t level) {
+  if (!has_soft_pwm(pin)) {
+    return 0;
+  }
+  uint8_t channel = soft_pwm_attach(portOutputRegister(digitalPinToPort(pin)), digitalPinToBitMask(pin));
+  if (channel == SOFT_PWM_NONE) {
+    digitalWrite(pin, level >= 0x8000 ? HIGH : LOW);
+  } else {
+    soft_pwm_write(channel, level >> 8);
+  }
+  return 1;
+}
+
+void dimming_release(uint8_t pin) {
+  if (has_soft_pwm(pin)) {
+    soft_pwm_detach(portOutputRegister(digitalPinToPort(pin)), digitalPinToBitMask(pin));
+  }
+}
+
+/**
+ * Switches Timer1 to fast PWM with ICR1 as top (mode 14) without
+ * prescaler, giving DIMMING_TIMER1_BITS of resolution on pins 9 and 10,
+ * and starts the software PWM on Timer2.
+ */
+void dimming_begin() {
+  TCCR1A = _BV(WGM11);
+  TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS10);
+  ICR1 = DIMMING_TIMER1_TOP;
+  soft_pwm_begin();
+}
+#else
+static uint8_t write_timer1(uint8_t pin, uint16_t level) {
+  return 0;
+}
+
+static uint8_t write_soft_pwm(uint8_t pin, uint16_t level) {
+  return 0;
+}
+
+void dimming_release(uint8_t pin) {
+}
+
+void dimming_begin() {
+}
+#endif
+
+void dimming_write(uint8_t pin, uint8_t curve, uint8_t value) {
+  uint16_t level = dimming_level(curve, value);
+  if (write_timer1(pin, level) || write_soft_pwm(pin, level)) {
+    return;
+  }
+  analogWrite(pin, level >> 8);
+}
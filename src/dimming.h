@@ -0,0 +1,31 @@
+#ifndef DIMMING_h
+#define DIMMING_h
+
+#include <stdint.h>
+
+/**
+ * Dimming curves map the linear 8 bit output value of a pin to a 16 bit
+ * output level through PROGMEM lookup tables, so the output path does no
+ * math beyond a table read.
+ *
+ * Pins on Timer1 (OC1A/OC1B) are driven with DIMMING_TIMER1_BITS of
+ * resolution, the Timer0 pins get the upper 8 bits through analogWrite()
+ * and all other pins the upper 8 bits from the software PWM in softpwm.h.
+ */
+
+#define DIMMING_CURVE_LINEAR 0x0
+#define DIMMING_CURVE_CIE1931 0x1
+#define DIMMING_CURVE_GAMMA22 0x2
+#define DIMMING_CURVE_CUSTOM 0x3
+
+#define DIMMING_TIMER1_BITS 12
+#define DIMMING_TIMER1_TOP ((1U << DIMMING_TIMER1_BITS) - 1)
+
+uint8_t validate_dimming_curve(uint8_t curve);
+uint16_t dimming_level(uint8_t curve, uint8_t value);
+void dimming_write(uint8_t pin, uint8_t curve, uint8_t value);
+// stops the software PWM of a pin that is no longer a PWM output
+void dimming_release(uint8_t pin);
+void dimming_begin();
+
+#endif
@@ -0,0 +1,45 @@
+#include "Arduino.h"
+#include <string.h>
+#include <homectrl.h>
+#include <events.h>
+
+event_t events[EVENT_QUEUE_SIZE];
+uint16_t event_sequence;
+uint8_t event_count;
+uint16_t events_dropped;
+
+void events_reset() {
+  memset(events, 0, sizeof(events));
+  event_sequence = 0;
+  event_count = 0;
+  events_dropped = 0;
+}
+
+void events_push(uint8_t index, uint8_t type, uint8_t value) {
+  events_push_at(index, type, value, millis());
+}
+
+void events_push_at(uint8_t index, uint8_t type, uint8_t value, unsigned long timestamp) {
+  if (event_count == EVENT_QUEUE_SIZE) {
+    events_dropped++;
+    return;
+  }
+  event_t *event = &events[event_count++];
+  event->index = index;
+  event->type = type;
+  event->value = value;
+  event->timestamp = timestamp;
+}
+
+uint8_t events_acknowledge(uint16_t sequence) {
+  uint16_t processed = sequence - event_sequence;
+  if (processed > event_count) {
+    return 0;
+  }
+  event_count -= processed;
+  event_sequence = sequence;
+  memmove(events, events + processed, event_count * sizeof(event_t));
+  // unused entries read as 0
+  memset(events + event_count, 0, processed * sizeof(event_t));
+  return 1;
+}
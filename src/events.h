@@ -0,0 +1,73 @@
+#ifndef EVENTS_h
+#define EVENTS_h
+
+#include <stdint.h>
+#include <homectrl.h>
+
+/**
+ * Queue of things that happened on the node, so a master can poll one
+ * short register block instead of all coils and counters.
+ *
+ * Button and signal events and output changes are appended with their
+ * millis() timestamp, edges of captured pins with the time the interrupt
+ * saw them. The queue is kept oldest first so the register map
+ * can serve it straight from the array; every entry is 4 registers:
+ *
+ * 0: pin index in the low byte, event type in the high byte
+ * 1: value, the output value or output state for output events
+ * 2 - 3: timestamp in milliseconds, low word first
+ *
+ * Entries are numbered with a 16 bit sequence number. A master
+ * acknowledges the entries it has processed by writing the sequence number
+ * of the first entry it has not seen yet, which removes the older ones.
+ * Events arriving while the queue is full are counted and dropped.
+ *
+ * Events are only pushed from the main loop, so the queue needs no
+ * locking.
+ */
+
+#define EVENT_QUEUE_SIZE 16
+
+enum event_type {
+  EVENT_NONE = 0,
+  EVENT_CLICK,
+  EVENT_SINGLE_CLICK,
+  EVENT_DOUBLE_CLICK,
+  EVENT_LONG_CLICK,
+  EVENT_RELEASE,
+  EVENT_RISE,
+  EVENT_FALL,
+  // the output settled at value
+  EVENT_OUTPUT_VALUE,
+  // the output entered output state value, e.g. started fading
+  EVENT_OUTPUT_STATE,
+};
+
+typedef struct {
+  uint8_t index;
+  uint8_t type;
+  uint16_t value;
+  uint32_t timestamp;
+} event_t;
+
+extern event_t events[EVENT_QUEUE_SIZE];
+// sequence number of events[0]
+extern uint16_t event_sequence;
+extern uint8_t event_count;
+extern uint16_t events_dropped;
+
+void events_reset();
+void events_push(uint8_t index, uint8_t type, uint8_t value);
+
+/**
+ * Appends an event that happened at timestamp, in millis().
+ */
+void events_push_at(uint8_t index, uint8_t type, uint8_t value, unsigned long timestamp);
+
+/**
+ * Removes the entries before sequence. Returns 0 if sequence lies beyond
+ * the newest entry.
+ */
+uint8_t events_acknowledge(uint16_t sequence);
+
+#endif
@@ -0,0 +1,70 @@
+#include "Arduino.h"
+#include <util/atomic.h>
+#include <homectrl.h>
+#include <fade.h>
+
+fade_t fades[NR_OF_DIGITAL_PINS];
+
+uint16_t fade_step(uint16_t full_scale_time) {
+  uint32_t tick_time = (uint32_t) full_scale_time * 1000UL;
+  uint32_t step = (((uint32_t) 0xFF << 8) * FADE_TICK_US + tick_time / 2) / tick_time;
+  if (step == 0) {
+    return 1;
+  }
+  return step > 0xFF00 ? 0xFF00 : step;
+}
+
+void fade_start(uint8_t index, uint8_t from, uint8_t target, uint16_t full_scale_time) {
+  fade_t *fade = &fades[index];
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    fade->value = (uint16_t) from << 8;
+    fade->target = target;
+    fade->step = fade_step(full_scale_time);
+    fade->active = from != target;
+  }
+}
+
+void fade_stop(uint8_t index) {
+  fades[index].active = 0;
+}
+
+uint8_t fade_is_active(uint8_t index) {
+  return fades[index].active;
+}
+
+void fade_tick() {
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    fade_t *fade = &fades[i];
+    if (!fade->active) {
+      continue;
+    }
+    uint16_t target = (uint16_t) fade->target << 8;
+    uint8_t previous = fade->value >> 8;
+    if (fade->value < target) {
+      fade->value = target - fade->value <= fade->step ? target : fade->value + fade->step;
+    } else {
+      fade->value = fade->value - target <= fade->step ? target : fade->value - fade->step;
+    }
+    if (fade->value == target) {
+      fade->active = 0;
+    }
+    if ((fade->value >> 8) != previous) {
+      fade_output(i, fade->value >> 8);
+    }
+  }
+}
+
+#ifdef __AVR__
+ISR(TIMER0_COMPA_vect) {
+  fade_tick();
+}
+
+void fade_timer_begin() {
+  OCR0A = 0x80;
+  TIMSK0 |= _BV(OCIE0A);
+}
+#else
+void fade_timer_begin() {
+  fade_host_timer_attach(fade_tick, FADE_TICK_US);
+}
+#endif
@@ -0,0 +1,61 @@
+#ifndef FADE_h
+#define FADE_h
+
+#include <stdint.h>
+#include <homectrl.h>
+
+/**
+ * Fade engine driven by a hardware timer tick.
+ *
+ * Every tick each active fade moves its 8.8 fixed point value one step
+ * towards the target, independent of how long the main loop takes. The
+ * step is derived from the full-scale fade time so all fades of a pin dim
+ * at the same constant rate.
+ *
+ * On AVR the tick is the TIMER0 compare A interrupt: Timer0 already runs
+ * for millis() and the compare match fires once per timer period whatever
+ * the PWM duty on OC0A is. Host builds hand the tick to
+ * fade_host_timer_attach() instead.
+ */
+
+#ifdef __AVR__
+#define FADE_TICK_US ((64UL * 256UL * 1000UL) / (F_CPU / 1000UL))
+#else
+#define FADE_TICK_US 1000UL
+#endif
+
+// fade_time holding register unit, 0 selects FADE_DEFAULT_TIME
+#define FADE_TIME_UNIT 100
+#define FADE_DEFAULT_TIME 1500
+
+typedef struct {
+  volatile uint8_t active;
+  uint8_t target;
+  uint16_t value;
+  uint16_t step;
+} fade_t;
+
+extern fade_t fades[];
+
+/**
+ * Called from the tick for every changed output value. Implemented by the
+ * firmware, it runs in interrupt context.
+ */
+void fade_output(uint8_t index, uint8_t value);
+
+uint16_t fade_step(uint16_t full_scale_time);
+void fade_start(uint8_t index, uint8_t from, uint8_t target, uint16_t full_scale_time);
+void fade_stop(uint8_t index);
+uint8_t fade_is_active(uint8_t index);
+void fade_tick();
+void fade_timer_begin();
+
+#ifndef __AVR__
+/**
+ * Runs tick every period_us on hosts without TIMER0. Implemented by the
+ * host platform, lib/ArduinoMock runs it as an emulated timer interrupt.
+ */
+void fade_host_timer_attach(void (*tick)(), unsigned long period_us);
+#endif
+
+#endif
@@ -5,10 +5,13 @@
 #include <stdlib.h>
 #include <stdint.h>
 
-#include <MultiButton.h>
 #include <ModbusSlave.h>
+#include <board.h>
 
-#define MAGIC 0x43
+// settings images with a crc, see config.h
+#define MAGIC 0x44
+// images from before the crc, adopted once at boot
+#define MAGIC_WITHOUT_CRC 0x43
 #define SETTINGS_OFFSET 0
 #define DEFAULT_SLAVE_ID 1
 #define BAUD_RATE 19200
@@ -19,9 +22,23 @@
 #define DIGITAL_PIN_MODE_INPUT 0x0
 #define DIGITAL_PIN_MODE_OUTPUT 0x1
 #define DIGITAL_PIN_MODE_INPUT_PULLUP 0x2
+// read by the ADC, only on pins with an analog input, see analog.h
+#define DIGITAL_PIN_MODE_ANALOG 0x3
 #define DIGITAL_PIN_BUTTON_MASK 0x04
 #define DIGITAL_PIN_INVERSE_MASK 0x08
 #define DIGITAL_PIN_PWM_MASK 0x10
+#define DIGITAL_PIN_CAPTURE_MASK 0x20
+
+// auto_off_time: bits 0 - 6 count, bit 7 selects minutes instead of seconds
+#define AUTO_OFF_TIME_MASK 0x7F
+#define AUTO_OFF_TIME_MINUTES 0x80
+// a new on command restarts a running auto off timer
+#define TIMER_OPTION_RETRIGGER 0x01
+// the output blinks off once TIMER_WARN_TIME before it switches off
+#define TIMER_OPTION_WARN 0x02
+// PWM outputs fade off instead of switching off
+#define TIMER_OPTION_FADE_OFF 0x04
+#define TIMER_OPTION_MASK 0x07
 
 #define COMMAND_NONE 0x00
 #define COMMAND_OFF 0x01
@@ -34,8 +51,26 @@
 #define COMMAND_FADE_TOGGLE 0x08
 #define COMMAND_TRIGGER_PWM_UP_DOWN_START 0x09
 #define COMMAND_TRIGGER_PWM_UP_DOWN_STOP 0x0a
+// COMMAND_SCENE_RECALL + k recalls scene k, see scene.h
+#define COMMAND_SCENE_RECALL 0x10
 
-#define NR_OF_DIGITAL_PINS 12
+#define SCENE_COUNT 8
+
+#define NR_OF_DIGITAL_PINS BOARD_PIN_COUNT
+
+// bit k of group_mask makes an output member of group k + 1
+#define GROUP_MASK_GROUPS 8
+#define MAX_GROUPS (NR_OF_DIGITAL_PINS + GROUP_MASK_GROUPS)
+
+#if NR_OF_DIGITAL_PINS <= 8
+typedef uint8_t pin_mask_t;
+#elif NR_OF_DIGITAL_PINS <= 16
+typedef uint16_t pin_mask_t;
+#elif NR_OF_DIGITAL_PINS <= 32
+typedef uint32_t pin_mask_t;
+#else
+typedef uint64_t pin_mask_t;
+#endif
 
 
 typedef struct __attribute__((__packed__)) {
@@ -50,35 +85,47 @@ typedef struct __attribute__((__packed__)) {
   uint8_t signal_fall_command;
   uint8_t release_command;
   uint8_t pwm_on_value;
-  uint8_t reserved[5];
+  uint8_t group_mask;
+  union {
+    uint8_t fade_time;
+    // analog inputs: signal_rise_command fires at this level, see analog.h
+    uint8_t analog_rise_level;
+  };
+  uint8_t dimming_curve;
+  union {
+    uint8_t auto_off_time;
+    // analog inputs: signal_fall_command fires below this level
+    uint8_t analog_fall_level;
+  };
+  uint8_t timer_options;
 } digital_pin_setting_t;
 
 typedef struct __attribute__((__packed__)) {
   uint8_t magic;
   uint8_t slave_id;
-  uint8_t reserved[6];
+  // serial link the node runs and the one it switches to, see link.h
+  uint8_t link_config;
+  uint8_t link_config_next;
+  uint16_t crc;
+  uint8_t reserved[2];
 } settings_t;
 
 typedef struct {
-  uint16_t click_cnt;
-  uint16_t single_click_cnt;
-  uint16_t double_click_cnt;
-  uint16_t long_press_cnt;
-  uint16_t release_cnt;
+  uint32_t click_cnt;
+  uint32_t single_click_cnt;
+  uint32_t double_click_cnt;
+  uint32_t long_press_cnt;
+  uint32_t release_cnt;
 } digital_pin_counters_t;
 
 enum output_state {
   OUTPUT_STATE_INIT=0,
   OUTPUT_STATE_IDLE,
   OUTPUT_STATE_FADE_TO_ON,
-  OUTPUT_STATE_FADE_TO_ON_WAIT,
   OUTPUT_STATE_FADE_TO_OFF,
-  OUTPUT_STATE_FADE_TO_OFF_WAIT,
   OUTPUT_STATE_PWM_UP,
-  OUTPUT_STATE_PWM_UP_WAIT,
   OUTPUT_STATE_PWM_UP_DOWN_IDLE,
   OUTPUT_STATE_PWM_DOWN,
-  OUTPUT_STATE_PWM_DOWN_WAIT,
 };
 
 struct output_pin_state {
@@ -86,6 +133,11 @@ struct output_pin_state {
   unsigned long last_update;
 };
 
+typedef struct {
+  uint8_t group;
+  pin_mask_t members;
+} group_index_t;
+
 typedef struct {
   uint8_t index;
   uint8_t pin_number;
@@ -95,20 +147,48 @@ typedef struct {
   struct output_pin_state *output_state;
 } digital_pin_context_t;
 
+inline uint16_t pin_setting_start_address(uint8_t index) {
+  return SETTINGS_OFFSET + sizeof(settings_t) + index* sizeof(digital_pin_setting_t);
+}
+
+extern Modbus slave;
 extern const uint8_t digital_pins_numbers[];
 extern digital_pin_counters_t counters[];
-extern MultiButton buttons[];
 extern uint8_t current_values[];
 extern struct output_pin_state output_states[];
+extern settings_t node_settings;
+extern digital_pin_setting_t digital_pin_settings[];
+extern uint8_t active_outputs[];
+extern uint8_t active_output_count;
 
 
 void handle_click(digital_pin_context_t *pin_ctx);
-
-uint8_t read_setting(uint8_t index);
-uint8_t write_setting(uint8_t index, uint8_t value);
+void handle_release(digital_pin_context_t *pin_ctx);
+uint8_t recall_scene(uint8_t index);
+uint8_t capture_scene(uint8_t index);
+void loop_digital_pins();
+void update_output(digital_pin_context_t *ctx, uint8_t command);
+void build_group_index();
+void build_input_masks();
+void build_active_outputs();
+pin_mask_t group_members(uint8_t group);
+void init_digital_pin_context(uint8_t index, digital_pin_context_t *ctx);
+
+uint8_t cb_read_coil(uint8_t fc, uint16_t address, uint16_t length);
+uint8_t cb_write_coil(uint8_t fc, uint16_t address, uint16_t length);
+uint8_t cb_read_input_register(uint8_t fc, uint16_t address, uint16_t length);
+uint8_t cb_read_holding_register(uint8_t fc, uint16_t address, uint16_t length);
+uint8_t cb_write_holding_register(uint8_t fc, uint16_t address, uint16_t length);
+
+uint8_t read_setting(uint16_t index);
+uint8_t write_setting(uint16_t index, uint8_t value);
 uint16_t read_single_input_register(uint16_t address);
 void write_digital_pin_settings_to_eeprom(uint8_t index, const digital_pin_setting_t &setting);
 void read_digital_pin_settings_from_eeprom(uint8_t index, digital_pin_setting_t &setting);
+void load_settings();
+void load_default_settings();
+void store_settings_crc();
+void load_digital_pin_settings();
 void read_settings_from_eeprom(settings_t &settings);
 void write_settings_to_eeprom(const settings_t &settings); 
 #endif
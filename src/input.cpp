@@ -0,0 +1,132 @@
+#include "Arduino.h"
+#include <homectrl.h>
+#include <input.h>
+
+#ifdef __AVR__
+#define INPUT_MAX_PORTS BOARD_PORTS
+
+static volatile uint8_t *input_ports[INPUT_MAX_PORTS];
+static uint8_t input_port_count;
+static uint8_t input_pin_port[NR_OF_DIGITAL_PINS];
+static uint8_t input_pin_bit[NR_OF_DIGITAL_PINS];
+
+/**
+ * Resolves the port and bit of every pin once, so a pass only reads each
+ * used PINx register a single time.
+ */
+void input_begin() {
+  input_port_count = 0;
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    volatile uint8_t *reg = portInputRegister(digitalPinToPort(digital_pins_numbers[i]));
+    uint8_t slot = 0;
+    while (slot < input_port_count && input_ports[slot] != reg) {
+      slot++;
+    }
+    if (slot == input_port_count) {
+      input_ports[input_port_count++] = reg;
+    }
+    input_pin_port[i] = slot;
+    input_pin_bit[i] = digitalPinToBitMask(digital_pins_numbers[i]);
+  }
+}
+
+pin_mask_t input_read_raw() {
+  uint8_t ports[INPUT_MAX_PORTS];
+  for (uint8_t slot = 0; slot < input_port_count; slot++) {
+    ports[slot] = *input_ports[slot];
+  }
+  pin_mask_t raw = 0;
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    if (ports[input_pin_port[i]] & input_pin_bit[i]) {
+      raw |= ((pin_mask_t) 1) << i;
+    }
+  }
+  return raw;
+}
+#else
+void input_begin() {
+}
+
+pin_mask_t input_read_raw() {
+  pin_mask_t raw = 0;
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    if (digitalRead(digital_pins_numbers[i])) {
+      raw |= ((pin_mask_t) 1) << i;
+    }
+  }
+  return raw;
+}
+#endif
+
+void debouncer_reset(debouncer_t *debouncer, pin_mask_t state) {
+  debouncer->state = state;
+  debouncer->ct0 = ~((pin_mask_t) 0);
+  debouncer->ct1 = ~((pin_mask_t) 0);
+}
+
+/**
+ * Returns the bits of the debounced state that flipped with this sample.
+ */
+pin_mask_t debouncer_sample(debouncer_t *debouncer, pin_mask_t raw) {
+  pin_mask_t delta = raw ^ debouncer->state;
+  debouncer->ct0 = ~(debouncer->ct0 & delta);
+  debouncer->ct1 = debouncer->ct0 ^ (debouncer->ct1 & delta);
+  pin_mask_t toggle = delta & debouncer->ct0 & debouncer->ct1;
+  debouncer->state ^= toggle;
+  return toggle;
+}
+
+static void button_transition(button_t *button, uint8_t state, uint16_t now) {
+  button->state = state;
+  button->last_transition = now;
+}
+
+/**
+ * Click detection on a debounced signal. Gives the same events as the
+ * MultiButton state machine minus its own debounce states.
+ */
+uint8_t button_update(button_t *button, uint8_t pressed, uint16_t now) {
+  uint16_t elapsed = now - button->last_transition;
+  switch (button->state) {
+  case BUTTON_STATE_IDLE:
+    if (pressed) {
+      button_transition(button, BUTTON_STATE_PRESSED, now);
+      return INPUT_EVENT_CLICK;
+    }
+    break;
+  case BUTTON_STATE_PRESSED:
+    if (!pressed) {
+      button_transition(button, BUTTON_STATE_CLICK_IDLE, now);
+      return INPUT_EVENT_RELEASE;
+    }
+    if (elapsed >= INPUT_LONGCLICK_DELAY) {
+      button_transition(button, BUTTON_STATE_LONG_CLICK, now);
+      return INPUT_EVENT_LONG_CLICK;
+    }
+    break;
+  case BUTTON_STATE_CLICK_IDLE:
+    if (pressed) {
+      button_transition(button, BUTTON_STATE_DOUBLE_CLICK, now);
+      return INPUT_EVENT_CLICK | INPUT_EVENT_DOUBLE_CLICK;
+    }
+    if (elapsed >= INPUT_SINGLECLICK_DELAY) {
+      button_transition(button, BUTTON_STATE_IDLE, now);
+      return INPUT_EVENT_SINGLE_CLICK;
+    }
+    break;
+  case BUTTON_STATE_DOUBLE_CLICK:
+  case BUTTON_STATE_LONG_CLICK:
+    if (!pressed) {
+      button_transition(button, BUTTON_STATE_IDLE, now);
+      return INPUT_EVENT_RELEASE;
+    }
+    break;
+  default:
+    break;
+  }
+  return 0;
+}
+
+uint8_t button_is_timed(const button_t *button) {
+  return button->state == BUTTON_STATE_PRESSED || button->state == BUTTON_STATE_CLICK_IDLE;
+}
@@ -0,0 +1,61 @@
+#ifndef INPUT_h
+#define INPUT_h
+
+#include <stdint.h>
+#include <homectrl.h>
+
+/**
+ * Input stage for all pins at once.
+ *
+ * The port input registers are read once per pass and packed into a
+ * pin_mask_t with bit i holding the level of digital_pins_numbers[i].
+ * Every INPUT_SAMPLE_INTERVAL the levels are debounced together with 2 bit
+ * vertical counters: a bit of the debounced state only flips after four
+ * consecutive samples disagree with it.
+ *
+ * The click detection of a button only runs when its debounced bit changed
+ * or while it waits for a click timeout.
+ */
+
+#define INPUT_SAMPLE_INTERVAL 5
+#define INPUT_SINGLECLICK_DELAY 250
+#define INPUT_LONGCLICK_DELAY 300
+
+#define INPUT_EVENT_CLICK 0x01
+#define INPUT_EVENT_SINGLE_CLICK 0x02
+#define INPUT_EVENT_DOUBLE_CLICK 0x04
+#define INPUT_EVENT_LONG_CLICK 0x08
+#define INPUT_EVENT_RELEASE 0x10
+
+enum button_state {
+  BUTTON_STATE_IDLE = 0,
+  BUTTON_STATE_PRESSED,
+  BUTTON_STATE_CLICK_IDLE,
+  BUTTON_STATE_DOUBLE_CLICK,
+  BUTTON_STATE_LONG_CLICK,
+};
+
+typedef struct {
+  uint8_t state;
+  uint16_t last_transition;
+} button_t;
+
+typedef struct {
+  pin_mask_t state;
+  pin_mask_t ct0;
+  pin_mask_t ct1;
+} debouncer_t;
+
+extern button_t buttons[];
+extern debouncer_t input_debouncer;
+
+void input_begin();
+pin_mask_t input_read_raw();
+
+void debouncer_reset(debouncer_t *debouncer, pin_mask_t state);
+pin_mask_t debouncer_sample(debouncer_t *debouncer, pin_mask_t raw);
+
+uint8_t button_update(button_t *button, uint8_t pressed, uint16_t now);
+uint8_t button_is_timed(const button_t *button);
+
+#endif
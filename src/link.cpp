@@ -0,0 +1,132 @@
+#include "Arduino.h"
+#include <avr/pgmspace.h>
+#include <homectrl.h>
+#include <link.h>
+
+// index 0 stays BAUD_RATE so erased or old settings keep the historic rate
+static const uint32_t link_baud_rates[] PROGMEM = {
+  BAUD_RATE, 9600, 38400, 57600, 76800, 115200, 250000,
+};
+#define LINK_BAUD_RATES (sizeof(link_baud_rates) / sizeof(link_baud_rates[0]))
+
+static uint8_t active_config = LINK_DEFAULT_CONFIG;
+static uint8_t trial;
+static uint8_t apply_requested;
+static unsigned long trial_start;
+
+uint16_t link_baud_error(uint32_t baud, uint32_t clock) {
+  // the double speed divisor HardwareSerial::begin() picks
+  uint32_t ubrr = (clock / 4 / baud - 1) / 2;
+  uint32_t actual = clock / 8 / (ubrr + 1);
+  uint32_t error = actual > baud ? actual - baud : baud - actual;
+  return (error * 1000 + baud / 2) / baud;
+}
+
+uint32_t link_baud(uint8_t config) {
+  return pgm_read_dword(&link_baud_rates[config & LINK_BAUD_MASK]);
+}
+
+uint8_t link_validate(uint8_t config) {
+  if ((config & ~(LINK_BAUD_MASK | LINK_PARITY_MASK)) != 0 ||
+      (config & LINK_BAUD_MASK) >= LINK_BAUD_RATES ||
+      (config >> LINK_PARITY_SHIFT) > LINK_PARITY_ODD) {
+    return 0;
+  }
+#ifdef F_CPU
+  return link_baud_error(link_baud(config), F_CPU) <= LINK_MAX_BAUD_ERROR;
+#else
+  // host serial ports run any rate
+  return 1;
+#endif
+}
+
+static uint8_t serial_config(uint8_t config) {
+  switch (config >> LINK_PARITY_SHIFT) {
+  case LINK_PARITY_EVEN:
+    return SERIAL_8E1;
+  case LINK_PARITY_ODD:
+    return SERIAL_8O1;
+  default:
+    return SERIAL_8N1;
+  }
+}
+
+void link_timing(uint8_t config, link_timing_t *timing) {
+  uint32_t baud = link_baud(config);
+  uint8_t bits = (config >> LINK_PARITY_SHIFT) == LINK_PARITY_NONE ? 10 : 11;
+  timing->char_us = (bits * 1000000UL + baud - 1) / baud;
+  timing->t35_us = baud > 19200 ? 1750 : (35UL * bits * 100000UL + baud - 1) / baud;
+  timing->turnaround_us = timing->t35_us + timing->char_us;
+}
+
+static void begin(uint8_t config) {
+  uint32_t baud = link_baud(config);
+  Serial.begin(baud, serial_config(config));
+  slave.begin(baud);
+  active_config = config;
+}
+
+static void start_trial(uint8_t config) {
+  trial = 1;
+  trial_start = millis();
+  begin(config);
+}
+
+void link_setup() {
+  uint8_t config = link_validate(node_settings.link_config) ? node_settings.link_config : LINK_DEFAULT_CONFIG;
+  uint8_t next = node_settings.link_config_next;
+  trial = 0;
+  apply_requested = 0;
+  if (link_validate(next) && next != config) {
+    start_trial(next);
+  } else {
+    begin(config);
+  }
+}
+
+void link_request_apply() {
+  apply_requested = 1;
+}
+
+uint8_t link_confirm() {
+  if (!trial) {
+    return 0;
+  }
+  trial = 0;
+  settings_t settings = node_settings;
+  settings.link_config = active_config;
+  settings.link_config_next = active_config;
+  write_settings_to_eeprom(settings);
+  return 1;
+}
+
+uint8_t link_trial_active() {
+  return trial;
+}
+
+uint8_t link_active_config() {
+  return active_config;
+}
+
+void link_loop() {
+  if (apply_requested) {
+    apply_requested = 0;
+    uint8_t next = node_settings.link_config_next;
+    if (link_validate(next) && next != active_config) {
+      // the acknowledgement still goes out on the old link
+      Serial.flush();
+      start_trial(next);
+    }
+  }
+  if (trial && millis() - trial_start >= LINK_TRIAL_TIMEOUT) {
+    trial = 0;
+    settings_t settings = node_settings;
+    if (!link_validate(settings.link_config)) {
+      settings.link_config = LINK_DEFAULT_CONFIG;
+    }
+    settings.link_config_next = settings.link_config;
+    write_settings_to_eeprom(settings);
+    Serial.flush();
+    begin(settings.link_config);
+  }
+}
@@ -0,0 +1,76 @@
+#ifndef LINK_h
+#define LINK_h
+
+#include <stdint.h>
+#include <homectrl.h>
+
+/**
+ * Serial link configuration.
+ *
+ * A link config byte holds a baud rate index in bits 0 - 3 and a
+ * LINK_PARITY_* in bits 4 - 5. Config 0 is the historic BAUD_RATE, 8N1.
+ *
+ * settings_t holds the config the node runs (link_config) and the one a
+ * master asked for (link_config_next). A different link_config_next is
+ * tried on the next boot or after a write to the link apply register,
+ * once the response to that write has left the wire. The trial only
+ * becomes the new link_config when the master confirms it within
+ * LINK_TRIAL_TIMEOUT over the new link; otherwise the node reverts to
+ * link_config and forgets the request, so a bad setting never locks a
+ * node off the bus.
+ *
+ * link_timing() computes the RTU figures of a link for the firmware and
+ * for masters reading them from the input registers. DiagStream applies
+ * them: it splits the frames on the t3.5 silence and holds the first byte
+ * of a response back until t3.5 has passed since the end of the request.
+ * The slave flushes the response before releasing RS485_CTRL_PIN.
+ *
+ * The USART divides F_CPU by 8 * (UBRR + 1), so not every rate is met.
+ * Rates more than LINK_MAX_BAUD_ERROR permille off fail validation: on the
+ * 8 MHz pro mini 115200 baud (-3.5 %). 57600 baud is 2.1 % fast there and
+ * passes, but leaves the master little margin; 76800 and 250000 are close
+ * to exact on 8 and 16 MHz.
+ */
+
+#define LINK_BAUD_MASK 0x0F
+#define LINK_PARITY_SHIFT 4
+#define LINK_PARITY_MASK 0x30
+#define LINK_PARITY_NONE 0
+#define LINK_PARITY_EVEN 1
+#define LINK_PARITY_ODD 2
+
+#define LINK_CONFIG(baud_index, parity) ((baud_index) | ((parity) << LINK_PARITY_SHIFT))
+#define LINK_DEFAULT_CONFIG LINK_CONFIG(0, LINK_PARITY_NONE)
+
+#define LINK_TRIAL_TIMEOUT 30000UL
+#define LINK_MAX_BAUD_ERROR 25
+
+typedef struct {
+  // one character including start, parity and stop bits
+  uint16_t char_us;
+  // RTU inter frame silence, 3.5 characters, fixed above 19200 baud
+  uint16_t t35_us;
+  // from the end of a request to the first response byte the master can
+  // receive: the t3.5 silence plus one character to release its driver
+  uint16_t turnaround_us;
+} link_timing_t;
+
+/**
+ * Returns how far the USART at clock misses baud, in permille.
+ */
+uint16_t link_baud_error(uint32_t baud, uint32_t clock);
+uint8_t link_validate(uint8_t config);
+uint32_t link_baud(uint8_t config);
+void link_timing(uint8_t config, link_timing_t *timing);
+
+/**
+ * Starts the link from node_settings at boot.
+ */
+void link_setup();
+void link_request_apply();
+uint8_t link_confirm();
+uint8_t link_trial_active();
+uint8_t link_active_config();
+void link_loop();
+
+#endif
@@ -1,12 +1,26 @@
 #include "Arduino.h"
 #include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include <EEPROM.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <homectrl.h>
-#include <MultiButton.h>
-
-#define FADE_SPEED 5
+#include <persist.h>
+#include <fade.h>
+#include <dimming.h>
+#include <input.h>
+#include <capture.h>
+#include <profile.h>
+#include <regmap.h>
+#include <events.h>
+#include <scene.h>
+#include <timer.h>
+#include <softpwm.h>
+#include <link.h>
+#include <config.h>
+#include <diag.h>
+#include <analog.h>
 
 #define DEBUG
 #ifdef DEBUG
@@ -19,34 +33,175 @@
  #define DEBUG_PRINTLN(x)
 #endif 
 
-Modbus slave(Serial, DEFAULT_SLAVE_ID, RS485_CTRL_PIN);
+// diag_serial counts the frames and answers the Diagnostics function
+Modbus slave(diag_serial, DEFAULT_SLAVE_ID, RS485_CTRL_PIN);
 
-const uint8_t digital_pins_numbers[NR_OF_DIGITAL_PINS] =
-  {10, 11, 12, 13, 14, 15, 16, 17, 9, 6, 5, 3};
+// the whole profile table, channels use the first NR_OF_DIGITAL_PINS
+const uint8_t digital_pins_numbers[BOARD_MAX_PINS] = {BOARD_PINS};
 
 digital_pin_counters_t counters[NR_OF_DIGITAL_PINS];
-MultiButton buttons[NR_OF_DIGITAL_PINS];
+button_t buttons[NR_OF_DIGITAL_PINS];
+debouncer_t input_debouncer;
+pin_mask_t input_levels;
+pin_mask_t button_pins;
+pin_mask_t signal_pins;
+pin_mask_t captured_pins;
+pin_mask_t analog_pins;
+// pins last handed to capture_begin() and analog_begin()
+static pin_mask_t capture_requested_pins;
+static pin_mask_t analog_requested_pins;
+// analog pins whose threshold state was set by a first value
+pin_mask_t analog_primed;
+pin_mask_t timed_buttons;
+unsigned long last_input_sample;
 uint8_t current_values[NR_OF_DIGITAL_PINS];
 struct output_pin_state output_states[NR_OF_DIGITAL_PINS];
+uint8_t active_outputs[NR_OF_DIGITAL_PINS];
+uint8_t active_output_count;
+settings_t node_settings;
+digital_pin_setting_t digital_pin_settings[NR_OF_DIGITAL_PINS];
+group_index_t group_index[MAX_GROUPS];
+uint8_t group_index_size;
+
+// EEPROM layout: settings, pin settings, scenes and the persist journal
+static_assert(E2END + 1 == BOARD_EEPROM_SIZE, "board profile does not match the EEPROM");
+static_assert(JOURNAL_ENTRIES >= 2 * NR_OF_DIGITAL_PINS, "settings and scenes leave too little room for the journal");
 
 void read_settings_from_eeprom(settings_t &settings) {
   EEPROM.get(SETTINGS_OFFSET, settings);
 }
 
 void write_settings_to_eeprom(const settings_t &settings) {
-  EEPROM.put(SETTINGS_OFFSET, settings);
+  node_settings = settings;
+  node_settings.crc = config_crc(&node_settings, digital_pin_settings);
+  if (config_store_pending()) {
+    // the background pass writes the crc once the image is complete
+    config_store();
+    return;
+  }
+  unsigned long start = micros();
+  EEPROM.put(SETTINGS_OFFSET, node_settings);
+  profile_record(PROFILE_EEPROM_WRITE, micros() - start);
 }
 
-inline uint8_t pin_setting_start_address(uint8_t index) {
-  return SETTINGS_OFFSET + sizeof(settings_t) + index* sizeof(digital_pin_setting_t);
+/**
+ * Updates the crc after a single setting was written to the EEPROM. Part
+ * of the caller's profiled write.
+ */
+void store_settings_crc() {
+  node_settings.crc = config_crc(&node_settings, digital_pin_settings);
+  if (config_store_pending()) {
+    config_store();
+    return;
+  }
+  EEPROM.put(SETTINGS_OFFSET + offsetof(settings_t, crc), node_settings.crc);
 }
 
 void read_digital_pin_settings_from_eeprom(uint8_t index, digital_pin_setting_t &setting) {
   EEPROM.get(pin_setting_start_address(index), setting);
 }
 
+/**
+ * Writes the pin setting to EEPROM and keeps the RAM copy in
+ * digital_pin_settings in sync.
+ */
 void write_digital_pin_settings_to_eeprom(uint8_t index, const digital_pin_setting_t &setting) {
+  digital_pin_settings[index] = setting;
+  unsigned long start = micros();
   EEPROM.put(pin_setting_start_address(index), setting);
+  store_settings_crc();
+  profile_record(PROFILE_EEPROM_WRITE, micros() - start);
+  // older journal entries would override the record at boot
+  persist_mark_dirty(index);
+  build_group_index();
+  build_input_masks();
+  build_active_outputs();
+}
+
+/**
+ * Writes the RAM copy of every pin setting to the EEPROM, only the bytes
+ * that differ are written.
+ */
+static void put_digital_pin_settings() {
+  unsigned long start = micros();
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    EEPROM.put(pin_setting_start_address(i), digital_pin_settings[i]);
+  }
+  profile_record(PROFILE_EEPROM_WRITE, micros() - start);
+}
+
+/**
+ * Writes the default settings: default slave id and link, every pin an
+ * input without commands.
+ */
+void load_default_settings() {
+  settings_t settings;
+  memset(&settings, 0, sizeof(settings));
+  settings.magic = MAGIC;
+  settings.slave_id = DEFAULT_SLAVE_ID;
+  settings.link_config = LINK_DEFAULT_CONFIG;
+  settings.link_config_next = LINK_DEFAULT_CONFIG;
+  memset(digital_pin_settings, 0, sizeof(digital_pin_settings));
+  put_digital_pin_settings();
+  write_settings_to_eeprom(settings);
+}
+
+/**
+ * Loads the node and pin settings. An image from before the crc is
+ * adopted together with the erased bytes load_digital_pin_settings()
+ * patched, the crc covers those and later single byte writes keep it
+ * only if the EEPROM holds them too. Any other image with a bad magic or
+ * crc is replaced by the defaults. Firmware with an older magic kept the persist journal where
+ * the scenes are now, its bytes must not pass for stored scenes.
+ */
+void load_settings() {
+  read_settings_from_eeprom(node_settings);
+  load_digital_pin_settings();
+  if (node_settings.magic != MAGIC) {
+    scene_forget_all();
+  }
+  if (node_settings.magic == MAGIC_WITHOUT_CRC) {
+    node_settings.magic = MAGIC;
+    put_digital_pin_settings();
+    write_settings_to_eeprom(node_settings);
+  } else if (node_settings.magic != MAGIC ||
+             node_settings.crc != config_crc(&node_settings, digital_pin_settings)) {
+    load_default_settings();
+  } else {
+    // a fix-up depends on the mode and the timer options, once they
+    // change the erased bytes would load differently
+    put_digital_pin_settings();
+  }
+}
+
+/**
+ * Loads all pin settings from EEPROM into digital_pin_settings. This is the
+ * only place the loop state is read from EEPROM, all other readers use the
+ * RAM copy.
+ */
+void load_digital_pin_settings() {
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    read_digital_pin_settings_from_eeprom(i, digital_pin_settings[i]);
+    // settings written before the timed commands hold erased bytes there
+    if (digital_pin_settings[i].timer_options & ~TIMER_OPTION_MASK) {
+      digital_pin_settings[i].timer_options = 0;
+      // the byte is the fall level of analog inputs, see analog.h
+      if (digital_pin_settings[i].auto_off_time == 0xFF &&
+          (digital_pin_settings[i].mode & DIGITAL_PIN_MODE_MASK) != DIGITAL_PIN_MODE_ANALOG) {
+        digital_pin_settings[i].auto_off_time = 0;
+      }
+    }
+    // erased before the group masks, it would join every group
+    if (digital_pin_settings[i].group_mask == 0xFF) {
+      digital_pin_settings[i].group_mask = 0;
+    }
+    // erased before the fade times, 0 selects FADE_DEFAULT_TIME. The byte
+    // is the rise level of analog inputs, see analog.h
+    if (digital_pin_settings[i].fade_time == 0xFF &&
+        (digital_pin_settings[i].mode & DIGITAL_PIN_MODE_MASK) != DIGITAL_PIN_MODE_ANALOG) {
+      digital_pin_settings[i].fade_time = 0;
+    }
+  }
 }
 
 uint8_t pin_mode(digital_pin_setting_t *setting) {
@@ -57,6 +212,18 @@ uint8_t is_output(digital_pin_setting_t *setting) {
   return pin_mode(setting)  == DIGITAL_PIN_MODE_OUTPUT;
 }
 
+uint8_t is_analog(digital_pin_setting_t *setting) {
+  return pin_mode(setting) == DIGITAL_PIN_MODE_ANALOG;
+}
+
+/**
+ * Returns the pinMode() of a mode setting, analog inputs have no pullup.
+ */
+uint8_t arduino_pin_mode(uint8_t mode) {
+  mode &= DIGITAL_PIN_MODE_MASK;
+  return mode == DIGITAL_PIN_MODE_ANALOG ? INPUT : mode;
+}
+
 uint8_t has_pwm(digital_pin_setting_t *setting) {
   return setting->mode & DIGITAL_PIN_PWM_MASK;
 }
@@ -65,21 +232,61 @@ uint8_t has_button(digital_pin_setting_t *setting) {
   return (setting->mode & DIGITAL_PIN_BUTTON_MASK) > 0;
 }
 
-void set_pin_output(digital_pin_context_t *ctx, uint8_t value) {
-  *ctx->current_value = value;
+uint8_t has_capture(digital_pin_setting_t *setting) {
+  return (setting->mode & DIGITAL_PIN_CAPTURE_MASK) > 0;
+}
+
+/**
+ * Drives the pin without touching current_value, see set_pin_output().
+ */
+void write_pin_output(digital_pin_context_t *ctx, uint8_t value) {
   if (has_pwm(&ctx->settings)) {
-    analogWrite(ctx->pin_number, value);
+    // the fade tick calls analogWrite on the same timers
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      dimming_write(ctx->pin_number, ctx->settings.dimming_curve, value);
+    }
   } else {
     digitalWrite(ctx->pin_number, value);
   }
 }
 
+void set_pin_output(digital_pin_context_t *ctx, uint8_t value) {
+  *ctx->current_value = value;
+  write_pin_output(ctx, value);
+}
+
+void fade_output(uint8_t index, uint8_t value) {
+  current_values[index] = value;
+  dimming_write(digital_pins_numbers[index], digital_pin_settings[index].dimming_curve, value);
+}
+
+uint16_t fade_time(digital_pin_context_t *ctx) {
+  if (ctx->settings.fade_time == 0) {
+    return FADE_DEFAULT_TIME;
+  }
+  return ctx->settings.fade_time * FADE_TIME_UNIT;
+}
+
+void start_fade(digital_pin_context_t *ctx, uint8_t target) {
+  fade_start(ctx->index, *ctx->current_value, target, fade_time(ctx));
+}
+
 enum output_state handle_output_init_state(digital_pin_context_t *ctx, uint8_t command) {
   uint8_t output = ctx->settings.output_value;
   set_pin_output(ctx, output);
   return OUTPUT_STATE_IDLE;
 }
 
+/**
+ * Updates the output value in the settings cache. The EEPROM copy is
+ * written later by the persist journal.
+ */
+void save_output_value(digital_pin_context_t *ctx, uint8_t value) {
+  ctx->settings.output_value = value;
+  digital_pin_settings[ctx->index].output_value = value;
+  persist_mark_dirty(ctx->index);
+}
+
 enum output_state handle_output_idle_state(digital_pin_context_t *ctx, uint8_t command) {
   uint8_t pwm = has_pwm(&ctx->settings);
   uint8_t on_value = pwm ? ctx->settings.pwm_on_value : 0x1;
@@ -109,25 +316,30 @@ enum output_state handle_output_idle_state(digital_pin_context_t *ctx, uint8_t c
     break;
   case COMMAND_FADE_TO_ON:
     if (pwm) {
+      start_fade(ctx, on_value);
       new_state = OUTPUT_STATE_FADE_TO_ON;
     }
     break;
   case COMMAND_FADE_TO_OFF:
     if (pwm) {
+      start_fade(ctx, 0x00);
       new_state = OUTPUT_STATE_FADE_TO_OFF;
     }
     break;
   case COMMAND_FADE_TOGGLE:
     if (pwm) {
       if( *ctx->current_value > 0) {
+        start_fade(ctx, 0x00);
         new_state = OUTPUT_STATE_FADE_TO_OFF;
       } else {
+        start_fade(ctx, on_value);
         new_state = OUTPUT_STATE_FADE_TO_ON;
       }
     }
     break;
   case COMMAND_TRIGGER_PWM_UP_DOWN_START:
     if (pwm) {
+      start_fade(ctx, 0xFF);
       new_state = OUTPUT_STATE_PWM_UP;
     }
     break;
@@ -136,115 +348,60 @@ enum output_state handle_output_idle_state(digital_pin_context_t *ctx, uint8_t c
   }
   if (new_value != *ctx->current_value) {
     set_pin_output(ctx, new_value);
+    events_push(ctx->index, EVENT_OUTPUT_VALUE, new_value);
   }
   if (ctx->settings.output_value != new_value) {
-    ctx->settings.output_value = new_value;
-    write_digital_pin_settings_to_eeprom(ctx->index, ctx->settings);
+    save_output_value(ctx, new_value);
   }
   return new_state;
 }
 
 void save_pwm_on_value(digital_pin_context_t *ctx) {
   ctx->settings.pwm_on_value = *ctx->current_value;
-  write_digital_pin_settings_to_eeprom(ctx->index, ctx->settings);
-}
-
-enum output_state handle_output_fade_to_on(digital_pin_context_t *ctx, uint8_t command) {
-  uint8_t on_value = ctx->settings.pwm_on_value;
-  if (*ctx->current_value >= on_value) {
-    return OUTPUT_STATE_IDLE;
-  }
-  uint8_t new_value = (*ctx->current_value) + 1;
-  set_pin_output(ctx, new_value);
-  return OUTPUT_STATE_FADE_TO_ON_WAIT;
+  digital_pin_settings[ctx->index].pwm_on_value = *ctx->current_value;
+  persist_mark_dirty(ctx->index);
 }
 
 inline unsigned long millis_since_last_state_change(digital_pin_context_t *ctx) {
   return millis()-ctx->output_state->last_update;
 }
 
-enum output_state handle_output_fade_to_on_wait(digital_pin_context_t *ctx,
-                                      uint8_t command) {
-  unsigned long diff = millis_since_last_state_change(ctx);
-  if (diff > FADE_SPEED) {
-    return OUTPUT_STATE_FADE_TO_ON;
-  } else {
-    return OUTPUT_STATE_FADE_TO_ON_WAIT;
+enum output_state handle_output_fade_to_on(digital_pin_context_t *ctx, uint8_t command) {
+  if (!fade_is_active(ctx->index)) {
+    return OUTPUT_STATE_IDLE;
   }
+  return OUTPUT_STATE_FADE_TO_ON;
 }
 
 enum output_state handle_output_fade_to_off(digital_pin_context_t *ctx, uint8_t command) {
-  if (*ctx->current_value == 0x00) {
+  if (!fade_is_active(ctx->index)) {
     return OUTPUT_STATE_IDLE;
   }
-  uint8_t new_value = (*ctx->current_value) - 1;
-  set_pin_output(ctx, new_value);
-  return OUTPUT_STATE_FADE_TO_OFF_WAIT;
-}
-
-enum output_state handle_output_fade_to_off_wait(digital_pin_context_t *ctx,
-                                      uint8_t command) {
-  unsigned long diff = millis_since_last_state_change(ctx);
-  if (diff > FADE_SPEED) {
-    return OUTPUT_STATE_FADE_TO_OFF;
-  } else {
-    return OUTPUT_STATE_FADE_TO_OFF_WAIT;
-  }
+  return OUTPUT_STATE_FADE_TO_OFF;
 }
 
 enum output_state handle_output_pwm_up(digital_pin_context_t *ctx, uint8_t command) {
   if (command == COMMAND_TRIGGER_PWM_UP_DOWN_STOP) {
+    fade_stop(ctx->index);
     return OUTPUT_STATE_PWM_UP_DOWN_IDLE;
   }
-  if (*ctx->current_value < 0xFF) {
-    uint8_t new_value = (*ctx->current_value) + 1;
-    set_pin_output(ctx, new_value);
-  }
-  return OUTPUT_STATE_PWM_UP_WAIT;
-}
-
-enum output_state handle_output_pwm_up_wait(digital_pin_context_t *ctx, uint8_t command) {
-  if (command == COMMAND_TRIGGER_PWM_UP_DOWN_STOP) {
-    return OUTPUT_STATE_PWM_UP_DOWN_IDLE;
-  }
-  unsigned long diff = millis_since_last_state_change(ctx);
-  if (diff > FADE_SPEED) {
-    return OUTPUT_STATE_PWM_UP;
-  } else {
-    return OUTPUT_STATE_PWM_UP_WAIT;
-  }
+  return OUTPUT_STATE_PWM_UP;
 }
 
 enum output_state handle_output_pwm_down(digital_pin_context_t *ctx, uint8_t command) {
   if (command == COMMAND_TRIGGER_PWM_UP_DOWN_STOP) {
+    fade_stop(ctx->index);
     save_pwm_on_value(ctx);
     return OUTPUT_STATE_IDLE;
   }
-  if (*ctx->current_value > 0x01) {
-    uint8_t new_value = (*ctx->current_value) - 1;
-    set_pin_output(ctx, new_value);
-  }
-  return OUTPUT_STATE_PWM_DOWN_WAIT;
-}
-
-enum output_state handle_output_pwm_down_wait(digital_pin_context_t *ctx,
-                                    uint8_t command) {
-  if (command == COMMAND_TRIGGER_PWM_UP_DOWN_STOP) {
-    save_pwm_on_value(ctx);
-    return OUTPUT_STATE_IDLE;
-  }
-  unsigned long diff = millis_since_last_state_change(ctx);
-  if (diff > FADE_SPEED) {
-    return OUTPUT_STATE_PWM_DOWN;
-  } else {
-    return OUTPUT_STATE_PWM_DOWN_WAIT;
-  }
+  return OUTPUT_STATE_PWM_DOWN;
 }
 
 #define UP_DOWN_TIMEOUT 2000
 enum output_state handle_output_pwm_up_down_idle(digital_pin_context_t *ctx,
                                        uint8_t command) {
   if (command == COMMAND_TRIGGER_PWM_UP_DOWN_START) {
+    start_fade(ctx, 0x01);
     return OUTPUT_STATE_PWM_DOWN;
   }
   unsigned long diff = millis_since_last_state_change(ctx);
@@ -256,54 +413,242 @@ enum output_state handle_output_pwm_up_down_idle(digital_pin_context_t *ctx,
   }
 }
 
-void update_output(digital_pin_context_t *ctx, uint8_t command) {
+typedef enum output_state (*output_state_handler_t)(digital_pin_context_t *ctx, uint8_t command);
+
+// indexed by enum output_state
+const output_state_handler_t output_state_handlers[] PROGMEM = {
+  handle_output_init_state,
+  handle_output_idle_state,
+  handle_output_fade_to_on,
+  handle_output_fade_to_off,
+  handle_output_pwm_up,
+  handle_output_pwm_up_down_idle,
+  handle_output_pwm_down,
+};
+static_assert(sizeof(output_state_handlers) / sizeof(output_state_handler_t) == OUTPUT_STATE_PWM_DOWN + 1,
+              "every output state needs a handler");
+
+void activate_output(uint8_t index) {
+  for (uint8_t i = 0; i < active_output_count; i++) {
+    if (active_outputs[i] == index) {
+      return;
+    }
+  }
+  active_outputs[active_output_count++] = index;
+}
+
+void deactivate_output(uint8_t index) {
+  for (uint8_t i = 0; i < active_output_count; i++) {
+    if (active_outputs[i] == index) {
+      active_outputs[i] = active_outputs[--active_output_count];
+      return;
+    }
+  }
+}
+
+/**
+ * Rebuilds the list of outputs that are not idle. Must be called whenever
+ * the mode of a pin changes.
+ */
+void build_active_outputs() {
+  active_output_count = 0;
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    if (is_output(&digital_pin_settings[i]) && output_states[i].state != OUTPUT_STATE_IDLE) {
+      active_outputs[active_output_count++] = i;
+    }
+  }
+}
+
+void enter_output_state(digital_pin_context_t *ctx, enum output_state next_state) {
   enum output_state current_state = ctx->output_state->state;
-  enum output_state next_state;
-  switch (current_state) {
-  case OUTPUT_STATE_INIT:
-    next_state = handle_output_init_state(ctx, command);
-    break;
-  case OUTPUT_STATE_IDLE:
-    next_state = handle_output_idle_state(ctx, command);
-    break;
-  case OUTPUT_STATE_FADE_TO_ON:
-    next_state = handle_output_fade_to_on(ctx, command);
-    break;
-  case OUTPUT_STATE_FADE_TO_ON_WAIT:
-    next_state = handle_output_fade_to_on_wait(ctx, command);
-    break;
+  if (current_state == next_state) {
+    return;
+  }
+  ctx->output_state->state = next_state;
+  ctx->output_state->last_update = millis();
+  if (next_state != OUTPUT_STATE_IDLE) {
+    events_push(ctx->index, EVENT_OUTPUT_STATE, next_state);
+    activate_output(ctx->index);
+    return;
+  }
+  deactivate_output(ctx->index);
+  if (current_state != OUTPUT_STATE_INIT) {
+    events_push(ctx->index, EVENT_OUTPUT_VALUE, *ctx->current_value);
+  }
+  if (ctx->settings.output_value != *ctx->current_value) {
+    save_output_value(ctx, *ctx->current_value);
+  }
+}
+
+/**
+ * Returns whether the output is on or on its way there.
+ */
+uint8_t output_is_on(digital_pin_context_t *ctx) {
+  switch (ctx->output_state->state) {
   case OUTPUT_STATE_FADE_TO_OFF:
-    next_state = handle_output_fade_to_off(ctx, command);
-    break;
-  case OUTPUT_STATE_FADE_TO_OFF_WAIT:
-    next_state = handle_output_fade_to_off_wait(ctx, command);
-    break;
+    return 0;
+  case OUTPUT_STATE_FADE_TO_ON:
   case OUTPUT_STATE_PWM_UP:
-    next_state = handle_output_pwm_up(ctx, command);
-    break;
-  case OUTPUT_STATE_PWM_UP_WAIT:
-    next_state = handle_output_pwm_up_wait(ctx, command);
+    return 1;
+  default:
+    return *ctx->current_value > 0;
+  }
+}
+
+/**
+ * Timed commands
+ *
+ * An output with a non zero auto_off_time switches itself off that long
+ * after it was switched on. With TIMER_OPTION_RETRIGGER a further
+ * COMMAND_ON or COMMAND_FADE_TO_ON restarts the delay, the usual
+ * staircase light behaviour. With TIMER_OPTION_WARN the output blinks off
+ * for TIMER_WARN_BLINK_TIME, TIMER_WARN_TIME before it switches off.
+ *
+ * Every output runs through at most one timer of the wheel in timer.h:
+ * TIMER_ACTION_WARN, then TIMER_ACTION_RESTORE, then TIMER_ACTION_OFF.
+ * A changed auto_off_time applies from the next on command.
+ */
+#define TIMER_WARN_TIME 10000
+#define TIMER_WARN_BLINK_TIME 500
+#define TIMER_WARN_TICKS (TIMER_WARN_TIME / TIMER_TICK_MS)
+#define TIMER_WARN_BLINK_TICKS (TIMER_WARN_BLINK_TIME / TIMER_TICK_MS)
+
+#define TIMER_ACTION_WARN 1
+#define TIMER_ACTION_RESTORE 2
+#define TIMER_ACTION_OFF 3
+
+uint32_t auto_off_ticks(uint8_t auto_off_time) {
+  uint32_t seconds = auto_off_time & AUTO_OFF_TIME_MASK;
+  if (auto_off_time & AUTO_OFF_TIME_MINUTES) {
+    seconds *= 60;
+  }
+  return seconds * (1000 / TIMER_TICK_MS);
+}
+
+/**
+ * Stops the timer of the output, ending a warning blink in progress.
+ */
+void cancel_output_timer(digital_pin_context_t *ctx) {
+  if (timer_action(ctx->index) == TIMER_ACTION_RESTORE) {
+    write_pin_output(ctx, *ctx->current_value);
+  }
+  timer_cancel(ctx->index);
+}
+
+void start_output_timer(digital_pin_context_t *ctx) {
+  uint32_t ticks = auto_off_ticks(ctx->settings.auto_off_time);
+  cancel_output_timer(ctx);
+  if ((ctx->settings.timer_options & TIMER_OPTION_WARN) && ticks > TIMER_WARN_TICKS) {
+    timer_start(ctx->index, TIMER_ACTION_WARN, ticks - TIMER_WARN_TICKS);
+  } else {
+    timer_start(ctx->index, TIMER_ACTION_OFF, ticks);
+  }
+}
+
+/**
+ * Starts, restarts or cancels the auto off timer after command moved the
+ * output from was_on to its current state.
+ */
+void update_output_timer(digital_pin_context_t *ctx, uint8_t was_on, uint8_t command) {
+  if (ctx->settings.auto_off_time == 0) {
+    return;
+  }
+  if (!output_is_on(ctx)) {
+    if (was_on) {
+      cancel_output_timer(ctx);
+    }
+    return;
+  }
+  if (!was_on ||
+      ((ctx->settings.timer_options & TIMER_OPTION_RETRIGGER) &&
+       (command == COMMAND_ON || command == COMMAND_FADE_TO_ON))) {
+    start_output_timer(ctx);
+  }
+}
+
+void update_output(digital_pin_context_t *ctx, uint8_t command) {
+  uint8_t was_on = output_is_on(ctx);
+  enum output_state current_state = ctx->output_state->state;
+  output_state_handler_t handler = (output_state_handler_t) pgm_read_ptr(&output_state_handlers[current_state]);
+  enter_output_state(ctx, handler(ctx, command));
+  if (command != COMMAND_NONE) {
+    update_output_timer(ctx, was_on, command);
+  }
+}
+
+/**
+ * Fades a PWM output to target from whatever state it is in.
+ */
+void fade_output_to(digital_pin_context_t *ctx, uint8_t target, uint8_t time) {
+  uint8_t was_on = output_is_on(ctx);
+  fade_stop(ctx->index);
+  if (target == *ctx->current_value) {
+    enter_output_state(ctx, OUTPUT_STATE_IDLE);
+  } else {
+    uint16_t full_scale_time = time == 0 ? FADE_DEFAULT_TIME : time * FADE_TIME_UNIT;
+    fade_start(ctx->index, *ctx->current_value, target, full_scale_time);
+    enter_output_state(ctx, target > *ctx->current_value ? OUTPUT_STATE_FADE_TO_ON : OUTPUT_STATE_FADE_TO_OFF);
+  }
+  update_output_timer(ctx, was_on, COMMAND_NONE);
+}
+
+void switch_output_off(digital_pin_context_t *ctx) {
+  if (has_pwm(&ctx->settings) && (ctx->settings.timer_options & TIMER_OPTION_FADE_OFF)) {
+    fade_output_to(ctx, 0, ctx->settings.fade_time);
+  } else if (ctx->output_state->state == OUTPUT_STATE_IDLE) {
+    update_output(ctx, COMMAND_OFF);
+  } else {
+    fade_stop(ctx->index);
+    set_pin_output(ctx, 0);
+    enter_output_state(ctx, OUTPUT_STATE_IDLE);
+  }
+}
+
+void timer_expired(uint8_t index, uint8_t action) {
+  digital_pin_context_t ctx;
+  init_digital_pin_context(index, &ctx);
+  if (!is_output(&ctx.settings)) {
+    return;
+  }
+  switch (action) {
+  case TIMER_ACTION_WARN:
+    // a fade in progress would overwrite the blink, skip it
+    if (ctx.output_state->state == OUTPUT_STATE_IDLE) {
+      write_pin_output(&ctx, 0);
+      timer_start(index, TIMER_ACTION_RESTORE, TIMER_WARN_BLINK_TICKS);
+    } else {
+      timer_start(index, TIMER_ACTION_OFF, TIMER_WARN_TICKS);
+    }
     break;
-  case OUTPUT_STATE_PWM_UP_DOWN_IDLE:
-    next_state = handle_output_pwm_up_down_idle(ctx, command);
+  case TIMER_ACTION_RESTORE:
+    write_pin_output(&ctx, *ctx.current_value);
+    timer_start(index, TIMER_ACTION_OFF, TIMER_WARN_TICKS - TIMER_WARN_BLINK_TICKS);
     break;
-  case OUTPUT_STATE_PWM_DOWN:
-    next_state = handle_output_pwm_down(ctx, command);
+  case TIMER_ACTION_OFF:
+    switch_output_off(&ctx);
     break;
-  case OUTPUT_STATE_PWM_DOWN_WAIT:
-    next_state = handle_output_pwm_down_wait(ctx, command);
+  }
+}
+
+/**
+ * Returns the time until the output switches itself off in seconds,
+ * rounded up, 0 if no timer runs.
+ */
+uint16_t auto_off_remaining(uint8_t index) {
+  uint32_t ticks = timer_remaining(index);
+  switch (timer_action(index)) {
+  case TIMER_ACTION_WARN:
+    ticks += TIMER_WARN_TICKS;
     break;
-  default:
+  case TIMER_ACTION_RESTORE:
+    ticks += TIMER_WARN_TICKS - TIMER_WARN_BLINK_TICKS;
     break;
   }
-  if (current_state != next_state) {
-    ctx->output_state->state = next_state;
-    ctx->output_state->last_update = millis();
-  }
+  return (ticks * TIMER_TICK_MS + 999) / 1000;
 }
 
 void init_digital_pin_context(uint8_t index, digital_pin_context_t *ctx) {
-  read_digital_pin_settings_from_eeprom(index, ctx->settings);
+  ctx->settings = digital_pin_settings[index];
   ctx->index = index;
   ctx->pin_number = digital_pins_numbers[index];
   ctx->counters = counters + index;
@@ -311,51 +656,156 @@ void init_digital_pin_context(uint8_t index, digital_pin_context_t *ctx) {
   ctx->output_state = output_states + index;
 }
 
-void trigger_command(digital_pin_context_t *origin_pin, uint8_t command) {
-  uint8_t group = origin_pin->settings.group;
-  if (group == 0) {
-    return;
+void add_group_member(uint8_t group, uint8_t index) {
+  for (uint8_t i = 0; i < group_index_size; i++) {
+    if (group_index[i].group == group) {
+      group_index[i].members |= ((pin_mask_t) 1) << index;
+      return;
+    }
   }
+  group_index[group_index_size].group = group;
+  group_index[group_index_size].members = ((pin_mask_t) 1) << index;
+  group_index_size++;
+}
+
+/**
+ * Rebuilds the output membership bitmask of every group in use. Must be
+ * called whenever the mode, group or group_mask of a pin changes.
+ */
+void build_group_index() {
+  group_index_size = 0;
   for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    digital_pin_setting_t *setting = &digital_pin_settings[i];
+    if (!is_output(setting)) {
+      continue;
+    }
+    if (setting->group != 0) {
+      add_group_member(setting->group, i);
+    }
+    for (uint8_t bit = 0; bit < GROUP_MASK_GROUPS; bit++) {
+      if (setting->group_mask & (1 << bit)) {
+        add_group_member(bit + 1, i);
+      }
+    }
+  }
+}
+
+pin_mask_t group_members(uint8_t group) {
+  for (uint8_t i = 0; i < group_index_size; i++) {
+    if (group_index[i].group == group) {
+      return group_index[i].members;
+    }
+  }
+  return 0;
+}
+
+void dispatch_command(pin_mask_t members, uint8_t command) {
+  for (uint8_t i = 0; members; i++, members >>= 1) {
+    if (!(members & 1)) {
+      continue;
+    }
     digital_pin_context_t context;
     init_digital_pin_context(i, &context);
-    if (context.settings.group != group || !is_output(&(context.settings))) {
+    update_output(&context, command);
+  }
+}
+
+uint8_t is_scene_command(uint8_t command) {
+  return command >= COMMAND_SCENE_RECALL && command < COMMAND_SCENE_RECALL + SCENE_COUNT;
+}
+
+/**
+ * Applies scene index to its member outputs. Returns 0 if the scene was
+ * never stored.
+ */
+uint8_t recall_scene(uint8_t index) {
+  scene_t scene;
+  if (!scene_load(index, &scene)) {
+    return 0;
+  }
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    if (!(scene.members & (((pin_mask_t) 1) << i)) || !is_output(&digital_pin_settings[i])) {
       continue;
     }
-    update_output(&context, command);    
+    digital_pin_context_t ctx;
+    init_digital_pin_context(i, &ctx);
+    if (has_pwm(&ctx.settings)) {
+      fade_output_to(&ctx, scene.level[i], scene.fade_time[i]);
+    } else {
+      update_output(&ctx, scene.level[i] ? COMMAND_ON : COMMAND_OFF);
+    }
   }
+  return 1;
+}
+
+/**
+ * Queues the current level of every output as scene index, outputs fading
+ * on or off with the level they are fading to.
+ */
+uint8_t capture_scene(uint8_t index) {
+  scene_t scene;
+  scene.members = 0;
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    enum output_state state = output_states[i].state;
+    uint8_t fading = state == OUTPUT_STATE_FADE_TO_ON || state == OUTPUT_STATE_FADE_TO_OFF;
+    scene.level[i] = fading ? fades[i].target : current_values[i];
+    scene.fade_time[i] = digital_pin_settings[i].fade_time;
+    if (is_output(&digital_pin_settings[i])) {
+      scene.members |= ((pin_mask_t) 1) << i;
+    }
+  }
+  return scene_store(index, &scene);
+}
+
+void trigger_command(digital_pin_context_t *origin_pin, uint8_t command) {
+  if (is_scene_command(command)) {
+    recall_scene(command - COMMAND_SCENE_RECALL);
+    return;
+  }
+  uint8_t group = origin_pin->settings.group;
+  if (group == 0) {
+    return;
+  }
+  dispatch_command(group_members(group), command);
 }
 
 void handle_click(digital_pin_context_t *pin_ctx) {
   pin_ctx->counters->click_cnt++;
+  events_push(pin_ctx->index, EVENT_CLICK, 0);
   trigger_command(pin_ctx, pin_ctx->settings.click_command);
 }
 
 void handle_single_click(digital_pin_context_t *pin_ctx) {
   pin_ctx->counters->single_click_cnt++;
+  events_push(pin_ctx->index, EVENT_SINGLE_CLICK, 0);
   trigger_command(pin_ctx, pin_ctx->settings.single_click_command);
 }
 
 void handle_long_click(digital_pin_context_t *pin_ctx) {
   pin_ctx->counters->long_press_cnt++;
+  events_push(pin_ctx->index, EVENT_LONG_CLICK, 0);
   trigger_command(pin_ctx, pin_ctx->settings.long_click_command);
 }
 
 void handle_double_click(digital_pin_context_t *pin_ctx) {
   pin_ctx->counters->double_click_cnt++;
+  events_push(pin_ctx->index, EVENT_DOUBLE_CLICK, 0);
   trigger_command(pin_ctx, pin_ctx->settings.double_click_command);
 }
 
 void handle_release(digital_pin_context_t *pin_ctx) {
   pin_ctx->counters->release_cnt++;
+  events_push(pin_ctx->index, EVENT_RELEASE, 0);
   trigger_command(pin_ctx, pin_ctx->settings.release_command);
 }
 
-void handle_rise(digital_pin_context_t *pin_ctx) {
+void handle_rise(digital_pin_context_t *pin_ctx, unsigned long timestamp) {
+  events_push_at(pin_ctx->index, EVENT_RISE, 0, timestamp);
   trigger_command(pin_ctx, pin_ctx->settings.signal_rise_command);
 }
 
-void handle_fall(digital_pin_context_t *pin_ctx) {
+void handle_fall(digital_pin_context_t *pin_ctx, unsigned long timestamp) {
+  events_push_at(pin_ctx->index, EVENT_FALL, 0, timestamp);
   trigger_command(pin_ctx, pin_ctx->settings.signal_fall_command);
 }
 
@@ -381,41 +831,75 @@ uint8_t cb_write_coil(uint8_t fc, uint16_t address, uint16_t length) {
   return STATUS_OK;
 }
 
-uint8_t read_setting(uint8_t index) {
+uint8_t read_setting(uint16_t index) {
   uint8_t value = 0;
   EEPROM.get(index, value);
   return value;
 };
 
-uint8_t validate_pin_mode(uint8_t value) {
+uint8_t validate_pin_mode(uint8_t pin, uint8_t value) {
   uint8_t mode = value & DIGITAL_PIN_MODE_MASK;
-  if (!(mode == DIGITAL_PIN_MODE_INPUT || mode == DIGITAL_PIN_MODE_OUTPUT ||
-        mode == DIGITAL_PIN_MODE_INPUT_PULLUP)) {
+  if (mode == DIGITAL_PIN_MODE_ANALOG &&
+      board_analog_input(digital_pins_numbers[pin]) == BOARD_NO_ANALOG_INPUT) {
     return STATUS_ILLEGAL_DATA_VALUE;
   }
   return STATUS_OK;
 }
 
 uint8_t validate_command(uint8_t value) {
-  if (value <= COMMAND_TRIGGER_PWM_UP_DOWN_STOP){
+  if (value <= COMMAND_TRIGGER_PWM_UP_DOWN_STOP || is_scene_command(value)){
     return STATUS_OK;
   }
   return STATUS_ILLEGAL_DATA_VALUE;
 }
 
-uint8_t write_digital_pin_setting(uint8_t pin, uint8_t offset, uint8_t value) {
-  if (offset == 0) {
-    uint8_t status = validate_pin_mode(value);
-    if (status != STATUS_OK) {
-      return status;
-    }
-    pinMode(digital_pins_numbers[pin], value & DIGITAL_PIN_MODE_MASK);
+#define HOLDING_REGISTER_MAGIC_ADDRESS 0
+#define HOLDING_REGISTER_SLAVE_ID_ADDRESS 1
+#define HOLDING_REGISTER_LINK_CONFIG_ADDRESS 2
+#define HOLDING_REGISTER_LINK_CONFIG_NEXT_ADDRESS 3
+
+uint8_t validate_digital_pin_setting(uint8_t pin, uint8_t offset, uint8_t value) {
+  if (offset == offsetof(digital_pin_setting_t, mode)) {
+    return validate_pin_mode(pin, value);
   }
   if(offset > 2 && offset < 9) {
-    uint8_t status = validate_command(value);
-    if (status != STATUS_OK) {
-      return status;
-    }
+    return validate_command(value);
+  }
+  if (offset == offsetof(digital_pin_setting_t, dimming_curve) &&
+      !validate_dimming_curve(value)) {
+    return STATUS_ILLEGAL_DATA_VALUE;
+  }
+  if (offset == offsetof(digital_pin_setting_t, timer_options) &&
+      (value & ~TIMER_OPTION_MASK)) {
+    return STATUS_ILLEGAL_DATA_VALUE;
+  }
+  return STATUS_OK;
+}
+
+uint8_t is_index_setting(uint8_t offset) {
+  return offset == offsetof(digital_pin_setting_t, mode) ||
+    offset == offsetof(digital_pin_setting_t, group) ||
+    offset == offsetof(digital_pin_setting_t, group_mask);
+}
+
+uint8_t is_runtime_setting(uint8_t offset) {
+  return offset == offsetof(digital_pin_setting_t, output_value) ||
+    offset == offsetof(digital_pin_setting_t, pwm_on_value);
+}
+
+/**
+ * Applies a validated pin setting to the pin and the RAM copy. The
+ * caller rebuilds the indexes and stores the setting.
+ */
+void apply_digital_pin_setting(uint8_t pin, uint8_t offset, uint8_t value) {
+  if (offset == offsetof(digital_pin_setting_t, mode)) {
+    dimming_release(digital_pins_numbers[pin]);
+    pinMode(digital_pins_numbers[pin], arduino_pin_mode(value));
+  }
+  if (offset == offsetof(digital_pin_setting_t, auto_off_time) && value == 0) {
+    digital_pin_context_t ctx;
+    init_digital_pin_context(pin, &ctx);
+    cancel_output_timer(&ctx);
   }
   if (offset == 2) {
     //todo validate if value matches pwm or not. Preferrably the output
@@ -424,21 +908,302 @@ uint8_t write_digital_pin_setting(uint8_t pin, uint8_t offset, uint8_t value) {
     init_digital_pin_context(pin, &ctx);
     set_pin_output(&ctx, value);
   }
+  ((uint8_t *) &digital_pin_settings[pin])[offset] = value;
+  if (is_runtime_setting(offset)) {
+    persist_mark_dirty(pin);
+  }
+}
+
+uint8_t write_digital_pin_setting(uint8_t pin, uint8_t offset, uint8_t value) {
+  uint8_t status = validate_digital_pin_setting(pin, offset, value);
+  if (status != STATUS_OK) {
+    return status;
+  }
+  apply_digital_pin_setting(pin, offset, value);
+  if (is_index_setting(offset)) {
+    build_group_index();
+    build_input_masks();
+    build_active_outputs();
+  }
+  if (is_runtime_setting(offset)) {
+    return STATUS_OK;
+  }
+  unsigned long start = micros();
   EEPROM.put(pin_setting_start_address(pin) + offset, value);
+  store_settings_crc();
+  profile_record(PROFILE_EEPROM_WRITE, micros() - start);
   return STATUS_OK;
 }
 
-#define HOLDING_REGISTER_MAGIC_ADDRESS 0
-#define HOLDING_REGISTER_SLAVE_ID_ADDRESS 1
-uint8_t write_setting(uint8_t index, uint8_t value) {
-  if (index == HOLDING_REGISTER_MAGIC_ADDRESS) {
+/**
+ * Validates the staged changes and applies the bytes that differ from the
+ * live settings in one go, see config.h. Unchanged bytes are not
+ * validated, pins never configured may still hold erased bytes.
+ */
+uint8_t commit_config() {
+  if (config_shadow.link_config_next != node_settings.link_config_next &&
+      !link_validate(config_shadow.link_config_next)) {
+    return STATUS_ILLEGAL_DATA_VALUE;
+  }
+  for (uint8_t i = 0; i < config_shadow.pin_count; i++) {
+    uint8_t pin = config_shadow.pin_index[i];
+    const uint8_t *staged = (const uint8_t *) &config_shadow.pins[i];
+    const uint8_t *live = (const uint8_t *) &digital_pin_settings[pin];
+    for (uint8_t offset = 0; offset < sizeof(digital_pin_setting_t); offset++) {
+      if (staged[offset] != live[offset] &&
+          validate_digital_pin_setting(pin, offset, staged[offset]) != STATUS_OK) {
+        return STATUS_ILLEGAL_DATA_VALUE;
+      }
+    }
+  }
+  for (uint8_t i = 0; i < config_shadow.pin_count; i++) {
+    uint8_t pin = config_shadow.pin_index[i];
+    const uint8_t *staged = (const uint8_t *) &config_shadow.pins[i];
+    const uint8_t *live = (const uint8_t *) &digital_pin_settings[pin];
+    for (uint8_t offset = 0; offset < sizeof(digital_pin_setting_t); offset++) {
+      if (staged[offset] != live[offset]) {
+        apply_digital_pin_setting(pin, offset, staged[offset]);
+      }
+    }
+  }
+  node_settings.slave_id = config_shadow.slave_id;
+  node_settings.link_config_next = config_shadow.link_config_next;
+  node_settings.crc = config_crc(&node_settings, digital_pin_settings);
+  build_group_index();
+  build_input_masks();
+  build_active_outputs();
+  config_discard();
+  config_store();
+  return STATUS_OK;
+}
+
+/**
+ * Holding register writes while staging, validated by the commit.
+ */
+uint8_t stage_setting(uint16_t index, uint8_t value) {
+  if (index == HOLDING_REGISTER_SLAVE_ID_ADDRESS) {
+    config_shadow.slave_id = value;
+    return STATUS_OK;
+  }
+  if (index == HOLDING_REGISTER_LINK_CONFIG_NEXT_ADDRESS) {
+    config_shadow.link_config_next = value;
+    return STATUS_OK;
+  }
+  if (index < sizeof(settings_t)) {
     return STATUS_ILLEGAL_DATA_ADDRESS;
   }
+  index -= sizeof(settings_t);
+  digital_pin_setting_t *staged = config_staged_pin(index / sizeof(digital_pin_setting_t));
+  if (staged == NULL) {
+    return STATUS_SLAVE_DEVICE_FAILURE;
+  }
+  ((uint8_t *) staged)[index % sizeof(digital_pin_setting_t)] = value;
+  return STATUS_OK;
+}
+
+
+/**
+ * Register blocks after the per pin records start at the next
+ * REGISTER_BLOCK_SIZE boundary, so they only move up on boards with more
+ * pins than fit below 0x100. The addresses below are those of a board
+ * with up to 15 pins.
+ */
+#define REGISTER_BLOCK_SIZE 0x100
+#define REGISTER_BLOCK_AFTER(end) \
+  (((end) + REGISTER_BLOCK_SIZE - 1) / REGISTER_BLOCK_SIZE * REGISTER_BLOCK_SIZE)
+
+/**
+ * Command registers live outside the settings image. They act on write
+ * and read back as 0 unless noted otherwise.
+ *
+ * 0x100: reset the profiling statistics
+ * 0x101: counter read mode, reads back the current mode.
+ *        COUNTER_MODE_READ_AND_CLEAR clears every counter after an input
+ *        register read returned both of its words, so a poller collects
+ *        deltas. Not persisted, the node boots in COUNTER_MODE_READ.
+ * 0x102: event acknowledge, write the sequence number of the first event
+ *        not processed yet, see events.h. Reads back the sequence number
+ *        of the oldest queued event.
+ * 0x103: group command, group number in the high byte and a COMMAND_* in
+ *        the low byte. Sent as a broadcast to slave id 0 it switches the
+ *        group on every node with the same frame, without responses.
+ * 0x104: arm a group command, same format. Armed commands are applied
+ *        together by the commit, so fades on all nodes start on the same
+ *        frame. Reads back the number of armed commands.
+ * 0x105: 1 applies the armed commands, 0 discards them
+ * 0x106: recall the scene with the written number, see scene.h
+ * 0x107: capture the current output levels into the scene with the
+ *        written number. Busy until the previous capture is written.
+ * 0x108: 1 switches to the link config in holding register 3 after the
+ *        response, see link.h
+ * 0x109: 1 confirms the link being tried, reads 1 while a trial runs
+ * 0x10A: 1 starts staging, settings writes then go to a shadow image
+ *        until the commit, see config.h. Reads 1 while staging.
+ * 0x10B: 1 validates and applies the staged image, 0 discards it. Reads 1
+ *        until the applied image is written to the EEPROM.
+ */
+#define HOLDING_REGISTER_SETTINGS_SIZE (sizeof(settings_t) + NR_OF_DIGITAL_PINS * sizeof(digital_pin_setting_t))
+#define HOLDING_REGISTER_COMMAND_OFFSET REGISTER_BLOCK_AFTER(HOLDING_REGISTER_SETTINGS_SIZE)
+#define HOLDING_REGISTER_PROFILE_RESET_ADDRESS (HOLDING_REGISTER_COMMAND_OFFSET + 0x0)
+#define HOLDING_REGISTER_COUNTER_MODE_ADDRESS (HOLDING_REGISTER_COMMAND_OFFSET + 0x1)
+#define HOLDING_REGISTER_EVENT_ACKNOWLEDGE_ADDRESS (HOLDING_REGISTER_COMMAND_OFFSET + 0x2)
+#define HOLDING_REGISTER_GROUP_COMMAND_ADDRESS (HOLDING_REGISTER_COMMAND_OFFSET + 0x3)
+#define HOLDING_REGISTER_ARM_GROUP_COMMAND_ADDRESS (HOLDING_REGISTER_COMMAND_OFFSET + 0x4)
+#define HOLDING_REGISTER_COMMIT_ADDRESS (HOLDING_REGISTER_COMMAND_OFFSET + 0x5)
+#define HOLDING_REGISTER_SCENE_RECALL_ADDRESS (HOLDING_REGISTER_COMMAND_OFFSET + 0x6)
+#define HOLDING_REGISTER_SCENE_CAPTURE_ADDRESS (HOLDING_REGISTER_COMMAND_OFFSET + 0x7)
+#define HOLDING_REGISTER_LINK_APPLY_ADDRESS (HOLDING_REGISTER_COMMAND_OFFSET + 0x8)
+#define HOLDING_REGISTER_LINK_CONFIRM_ADDRESS (HOLDING_REGISTER_COMMAND_OFFSET + 0x9)
+#define HOLDING_REGISTER_CONFIG_STAGE_ADDRESS (HOLDING_REGISTER_COMMAND_OFFSET + 0xA)
+#define HOLDING_REGISTER_CONFIG_COMMIT_ADDRESS (HOLDING_REGISTER_COMMAND_OFFSET + 0xB)
+#define HOLDING_REGISTER_COMMAND_SIZE 12
+
+#define COUNTER_MODE_READ 0
+#define COUNTER_MODE_READ_AND_CLEAR 1
+
+#define MAX_ARMED_COMMANDS 4
+#define COMMIT_DISCARD 0
+#define COMMIT_APPLY 1
+
+uint8_t counter_mode;
+uint16_t armed_commands[MAX_ARMED_COMMANDS];
+uint8_t armed_command_count;
+
+uint8_t validate_group_command(uint16_t value) {
+  // scene commands ignore the group
+  if ((value >> 8) == 0 && !is_scene_command(value & 0xFF)) {
+    return STATUS_ILLEGAL_DATA_VALUE;
+  }
+  return validate_command(value & 0xFF);
+}
+
+void apply_group_command(uint16_t value) {
+  uint8_t command = value & 0xFF;
+  // scenes carry their own set of outputs
+  if (is_scene_command(command)) {
+    recall_scene(command - COMMAND_SCENE_RECALL);
+    return;
+  }
+  dispatch_command(group_members(value >> 8), command);
+}
+
+uint8_t arm_group_command(uint16_t value) {
+  if (armed_command_count == MAX_ARMED_COMMANDS) {
+    return STATUS_SLAVE_DEVICE_FAILURE;
+  }
+  armed_commands[armed_command_count++] = value;
+  return STATUS_OK;
+}
+
+void commit_armed_commands(uint8_t apply) {
+  for (uint8_t i = 0; apply && i < armed_command_count; i++) {
+    apply_group_command(armed_commands[i]);
+  }
+  armed_command_count = 0;
+}
+
+uint8_t write_command_register(uint16_t address, uint16_t value) {
+  if (address == HOLDING_REGISTER_PROFILE_RESET_ADDRESS) {
+    profile_reset();
+    return STATUS_OK;
+  }
+  if (address == HOLDING_REGISTER_COUNTER_MODE_ADDRESS) {
+    if (value > COUNTER_MODE_READ_AND_CLEAR) {
+      return STATUS_ILLEGAL_DATA_VALUE;
+    }
+    counter_mode = value;
+    return STATUS_OK;
+  }
+  if (address == HOLDING_REGISTER_EVENT_ACKNOWLEDGE_ADDRESS) {
+    return events_acknowledge(value) ? STATUS_OK : STATUS_ILLEGAL_DATA_VALUE;
+  }
+  if (address == HOLDING_REGISTER_GROUP_COMMAND_ADDRESS ||
+      address == HOLDING_REGISTER_ARM_GROUP_COMMAND_ADDRESS) {
+    uint8_t status = validate_group_command(value);
+    if (status != STATUS_OK) {
+      return status;
+    }
+    if (address == HOLDING_REGISTER_ARM_GROUP_COMMAND_ADDRESS) {
+      return arm_group_command(value);
+    }
+    apply_group_command(value);
+    return STATUS_OK;
+  }
+  if (address == HOLDING_REGISTER_COMMIT_ADDRESS) {
+    if (value > COMMIT_APPLY) {
+      return STATUS_ILLEGAL_DATA_VALUE;
+    }
+    commit_armed_commands(value);
+    return STATUS_OK;
+  }
+  if (address == HOLDING_REGISTER_SCENE_RECALL_ADDRESS ||
+      address == HOLDING_REGISTER_SCENE_CAPTURE_ADDRESS) {
+    if (value >= SCENE_COUNT) {
+      return STATUS_ILLEGAL_DATA_VALUE;
+    }
+    if (address == HOLDING_REGISTER_SCENE_CAPTURE_ADDRESS) {
+      return capture_scene(value) ? STATUS_OK : STATUS_SLAVE_DEVICE_BUSY;
+    }
+    return recall_scene(value) ? STATUS_OK : STATUS_ILLEGAL_DATA_VALUE;
+  }
+  if (address == HOLDING_REGISTER_LINK_APPLY_ADDRESS) {
+    if (value != 1) {
+      return STATUS_ILLEGAL_DATA_VALUE;
+    }
+    link_request_apply();
+    return STATUS_OK;
+  }
+  if (address == HOLDING_REGISTER_LINK_CONFIRM_ADDRESS) {
+    if (value != 1) {
+      return STATUS_ILLEGAL_DATA_VALUE;
+    }
+    return link_confirm() ? STATUS_OK : STATUS_ILLEGAL_DATA_VALUE;
+  }
+  if (address == HOLDING_REGISTER_CONFIG_STAGE_ADDRESS) {
+    if (value != 1) {
+      return STATUS_ILLEGAL_DATA_VALUE;
+    }
+    config_stage();
+    return STATUS_OK;
+  }
+  if (address == HOLDING_REGISTER_CONFIG_COMMIT_ADDRESS) {
+    if (value > COMMIT_APPLY || !config_staging()) {
+      return STATUS_ILLEGAL_DATA_VALUE;
+    }
+    if (value == COMMIT_DISCARD) {
+      config_discard();
+      return STATUS_OK;
+    }
+    return commit_config();
+  }
+  return STATUS_ILLEGAL_DATA_ADDRESS;
+}
+
+uint8_t write_setting(uint16_t index, uint8_t value) {
+  if (index == HOLDING_REGISTER_MAGIC_ADDRESS ||
+      index == HOLDING_REGISTER_LINK_CONFIG_ADDRESS) {
+    return STATUS_ILLEGAL_DATA_ADDRESS;
+  }
+  if (index == HOLDING_REGISTER_LINK_CONFIG_NEXT_ADDRESS) {
+    if (!link_validate(value)) {
+      return STATUS_ILLEGAL_DATA_VALUE;
+    }
+    node_settings.link_config_next = value;
+    unsigned long start = micros();
+    EEPROM.put(index, value);
+    store_settings_crc();
+    profile_record(PROFILE_EEPROM_WRITE, micros() - start);
+    return STATUS_OK;
+  }
   if (index == HOLDING_REGISTER_SLAVE_ID_ADDRESS) { // slave id
     if (value > 0xFF) {
       return STATUS_ILLEGAL_DATA_VALUE;
     } else {
+      node_settings.slave_id = value;
+      unsigned long start = micros();
       EEPROM.put(index, value);
+      store_settings_crc();
+      profile_record(PROFILE_EEPROM_WRITE, micros() - start);
       return STATUS_OK;
     }
   }
@@ -450,94 +1215,235 @@ uint8_t write_setting(uint8_t index, uint8_t value) {
   return STATUS_ILLEGAL_DATA_ADDRESS;
 }
 
-uint16_t read_counter(uint8_t index) {
-  uint16_t* counter = (uint16_t *) &counters;
-  return *(counter + index);
-}
-
 /**
  * input register design
  *
  * address: value
  * 0 : number of digital pins
- * 1 - 7: reserved
+ * 1 - 2: uptime in milliseconds, low word first
+ * 3: number of journal entries written by the persist layer
+ * 4: number of pins with values waiting to be persisted
+ * 5: number of captured edges dropped because the queue was full
+ * 6: link config the serial port runs, see link.h
+ * 7: link turnaround in microseconds, t3.5 plus one character
  * 
  * per pin registers starting at address 8 
  *
  * 8: pin 1 pin number
- * 9: pin 1 click counter
- * 10: pin 1 single click counter
- * 11: pin 1 double click counter
- * 12: pin 1 long press counter
- * 13: pin 1 release counter
- * 14-15 reserved
- * 
+ * 9: pin 1 seconds until the auto off timer switches the output off
+ * 10 - 11: pin 1 click counter
+ * 12 - 13: pin 1 single click counter
+ * 14 - 15: pin 1 double click counter
+ * 16 - 17: pin 1 long press counter
+ * 18 - 19: pin 1 release counter
+ *
+ * The uptime and counters are 32 bit, low word first. The uptime is
+ * latched once per request. The counters only change in the main loop,
+ * which does not run while a request is answered, so a multi-register
+ * read always returns one consistent view of them.
+ *
+ * profiling block starting at address 0x100, the first block after the
+ * per pin registers, see profile.h
+ *
+ * event block starting at address 0x200, the block after the profiling
+ *
+ * 0x200: sequence number of the oldest queued event
+ * 0x201: number of queued events
+ * 0x202: number of events dropped because the queue was full
+ * 0x203: reserved
+ * 0x204: queued events, oldest first, 4 registers each, see events.h
+ *
+ * diagnostics block starting at address 0x300, the block after the
+ * events, see diag.h. The counters are also returned by the Diagnostics
+ * function (0x08), which clears them with sub-function 0x0A.
+ *
+ * 0x300: frames seen on the bus
+ * 0x301: frames with a crc error
+ * 0x302: exception responses sent
+ * 0x303: frames for this node, broadcasts included
+ * 0x304: frames for this node that were not answered
+ * 0x305: frames during which the receive buffer overran
+ * 0x306 - 0x307: longest time between two polls of the slave in
+ *        microseconds, low word first
+ *
+ * analog block starting at address 0x400, the block after the
+ * diagnostics, see analog.h
+ *
+ * 0x400: pin 1 latest 12 bit value, 0 unless the pin is an analog input
+ * 0x401: pin 2 latest value, and so on for every pin
  */
 
-#define INPUT_REGISTER_VALUE_RESERVED 0
 #define INPUT_REGISTER_NUMBER_OF_PINS_ADDRESS 0
 #define INPUT_REGISTER_PER_PIN_ADDRESS_OFFSET 8
 #define INPUT_REGISTER_PER_PIN_PINNUMBER_ADDRESS 0
+#define INPUT_REGISTER_PER_PIN_AUTO_OFF_ADDRESS 1
 #define INPUT_REGISTER_UPTIME_ADDRESS 1
-#define INPUT_REGISTER_PER_PIN_RESERVED 6
-#define INPUT_REGISTER_PER_PIN_SIZE 8
-#define INPUT_REGISTER_PER_PIN_COUNTER_SIZE 5
+#define INPUT_REGISTER_PERSIST_FLUSH_COUNT_ADDRESS 3
+#define INPUT_REGISTER_PERSIST_PENDING_ADDRESS 4
+#define INPUT_REGISTER_CAPTURE_OVERFLOW_ADDRESS 5
+#define INPUT_REGISTER_LINK_CONFIG_ADDRESS 6
+#define INPUT_REGISTER_LINK_TURNAROUND_ADDRESS 7
+#define INPUT_REGISTER_PER_PIN_COUNTER_ADDRESS 2
+#define INPUT_REGISTER_PER_PIN_SIZE 12
+#define INPUT_REGISTER_PER_PIN_COUNTER_SIZE (sizeof(digital_pin_counters_t) / sizeof(uint16_t))
+#define INPUT_REGISTER_PROFILE_OFFSET REGISTER_BLOCK_AFTER(INPUT_REGISTER_PER_PIN_ADDRESS_OFFSET \
+                                                      + NR_OF_DIGITAL_PINS * INPUT_REGISTER_PER_PIN_SIZE)
+#define INPUT_REGISTER_EVENT_OFFSET (INPUT_REGISTER_PROFILE_OFFSET + REGISTER_BLOCK_SIZE)
+#define INPUT_REGISTER_EVENT_SEQUENCE_ADDRESS (INPUT_REGISTER_EVENT_OFFSET + 0x0)
+#define INPUT_REGISTER_EVENT_COUNT_ADDRESS (INPUT_REGISTER_EVENT_OFFSET + 0x1)
+#define INPUT_REGISTER_EVENTS_DROPPED_ADDRESS (INPUT_REGISTER_EVENT_OFFSET + 0x2)
+#define INPUT_REGISTER_EVENT_QUEUE_ADDRESS (INPUT_REGISTER_EVENT_OFFSET + 0x4)
+#define INPUT_REGISTER_EVENT_SIZE (sizeof(event_t) / sizeof(uint16_t))
+#define INPUT_REGISTER_DIAG_OFFSET (INPUT_REGISTER_EVENT_OFFSET + REGISTER_BLOCK_SIZE)
+#define INPUT_REGISTER_DIAG_SIZE (sizeof(diag_counters_t) / sizeof(uint16_t))
+#define INPUT_REGISTER_ANALOG_OFFSET (INPUT_REGISTER_DIAG_OFFSET + REGISTER_BLOCK_SIZE)
 
-uint16_t read_single_input_register(uint16_t address) {
-  if (address == INPUT_REGISTER_NUMBER_OF_PINS_ADDRESS) {
-    return NR_OF_DIGITAL_PINS;
-  }
-  if (address == INPUT_REGISTER_UPTIME_ADDRESS) {
-    return (millis() & 0xFFFF);
-  }
-  if (address == INPUT_REGISTER_UPTIME_ADDRESS + 1) {
-    return (millis() >> 16)&0xFFFF;
-  }
-  if (address < INPUT_REGISTER_PER_PIN_ADDRESS_OFFSET) {
-    return INPUT_REGISTER_VALUE_RESERVED;
+static_assert(PROFILE_REGISTERS <= REGISTER_BLOCK_SIZE, "profiling block overlaps the event block");
+static_assert(INPUT_REGISTER_EVENT_QUEUE_ADDRESS - INPUT_REGISTER_EVENT_OFFSET
+              + EVENT_QUEUE_SIZE * INPUT_REGISTER_EVENT_SIZE <= REGISTER_BLOCK_SIZE,
+              "event block overlaps the diagnostics block");
+static_assert(INPUT_REGISTER_DIAG_SIZE <= REGISTER_BLOCK_SIZE, "diagnostics block overlaps the analog block");
+
+static const uint16_t number_of_pins = NR_OF_DIGITAL_PINS;
+static uint32_t uptime;
+
+uint16_t read_persist_pending_register(uint16_t offset) {
+  return persist_pending_count();
+}
+
+uint16_t read_auto_off_register(uint16_t offset) {
+  return auto_off_remaining(offset);
+}
+
+uint16_t read_link_register(uint16_t offset) {
+  uint8_t config = link_active_config();
+  if (offset == 0) {
+    return config;
   }
-  uint8_t pin_index = (address-INPUT_REGISTER_PER_PIN_ADDRESS_OFFSET)/INPUT_REGISTER_PER_PIN_SIZE;
-  uint8_t pin_address = (address-INPUT_REGISTER_PER_PIN_ADDRESS_OFFSET) % INPUT_REGISTER_PER_PIN_SIZE;
+  link_timing_t timing;
+  link_timing(config, &timing);
+  return timing.turnaround_us;
+}
 
-  if (pin_address == INPUT_REGISTER_PER_PIN_PINNUMBER_ADDRESS) {
-    return digital_pins_numbers[pin_index];
+uint16_t read_capture_overflow_register(uint16_t offset) {
+  uint16_t overflow_count;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    overflow_count = capture_overflow_count;
   }
-  if (pin_address >= INPUT_REGISTER_PER_PIN_RESERVED) {
-    return INPUT_REGISTER_VALUE_RESERVED;
+  return overflow_count;
+}
+
+uint16_t read_analog_register(uint16_t offset) {
+  return (analog_pins >> offset) & 1 ? analog_value(offset) : 0;
+}
+
+const regmap_range_t input_register_map[] PROGMEM = {
+  REGMAP_WINDOW_RANGE(0, INPUT_REGISTER_PER_PIN_ADDRESS_OFFSET
+                      + NR_OF_DIGITAL_PINS * INPUT_REGISTER_PER_PIN_SIZE),
+  REGMAP_WORD_RANGE(INPUT_REGISTER_NUMBER_OF_PINS_ADDRESS, 1, 1, 1, 0, &number_of_pins),
+  REGMAP_WORD_RANGE(INPUT_REGISTER_UPTIME_ADDRESS, 1, 2, 2, 0, &uptime),
+  REGMAP_WORD_RANGE(INPUT_REGISTER_PERSIST_FLUSH_COUNT_ADDRESS, 1, 1, 1, 0, &persist_flush_count),
+  REGMAP_FUNCTION_RANGE(INPUT_REGISTER_PERSIST_PENDING_ADDRESS, 1, read_persist_pending_register),
+  REGMAP_FUNCTION_RANGE(INPUT_REGISTER_CAPTURE_OVERFLOW_ADDRESS, 1, read_capture_overflow_register),
+  REGMAP_FUNCTION_RANGE(INPUT_REGISTER_LINK_CONFIG_ADDRESS, 2, read_link_register),
+  REGMAP_BYTE_RANGE(INPUT_REGISTER_PER_PIN_ADDRESS_OFFSET + INPUT_REGISTER_PER_PIN_PINNUMBER_ADDRESS,
+                    NR_OF_DIGITAL_PINS, INPUT_REGISTER_PER_PIN_SIZE, 1, 1, digital_pins_numbers),
+  REGMAP_FUNCTION_RECORDS(INPUT_REGISTER_PER_PIN_ADDRESS_OFFSET + INPUT_REGISTER_PER_PIN_AUTO_OFF_ADDRESS,
+                          NR_OF_DIGITAL_PINS, INPUT_REGISTER_PER_PIN_SIZE, 1, read_auto_off_register),
+  REGMAP_WORD_RANGE(INPUT_REGISTER_PER_PIN_ADDRESS_OFFSET + INPUT_REGISTER_PER_PIN_COUNTER_ADDRESS,
+                    NR_OF_DIGITAL_PINS, INPUT_REGISTER_PER_PIN_SIZE, INPUT_REGISTER_PER_PIN_COUNTER_SIZE,
+                    sizeof(digital_pin_counters_t), counters),
+  REGMAP_WINDOW_RANGE(INPUT_REGISTER_PROFILE_OFFSET, PROFILE_REGISTERS),
+  REGMAP_FUNCTION_RANGE(INPUT_REGISTER_PROFILE_OFFSET, PROFILE_REGISTERS, profile_read_register),
+  REGMAP_WINDOW_RANGE(INPUT_REGISTER_EVENT_OFFSET, INPUT_REGISTER_EVENT_QUEUE_ADDRESS - INPUT_REGISTER_EVENT_OFFSET
+                      + EVENT_QUEUE_SIZE * INPUT_REGISTER_EVENT_SIZE),
+  REGMAP_WORD_RANGE(INPUT_REGISTER_EVENT_SEQUENCE_ADDRESS, 1, 1, 1, 0, &event_sequence),
+  REGMAP_BYTE_RANGE(INPUT_REGISTER_EVENT_COUNT_ADDRESS, 1, 1, 1, 0, &event_count),
+  REGMAP_WORD_RANGE(INPUT_REGISTER_EVENTS_DROPPED_ADDRESS, 1, 1, 1, 0, &events_dropped),
+  REGMAP_WORD_RANGE(INPUT_REGISTER_EVENT_QUEUE_ADDRESS, EVENT_QUEUE_SIZE, INPUT_REGISTER_EVENT_SIZE,
+                    INPUT_REGISTER_EVENT_SIZE, sizeof(event_t), events),
+  REGMAP_WINDOW_RANGE(INPUT_REGISTER_DIAG_OFFSET, INPUT_REGISTER_DIAG_SIZE),
+  REGMAP_WORD_RANGE(INPUT_REGISTER_DIAG_OFFSET, 1, INPUT_REGISTER_DIAG_SIZE, INPUT_REGISTER_DIAG_SIZE, 0,
+                    &diag_counters),
+  REGMAP_WINDOW_RANGE(INPUT_REGISTER_ANALOG_OFFSET, NR_OF_DIGITAL_PINS),
+  REGMAP_FUNCTION_RANGE(INPUT_REGISTER_ANALOG_OFFSET, NR_OF_DIGITAL_PINS, read_analog_register),
+};
+
+/**
+ * Clears the counters of which both words lie in the registers
+ * [address, address + length).
+ */
+void clear_read_counters(uint16_t address, uint16_t length) {
+  uint16_t counter_address = INPUT_REGISTER_PER_PIN_ADDRESS_OFFSET + INPUT_REGISTER_PER_PIN_COUNTER_ADDRESS;
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    uint32_t *counter = (uint32_t *) &counters[i];
+    for (uint8_t j = 0; j < sizeof(digital_pin_counters_t) / sizeof(uint32_t); j++) {
+      uint16_t first = counter_address + 2 * j;
+      if (first >= address && first + 2 <= address + length) {
+        counter[j] = 0;
+      }
+    }
+    counter_address += INPUT_REGISTER_PER_PIN_SIZE;
   }
-  return read_counter(pin_index * INPUT_REGISTER_PER_PIN_COUNTER_SIZE
-                      + pin_address
-                      - 1);
+}
+
+uint16_t read_single_input_register(uint16_t address) {
+  uptime = millis();
+  return regmap_read_register(input_register_map, REGMAP_SIZE(input_register_map), address);
 }
 
 uint8_t cb_read_input_register(uint8_t fc, uint16_t address, uint16_t length) {
-  uint16_t max_size = NR_OF_DIGITAL_PINS*INPUT_REGISTER_PER_PIN_SIZE
-    + INPUT_REGISTER_PER_PIN_ADDRESS_OFFSET;
-  if (address > max_size || address + length > max_size) {
-    return STATUS_ILLEGAL_DATA_ADDRESS;
+  uptime = millis();
+  uint8_t status = regmap_read(input_register_map, REGMAP_SIZE(input_register_map), address, length);
+  if (status == STATUS_OK && counter_mode == COUNTER_MODE_READ_AND_CLEAR) {
+    clear_read_counters(address, length);
   }
-  for (uint8_t i = 0; i < length; i++) {
-    uint16_t value = read_single_input_register(address + i);
-    slave.writeRegisterToBuffer(i, value);
-  }
-  return STATUS_OK;  
+  return status;
+}
+
+uint16_t read_link_trial_register(uint16_t offset) {
+  return link_trial_active();
 }
 
+uint16_t read_config_register(uint16_t offset) {
+  return offset == 0 ? config_staging() : config_store_pending();
+}
+
+/**
+ * Holding registers are served from the RAM copies of the settings, the
+ * command block reads as 0 apart from the counter mode, the event
+ * sequence number and the number of armed commands.
+ */
+const regmap_range_t holding_register_map[] PROGMEM = {
+  REGMAP_WINDOW_RANGE(HOLDING_REGISTER_MAGIC_ADDRESS, sizeof(settings_t)
+                      + sizeof(digital_pin_setting_t) * NR_OF_DIGITAL_PINS),
+  REGMAP_BYTE_RANGE(HOLDING_REGISTER_MAGIC_ADDRESS, 1, sizeof(settings_t), sizeof(settings_t), 0, &node_settings),
+  REGMAP_BYTE_RANGE(HOLDING_REGISTER_MAGIC_ADDRESS + sizeof(settings_t), NR_OF_DIGITAL_PINS,
+                    sizeof(digital_pin_setting_t), sizeof(digital_pin_setting_t),
+                    sizeof(digital_pin_setting_t), digital_pin_settings),
+  REGMAP_WINDOW_RANGE(HOLDING_REGISTER_COMMAND_OFFSET, HOLDING_REGISTER_COMMAND_SIZE),
+  REGMAP_BYTE_RANGE(HOLDING_REGISTER_COUNTER_MODE_ADDRESS, 1, 1, 1, 0, &counter_mode),
+  REGMAP_WORD_RANGE(HOLDING_REGISTER_EVENT_ACKNOWLEDGE_ADDRESS, 1, 1, 1, 0, &event_sequence),
+  REGMAP_BYTE_RANGE(HOLDING_REGISTER_ARM_GROUP_COMMAND_ADDRESS, 1, 1, 1, 0, &armed_command_count),
+  REGMAP_FUNCTION_RANGE(HOLDING_REGISTER_LINK_CONFIRM_ADDRESS, 1, read_link_trial_register),
+  REGMAP_FUNCTION_RANGE(HOLDING_REGISTER_CONFIG_STAGE_ADDRESS, 2, read_config_register),
+};
 
 uint8_t cb_read_holding_register(uint8_t fc, uint16_t address, uint16_t length) {
-  uint16_t max_size = sizeof(settings_t) + sizeof(digital_pin_setting_t) * NR_OF_DIGITAL_PINS;
-  if (address > max_size || address + length > max_size) {
-    return STATUS_ILLEGAL_DATA_ADDRESS;
-  }
-  for (uint8_t i = 0; i < length; i++) {
-    uint8_t value = read_setting(address + i);
-    slave.writeRegisterToBuffer(i, value);
-  }
-  return STATUS_OK;
+  return regmap_read(holding_register_map, REGMAP_SIZE(holding_register_map), address, length);
 }
 
 uint8_t cb_write_holding_register(uint8_t fc, uint16_t address, uint16_t length) {
   uint16_t max_size = sizeof(settings_t) + sizeof(digital_pin_setting_t) * NR_OF_DIGITAL_PINS;
+  if (address >= HOLDING_REGISTER_COMMAND_OFFSET) {
+    for (uint8_t i = 0; i < length; i++) {
+      uint8_t status = write_command_register(address + i, slave.readRegisterFromBuffer(i));
+      if (status != STATUS_OK) {
+        return status;
+      }
+    }
+    return STATUS_OK;
+  }
   if (address < 1 || address > max_size || address + length > max_size) {
     return STATUS_ILLEGAL_DATA_ADDRESS;
   }
@@ -546,7 +1452,7 @@ uint8_t cb_write_holding_register(uint8_t fc, uint16_t address, uint16_t length)
     if (value > 0xFF) {
       return STATUS_ILLEGAL_DATA_VALUE;
     }
-    uint8_t status = write_setting(address+i, value);
+    uint8_t status = config_staging() ? stage_setting(address + i, value) : write_setting(address+i, value);
     if (status != STATUS_OK) {
       return status;
     }
@@ -555,82 +1461,226 @@ uint8_t cb_write_holding_register(uint8_t fc, uint16_t address, uint16_t length)
 }
 
 
-void poll_input(digital_pin_context_t *ctx) {
-  uint8_t i = ctx->index;
-  uint8_t rawValue = digitalRead(digital_pins_numbers[i]);
-    if (has_button(&ctx->settings)) {
-      buttons[i].update(rawValue == 0);
-      if (buttons[i].isClick()) {
-        handle_click(ctx);
-      }
-      if (buttons[i].isSingleClick()) {
-        handle_single_click(ctx);
-      }
-      if (buttons[i].isLongClick()) {
-        handle_long_click(ctx);
-      }
-      if (buttons[i].isDoubleClick()) {
-        handle_double_click(ctx);
-      }
-      if (buttons[i].isReleased()) {
-        handle_release(ctx);
-      }
+/**
+ * Rebuilds the masks of button and signal inputs. Must be called whenever
+ * the mode of a pin changes. Capture and the ADC are only restarted when
+ * their pins change, a restart drops the queued edges and the partial
+ * values and threshold states of every analog pin.
+ */
+void build_input_masks() {
+  pin_mask_t capture_requested = 0;
+  pin_mask_t analog_requested = 0;
+  button_pins = 0;
+  signal_pins = 0;
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    digital_pin_setting_t *setting = &digital_pin_settings[i];
+    if (is_output(setting)) {
+      continue;
+    }
+    if (is_analog(setting)) {
+      analog_requested |= ((pin_mask_t) 1) << i;
+    } else if (has_button(setting)) {
+      button_pins |= ((pin_mask_t) 1) << i;
+    } else if (has_capture(setting)) {
+      capture_requested |= ((pin_mask_t) 1) << i;
     } else {
-      if (*ctx->current_value < rawValue) {
-        handle_rise(ctx);
-      }
-      if (*ctx->current_value > rawValue) {
-        handle_fall(ctx);
-      }
-      *ctx->current_value = rawValue;
+      signal_pins |= ((pin_mask_t) 1) << i;
     }
+  }
+  timed_buttons &= button_pins;
+  if (capture_requested != capture_requested_pins) {
+    capture_requested_pins = capture_requested;
+    captured_pins = capture_begin(capture_requested);
+  }
+  // pins the MCU cannot capture fall back to polling
+  signal_pins |= capture_requested & ~captured_pins;
+  if (analog_requested != analog_requested_pins) {
+    analog_requested_pins = analog_requested;
+    analog_pins = analog_begin(analog_requested);
+    analog_primed &= analog_pins;
+  }
 }
 
-void loop_digital_pins() {
-  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
-    digital_pin_context_t pin_ctx;
-    init_digital_pin_context(i, &pin_ctx);
-    if (is_output(&pin_ctx.settings)) {
-      update_output(&pin_ctx, COMMAND_NONE);
+void handle_button_events(digital_pin_context_t *ctx, uint8_t events) {
+  if (events & INPUT_EVENT_CLICK) {
+    handle_click(ctx);
+  }
+  if (events & INPUT_EVENT_SINGLE_CLICK) {
+    handle_single_click(ctx);
+  }
+  if (events & INPUT_EVENT_LONG_CLICK) {
+    handle_long_click(ctx);
+  }
+  if (events & INPUT_EVENT_DOUBLE_CLICK) {
+    handle_double_click(ctx);
+  }
+  if (events & INPUT_EVENT_RELEASE) {
+    handle_release(ctx);
+  }
+}
+
+/**
+ * Fires the edge of a signal input that changed to value at timestamp.
+ */
+void handle_signal(uint8_t index, uint8_t value, unsigned long timestamp) {
+  digital_pin_context_t ctx;
+  init_digital_pin_context(index, &ctx);
+  if (*ctx.current_value < value) {
+    handle_rise(&ctx, timestamp);
+  }
+  if (*ctx.current_value > value) {
+    handle_fall(&ctx, timestamp);
+  }
+  *ctx.current_value = value;
+}
+
+void poll_signals(pin_mask_t raw) {
+  pin_mask_t changed = (raw ^ input_levels) & signal_pins;
+  input_levels = raw;
+  for (uint8_t i = 0; changed; i++, changed >>= 1) {
+    if (changed & 1) {
+      handle_signal(i, (raw >> i) & 1, millis());
+    }
+  }
+}
+
+void drain_captured_edges() {
+  capture_event_t event;
+  while (capture_pop(&event)) {
+    if (captured_pins & (((pin_mask_t) 1) << event.index)) {
+      handle_signal(event.index, event.level, event.timestamp);
+    }
+  }
+}
+
+/**
+ * Applies the thresholds to the new analog values, see analog.h.
+ */
+void poll_analog() {
+  pin_mask_t ready = analog_take_ready() & analog_pins;
+  for (uint8_t i = 0; ready; i++, ready >>= 1) {
+    if (!(ready & 1)) {
+      continue;
+    }
+    digital_pin_setting_t *setting = &digital_pin_settings[i];
+    uint8_t state = analog_threshold(current_values[i], analog_value(i),
+                                     setting->analog_rise_level, setting->analog_fall_level);
+    pin_mask_t bit = ((pin_mask_t) 1) << i;
+    if (!(analog_primed & bit)) {
+      analog_primed |= bit;
+      current_values[i] = state;
+      continue;
+    }
+    handle_signal(i, state, millis());
+  }
+}
+
+void poll_buttons(pin_mask_t raw) {
+  unsigned long now = millis();
+  pin_mask_t changed = 0;
+  if (now - last_input_sample >= INPUT_SAMPLE_INTERVAL) {
+    last_input_sample = now;
+    changed = debouncer_sample(&input_debouncer, raw);
+  }
+  pin_mask_t pending = (changed | timed_buttons) & button_pins;
+  for (uint8_t i = 0; pending; i++, pending >>= 1) {
+    if (!(pending & 1)) {
+      continue;
+    }
+    // buttons pull the input low
+    uint8_t pressed = !((input_debouncer.state >> i) & 1);
+    uint8_t events = button_update(&buttons[i], pressed, now);
+    if (button_is_timed(&buttons[i])) {
+      timed_buttons |= ((pin_mask_t) 1) << i;
     } else {
-      poll_input(&pin_ctx);
+      timed_buttons &= ~(((pin_mask_t) 1) << i);
+    }
+    if (events) {
+      digital_pin_context_t ctx;
+      init_digital_pin_context(i, &ctx);
+      handle_button_events(&ctx, events);
     }
   }
 }
 
+void poll_inputs() {
+  pin_mask_t raw = input_read_raw();
+  drain_captured_edges();
+  poll_analog();
+  poll_signals(raw);
+  poll_buttons(raw);
+}
+
+void loop_digital_pins() {
+  // backwards, a finished output is replaced by the last entry
+  for (uint8_t i = active_output_count; i > 0; i--) {
+    digital_pin_context_t pin_ctx;
+    init_digital_pin_context(active_outputs[i - 1], &pin_ctx);
+    update_output(&pin_ctx, COMMAND_NONE);
+  }
+  poll_inputs();
+  timer_loop();
+}
+
+/**
+ * Wraps a Modbus callback so its execution time ends up in the given
+ * profiling slot.
+ */
+template <uint8_t (*callback)(uint8_t, uint16_t, uint16_t), uint8_t slot>
+uint8_t profiled_callback(uint8_t fc, uint16_t address, uint16_t length) {
+  unsigned long start = micros();
+  uint8_t status = callback(fc, address, length);
+  profile_record(slot, micros() - start);
+  return status;
+}
+
 #ifndef UNIT_TEST
 // cppcheck-suppress unusedFunction
 void setup() {
   memset(counters, 0, NR_OF_DIGITAL_PINS * sizeof(digital_pin_counters_t));
   memset(current_values, 0, NR_OF_DIGITAL_PINS * sizeof(uint8_t));
   memset(output_states, 0, NR_OF_DIGITAL_PINS * sizeof(struct output_pin_state));
-  settings_t settings;
-  read_settings_from_eeprom(settings);
-  Serial.begin(BAUD_RATE);
-  if (settings.magic != MAGIC) {
-    settings.magic = MAGIC;
-    settings.slave_id = DEFAULT_SLAVE_ID;
-    write_settings_to_eeprom(settings);
-  }
-
+  load_settings();
+  link_setup();
+  diag_begin(DEFAULT_SLAVE_ID);
+  persist_recover();
+  build_group_index();
+  build_input_masks();
+  build_active_outputs();
   for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
-    digital_pin_setting_t pin_setting;
-    read_digital_pin_settings_from_eeprom(i, pin_setting);
-    pinMode(digital_pins_numbers[i], pin_mode(&pin_setting));
+    pinMode(digital_pins_numbers[i], arduino_pin_mode(digital_pin_settings[i].mode));
   }
+  dimming_begin();
+  input_begin();
+  input_levels = input_read_raw();
+  debouncer_reset(&input_debouncer, input_levels);
   
-  slave.cbVector[CB_READ_COILS] = cb_read_coil;
-  slave.cbVector[CB_WRITE_COILS] = cb_write_coil;
-  slave.cbVector[CB_READ_HOLDING_REGISTERS] = cb_read_holding_register;
-  slave.cbVector[CB_WRITE_HOLDING_REGISTERS] = cb_write_holding_register;
-  slave.cbVector[CB_READ_INPUT_REGISTERS] = cb_read_input_register;
-  slave.begin(BAUD_RATE);
+  slave.cbVector[CB_READ_COILS] = profiled_callback<cb_read_coil, PROFILE_CB_READ_COILS>;
+  slave.cbVector[CB_WRITE_COILS] = profiled_callback<cb_write_coil, PROFILE_CB_WRITE_COILS>;
+  slave.cbVector[CB_READ_HOLDING_REGISTERS] =
+    profiled_callback<cb_read_holding_register, PROFILE_CB_READ_HOLDING_REGISTERS>;
+  slave.cbVector[CB_WRITE_HOLDING_REGISTERS] =
+    profiled_callback<cb_write_holding_register, PROFILE_CB_WRITE_HOLDING_REGISTERS>;
+  slave.cbVector[CB_READ_INPUT_REGISTERS] =
+    profiled_callback<cb_read_input_register, PROFILE_CB_READ_INPUT_REGISTERS>;
+  fade_timer_begin();
 }
 
 // cppcheck-suppress unusedFunction
 void loop() {
-  slave.poll();
+  unsigned long loop_start = micros();
+  diag_poll();
+  // poll() returns non-zero when it answered a request
+  if (slave.poll()) {
+    profile_record(PROFILE_REQUEST, micros() - loop_start);
+  }
+  link_loop();
+  config_loop();
   loop_digital_pins();
+  soft_pwm_loop();
+  persist_loop();
+  scene_loop();
+  profile_record_loop(micros() - loop_start);
 };
 
 #endif
@@ -0,0 +1,212 @@
+#include "Arduino.h"
+#include <EEPROM.h>
+#include <stddef.h>
+#include <string.h>
+#include <homectrl.h>
+#include <persist.h>
+#include <profile.h>
+
+#define JOURNAL_CHECK_SALT 0xA5
+
+enum persist_state {
+  PERSIST_STATE_IDLE = 0,
+  PERSIST_STATE_CHECKPOINT,
+  PERSIST_STATE_ENTRY,
+};
+
+static uint8_t dirty[(NR_OF_DIGITAL_PINS + 7) / 8];
+static unsigned long first_change;
+static unsigned long last_change;
+
+// values as they are currently recoverable from EEPROM
+static uint8_t persisted_output_values[NR_OF_DIGITAL_PINS];
+static uint8_t persisted_pwm_on_values[NR_OF_DIGITAL_PINS];
+
+static enum persist_state state;
+static uint8_t journal_head;
+static uint8_t journal_seq;
+static journal_entry_t pending_entry;
+static uint8_t cursor;
+
+uint16_t persist_flush_count;
+
+static uint8_t journal_check(const journal_entry_t &entry) {
+  return entry.seq ^ entry.index ^ entry.output_value ^ entry.pwm_on_value ^ JOURNAL_CHECK_SALT;
+}
+
+static uint16_t journal_slot_address(uint8_t slot) {
+  return JOURNAL_OFFSET + slot * sizeof(journal_entry_t);
+}
+
+static uint8_t read_journal_entry(uint8_t slot, journal_entry_t &entry) {
+  EEPROM.get(journal_slot_address(slot), entry);
+  return entry.check == journal_check(entry) && entry.index < NR_OF_DIGITAL_PINS;
+}
+
+static uint8_t is_dirty(uint8_t index) {
+  return dirty[index >> 3] & (1 << (index & 0x7));
+}
+
+void persist_recover() {
+  int16_t newest = -1;
+  journal_entry_t entry;
+  for (uint8_t slot = 0; slot < JOURNAL_ENTRIES; slot++) {
+    if (!read_journal_entry(slot, entry)) {
+      continue;
+    }
+    if (newest < 0 || (int8_t) (entry.seq - journal_seq) > 0) {
+      newest = slot;
+      journal_seq = entry.seq;
+    }
+  }
+  if (newest < 0) {
+    journal_head = 0;
+    journal_seq = 0;
+  } else {
+    // replay from the oldest slot to the newest so the last entry wins
+    for (uint8_t i = 1; i <= JOURNAL_ENTRIES; i++) {
+      uint8_t slot = (newest + i) % JOURNAL_ENTRIES;
+      if (!read_journal_entry(slot, entry)) {
+        continue;
+      }
+      digital_pin_settings[entry.index].output_value = entry.output_value;
+      digital_pin_settings[entry.index].pwm_on_value = entry.pwm_on_value;
+    }
+    journal_head = (newest + 1) % JOURNAL_ENTRIES;
+    journal_seq++;
+  }
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    persisted_output_values[i] = digital_pin_settings[i].output_value;
+    persisted_pwm_on_values[i] = digital_pin_settings[i].pwm_on_value;
+  }
+  memset(dirty, 0, sizeof(dirty));
+  state = PERSIST_STATE_IDLE;
+}
+
+void persist_mark_dirty(uint8_t index) {
+  if (persist_pending_count() == 0) {
+    first_change = millis();
+  }
+  last_change = millis();
+  dirty[index >> 3] |= 1 << (index & 0x7);
+}
+
+uint8_t persist_pending_count() {
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    if (is_dirty(i)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+static int16_t next_dirty_pin() {
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    if (is_dirty(i)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void start_entry(uint8_t index) {
+  dirty[index >> 3] &= ~(1 << (index & 0x7));
+  pending_entry.seq = journal_seq;
+  pending_entry.index = index;
+  pending_entry.output_value = digital_pin_settings[index].output_value;
+  pending_entry.pwm_on_value = digital_pin_settings[index].pwm_on_value;
+  pending_entry.check = journal_check(pending_entry);
+  cursor = 0;
+  state = PERSIST_STATE_ENTRY;
+}
+
+/**
+ * Writes the next differing checkpoint byte, returns 0 when the pin
+ * settings records match the journaled values.
+ */
+static uint8_t step_checkpoint() {
+  while (cursor < NR_OF_DIGITAL_PINS * 2) {
+    uint8_t index = cursor >> 1;
+    uint16_t address = pin_setting_start_address(index);
+    uint8_t value;
+    if (cursor & 0x1) {
+      address += offsetof(digital_pin_setting_t, pwm_on_value);
+      value = persisted_pwm_on_values[index];
+    } else {
+      address += offsetof(digital_pin_setting_t, output_value);
+      value = persisted_output_values[index];
+    }
+    cursor++;
+    if (EEPROM.read(address) != value) {
+      unsigned long start = micros();
+      EEPROM.write(address, value);
+      profile_record(PROFILE_EEPROM_WRITE, micros() - start);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void step_entry() {
+  uint16_t address = journal_slot_address(journal_head) + cursor;
+  unsigned long start = micros();
+  EEPROM.write(address, ((uint8_t *) &pending_entry)[cursor]);
+  profile_record(PROFILE_EEPROM_WRITE, micros() - start);
+  cursor++;
+  if (cursor < sizeof(journal_entry_t)) {
+    return;
+  }
+  persisted_output_values[pending_entry.index] = pending_entry.output_value;
+  persisted_pwm_on_values[pending_entry.index] = pending_entry.pwm_on_value;
+  journal_head = (journal_head + 1) % JOURNAL_ENTRIES;
+  journal_seq++;
+  persist_flush_count++;
+  state = PERSIST_STATE_IDLE;
+}
+
+static uint8_t flush_due() {
+  if (persist_pending_count() == 0) {
+    return 0;
+  }
+  unsigned long now = millis();
+  return now - last_change >= PERSIST_QUIET_PERIOD || now - first_change >= PERSIST_MAX_DELAY;
+}
+
+static void persist_step() {
+  switch (state) {
+  case PERSIST_STATE_IDLE:
+    if (journal_head == 0) {
+      // the ring is about to overwrite its oldest entries
+      cursor = 0;
+      state = PERSIST_STATE_CHECKPOINT;
+    } else {
+      start_entry(next_dirty_pin());
+    }
+    break;
+  case PERSIST_STATE_CHECKPOINT:
+    if (!step_checkpoint()) {
+      start_entry(next_dirty_pin());
+    }
+    break;
+  case PERSIST_STATE_ENTRY:
+    step_entry();
+    break;
+  }
+}
+
+void persist_loop() {
+  if (!eeprom_is_ready()) {
+    return;
+  }
+  if (state == PERSIST_STATE_IDLE && !flush_due()) {
+    return;
+  }
+  persist_step();
+}
+
+void persist_flush() {
+  while (state != PERSIST_STATE_IDLE || persist_pending_count() > 0) {
+    persist_step();
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef PERSIST_h
+#define PERSIST_h
+
+#include <stdint.h>
+#include <homectrl.h>
+#include <scene.h>
+
+/**
+ * Deferred persistence of the runtime output values.
+ *
+ * output_value and pwm_on_value change on every ON/OFF/TOGGLE command. The
+ * new values are kept in digital_pin_settings and only marked dirty; once
+ * the outputs have been quiet for PERSIST_QUIET_PERIOD they are appended
+ * to a journal ring in the EEPROM after the scenes, one byte per loop
+ * pass so slave.poll() never waits for an EEPROM write.
+ *
+ * At boot the journal is replayed over the pin settings, the newest entry
+ * of each pin wins. Before the ring wraps the last journaled values are
+ * checkpointed into the pin settings records so overwritten entries are
+ * never lost.
+ */
+
+#define PERSIST_QUIET_PERIOD 2000
+#define PERSIST_MAX_DELAY 30000
+
+typedef struct __attribute__((__packed__)) {
+  uint8_t seq;
+  uint8_t index;
+  uint8_t output_value;
+  uint8_t pwm_on_value;
+  uint8_t check;
+} journal_entry_t;
+
+#define JOURNAL_OFFSET SCENE_END
+#define JOURNAL_MAX_ENTRIES 127
+#define JOURNAL_FREE_ENTRIES ((E2END + 1 - JOURNAL_OFFSET) / sizeof(journal_entry_t))
+#define JOURNAL_ENTRIES (JOURNAL_FREE_ENTRIES > JOURNAL_MAX_ENTRIES ? JOURNAL_MAX_ENTRIES : JOURNAL_FREE_ENTRIES)
+
+extern uint16_t persist_flush_count;
+
+void persist_recover();
+void persist_mark_dirty(uint8_t index);
+void persist_loop();
+void persist_flush();
+uint8_t persist_pending_count();
+
+#endif
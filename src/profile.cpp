@@ -0,0 +1,62 @@
+#include "Arduino.h"
+#include <string.h>
+#include <profile.h>
+
+static profile_stat_t profile_stats[PROFILE_SLOTS];
+static uint16_t loop_histogram[PROFILE_HISTOGRAM_BUCKETS];
+
+void profile_reset() {
+  memset(profile_stats, 0, sizeof(profile_stats));
+  memset(loop_histogram, 0, sizeof(loop_histogram));
+}
+
+void profile_record(uint8_t slot, unsigned long duration) {
+  profile_stat_t *stat = &profile_stats[slot];
+  uint16_t value = duration > 0xFFFF ? 0xFFFF : duration;
+  if (stat->count == 0xFFFF) {
+    // keep the mean meaningful instead of wrapping
+    stat->count /= 2;
+    stat->total /= 2;
+  }
+  if (stat->count == 0 || value < stat->min) {
+    stat->min = value;
+  }
+  stat->count++;
+  stat->total += value;
+  if (value > stat->max) {
+    stat->max = value;
+  }
+}
+
+void profile_record_loop(unsigned long duration) {
+  profile_record(PROFILE_LOOP, duration);
+  uint8_t bucket = 0;
+  while (duration > 1 && bucket < PROFILE_HISTOGRAM_BUCKETS - 1) {
+    duration >>= 1;
+    bucket++;
+  }
+  if (loop_histogram[bucket] < 0xFFFF) {
+    loop_histogram[bucket]++;
+  }
+}
+
+uint16_t profile_read_register(uint16_t offset) {
+  if (offset == 0) {
+    return PROFILE_SLOTS;
+  }
+  offset--;
+  if (offset >= 4 * PROFILE_SLOTS) {
+    return loop_histogram[offset - 4 * PROFILE_SLOTS];
+  }
+  profile_stat_t *stat = &profile_stats[offset / 4];
+  switch (offset % 4) {
+  case 0:
+    return stat->count;
+  case 1:
+    return stat->min;
+  case 2:
+    return stat->max;
+  default:
+    return stat->count ? stat->total / stat->count : 0;
+  }
+}
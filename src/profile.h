@@ -0,0 +1,51 @@
+#ifndef PROFILE_h
+#define PROFILE_h
+
+#include <stdint.h>
+
+/**
+ * Execution time statistics in microseconds.
+ *
+ * Every slot keeps a saturating sample count, min, max and the total used
+ * for the mean. Loop durations also go into a log2 histogram: bucket k
+ * counts passes that took between 2^k and 2^(k+1) - 1 us, the last bucket
+ * everything longer.
+ *
+ * Exposed as an input register block:
+ *
+ * 0: number of slots
+ * 1 + 4 * slot + 0: sample count
+ * 1 + 4 * slot + 1: min
+ * 1 + 4 * slot + 2: max
+ * 1 + 4 * slot + 3: mean
+ * 1 + 4 * PROFILE_SLOTS + k: loop histogram bucket k
+ */
+
+enum profile_slot {
+  PROFILE_LOOP = 0,
+  PROFILE_REQUEST,
+  PROFILE_CB_READ_COILS,
+  PROFILE_CB_WRITE_COILS,
+  PROFILE_CB_READ_HOLDING_REGISTERS,
+  PROFILE_CB_WRITE_HOLDING_REGISTERS,
+  PROFILE_CB_READ_INPUT_REGISTERS,
+  PROFILE_EEPROM_WRITE,
+  PROFILE_SLOTS
+};
+
+#define PROFILE_HISTOGRAM_BUCKETS 16
+#define PROFILE_REGISTERS (1 + 4 * PROFILE_SLOTS + PROFILE_HISTOGRAM_BUCKETS)
+
+typedef struct {
+  uint16_t count;
+  uint16_t min;
+  uint16_t max;
+  uint32_t total;
+} profile_stat_t;
+
+void profile_reset();
+void profile_record(uint8_t slot, unsigned long duration);
+void profile_record_loop(unsigned long duration);
+uint16_t profile_read_register(uint16_t offset);
+
+#endif
@@ -0,0 +1,103 @@
+#include "Arduino.h"
+#include <avr/pgmspace.h>
+#include <homectrl.h>
+#include <regmap.h>
+
+static uint16_t range_end(const regmap_range_t *range) {
+  return range->start + range->records * range->period;
+}
+
+static void load_range(const regmap_range_t *map, uint8_t index, regmap_range_t *range) {
+  memcpy_P(range, &map[index], sizeof(regmap_range_t));
+}
+
+/**
+ * Writes the registers of range that fall inside [first, last) to the
+ * response buffer, buffer index 0 being address.
+ */
+static void copy_range(const regmap_range_t *range, uint16_t address,
+                       uint16_t first, uint16_t last) {
+  uint16_t offset = first - range->start;
+  uint16_t record = offset / range->period;
+  uint8_t field = offset - record * range->period;
+  uint8_t size = range->type == REGMAP_WORD ? 2 : 1;
+  const uint8_t *record_source = (const uint8_t *) range->source + record * range->stride;
+  const uint8_t *source = record_source + field * size;
+
+  for (uint16_t i = first - address; i < last - address; i++) {
+    if (field < range->width) {
+      uint16_t value;
+      if (range->type == REGMAP_FUNCTION) {
+        value = range->read(record * range->width + field);
+      } else if (size == 2) {
+        value = *(const uint16_t *) source;
+      } else {
+        value = *source;
+      }
+      slave.writeRegisterToBuffer(i, value);
+      source += size;
+    }
+    if (++field == range->period) {
+      field = 0;
+      record++;
+      record_source += range->stride;
+      source = record_source;
+    }
+  }
+}
+
+uint8_t regmap_read(const regmap_range_t *map, uint8_t size, uint16_t address, uint16_t length) {
+  uint16_t last = address + length;
+  // a request running past 0xFFFF would wrap into the first window
+  if (last < address) {
+    return STATUS_ILLEGAL_DATA_ADDRESS;
+  }
+  uint8_t status = STATUS_ILLEGAL_DATA_ADDRESS;
+  uint8_t in_window = 0;
+  for (uint8_t i = 0; i < size; i++) {
+    regmap_range_t range;
+    load_range(map, i, &range);
+    uint16_t end = range_end(&range);
+    if (range.type == REGMAP_WINDOW) {
+      in_window = address >= range.start && last <= end;
+      if (in_window) {
+        status = STATUS_OK;
+        for (uint16_t j = 0; j < length; j++) {
+          slave.writeRegisterToBuffer(j, 0);
+        }
+      }
+      continue;
+    }
+    if (in_window && range.start < last && end > address) {
+      copy_range(&range, address,
+                 range.start > address ? range.start : address,
+                 end < last ? end : last);
+    }
+  }
+  return status;
+}
+
+uint16_t regmap_read_register(const regmap_range_t *map, uint8_t size, uint16_t address) {
+  for (uint8_t i = 0; i < size; i++) {
+    regmap_range_t range;
+    load_range(map, i, &range);
+    if (range.type == REGMAP_WINDOW || address < range.start || address >= range_end(&range)) {
+      continue;
+    }
+    uint16_t offset = address - range.start;
+    uint16_t record = offset / range.period;
+    uint8_t field = offset - record * range.period;
+    if (field >= range.width) {
+      continue;
+    }
+    if (range.type == REGMAP_FUNCTION) {
+      return range.read(record * range.width + field);
+    }
+    const uint8_t *source = (const uint8_t *) range.source + record * range.stride;
+    if (range.type == REGMAP_WORD) {
+      return *(const uint16_t *) (source + field * 2);
+    }
+    return source[field];
+  }
+  return 0;
+}
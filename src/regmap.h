@@ -0,0 +1,73 @@
+#ifndef REGMAP_h
+#define REGMAP_h
+
+#include <stdint.h>
+#include <homectrl.h>
+
+/**
+ * Declarative register map.
+ *
+ * A map is a PROGMEM table of ranges. Each range lays out a number of
+ * records of period registers starting at start; the first width
+ * registers of a record are taken from source, the rest read as 0. A
+ * record starts stride bytes after the previous one in source, so a range
+ * can point straight at an array of structs such as counters or
+ * digital_pin_settings.
+ *
+ * REGMAP_WINDOW ranges have no source. They define which addresses a
+ * request may cover and read as 0 until a later range fills them in, so
+ * every window must come before the ranges inside it.
+ *
+ * A bulk read visits every range once: the first record and field are
+ * computed with a single division, after that the registers are copied
+ * into the Modbus buffer walking the source with a pointer.
+ */
+
+enum regmap_type {
+  REGMAP_WINDOW = 0,
+  REGMAP_BYTE,
+  REGMAP_WORD,
+  REGMAP_FUNCTION,
+};
+
+// returns the register at offset, counting only the width registers of each record
+typedef uint16_t (*regmap_read_t)(uint16_t offset);
+
+typedef struct {
+  uint16_t start;
+  uint16_t records;
+  uint8_t period;
+  uint8_t width;
+  uint8_t stride;
+  uint8_t type;
+  const void *source;
+  regmap_read_t read;
+} regmap_range_t;
+
+#define REGMAP_WINDOW_RANGE(start, size) \
+  {(start), (size), 1, 0, 0, REGMAP_WINDOW, NULL, NULL}
+#define REGMAP_BYTE_RANGE(start, records, period, width, stride, source) \
+  {(start), (records), (period), (width), (stride), REGMAP_BYTE, (source), NULL}
+#define REGMAP_WORD_RANGE(start, records, period, width, stride, source) \
+  {(start), (records), (period), (width), (stride), REGMAP_WORD, (source), NULL}
+#define REGMAP_FUNCTION_RANGE(start, size, read) \
+  {(start), 1, (size), (size), 0, REGMAP_FUNCTION, NULL, (read)}
+
+#define REGMAP_FUNCTION_RECORDS(start, records, period, width, read) \
+  {(start), (records), (period), (width), 0, REGMAP_FUNCTION, NULL, (read)}
+
+#define REGMAP_SIZE(map) (sizeof(map) / sizeof(regmap_range_t))
+
+/**
+ * Copies length registers starting at address into the response buffer of
+ * slave. Returns STATUS_ILLEGAL_DATA_ADDRESS if no single window covers
+ * the whole request.
+ */
+uint8_t regmap_read(const regmap_range_t *map, uint8_t size, uint16_t address, uint16_t length);
+
+/**
+ * Returns the register at address, 0 for unmapped addresses.
+ */
+uint16_t regmap_read_register(const regmap_range_t *map, uint8_t size, uint16_t address);
+
+#endif
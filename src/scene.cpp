@@ -0,0 +1,69 @@
+#include "Arduino.h"
+#include <EEPROM.h>
+#include <stddef.h>
+#include <homectrl.h>
+#include <scene.h>
+#include <profile.h>
+
+#define SCENE_NONE 0xFF
+
+static scene_t pending_scene;
+static uint8_t pending_index = SCENE_NONE;
+static uint8_t cursor;
+
+static uint16_t scene_address(uint8_t index) {
+  return SCENE_OFFSET + index * sizeof(scene_t);
+}
+
+uint8_t scene_load(uint8_t index, scene_t *scene) {
+  if (index == pending_index) {
+    *scene = pending_scene;
+    return 1;
+  }
+  EEPROM.get(scene_address(index), *scene);
+  return scene->magic == SCENE_MAGIC;
+}
+
+uint8_t scene_store(uint8_t index, const scene_t *scene) {
+  if (pending_index != SCENE_NONE && pending_index != index) {
+    return 0;
+  }
+  pending_scene = *scene;
+  pending_scene.magic = SCENE_MAGIC;
+  pending_index = index;
+  cursor = 0;
+  return 1;
+}
+
+uint8_t scene_store_pending() {
+  return pending_index != SCENE_NONE;
+}
+
+void scene_loop() {
+  if (pending_index == SCENE_NONE || !eeprom_is_ready()) {
+    return;
+  }
+  // the magic is cleared first and written last, so a half written scene
+  // is never recalled after a reset
+  uint8_t offset = cursor;
+  uint8_t value = 0;
+  if (cursor == sizeof(scene_t)) {
+    offset = offsetof(scene_t, magic);
+    value = SCENE_MAGIC;
+  } else if (cursor != offsetof(scene_t, magic)) {
+    value = ((uint8_t *) &pending_scene)[cursor];
+  }
+  unsigned long start = micros();
+  EEPROM.update(scene_address(pending_index) + offset, value);
+  profile_record(PROFILE_EEPROM_WRITE, micros() - start);
+  if (cursor++ == sizeof(scene_t)) {
+    pending_index = SCENE_NONE;
+  }
+}
+
+void scene_forget_all() {
+  // erased, which costs no write on a new chip
+  for (uint8_t i = 0; i < SCENE_COUNT; i++) {
+    EEPROM.update(scene_address(i) + offsetof(scene_t, magic), 0xFF);
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef SCENE_h
+#define SCENE_h
+
+#include <stdint.h>
+#include <homectrl.h>
+
+/**
+ * Scenes: stored output levels for a set of outputs, recalled with one
+ * register write or a COMMAND_SCENE_RECALL button command.
+ *
+ * The scenes live in the EEPROM right after the pin settings, the persist
+ * journal follows them. Every scene holds the outputs it applies to, and
+ * per output the level and the fade time in FADE_TIME_UNIT (0 selects
+ * FADE_DEFAULT_TIME, like the fade_time setting). On recall all PWM
+ * members start fading at once, other outputs switch on for any non zero
+ * level.
+ *
+ * Storing a scene writes one byte per scene_loop() pass, like the persist
+ * journal, so a capture never blocks the Modbus response.
+ */
+
+#define SCENE_MAGIC 0x5C
+
+typedef struct __attribute__((__packed__)) {
+  uint8_t magic;
+  pin_mask_t members;
+  uint8_t level[NR_OF_DIGITAL_PINS];
+  uint8_t fade_time[NR_OF_DIGITAL_PINS];
+} scene_t;
+
+#define SCENE_OFFSET (SETTINGS_OFFSET + sizeof(settings_t) + NR_OF_DIGITAL_PINS * sizeof(digital_pin_setting_t))
+#define SCENE_END (SCENE_OFFSET + SCENE_COUNT * sizeof(scene_t))
+
+/**
+ * Loads scene index, including a store that is still in progress. Returns
+ * 0 if the scene was never stored.
+ */
+uint8_t scene_load(uint8_t index, scene_t *scene);
+
+/**
+ * Queues scene index for writing. Returns 0 while an earlier store is
+ * still being written.
+ */
+uint8_t scene_store(uint8_t index, const scene_t *scene);
+uint8_t scene_store_pending();
+void scene_loop();
+
+/**
+ * Marks every scene as never stored. For EEPROM that held something else
+ * before, see load_settings().
+ */
+void scene_forget_all();
+
+#endif
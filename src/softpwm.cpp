@@ -0,0 +1,213 @@
+#include "Arduino.h"
+#include <string.h>
+#include <util/atomic.h>
+#include <homectrl.h>
+#include <softpwm.h>
+
+typedef struct {
+  uint8_t port;
+  uint8_t mask;
+  volatile uint8_t duty;
+} soft_pwm_channel_t;
+
+static volatile uint8_t *ports[SOFT_PWM_MAX_PORTS];
+static uint8_t port_count;
+static soft_pwm_channel_t channels[SOFT_PWM_MAX_CHANNELS];
+static uint8_t channel_count;
+
+static soft_pwm_frame_t frames[2];
+static volatile uint8_t active_frame;
+static volatile uint8_t frame_pending;
+static volatile uint8_t duties_changed;
+// next compare point of the active frame
+static uint8_t next_point;
+
+void soft_pwm_reset() {
+  port_count = 0;
+  channel_count = 0;
+  memset(frames, 0, sizeof(frames));
+  active_frame = 0;
+  frame_pending = 0;
+  duties_changed = 0;
+  next_point = 0;
+}
+
+static uint8_t find_port(volatile uint8_t *port) {
+  for (uint8_t i = 0; i < port_count; i++) {
+    if (ports[i] == port) {
+      return i;
+    }
+  }
+  return SOFT_PWM_NONE;
+}
+
+static uint8_t find_channel(uint8_t port, uint8_t mask) {
+  for (uint8_t i = 0; i < channel_count; i++) {
+    if (channels[i].port == port && channels[i].mask == mask) {
+      return i;
+    }
+  }
+  return SOFT_PWM_NONE;
+}
+
+static uint8_t add_channel(volatile uint8_t *port, uint8_t mask) {
+  uint8_t port_index = find_port(port);
+  if (port_index == SOFT_PWM_NONE) {
+    if (port_count == SOFT_PWM_MAX_PORTS) {
+      return SOFT_PWM_NONE;
+    }
+    port_index = port_count;
+    ports[port_count++] = port;
+  }
+  uint8_t channel = find_channel(port_index, mask);
+  if (channel != SOFT_PWM_NONE) {
+    return channel;
+  }
+  if (channel_count == SOFT_PWM_MAX_CHANNELS) {
+    return SOFT_PWM_NONE;
+  }
+  channel = channel_count++;
+  channels[channel].port = port_index;
+  channels[channel].mask = mask;
+  channels[channel].duty = 0;
+  return channel;
+}
+
+uint8_t soft_pwm_attach(volatile uint8_t *port, uint8_t mask) {
+  uint8_t channel;
+  // the fade interrupt attaches while the main loop may be detaching
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    channel = add_channel(port, mask);
+  }
+  return channel;
+}
+
+static void strip_frame(soft_pwm_frame_t *frame, uint8_t port, uint8_t mask) {
+  frame->set[port] &= ~mask;
+  for (uint8_t i = 0; i < frame->count; i++) {
+    frame->points[i].clear[port] &= ~mask;
+  }
+}
+
+void soft_pwm_detach(volatile uint8_t *port, uint8_t mask) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint8_t port_index = find_port(port);
+    if (port_index == SOFT_PWM_NONE) {
+      return;
+    }
+    uint8_t channel = find_channel(port_index, mask);
+    if (channel == SOFT_PWM_NONE) {
+      return;
+    }
+    // neither frame may touch the bit once the pin is used otherwise
+    strip_frame(&frames[0], port_index, mask);
+    strip_frame(&frames[1], port_index, mask);
+    *port &= ~mask;
+    channels[channel] = channels[--channel_count];
+  }
+}
+
+void soft_pwm_write(uint8_t channel, uint8_t duty) {
+  if (channels[channel].duty != duty) {
+    channels[channel].duty = duty;
+    duties_changed = 1;
+  }
+}
+
+/**
+ * Sorts the channels into compare points, merging equal duties.
+ */
+static void build_frame(soft_pwm_frame_t *frame) {
+  memset(frame, 0, sizeof(soft_pwm_frame_t));
+  for (uint8_t c = 0; c < channel_count; c++) {
+    uint8_t duty = channels[c].duty;
+    if (duty == 0) {
+      continue;
+    }
+    frame->set[channels[c].port] |= channels[c].mask;
+    if (duty == 0xFF) {
+      continue;
+    }
+    uint8_t i = 0;
+    while (i < frame->count && frame->points[i].time < duty) {
+      i++;
+    }
+    if (i == frame->count || frame->points[i].time != duty) {
+      memmove(&frame->points[i + 1], &frame->points[i], (frame->count - i) * sizeof(soft_pwm_point_t));
+      memset(&frame->points[i], 0, sizeof(soft_pwm_point_t));
+      frame->points[i].time = duty;
+      frame->count++;
+    }
+    frame->points[i].clear[channels[c].port] |= channels[c].mask;
+  }
+}
+
+void soft_pwm_loop() {
+  if (!duties_changed) {
+    return;
+  }
+  // keep the overflow from swapping in the frame while it is rebuilt
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    frame_pending = 0;
+  }
+  duties_changed = 0;
+  build_frame(&frames[active_frame ^ 1]);
+  frame_pending = 1;
+}
+
+uint8_t soft_pwm_compare(uint8_t now) {
+  const soft_pwm_frame_t *frame = &frames[active_frame];
+  while (next_point < frame->count &&
+         frame->points[next_point].time <= (uint16_t) now + SOFT_PWM_MIN_GAP) {
+    const soft_pwm_point_t *point = &frame->points[next_point++];
+    for (uint8_t p = 0; p < port_count; p++) {
+      if (point->clear[p]) {
+        *ports[p] &= ~point->clear[p];
+      }
+    }
+  }
+  if (next_point < frame->count) {
+    return frame->points[next_point].time;
+  }
+  // already passed, does not match again before the next overflow
+  return now;
+}
+
+uint8_t soft_pwm_period_start(uint8_t now) {
+  if (frame_pending) {
+    active_frame ^= 1;
+    frame_pending = 0;
+  }
+  const soft_pwm_frame_t *frame = &frames[active_frame];
+  for (uint8_t p = 0; p < port_count; p++) {
+    if (frame->set[p]) {
+      *ports[p] |= frame->set[p];
+    }
+  }
+  next_point = 0;
+  return soft_pwm_compare(now);
+}
+
+const soft_pwm_frame_t *soft_pwm_frame() {
+  return &frames[active_frame];
+}
+
+#ifdef __AVR__
+ISR(TIMER2_OVF_vect) {
+  OCR2A = soft_pwm_period_start(TCNT2);
+}
+
+ISR(TIMER2_COMPA_vect) {
+  OCR2A = soft_pwm_compare(TCNT2);
+}
+
+void soft_pwm_begin() {
+  // normal mode, which also disconnects OC2A and OC2B, clk/64
+  TCCR2A = 0;
+  TCCR2B = _BV(CS22);
+  TIMSK2 = _BV(TOIE2) | _BV(OCIE2A);
+}
+#else
+void soft_pwm_begin() {
+}
+#endif
@@ -0,0 +1,76 @@
+#ifndef SOFTPWM_h
+#define SOFTPWM_h
+
+#include <stdint.h>
+#include <homectrl.h>
+
+/**
+ * Software PWM for output pins without a usable hardware PWM channel.
+ *
+ * Timer2 runs in normal mode with prescaler 64, one PWM period being one
+ * 256 step timer cycle (488 Hz at 8 MHz). At the overflow every channel
+ * with a non zero duty is switched on, then the compare A interrupt walks
+ * a list of compare points sorted by time. A point holds the bits to
+ * clear in every port, so channels that share a duty cost one port write
+ * per port whatever their number, and a period takes at most one
+ * interrupt per distinct duty plus the overflow. Points closer than
+ * SOFT_PWM_MIN_GAP steps to the current count run in the same interrupt,
+ * because a compare value the timer has already passed would only match
+ * in the next period.
+ *
+ * New duties are sorted into a back frame by soft_pwm_loop() in the main
+ * loop and swapped in by the overflow interrupt, so a period always runs
+ * one consistent frame and the interrupts never sort.
+ *
+ * Timer2 is taken from its hardware PWM pins 3 and 11, they become
+ * software PWM channels as well.
+ */
+
+#define SOFT_PWM_MAX_CHANNELS NR_OF_DIGITAL_PINS
+#define SOFT_PWM_MAX_PORTS BOARD_PORTS
+#define SOFT_PWM_MIN_GAP 2
+#define SOFT_PWM_NONE 0xFF
+
+typedef struct {
+  uint8_t time;
+  uint8_t clear[SOFT_PWM_MAX_PORTS];
+} soft_pwm_point_t;
+
+typedef struct {
+  uint8_t set[SOFT_PWM_MAX_PORTS];
+  uint8_t count;
+  soft_pwm_point_t points[SOFT_PWM_MAX_CHANNELS];
+} soft_pwm_frame_t;
+
+void soft_pwm_reset();
+
+/**
+ * Returns the channel driving mask of port, adding one if needed.
+ * Returns SOFT_PWM_NONE when all channels or ports are taken. Safe to
+ * call from interrupt context, the fade tick attaches dimmers.
+ */
+uint8_t soft_pwm_attach(volatile uint8_t *port, uint8_t mask);
+
+/**
+ * Stops the channel of mask on port and leaves its bit low.
+ */
+void soft_pwm_detach(volatile uint8_t *port, uint8_t mask);
+
+/**
+ * Sets the duty of channel, in 1/256 of a period; 0xFF is always on.
+ * Safe to call from interrupt context.
+ */
+void soft_pwm_write(uint8_t channel, uint8_t duty);
+void soft_pwm_loop();
+
+/**
+ * Interrupt handlers, split out for the host tests. Both take the timer
+ * count at entry and return the next compare value.
+ */
+uint8_t soft_pwm_period_start(uint8_t now);
+uint8_t soft_pwm_compare(uint8_t now);
+
+const soft_pwm_frame_t *soft_pwm_frame();
+void soft_pwm_begin();
+
+#endif
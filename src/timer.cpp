@@ -0,0 +1,101 @@
+#include "Arduino.h"
+#include <string.h>
+#include <homectrl.h>
+#include <timer.h>
+
+#define TIMER_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+// links hold index + 1, 0 ends a list
+#define TIMER_LINK_END 0
+
+typedef struct {
+  uint8_t next;
+  uint8_t slot;
+  uint8_t action;
+  uint16_t rounds;
+} timer_entry_t;
+
+static timer_entry_t timers[NR_OF_DIGITAL_PINS];
+static uint8_t slots[TIMER_WHEEL_SLOTS];
+static uint8_t current_slot;
+static unsigned long last_tick;
+
+static void link_timer(uint8_t index) {
+  timer_entry_t *timer = &timers[index];
+  timer->next = slots[timer->slot];
+  slots[timer->slot] = index + 1;
+}
+
+static void unlink_timer(uint8_t index) {
+  uint8_t *link = &slots[timers[index].slot];
+  while (*link != index + 1) {
+    link = &timers[*link - 1].next;
+  }
+  *link = timers[index].next;
+}
+
+void timer_reset() {
+  memset(timers, 0, sizeof(timers));
+  memset(slots, TIMER_LINK_END, sizeof(slots));
+  current_slot = 0;
+  last_tick = millis();
+}
+
+void timer_start(uint8_t index, uint8_t action, uint32_t ticks) {
+  timer_cancel(index);
+  if (ticks == 0) {
+    ticks = 1;
+  }
+  timer_entry_t *timer = &timers[index];
+  timer->slot = (current_slot + ticks) & TIMER_SLOT_MASK;
+  timer->rounds = (ticks - 1) / TIMER_WHEEL_SLOTS;
+  timer->action = action;
+  link_timer(index);
+}
+
+void timer_cancel(uint8_t index) {
+  if (timers[index].action == TIMER_NONE) {
+    return;
+  }
+  unlink_timer(index);
+  timers[index].action = TIMER_NONE;
+}
+
+uint8_t timer_action(uint8_t index) {
+  return timers[index].action;
+}
+
+uint32_t timer_remaining(uint8_t index) {
+  const timer_entry_t *timer = &timers[index];
+  if (timer->action == TIMER_NONE) {
+    return 0;
+  }
+  uint8_t distance = (timer->slot - current_slot - 1) & TIMER_SLOT_MASK;
+  return distance + 1 + (uint32_t) timer->rounds * TIMER_WHEEL_SLOTS;
+}
+
+void timer_tick() {
+  current_slot = (current_slot + 1) & TIMER_SLOT_MASK;
+  // detach the slot first, timer_expired() may link new timers into it
+  uint8_t link = slots[current_slot];
+  slots[current_slot] = TIMER_LINK_END;
+  while (link != TIMER_LINK_END) {
+    uint8_t index = link - 1;
+    timer_entry_t *timer = &timers[index];
+    link = timer->next;
+    if (timer->rounds > 0) {
+      timer->rounds--;
+      link_timer(index);
+    } else {
+      uint8_t action = timer->action;
+      timer->action = TIMER_NONE;
+      timer_expired(index, action);
+    }
+  }
+}
+
+void timer_loop() {
+  while (millis() - last_tick >= TIMER_TICK_MS) {
+    last_tick += TIMER_TICK_MS;
+    timer_tick();
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef TIMER_h
+#define TIMER_h
+
+#include <stdint.h>
+#include <homectrl.h>
+
+/**
+ * Hashed timer wheel for the per-pin timed commands.
+ *
+ * Every pin index owns at most one timer. A timer due in ticks lands in
+ * slot (current + ticks) % TIMER_WHEEL_SLOTS and goes around the wheel
+ * (ticks - 1) / TIMER_WHEEL_SLOTS more times before it fires. A tick only
+ * walks the list of the slot it reaches, so the cost per tick does not
+ * grow with the number of pins that have a timer pending, and pins without
+ * a timer cost nothing.
+ *
+ * timer_loop() advances the wheel from millis() and calls timer_expired()
+ * for every timer that fires. timer_expired() may start or cancel the
+ * timer of the index it was called for, but no other.
+ */
+
+#define TIMER_TICK_MS 100
+#define TIMER_WHEEL_SLOTS 32
+// actions are non zero, a zeroed wheel holds no timers
+#define TIMER_NONE 0
+
+static_assert((TIMER_WHEEL_SLOTS & (TIMER_WHEEL_SLOTS - 1)) == 0,
+              "TIMER_WHEEL_SLOTS must be a power of two");
+
+void timer_reset();
+
+/**
+ * Schedules action for index in ticks, replacing a timer index already has.
+ */
+void timer_start(uint8_t index, uint8_t action, uint32_t ticks);
+void timer_cancel(uint8_t index);
+
+/**
+ * Returns the action pending for index, TIMER_NONE if there is none.
+ */
+uint8_t timer_action(uint8_t index);
+
+/**
+ * Returns the number of ticks until the timer of index fires, 0 if none.
+ */
+uint32_t timer_remaining(uint8_t index);
+
+void timer_tick();
+void timer_loop();
+
+// implemented by the firmware
+void timer_expired(uint8_t index, uint8_t action);
+
+#endif
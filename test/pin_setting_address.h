@@ -0,0 +1,14 @@
+#ifndef PIN_SETTING_ADDRESS_H
+#define PIN_SETTING_ADDRESS_H
+
+#include <stddef.h>
+#include <homectrl.h>
+
+/**
+ * Holding register of field in the settings of pin index. The pin records
+ * follow settings_t.
+ */
+#define PIN_SETTING_ADDRESS(index, field) \
+  (sizeof(settings_t) + (index) * sizeof(digital_pin_setting_t) + offsetof(digital_pin_setting_t, field))
+
+#endif
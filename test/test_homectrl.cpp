@@ -47,6 +47,11 @@ void test_r_setting_group_p2(void) {
   TEST_ASSERT_EQUAL(23, pin_ctx.settings.group);
 }
 
+void test_write_setting_updates_settings_cache(void) {
+  write_setting(8 + (2 * 16) + 3, COMMAND_TOGGLE);
+  TEST_ASSERT_EQUAL(COMMAND_TOGGLE, digital_pin_settings[pinidx].click_command);
+}
+
 void test_write_setting_mode_pin_2(void) {
   pin_ctx.settings.mode=DIGITAL_PIN_MODE_OUTPUT;
   write_digital_pin_settings_to_eeprom(pinidx, pin_ctx.settings);
@@ -56,13 +61,13 @@ void test_write_setting_mode_pin_2(void) {
 
 void test_read_click_cnt_pin_2(void) {
   counters[2].click_cnt=5;
-  uint16_t value = read_single_input_register(8 + 2*8 + 1);
+  uint16_t value = read_single_input_register(8 + 2*12 + 2);
   TEST_ASSERT_EQUAL(5, value);
 }
 
 void test_read_release_cnt_pin_2(void) {
   counters[2].release_cnt=5;
-  uint16_t value = read_single_input_register(8 + 2*8 + 5);
+  uint16_t value = read_single_input_register(8 + 2*12 + 10);
   TEST_ASSERT_EQUAL(5, value);
 }
 
@@ -78,6 +83,7 @@ void setup() {
   RUN_TEST(test_write_setting_mode_pin_2);
   RUN_TEST(test_read_setting_slave_id);
   RUN_TEST(test_r_setting_group_p2);
+  RUN_TEST(test_write_setting_updates_settings_cache);
   RUN_TEST(test_read_click_cnt_pin_2);
   RUN_TEST(test_read_release_cnt_pin_2);
   UNITY_END();
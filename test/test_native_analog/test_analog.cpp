@@ -0,0 +1,169 @@
+#include <unity.h>
+#include <stddef.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <analog.h>
+#include "../pin_setting_address.h"
+
+// A0 on the pro mini
+#define ANALOG_PIN_INDEX 4
+#define OUTPUT_PIN_INDEX 5
+#define ANALOG_REGISTERS 0x400
+
+extern pin_mask_t analog_primed;
+
+/**
+ * Feeds one value worth of samples, sample k of the stream is
+ * samples[k % length].
+ */
+void push_samples(const uint16_t *samples, uint8_t length) {
+  for (uint8_t k = 0; k < ANALOG_OVERSAMPLING; k++) {
+    analog_push(ANALOG_PIN_INDEX, samples[k % length]);
+  }
+}
+
+void push_constant(uint16_t sample) {
+  push_samples(&sample, 1);
+}
+
+void setUp() {
+  mock_reset();
+  EEPROM.clear(0);
+  load_digital_pin_settings();
+  analog_primed = 0;
+  memset(current_values, 0, NR_OF_DIGITAL_PINS);
+  memset(output_states, 0, NR_OF_DIGITAL_PINS * sizeof(struct output_pin_state));
+  write_setting(PIN_SETTING_ADDRESS(ANALOG_PIN_INDEX, mode), DIGITAL_PIN_MODE_ANALOG);
+  write_setting(PIN_SETTING_ADDRESS(ANALOG_PIN_INDEX, group), 3);
+  write_setting(PIN_SETTING_ADDRESS(ANALOG_PIN_INDEX, signal_rise_command), COMMAND_ON);
+  write_setting(PIN_SETTING_ADDRESS(ANALOG_PIN_INDEX, signal_fall_command), COMMAND_OFF);
+  // rises at 2048, falls below 1024
+  write_setting(PIN_SETTING_ADDRESS(ANALOG_PIN_INDEX, analog_rise_level), 0x80);
+  write_setting(PIN_SETTING_ADDRESS(ANALOG_PIN_INDEX, analog_fall_level), 0x40);
+  write_setting(PIN_SETTING_ADDRESS(OUTPUT_PIN_INDEX, mode), DIGITAL_PIN_MODE_OUTPUT);
+  write_setting(PIN_SETTING_ADDRESS(OUTPUT_PIN_INDEX, group), 3);
+  loop_digital_pins();
+}
+
+void test_value_is_ready_after_oversampling(void) {
+  analog_filter_t filter = {0, 0};
+  uint16_t value = 0;
+  for (uint8_t k = 1; k < ANALOG_OVERSAMPLING; k++) {
+    TEST_ASSERT_FALSE(analog_filter_push(&filter, 512, &value));
+  }
+  TEST_ASSERT_TRUE(analog_filter_push(&filter, 512, &value));
+  TEST_ASSERT_EQUAL(2048, value);
+  // the next value starts from scratch
+  for (uint8_t k = 0; k < ANALOG_OVERSAMPLING; k++) {
+    analog_filter_push(&filter, 1023, &value);
+  }
+  TEST_ASSERT_EQUAL(4092, value);
+}
+
+void test_dither_resolves_between_counts(void) {
+  // half way and a quarter way between two counts
+  const uint16_t half[] = {511, 512};
+  push_samples(half, 2);
+  TEST_ASSERT_EQUAL(2046, analog_value(ANALOG_PIN_INDEX));
+  const uint16_t quarter[] = {513, 512, 512, 512};
+  push_samples(quarter, 4);
+  TEST_ASSERT_EQUAL(2049, analog_value(ANALOG_PIN_INDEX));
+}
+
+void test_noise_averages_out(void) {
+  // 300.4 counts with up to 2 counts of noise
+  uint32_t seed = 1;
+  uint16_t samples[ANALOG_OVERSAMPLING];
+  for (uint8_t k = 0; k < ANALOG_OVERSAMPLING; k++) {
+    seed = seed * 1103515245 + 12345;
+    samples[k] = 298 + (k % 5 < 2) + (seed >> 16) % 5;
+  }
+  push_samples(samples, ANALOG_OVERSAMPLING);
+  uint16_t value = analog_value(ANALOG_PIN_INDEX);
+  TEST_ASSERT_TRUE(value >= 1201 - 8 && value <= 1201 + 8);
+}
+
+void test_ramp_is_followed(void) {
+  // a slow ramp, one count per value
+  for (uint16_t sample = 0; sample < 1024; sample += 64) {
+    push_constant(sample);
+    TEST_ASSERT_EQUAL(sample * 4, analog_value(ANALOG_PIN_INDEX));
+  }
+  TEST_ASSERT_EQUAL(1 << ANALOG_PIN_INDEX, analog_take_ready());
+  TEST_ASSERT_EQUAL(0, analog_take_ready());
+}
+
+void test_hysteresis(void) {
+  TEST_ASSERT_EQUAL(1, analog_threshold(0, 2048, 0x80, 0x40));
+  TEST_ASSERT_EQUAL(1, analog_threshold(1, 1024, 0x80, 0x40));
+  TEST_ASSERT_EQUAL(0, analog_threshold(0, 2047, 0x80, 0x40));
+  TEST_ASSERT_EQUAL(0, analog_threshold(1, 1023, 0x80, 0x40));
+  // a fall level above the rise level counts as the rise level
+  TEST_ASSERT_EQUAL(1, analog_threshold(1, 2048, 0x80, 0xC0));
+  TEST_ASSERT_EQUAL(0, analog_threshold(1, 2047, 0x80, 0xC0));
+}
+
+void test_thresholds_fire_the_group(void) {
+  // the first value only sets the state
+  push_constant(600);
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(1, current_values[ANALOG_PIN_INDEX]);
+  TEST_ASSERT_EQUAL(0, current_values[OUTPUT_PIN_INDEX]);
+  push_constant(200);
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(0, current_values[ANALOG_PIN_INDEX]);
+  push_constant(400);
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(0, current_values[OUTPUT_PIN_INDEX]);
+  push_constant(512);
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(1, current_values[ANALOG_PIN_INDEX]);
+  TEST_ASSERT_EQUAL(1, current_values[OUTPUT_PIN_INDEX]);
+  push_constant(300);
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(1, current_values[OUTPUT_PIN_INDEX]);
+  push_constant(255);
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(0, current_values[OUTPUT_PIN_INDEX]);
+}
+
+void test_values_are_input_registers(void) {
+  push_constant(700);
+  TEST_ASSERT_EQUAL(2800, read_single_input_register(ANALOG_REGISTERS + ANALOG_PIN_INDEX));
+  TEST_ASSERT_EQUAL(0, read_single_input_register(ANALOG_REGISTERS + OUTPUT_PIN_INDEX));
+}
+
+void test_analog_mode_needs_an_analog_input(void) {
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_VALUE, write_setting(PIN_SETTING_ADDRESS(0, mode), DIGITAL_PIN_MODE_ANALOG));
+  // back to a digital input, the value is gone
+  push_constant(700);
+  write_setting(PIN_SETTING_ADDRESS(ANALOG_PIN_INDEX, mode), DIGITAL_PIN_MODE_INPUT);
+  TEST_ASSERT_EQUAL(0, read_single_input_register(ANALOG_REGISTERS + ANALOG_PIN_INDEX));
+}
+
+void test_other_settings_keep_the_conversion(void) {
+  for (uint8_t k = 0; k < ANALOG_OVERSAMPLING / 2; k++) {
+    analog_push(ANALOG_PIN_INDEX, 700);
+  }
+  write_setting(PIN_SETTING_ADDRESS(OUTPUT_PIN_INDEX, group), 4);
+  write_setting(PIN_SETTING_ADDRESS(ANALOG_PIN_INDEX, group_mask), 1);
+  for (uint8_t k = 0; k < ANALOG_OVERSAMPLING / 2; k++) {
+    analog_push(ANALOG_PIN_INDEX, 700);
+  }
+  TEST_ASSERT_EQUAL(2800, analog_value(ANALOG_PIN_INDEX));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_value_is_ready_after_oversampling);
+  RUN_TEST(test_dither_resolves_between_counts);
+  RUN_TEST(test_noise_averages_out);
+  RUN_TEST(test_ramp_is_followed);
+  RUN_TEST(test_hysteresis);
+  RUN_TEST(test_thresholds_fire_the_group);
+  RUN_TEST(test_values_are_input_registers);
+  RUN_TEST(test_analog_mode_needs_an_analog_input);
+  RUN_TEST(test_other_settings_keep_the_conversion);
+  return UNITY_END();
+}
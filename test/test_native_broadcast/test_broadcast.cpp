@@ -0,0 +1,272 @@
+#include <unity.h>
+#include <new>
+#include <stddef.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <fade.h>
+#include <events.h>
+#include "../pin_setting_address.h"
+
+/**
+ * Several nodes on one virtual bus. Every node is a forked copy of the
+ * firmware with its own slave id, talking Modbus RTU over a socket. The
+ * test acts as the master: every frame it sends reaches all nodes, like
+ * on RS-485, and it checks that only the addressed node answers.
+ */
+
+#define NODES 3
+#define SCENE_GROUP 5
+#define OTHER_GROUP 6
+#define OTHER_PIN_INDEX 0
+#define FIRST_SCENE_PIN_INDEX 8
+#define SCENE_PINS 4
+#define RESPONSE_TIMEOUT_MS 200
+#define SILENCE_MS 50
+#define SYNC_TOLERANCE_MS 50
+#define GROUP_COMMAND(group, command) ((group) << 8 | (command))
+
+#define BROADCAST_ID 0
+#define GROUP_COMMAND_REGISTER 0x103
+#define ARM_GROUP_COMMAND_REGISTER 0x104
+#define COMMIT_REGISTER 0x105
+#define EVENT_QUEUE_REGISTER 0x204
+
+int bus[NODES];
+pid_t nodes[NODES];
+
+uint16_t crc16(const uint8_t *data, uint8_t length) {
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+  }
+  return crc;
+}
+
+void run_node(int fd, uint8_t id) {
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  mock_serial_attach(fd);
+  // the library has no setter for the unit id
+  new (&slave) Modbus(Serial, id, RS485_CTRL_PIN);
+  slave.cbVector[CB_READ_COILS] = cb_read_coil;
+  slave.cbVector[CB_WRITE_COILS] = cb_write_coil;
+  slave.cbVector[CB_READ_HOLDING_REGISTERS] = cb_read_holding_register;
+  slave.cbVector[CB_WRITE_HOLDING_REGISTERS] = cb_write_holding_register;
+  slave.cbVector[CB_READ_INPUT_REGISTERS] = cb_read_input_register;
+  slave.begin(BAUD_RATE);
+  fade_timer_begin();
+  while (true) {
+    slave.poll();
+    loop_digital_pins();
+    mock_run_timers();
+    usleep(100);
+  }
+}
+
+void setUp() {
+  mock_reset();
+  // shared by all nodes so their timestamps compare
+  mock_use_realtime_clock();
+  EEPROM.clear(0);
+  load_settings();
+  load_digital_pin_settings();
+  memset(current_values, 0, NR_OF_DIGITAL_PINS);
+  memset(output_states, 0, NR_OF_DIGITAL_PINS * sizeof(struct output_pin_state));
+  for (uint8_t i = FIRST_SCENE_PIN_INDEX; i < FIRST_SCENE_PIN_INDEX + SCENE_PINS; i++) {
+    write_setting(PIN_SETTING_ADDRESS(i, mode), DIGITAL_PIN_MODE_OUTPUT | DIGITAL_PIN_PWM_MASK);
+    write_setting(PIN_SETTING_ADDRESS(i, group), SCENE_GROUP);
+    write_setting(PIN_SETTING_ADDRESS(i, pwm_on_value), 0xFF);
+  }
+  write_setting(PIN_SETTING_ADDRESS(OTHER_PIN_INDEX, mode), DIGITAL_PIN_MODE_OUTPUT);
+  write_setting(PIN_SETTING_ADDRESS(OTHER_PIN_INDEX, group), OTHER_GROUP);
+  loop_digital_pins();
+  events_reset();
+
+  for (uint8_t i = 0; i < NODES; i++) {
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    nodes[i] = fork();
+    if (nodes[i] == 0) {
+      close(fds[0]);
+      run_node(fds[1], i + 1);
+    }
+    close(fds[1]);
+    bus[i] = fds[0];
+  }
+}
+
+void tearDown() {
+  for (uint8_t i = 0; i < NODES; i++) {
+    kill(nodes[i], SIGKILL);
+    waitpid(nodes[i], NULL, 0);
+    close(bus[i]);
+  }
+}
+
+void send_frame(uint8_t *frame, uint8_t length) {
+  uint16_t crc = crc16(frame, length);
+  frame[length++] = crc & 0xFF;
+  frame[length++] = crc >> 8;
+  for (uint8_t i = 0; i < NODES; i++) {
+    TEST_ASSERT_EQUAL(length, write(bus[i], frame, length));
+  }
+}
+
+/**
+ * Collects what node sends within timeout_ms, or until expected bytes
+ * arrived.
+ */
+size_t receive(uint8_t node, uint8_t *frame, size_t expected, int timeout_ms) {
+  size_t received = 0;
+  struct pollfd fd = {bus[node], POLLIN, 0};
+  while (received < expected && poll(&fd, 1, timeout_ms) > 0) {
+    ssize_t n = read(bus[node], frame + received, expected - received);
+    if (n <= 0) {
+      break;
+    }
+    received += n;
+  }
+  return received;
+}
+
+void assert_silent(uint8_t node) {
+  uint8_t frame[256];
+  TEST_ASSERT_EQUAL_MESSAGE(0, receive(node, frame, sizeof(frame), SILENCE_MS), "unexpected response");
+}
+
+/**
+ * Sends a request to id and returns the response of that node. All other
+ * nodes must stay silent.
+ */
+size_t request(uint8_t id, uint8_t *frame, uint8_t length, size_t expected) {
+  send_frame(frame, length);
+  size_t received = receive(id - 1, frame, expected, RESPONSE_TIMEOUT_MS);
+  if (received >= 3 && (frame[1] & 0x80)) {
+    received += receive(id - 1, frame + received, 5 - received, RESPONSE_TIMEOUT_MS);
+  }
+  TEST_ASSERT_EQUAL(0, crc16(frame, received));
+  for (uint8_t i = 0; i < NODES; i++) {
+    if (i != id - 1) {
+      assert_silent(i);
+    }
+  }
+  return received;
+}
+
+void broadcast_register(uint16_t address, uint16_t value) {
+  uint8_t frame[8] = {BROADCAST_ID, 6, (uint8_t) (address >> 8), (uint8_t) address,
+                      (uint8_t) (value >> 8), (uint8_t) value};
+  send_frame(frame, 6);
+  for (uint8_t i = 0; i < NODES; i++) {
+    assert_silent(i);
+  }
+}
+
+uint8_t write_register(uint8_t id, uint16_t address, uint16_t value) {
+  uint8_t frame[8] = {id, 6, (uint8_t) (address >> 8), (uint8_t) address,
+                      (uint8_t) (value >> 8), (uint8_t) value};
+  size_t received = request(id, frame, 6, 8);
+  return received == 5 ? frame[2] : 0;
+}
+
+void read_registers(uint8_t id, uint8_t fc, uint16_t address, uint8_t length, uint16_t *values) {
+  uint8_t frame[256] = {id, fc, (uint8_t) (address >> 8), (uint8_t) address, 0, length};
+  TEST_ASSERT_EQUAL(5 + 2 * length, request(id, frame, 6, 5 + 2 * length));
+  for (uint8_t i = 0; i < length; i++) {
+    values[i] = (frame[3 + 2 * i] << 8) | frame[4 + 2 * i];
+  }
+}
+
+uint16_t read_coils(uint8_t id) {
+  uint8_t frame[256] = {id, 1, 0, 0, 0, NR_OF_DIGITAL_PINS};
+  uint8_t bytes = (NR_OF_DIGITAL_PINS + 7) / 8;
+  TEST_ASSERT_EQUAL(5 + bytes, request(id, frame, 6, 5 + bytes));
+  return frame[3] | frame[4] << 8;
+}
+
+uint16_t scene_coils() {
+  return ((1 << SCENE_PINS) - 1) << FIRST_SCENE_PIN_INDEX;
+}
+
+void test_broadcast_group_command(void) {
+  broadcast_register(GROUP_COMMAND_REGISTER, GROUP_COMMAND(SCENE_GROUP, COMMAND_ON));
+  for (uint8_t id = 1; id <= NODES; id++) {
+    TEST_ASSERT_EQUAL_HEX(scene_coils(), read_coils(id));
+  }
+  broadcast_register(GROUP_COMMAND_REGISTER, GROUP_COMMAND(OTHER_GROUP, COMMAND_TOGGLE));
+  broadcast_register(GROUP_COMMAND_REGISTER, GROUP_COMMAND(SCENE_GROUP, COMMAND_OFF));
+  for (uint8_t id = 1; id <= NODES; id++) {
+    TEST_ASSERT_EQUAL_HEX(1 << OTHER_PIN_INDEX, read_coils(id));
+  }
+}
+
+void test_invalid_group_command(void) {
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_VALUE,
+                    write_register(2, GROUP_COMMAND_REGISTER, GROUP_COMMAND(0, COMMAND_ON)));
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_VALUE,
+                    write_register(2, GROUP_COMMAND_REGISTER, GROUP_COMMAND(SCENE_GROUP, 0xFE)));
+  TEST_ASSERT_EQUAL(0, write_register(2, GROUP_COMMAND_REGISTER, GROUP_COMMAND(SCENE_GROUP, COMMAND_ON)));
+  TEST_ASSERT_EQUAL_HEX(scene_coils(), read_coils(2));
+  TEST_ASSERT_EQUAL_HEX(0, read_coils(1));
+}
+
+void test_armed_fades_start_on_commit(void) {
+  uint16_t value;
+  broadcast_register(ARM_GROUP_COMMAND_REGISTER, GROUP_COMMAND(SCENE_GROUP, COMMAND_FADE_TO_ON));
+  broadcast_register(ARM_GROUP_COMMAND_REGISTER, GROUP_COMMAND(OTHER_GROUP, COMMAND_ON));
+  for (uint8_t id = 1; id <= NODES; id++) {
+    read_registers(id, 3, ARM_GROUP_COMMAND_REGISTER, 1, &value);
+    TEST_ASSERT_EQUAL(2, value);
+    TEST_ASSERT_EQUAL_HEX(0, read_coils(id));
+  }
+  broadcast_register(COMMIT_REGISTER, 1);
+
+  uint32_t first = 0xFFFFFFFF;
+  uint32_t last = 0;
+  for (uint8_t id = 1; id <= NODES; id++) {
+    uint16_t entry[4];
+    read_registers(id, 3, ARM_GROUP_COMMAND_REGISTER, 1, &value);
+    TEST_ASSERT_EQUAL(0, value);
+    read_registers(id, 4, EVENT_QUEUE_REGISTER, 4, entry);
+    TEST_ASSERT_EQUAL(FIRST_SCENE_PIN_INDEX | EVENT_OUTPUT_STATE << 8, entry[0]);
+    TEST_ASSERT_EQUAL(OUTPUT_STATE_FADE_TO_ON, entry[1]);
+    uint32_t started = entry[2] | (uint32_t) entry[3] << 16;
+    first = started < first ? started : first;
+    last = started > last ? started : last;
+  }
+  printf("fades started within %u ms on %d nodes\n", (unsigned) (last - first), NODES);
+  TEST_ASSERT_LESS_THAN(SYNC_TOLERANCE_MS, last - first);
+  delay(FADE_DEFAULT_TIME + 100);
+  for (uint8_t id = 1; id <= NODES; id++) {
+    TEST_ASSERT_EQUAL_HEX(scene_coils() | 1 << OTHER_PIN_INDEX, read_coils(id));
+  }
+}
+
+void test_discarded_commands_are_not_applied(void) {
+  uint16_t value;
+  broadcast_register(ARM_GROUP_COMMAND_REGISTER, GROUP_COMMAND(SCENE_GROUP, COMMAND_ON));
+  broadcast_register(COMMIT_REGISTER, 0);
+  for (uint8_t id = 1; id <= NODES; id++) {
+    read_registers(id, 3, ARM_GROUP_COMMAND_REGISTER, 1, &value);
+    TEST_ASSERT_EQUAL(0, value);
+    TEST_ASSERT_EQUAL_HEX(0, read_coils(id));
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_broadcast_group_command);
+  RUN_TEST(test_invalid_group_command);
+  RUN_TEST(test_armed_fades_start_on_commit);
+  RUN_TEST(test_discarded_commands_are_not_applied);
+  return UNITY_END();
+}
@@ -0,0 +1,95 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <bustrace.h>
+
+// header of a version 1 trace at 19200 baud with two frames
+static const uint8_t header[] = {'H', 'C', 'B', 'T', 1, 0, 0, 0, 0x00, 0x4B, 0, 0, 2, 0, 0, 0};
+// read holding register 0 of slave 1 at 0 and its response 300 us later
+static const uint8_t records[] = {
+  0x00, 0x00, 0x08, 0x01, 0x03, 0x00, 0x00, 0x00, 0x01, 0x84, 0x0A,
+  0xAC, 0x02, BUSTRACE_FRAME_RESPONSE, 0x07, 0x01, 0x03, 0x02, 0x00, 0x2A, 0x39, 0x9B,
+};
+
+static uint8_t buffer[64];
+static FILE *file;
+static bustrace_t trace;
+static bustrace_frame_t frame;
+
+FILE *open_trace(const uint8_t *data, size_t length) {
+  memcpy(buffer, data, length);
+  file = fmemopen(buffer, length, "rb");
+  return file;
+}
+
+FILE *open_default_trace(size_t length) {
+  uint8_t data[sizeof(header) + sizeof(records)];
+  memcpy(data, header, sizeof(header));
+  memcpy(data + sizeof(header), records, sizeof(records));
+  return open_trace(data, length);
+}
+
+void setUp() {
+  file = 0;
+}
+
+void tearDown() {
+  if (file) {
+    fclose(file);
+  }
+}
+
+void test_frames_are_read_with_their_times(void) {
+  TEST_ASSERT_EQUAL(BUSTRACE_OK, bustrace_open(&trace, open_default_trace(sizeof(header) + sizeof(records))));
+  TEST_ASSERT_EQUAL(1, trace.version);
+  TEST_ASSERT_EQUAL(19200, trace.baudrate);
+  TEST_ASSERT_EQUAL(2, trace.frame_count);
+  TEST_ASSERT_EQUAL(BUSTRACE_OK, bustrace_next(&trace, &frame));
+  TEST_ASSERT_EQUAL(0, frame.time_us);
+  TEST_ASSERT_EQUAL(0, frame.flags);
+  TEST_ASSERT_EQUAL(8, frame.length);
+  TEST_ASSERT_EQUAL(0x0A, frame.data[7]);
+  TEST_ASSERT_EQUAL(BUSTRACE_OK, bustrace_next(&trace, &frame));
+  // 0xAC 0x02 is 0x2C + (2 << 7)
+  TEST_ASSERT_EQUAL(300, frame.time_us);
+  TEST_ASSERT_EQUAL(BUSTRACE_FRAME_RESPONSE, frame.flags);
+  TEST_ASSERT_EQUAL(7, frame.length);
+  TEST_ASSERT_EQUAL(0x2A, frame.data[4]);
+  TEST_ASSERT_EQUAL(BUSTRACE_END, bustrace_next(&trace, &frame));
+  TEST_ASSERT_EQUAL(2, trace.frames_read);
+}
+
+void test_newer_versions_are_rejected(void) {
+  uint8_t data[sizeof(header)];
+  memcpy(data, header, sizeof(header));
+  data[4] = BUSTRACE_VERSION + 1;
+  TEST_ASSERT_EQUAL(BUSTRACE_ERROR_VERSION, bustrace_open(&trace, open_trace(data, sizeof(data))));
+  fclose(file);
+  data[0] = 'X';
+  TEST_ASSERT_EQUAL(BUSTRACE_ERROR_MAGIC, bustrace_open(&trace, open_trace(data, sizeof(data))));
+}
+
+void test_truncated_frame_is_an_error(void) {
+  TEST_ASSERT_EQUAL(BUSTRACE_OK, bustrace_open(&trace, open_default_trace(sizeof(header) + 11 + 4)));
+  TEST_ASSERT_EQUAL(BUSTRACE_OK, bustrace_next(&trace, &frame));
+  TEST_ASSERT_EQUAL(BUSTRACE_ERROR_TRUNCATED, bustrace_next(&trace, &frame));
+}
+
+void test_oversized_frame_is_an_error(void) {
+  uint8_t data[sizeof(header) + 4];
+  memcpy(data, header, sizeof(header));
+  // length 257
+  const uint8_t record[] = {0x00, 0x00, 0x81, 0x02};
+  memcpy(data + sizeof(header), record, sizeof(record));
+  TEST_ASSERT_EQUAL(BUSTRACE_OK, bustrace_open(&trace, open_trace(data, sizeof(data))));
+  TEST_ASSERT_EQUAL(BUSTRACE_ERROR_LENGTH, bustrace_next(&trace, &frame));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_frames_are_read_with_their_times);
+  RUN_TEST(test_newer_versions_are_rejected);
+  RUN_TEST(test_truncated_frame_is_an_error);
+  RUN_TEST(test_oversized_frame_is_an_error);
+  return UNITY_END();
+}
@@ -0,0 +1,95 @@
+#include <unity.h>
+#include <stddef.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <capture.h>
+#include <events.h>
+#include <timer.h>
+#include "../pin_setting_address.h"
+
+#define SIGNAL_PIN_INDEX 4
+#define OUTPUT_PIN_INDEX 5
+
+void setUp() {
+  mock_reset();
+  EEPROM.clear(0);
+  load_digital_pin_settings();
+  capture_event_t event;
+  while (capture_pop(&event)) {
+  }
+  capture_overflow_count = 0;
+  timer_reset();
+  memset(current_values, 0, NR_OF_DIGITAL_PINS);
+  memset(output_states, 0, NR_OF_DIGITAL_PINS * sizeof(struct output_pin_state));
+  write_setting(PIN_SETTING_ADDRESS(SIGNAL_PIN_INDEX, mode), DIGITAL_PIN_MODE_INPUT | DIGITAL_PIN_CAPTURE_MASK);
+  write_setting(PIN_SETTING_ADDRESS(SIGNAL_PIN_INDEX, group), 3);
+  write_setting(PIN_SETTING_ADDRESS(SIGNAL_PIN_INDEX, signal_rise_command), COMMAND_TOGGLE);
+  write_setting(PIN_SETTING_ADDRESS(OUTPUT_PIN_INDEX, mode), DIGITAL_PIN_MODE_OUTPUT);
+  write_setting(PIN_SETTING_ADDRESS(OUTPUT_PIN_INDEX, group), 3);
+  loop_digital_pins();
+}
+
+void test_short_pulse_between_passes_is_seen(void) {
+  // the pin is low again by the time the loop comes round
+  capture_push(SIGNAL_PIN_INDEX, 1);
+  capture_push(SIGNAL_PIN_INDEX, 0);
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(1, current_values[OUTPUT_PIN_INDEX]);
+  TEST_ASSERT_EQUAL(0, current_values[SIGNAL_PIN_INDEX]);
+}
+
+void test_pulses_are_replayed_in_order(void) {
+  for (uint8_t i = 0; i < 3; i++) {
+    capture_push(SIGNAL_PIN_INDEX, 1);
+    capture_push(SIGNAL_PIN_INDEX, 0);
+  }
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(1, current_values[OUTPUT_PIN_INDEX]);
+}
+
+void test_events_are_timestamped(void) {
+  mock_advance_millis(1234);
+  capture_push(SIGNAL_PIN_INDEX, 1);
+  capture_event_t event;
+  TEST_ASSERT_TRUE(capture_pop(&event));
+  TEST_ASSERT_EQUAL(1234, event.timestamp);
+  TEST_ASSERT_EQUAL(SIGNAL_PIN_INDEX, event.index);
+  TEST_ASSERT_EQUAL(1, event.level);
+  TEST_ASSERT_FALSE(capture_pop(&event));
+}
+
+void test_edges_keep_their_timestamp(void) {
+  events_reset();
+  mock_advance_millis(1000);
+  capture_push(SIGNAL_PIN_INDEX, 1);
+  // a long loop pass
+  mock_advance_millis(80);
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(EVENT_RISE, events[0].type);
+  TEST_ASSERT_EQUAL(1000, events[0].timestamp);
+}
+
+void test_overflow_is_counted(void) {
+  for (uint8_t i = 0; i < CAPTURE_QUEUE_SIZE + 4; i++) {
+    capture_push(SIGNAL_PIN_INDEX, i & 1);
+  }
+  TEST_ASSERT_EQUAL(5, read_single_input_register(5));
+}
+
+void test_captured_pin_is_not_polled(void) {
+  mock_set_pin(digital_pins_numbers[SIGNAL_PIN_INDEX], 1);
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(0, current_values[OUTPUT_PIN_INDEX]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_short_pulse_between_passes_is_seen);
+  RUN_TEST(test_pulses_are_replayed_in_order);
+  RUN_TEST(test_events_are_timestamped);
+  RUN_TEST(test_edges_keep_their_timestamp);
+  RUN_TEST(test_overflow_is_counted);
+  RUN_TEST(test_captured_pin_is_not_polled);
+  return UNITY_END();
+}
@@ -0,0 +1,258 @@
+#include <unity.h>
+#include <stddef.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <config.h>
+#include <link.h>
+#include "../pin_setting_address.h"
+
+#define CRC_ADDRESS (SETTINGS_OFFSET + offsetof(settings_t, crc))
+#define STAGE_REGISTER 0x10A
+#define COMMIT_REGISTER 0x10B
+
+uint8_t write_register(uint16_t address, uint16_t value) {
+  slave.writeRegisterToBuffer(0, value);
+  return cb_write_holding_register(0x06, address, 1);
+}
+
+uint16_t eeprom_crc() {
+  uint16_t crc;
+  EEPROM.get(CRC_ADDRESS, crc);
+  return crc;
+}
+
+void store_config() {
+  while (config_store_pending()) {
+    config_loop();
+  }
+}
+
+void setUp() {
+  mock_reset();
+  EEPROM.clear(0xFF);
+  load_settings();
+  config_discard();
+  store_config();
+}
+
+void test_blank_eeprom_gets_defaults(void) {
+  TEST_ASSERT_EQUAL(MAGIC, EEPROM.data[SETTINGS_OFFSET]);
+  TEST_ASSERT_EQUAL(DEFAULT_SLAVE_ID, node_settings.slave_id);
+  TEST_ASSERT_EQUAL(0, digital_pin_settings[3].mode);
+  TEST_ASSERT_EQUAL(config_crc(&node_settings, digital_pin_settings), eeprom_crc());
+}
+
+void test_immediate_writes_keep_crc_valid(void) {
+  TEST_ASSERT_EQUAL(STATUS_OK, write_setting(PIN_SETTING_ADDRESS(2, mode), DIGITAL_PIN_MODE_OUTPUT));
+  TEST_ASSERT_EQUAL(STATUS_OK, write_setting(PIN_SETTING_ADDRESS(2, fade_time), 7));
+  TEST_ASSERT_EQUAL(STATUS_OK, write_setting(1, 9));
+  load_settings();
+  TEST_ASSERT_EQUAL(9, node_settings.slave_id);
+  TEST_ASSERT_EQUAL(DIGITAL_PIN_MODE_OUTPUT, digital_pin_settings[2].mode);
+  TEST_ASSERT_EQUAL(7, digital_pin_settings[2].fade_time);
+}
+
+void test_runtime_bytes_are_not_covered(void) {
+  uint16_t crc = eeprom_crc();
+  write_setting(PIN_SETTING_ADDRESS(4, pwm_on_value), 0x80);
+  EEPROM.data[PIN_SETTING_ADDRESS(4, output_value)] = 0x12;
+  TEST_ASSERT_EQUAL(crc, eeprom_crc());
+  load_settings();
+  TEST_ASSERT_EQUAL(0x12, digital_pin_settings[4].output_value);
+}
+
+void test_crc_mismatch_loads_defaults(void) {
+  write_setting(PIN_SETTING_ADDRESS(2, mode), DIGITAL_PIN_MODE_OUTPUT);
+  write_setting(1, 9);
+  EEPROM.data[PIN_SETTING_ADDRESS(2, click_command)] = COMMAND_TOGGLE;
+  load_settings();
+  TEST_ASSERT_EQUAL(DEFAULT_SLAVE_ID, node_settings.slave_id);
+  TEST_ASSERT_EQUAL(0, digital_pin_settings[2].mode);
+  TEST_ASSERT_EQUAL(0, digital_pin_settings[2].click_command);
+}
+
+void test_image_without_crc_is_adopted(void) {
+  write_setting(PIN_SETTING_ADDRESS(2, mode), DIGITAL_PIN_MODE_OUTPUT);
+  write_setting(1, 9);
+  EEPROM.data[SETTINGS_OFFSET] = MAGIC_WITHOUT_CRC;
+  EEPROM.data[CRC_ADDRESS] = 0xFF;
+  EEPROM.data[CRC_ADDRESS + 1] = 0xFF;
+  load_settings();
+  TEST_ASSERT_EQUAL(9, node_settings.slave_id);
+  TEST_ASSERT_EQUAL(DIGITAL_PIN_MODE_OUTPUT, digital_pin_settings[2].mode);
+  TEST_ASSERT_EQUAL(MAGIC, EEPROM.data[SETTINGS_OFFSET]);
+  TEST_ASSERT_EQUAL(config_crc(&node_settings, digital_pin_settings), eeprom_crc());
+}
+
+void test_adopted_image_survives_a_write_and_reboot(void) {
+  // an image from before the timed commands and the crc
+  write_setting(PIN_SETTING_ADDRESS(2, mode), DIGITAL_PIN_MODE_OUTPUT);
+  write_setting(1, 9);
+  EEPROM.data[PIN_SETTING_ADDRESS(2, auto_off_time)] = 0xFF;
+  EEPROM.data[PIN_SETTING_ADDRESS(2, timer_options)] = 0xFF;
+  EEPROM.data[SETTINGS_OFFSET] = MAGIC_WITHOUT_CRC;
+  load_settings();
+  TEST_ASSERT_EQUAL(0, EEPROM.data[PIN_SETTING_ADDRESS(2, timer_options)]);
+  TEST_ASSERT_EQUAL(STATUS_OK, write_setting(PIN_SETTING_ADDRESS(2, auto_off_time), 30));
+  load_settings();
+  TEST_ASSERT_EQUAL(9, node_settings.slave_id);
+  TEST_ASSERT_EQUAL(DIGITAL_PIN_MODE_OUTPUT, digital_pin_settings[2].mode);
+  TEST_ASSERT_EQUAL(30, digital_pin_settings[2].auto_off_time);
+}
+
+void test_switching_to_analog_keeps_crc_valid(void) {
+  // an erased fade time, the crc covers the 0 it loads as
+  EEPROM.data[PIN_SETTING_ADDRESS(4, fade_time)] = 0xFF;
+  load_digital_pin_settings();
+  store_settings_crc();
+  load_settings();
+  TEST_ASSERT_EQUAL(STATUS_OK, write_setting(PIN_SETTING_ADDRESS(4, mode), DIGITAL_PIN_MODE_ANALOG));
+  write_setting(1, 9);
+  load_settings();
+  TEST_ASSERT_EQUAL(9, node_settings.slave_id);
+  TEST_ASSERT_EQUAL(DIGITAL_PIN_MODE_ANALOG, digital_pin_settings[4].mode);
+}
+
+void test_staged_writes_apply_on_commit(void) {
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(STAGE_REGISTER, 1));
+  TEST_ASSERT_TRUE(config_staging());
+  slave.writeRegisterToBuffer(0, DIGITAL_PIN_MODE_OUTPUT);
+  slave.writeRegisterToBuffer(1, 0);
+  slave.writeRegisterToBuffer(2, 0);
+  slave.writeRegisterToBuffer(3, COMMAND_TOGGLE);
+  TEST_ASSERT_EQUAL(STATUS_OK, cb_write_holding_register(0x10, PIN_SETTING_ADDRESS(5, mode), 4));
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(1, 12));
+  // nothing is visible before the commit
+  TEST_ASSERT_EQUAL(0, digital_pin_settings[5].mode);
+  TEST_ASSERT_EQUAL(DEFAULT_SLAVE_ID, node_settings.slave_id);
+  EEPROM.reset_counters();
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(COMMIT_REGISTER, 1));
+  TEST_ASSERT_EQUAL(0, EEPROM.writes);
+  TEST_ASSERT_FALSE(config_staging());
+  TEST_ASSERT_EQUAL(DIGITAL_PIN_MODE_OUTPUT, digital_pin_settings[5].mode);
+  TEST_ASSERT_EQUAL(COMMAND_TOGGLE, digital_pin_settings[5].click_command);
+  TEST_ASSERT_EQUAL(12, node_settings.slave_id);
+  TEST_ASSERT_EQUAL(OUTPUT, mock_get_pin_mode(digital_pins_numbers[5]));
+  store_config();
+  load_settings();
+  TEST_ASSERT_EQUAL(12, node_settings.slave_id);
+  TEST_ASSERT_EQUAL(COMMAND_TOGGLE, digital_pin_settings[5].click_command);
+}
+
+void test_discard_drops_staged_writes(void) {
+  write_register(STAGE_REGISTER, 1);
+  write_register(PIN_SETTING_ADDRESS(5, mode), DIGITAL_PIN_MODE_OUTPUT);
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(COMMIT_REGISTER, 0));
+  TEST_ASSERT_FALSE(config_staging());
+  TEST_ASSERT_EQUAL(0, digital_pin_settings[5].mode);
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_VALUE, write_register(COMMIT_REGISTER, 1));
+}
+
+void test_invalid_staged_image_is_rejected(void) {
+  write_register(STAGE_REGISTER, 1);
+  write_register(PIN_SETTING_ADDRESS(5, mode), DIGITAL_PIN_MODE_OUTPUT);
+  // accepted while staging, validated by the commit
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(PIN_SETTING_ADDRESS(6, click_command), 0x7F));
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_ADDRESS, write_register(CRC_ADDRESS, 0));
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_VALUE, write_register(COMMIT_REGISTER, 1));
+  TEST_ASSERT_TRUE(config_staging());
+  TEST_ASSERT_EQUAL(0, digital_pin_settings[5].mode);
+  write_register(PIN_SETTING_ADDRESS(6, click_command), COMMAND_ON);
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(COMMIT_REGISTER, 1));
+  TEST_ASSERT_EQUAL(DIGITAL_PIN_MODE_OUTPUT, digital_pin_settings[5].mode);
+}
+
+void test_erased_bytes_of_other_pins_do_not_block_a_commit(void) {
+  // a node set up before the crc, pin 6 never configured
+  EEPROM.data[PIN_SETTING_ADDRESS(6, click_command)] = 0xFF;
+  EEPROM.data[PIN_SETTING_ADDRESS(6, dimming_curve)] = 0xFF;
+  EEPROM.data[SETTINGS_OFFSET] = MAGIC_WITHOUT_CRC;
+  load_settings();
+  write_register(STAGE_REGISTER, 1);
+  write_register(PIN_SETTING_ADDRESS(5, mode), DIGITAL_PIN_MODE_OUTPUT);
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(COMMIT_REGISTER, 1));
+  TEST_ASSERT_EQUAL(DIGITAL_PIN_MODE_OUTPUT, digital_pin_settings[5].mode);
+  // a changed byte is still validated
+  write_register(STAGE_REGISTER, 1);
+  write_register(PIN_SETTING_ADDRESS(6, click_command), 0xFE);
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_VALUE, write_register(COMMIT_REGISTER, 1));
+}
+
+void test_staging_covers_a_limited_number_of_pins(void) {
+  write_register(STAGE_REGISTER, 1);
+  for (uint8_t pin = 0; pin < CONFIG_STAGED_PINS; pin++) {
+    TEST_ASSERT_EQUAL(STATUS_OK, write_register(PIN_SETTING_ADDRESS(pin, mode), DIGITAL_PIN_MODE_OUTPUT));
+  }
+  TEST_ASSERT_EQUAL(STATUS_SLAVE_DEVICE_FAILURE,
+    write_register(PIN_SETTING_ADDRESS(CONFIG_STAGED_PINS, mode), DIGITAL_PIN_MODE_OUTPUT));
+  // staged pins and the node settings still take writes
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(PIN_SETTING_ADDRESS(0, group), 2));
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(1, 12));
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(COMMIT_REGISTER, 1));
+  TEST_ASSERT_EQUAL(DIGITAL_PIN_MODE_OUTPUT, digital_pin_settings[CONFIG_STAGED_PINS - 1].mode);
+  TEST_ASSERT_EQUAL(2, digital_pin_settings[0].group);
+  TEST_ASSERT_EQUAL(12, node_settings.slave_id);
+  // the next staging starts empty
+  write_register(STAGE_REGISTER, 1);
+  TEST_ASSERT_EQUAL(STATUS_OK,
+    write_register(PIN_SETTING_ADDRESS(CONFIG_STAGED_PINS, mode), DIGITAL_PIN_MODE_OUTPUT));
+}
+
+void test_commit_is_written_one_byte_per_pass(void) {
+  write_register(STAGE_REGISTER, 1);
+  write_register(PIN_SETTING_ADDRESS(1, fade_time), 3);
+  write_register(PIN_SETTING_ADDRESS(7, fade_time), 4);
+  write_register(PIN_SETTING_ADDRESS(9, group), 2);
+  write_register(COMMIT_REGISTER, 1);
+  uint16_t crc = node_settings.crc;
+  TEST_ASSERT_NOT_EQUAL(crc, eeprom_crc());
+  uint16_t writes = 0;
+  while (config_store_pending()) {
+    EEPROM.reset_counters();
+    config_loop();
+    TEST_ASSERT_LESS_OR_EQUAL(1, EEPROM.writes);
+    writes += EEPROM.writes;
+    if (writes < 5) {
+      // the crc only matches once every covered byte is written
+      TEST_ASSERT_NOT_EQUAL(crc, eeprom_crc());
+    }
+  }
+  // three changed bytes and the crc
+  TEST_ASSERT_EQUAL(5, writes);
+  TEST_ASSERT_EQUAL(crc, eeprom_crc());
+  TEST_ASSERT_EQUAL(4, EEPROM.data[PIN_SETTING_ADDRESS(7, fade_time)]);
+}
+
+void test_immediate_write_during_store(void) {
+  write_register(STAGE_REGISTER, 1);
+  write_register(PIN_SETTING_ADDRESS(1, fade_time), 3);
+  write_register(COMMIT_REGISTER, 1);
+  TEST_ASSERT_EQUAL(1, config_store_pending());
+  // an immediate write during the pass leaves the crc to the pass
+  write_setting(PIN_SETTING_ADDRESS(2, fade_time), 5);
+  TEST_ASSERT_NOT_EQUAL(node_settings.crc, eeprom_crc());
+  store_config();
+  load_settings();
+  TEST_ASSERT_EQUAL(3, digital_pin_settings[1].fade_time);
+  TEST_ASSERT_EQUAL(5, digital_pin_settings[2].fade_time);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_blank_eeprom_gets_defaults);
+  RUN_TEST(test_immediate_writes_keep_crc_valid);
+  RUN_TEST(test_runtime_bytes_are_not_covered);
+  RUN_TEST(test_crc_mismatch_loads_defaults);
+  RUN_TEST(test_image_without_crc_is_adopted);
+  RUN_TEST(test_adopted_image_survives_a_write_and_reboot);
+  RUN_TEST(test_switching_to_analog_keeps_crc_valid);
+  RUN_TEST(test_staged_writes_apply_on_commit);
+  RUN_TEST(test_discard_drops_staged_writes);
+  RUN_TEST(test_invalid_staged_image_is_rejected);
+  RUN_TEST(test_erased_bytes_of_other_pins_do_not_block_a_commit);
+  RUN_TEST(test_staging_covers_a_limited_number_of_pins);
+  RUN_TEST(test_commit_is_written_one_byte_per_pass);
+  RUN_TEST(test_immediate_write_during_store);
+  return UNITY_END();
+}
@@ -0,0 +1,166 @@
+#include <unity.h>
+#include <string.h>
+#include <util/crc16.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <link.h>
+#include <diag.h>
+
+// input registers of the diagnostics block on a 12 pin node
+#define DIAG_REGISTERS 0x300
+#define MAX_POLL_GAP_REGISTER (DIAG_REGISTERS + 6)
+#define FC_READ_INPUT_REGISTERS 0x04
+#define FC_WRITE_REGISTER 0x06
+
+static uint8_t response[256];
+
+uint8_t build_frame(uint8_t *frame, uint8_t slave_id, uint8_t function, uint16_t first, uint16_t second) {
+  uint8_t request[] = {slave_id, function, (uint8_t) (first >> 8), (uint8_t) first,
+                       (uint8_t) (second >> 8), (uint8_t) second};
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < sizeof(request); i++) {
+    crc = _crc16_update(crc, request[i]);
+  }
+  memcpy(frame, request, sizeof(request));
+  frame[6] = crc & 0xFF;
+  frame[7] = crc >> 8;
+  return 8;
+}
+
+/**
+ * Feeds the frame and runs the loop for 5 ms, returns the response length.
+ */
+size_t exchange(const uint8_t *frame, size_t length) {
+  mock_serial_feed(frame, length);
+  size_t received = 0;
+  for (uint8_t i = 0; i < 50; i++) {
+    mock_advance_micros(100);
+    diag_poll();
+    slave.poll();
+    received += mock_serial_take(response + received, sizeof(response) - received);
+  }
+  return received;
+}
+
+size_t request(uint8_t slave_id, uint8_t function, uint16_t first, uint16_t second) {
+  uint8_t frame[8];
+  return exchange(frame, build_frame(frame, slave_id, function, first, second));
+}
+
+void setUp() {
+  mock_reset();
+  EEPROM.clear(0xFF);
+  load_settings();
+  link_setup();
+  diag_begin(DEFAULT_SLAVE_ID);
+  slave.cbVector[CB_READ_INPUT_REGISTERS] = cb_read_input_register;
+  slave.cbVector[CB_WRITE_HOLDING_REGISTERS] = cb_write_holding_register;
+}
+
+void test_frames_are_counted(void) {
+  TEST_ASSERT_EQUAL(7, request(DEFAULT_SLAVE_ID, FC_READ_INPUT_REGISTERS, 0, 1));
+  // a request to another node and a frame with a broken crc
+  TEST_ASSERT_EQUAL(0, request(DEFAULT_SLAVE_ID + 1, FC_READ_INPUT_REGISTERS, 0, 1));
+  const uint8_t other_response[] = {DEFAULT_SLAVE_ID + 1, 0x04, 0x02, 0x00, 0x0C, 0x00, 0x00};
+  TEST_ASSERT_EQUAL(0, exchange(other_response, sizeof(other_response)));
+  TEST_ASSERT_EQUAL(3, diag_counters.bus_messages);
+  TEST_ASSERT_EQUAL(1, diag_counters.crc_errors);
+  TEST_ASSERT_EQUAL(1, diag_counters.slave_messages);
+  TEST_ASSERT_EQUAL(0, diag_counters.exceptions);
+  TEST_ASSERT_EQUAL(0, diag_counters.no_responses);
+}
+
+void test_exceptions_and_broadcasts(void) {
+  TEST_ASSERT_EQUAL(5, request(DEFAULT_SLAVE_ID, FC_READ_INPUT_REGISTERS, 0x1000, 1));
+  TEST_ASSERT_EQUAL(0x84, response[1]);
+  // broadcasts are never answered
+  TEST_ASSERT_EQUAL(0, request(0, FC_WRITE_REGISTER, 0x101, 1));
+  TEST_ASSERT_EQUAL(1, diag_counters.exceptions);
+  TEST_ASSERT_EQUAL(2, diag_counters.slave_messages);
+  TEST_ASSERT_EQUAL(1, diag_counters.no_responses);
+}
+
+void test_diagnostics_function(void) {
+  request(DEFAULT_SLAVE_ID, FC_READ_INPUT_REGISTERS, 0, 1);
+  request(DEFAULT_SLAVE_ID + 1, FC_READ_INPUT_REGISTERS, 0, 1);
+  // the request counts itself
+  TEST_ASSERT_EQUAL(8, request(DEFAULT_SLAVE_ID, FC_DIAGNOSTICS, DIAG_BUS_MESSAGE_COUNT, 0));
+  uint8_t expected[8];
+  build_frame(expected, DEFAULT_SLAVE_ID, FC_DIAGNOSTICS, DIAG_BUS_MESSAGE_COUNT, 3);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, response, 8);
+  TEST_ASSERT_EQUAL(8, request(DEFAULT_SLAVE_ID, FC_DIAGNOSTICS, DIAG_SLAVE_MESSAGE_COUNT, 0));
+  TEST_ASSERT_EQUAL(3, response[5]);
+  TEST_ASSERT_EQUAL(8, request(DEFAULT_SLAVE_ID, FC_DIAGNOSTICS, DIAG_RETURN_QUERY_DATA, 0x1234));
+  build_frame(expected, DEFAULT_SLAVE_ID, FC_DIAGNOSTICS, DIAG_RETURN_QUERY_DATA, 0x1234);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, response, 8);
+  // unknown sub-functions and data on a counter query
+  TEST_ASSERT_EQUAL(5, request(DEFAULT_SLAVE_ID, FC_DIAGNOSTICS, 0x04, 0));
+  TEST_ASSERT_EQUAL(0x88, response[1]);
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_FUNCTION, response[2]);
+  TEST_ASSERT_EQUAL(5, request(DEFAULT_SLAVE_ID, FC_DIAGNOSTICS, DIAG_BUS_MESSAGE_COUNT, 1));
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_VALUE, response[2]);
+  TEST_ASSERT_EQUAL(2, diag_counters.exceptions);
+  TEST_ASSERT_EQUAL(0, diag_counters.no_responses);
+  TEST_ASSERT_EQUAL(8, request(DEFAULT_SLAVE_ID, FC_DIAGNOSTICS, DIAG_CLEAR_COUNTERS, 0));
+  TEST_ASSERT_EQUAL(0, diag_counters.bus_messages);
+  // a broadcast clear has no response
+  request(DEFAULT_SLAVE_ID + 1, FC_READ_INPUT_REGISTERS, 0, 1);
+  TEST_ASSERT_EQUAL(0, request(0, FC_DIAGNOSTICS, DIAG_CLEAR_COUNTERS, 0));
+  TEST_ASSERT_EQUAL(0, diag_counters.bus_messages);
+}
+
+void test_overrun(void) {
+  uint8_t noise[SERIAL_RX_BUFFER_SIZE];
+  memset(noise, 0x55, sizeof(noise));
+  TEST_ASSERT_EQUAL(0, exchange(noise, sizeof(noise)));
+  TEST_ASSERT_EQUAL(1, diag_counters.overruns);
+  TEST_ASSERT_EQUAL(1, diag_counters.crc_errors);
+  TEST_ASSERT_EQUAL(7, request(DEFAULT_SLAVE_ID, FC_READ_INPUT_REGISTERS, 0, 1));
+  TEST_ASSERT_EQUAL(1, diag_counters.overruns);
+}
+
+void test_input_registers(void) {
+  diag_poll();
+  mock_advance_micros(70000);
+  diag_poll();
+  request(DEFAULT_SLAVE_ID, FC_READ_INPUT_REGISTERS, 0, 1);
+  TEST_ASSERT_EQUAL(1, read_single_input_register(DIAG_REGISTERS));
+  TEST_ASSERT_EQUAL(1, read_single_input_register(DIAG_REGISTERS + 3));
+  TEST_ASSERT_EQUAL(70000 & 0xFFFF, read_single_input_register(MAX_POLL_GAP_REGISTER));
+  TEST_ASSERT_EQUAL(70000 >> 16, read_single_input_register(MAX_POLL_GAP_REGISTER + 1));
+  TEST_ASSERT_EQUAL(7, request(DEFAULT_SLAVE_ID, FC_READ_INPUT_REGISTERS, DIAG_REGISTERS + 1, 1));
+}
+
+void test_response_waits_for_t35(void) {
+  uint8_t config = LINK_CONFIG(1, LINK_PARITY_EVEN);
+  node_settings.link_config = config;
+  node_settings.link_config_next = config;
+  link_setup();
+  link_timing_t timing;
+  link_timing(config, &timing);
+  uint8_t frame[8];
+  mock_serial_feed(frame, build_frame(frame, DEFAULT_SLAVE_ID, FC_READ_INPUT_REGISTERS, 0, 1));
+  diag_poll();
+  unsigned long request_end = micros();
+  size_t received = 0;
+  for (uint8_t i = 0; i < 100 && received == 0; i++) {
+    mock_advance_micros(100);
+    diag_poll();
+    slave.poll();
+    received = mock_serial_take(response, sizeof(response));
+  }
+  TEST_ASSERT_EQUAL(7, received);
+  TEST_ASSERT_GREATER_OR_EQUAL(timing.t35_us, micros() - request_end);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_frames_are_counted);
+  RUN_TEST(test_exceptions_and_broadcasts);
+  RUN_TEST(test_diagnostics_function);
+  RUN_TEST(test_overrun);
+  RUN_TEST(test_response_waits_for_t35);
+  RUN_TEST(test_input_registers);
+  return UNITY_END();
+}
@@ -0,0 +1,72 @@
+#include <unity.h>
+#include <stddef.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <ModbusSlave.h>
+#include <homectrl.h>
+#include <dimming.h>
+#include "../pin_setting_address.h"
+
+#define PWM_PIN_INDEX 10
+
+void setUp() {
+  mock_reset();
+  EEPROM.clear(0);
+  load_digital_pin_settings();
+  memset(output_states, 0, NR_OF_DIGITAL_PINS * sizeof(struct output_pin_state));
+  write_setting(PIN_SETTING_ADDRESS(PWM_PIN_INDEX, mode), DIGITAL_PIN_MODE_OUTPUT | DIGITAL_PIN_PWM_MASK);
+}
+
+void test_curve_endpoints(void) {
+  for (uint8_t curve = DIMMING_CURVE_LINEAR; curve <= DIMMING_CURVE_CUSTOM; curve++) {
+    TEST_ASSERT_EQUAL(0, dimming_level(curve, 0));
+    TEST_ASSERT_EQUAL(0xFFFF, dimming_level(curve, 0xFF));
+  }
+}
+
+void test_curves_are_monotonic(void) {
+  for (uint8_t curve = DIMMING_CURVE_LINEAR; curve <= DIMMING_CURVE_CUSTOM; curve++) {
+    for (uint16_t value = 1; value < 0x100; value++) {
+      TEST_ASSERT_TRUE(dimming_level(curve, value) >= dimming_level(curve, value - 1));
+    }
+  }
+}
+
+void test_linear_curve_is_identity(void) {
+  for (uint16_t value = 0; value < 0x100; value++) {
+    TEST_ASSERT_EQUAL(value, dimming_level(DIMMING_CURVE_LINEAR, value) >> 8);
+  }
+}
+
+void test_perceptual_curves_expand_low_end(void) {
+  TEST_ASSERT_LESS_THAN(dimming_level(DIMMING_CURVE_LINEAR, 0x40), dimming_level(DIMMING_CURVE_CIE1931, 0x40));
+  TEST_ASSERT_LESS_THAN(dimming_level(DIMMING_CURVE_LINEAR, 0x40), dimming_level(DIMMING_CURVE_GAMMA22, 0x40));
+}
+
+void test_output_applies_curve(void) {
+  TEST_ASSERT_EQUAL(STATUS_OK, write_setting(PIN_SETTING_ADDRESS(PWM_PIN_INDEX, dimming_curve), DIMMING_CURVE_GAMMA22));
+  write_setting(PIN_SETTING_ADDRESS(PWM_PIN_INDEX, pwm_on_value), 0x80);
+  digital_pin_context_t ctx;
+  init_digital_pin_context(PWM_PIN_INDEX, &ctx);
+  update_output(&ctx, COMMAND_NONE);
+  update_output(&ctx, COMMAND_ON);
+  TEST_ASSERT_EQUAL(0x80, current_values[PWM_PIN_INDEX]);
+  TEST_ASSERT_EQUAL(dimming_level(DIMMING_CURVE_GAMMA22, 0x80) >> 8,
+                    mock_get_analog(digital_pins_numbers[PWM_PIN_INDEX]));
+}
+
+void test_invalid_curve_rejected(void) {
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_VALUE,
+                    write_setting(PIN_SETTING_ADDRESS(PWM_PIN_INDEX, dimming_curve), DIMMING_CURVE_CUSTOM + 1));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_curve_endpoints);
+  RUN_TEST(test_curves_are_monotonic);
+  RUN_TEST(test_linear_curve_is_identity);
+  RUN_TEST(test_perceptual_curves_expand_low_end);
+  RUN_TEST(test_output_applies_curve);
+  RUN_TEST(test_invalid_curve_rejected);
+  return UNITY_END();
+}
@@ -0,0 +1,104 @@
+#include <unity.h>
+#include <stddef.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <fade.h>
+#include <events.h>
+#include "../pin_setting_address.h"
+
+#define BUTTON_PIN_INDEX 0
+#define OUTPUT_PIN_INDEX 8
+#define EVENT_REGISTER(entry, field) read_single_input_register(0x204 + 4 * (entry) + (field))
+
+digital_pin_context_t button;
+
+void setUp() {
+  mock_reset();
+  EEPROM.clear(0);
+  load_digital_pin_settings();
+  memset(current_values, 0, NR_OF_DIGITAL_PINS);
+  memset(output_states, 0, NR_OF_DIGITAL_PINS * sizeof(struct output_pin_state));
+  write_setting(PIN_SETTING_ADDRESS(BUTTON_PIN_INDEX, mode), DIGITAL_PIN_MODE_INPUT_PULLUP | DIGITAL_PIN_BUTTON_MASK);
+  write_setting(PIN_SETTING_ADDRESS(BUTTON_PIN_INDEX, group), 2);
+  write_setting(PIN_SETTING_ADDRESS(BUTTON_PIN_INDEX, click_command), COMMAND_TOGGLE);
+  write_setting(PIN_SETTING_ADDRESS(OUTPUT_PIN_INDEX, mode), DIGITAL_PIN_MODE_OUTPUT | DIGITAL_PIN_PWM_MASK);
+  write_setting(PIN_SETTING_ADDRESS(OUTPUT_PIN_INDEX, group), 2);
+  write_setting(PIN_SETTING_ADDRESS(OUTPUT_PIN_INDEX, pwm_on_value), 0x80);
+  loop_digital_pins();
+  events_reset();
+  init_digital_pin_context(BUTTON_PIN_INDEX, &button);
+}
+
+void test_click_and_output_change(void) {
+  mock_set_micros(0x12345678UL);
+  handle_click(&button);
+  TEST_ASSERT_EQUAL(0, read_single_input_register(0x200));
+  TEST_ASSERT_EQUAL(2, read_single_input_register(0x201));
+  TEST_ASSERT_EQUAL(BUTTON_PIN_INDEX | EVENT_CLICK << 8, EVENT_REGISTER(0, 0));
+  TEST_ASSERT_EQUAL(OUTPUT_PIN_INDEX | EVENT_OUTPUT_VALUE << 8, EVENT_REGISTER(1, 0));
+  TEST_ASSERT_EQUAL(0x80, EVENT_REGISTER(1, 1));
+  TEST_ASSERT_EQUAL(millis() & 0xFFFF, EVENT_REGISTER(1, 2));
+  TEST_ASSERT_EQUAL(millis() >> 16, EVENT_REGISTER(1, 3));
+}
+
+void test_fade_reports_state_and_final_value(void) {
+  digital_pin_context_t output;
+  init_digital_pin_context(OUTPUT_PIN_INDEX, &output);
+  update_output(&output, COMMAND_FADE_TO_ON);
+  while (fade_is_active(OUTPUT_PIN_INDEX)) {
+    fade_tick();
+  }
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(2, event_count);
+  TEST_ASSERT_EQUAL(EVENT_OUTPUT_STATE, events[0].type);
+  TEST_ASSERT_EQUAL(OUTPUT_STATE_FADE_TO_ON, events[0].value);
+  TEST_ASSERT_EQUAL(EVENT_OUTPUT_VALUE, events[1].type);
+  TEST_ASSERT_EQUAL(0x80, events[1].value);
+}
+
+void test_acknowledge_removes_processed_events(void) {
+  handle_release(&button);
+  handle_click(&button);
+  TEST_ASSERT_EQUAL(3, event_count);
+  TEST_ASSERT_TRUE(events_acknowledge(1));
+  TEST_ASSERT_EQUAL(1, read_single_input_register(0x200));
+  TEST_ASSERT_EQUAL(2, read_single_input_register(0x201));
+  TEST_ASSERT_EQUAL(BUTTON_PIN_INDEX | EVENT_CLICK << 8, EVENT_REGISTER(0, 0));
+  TEST_ASSERT_EQUAL(0, EVENT_REGISTER(2, 0));
+  TEST_ASSERT_FALSE(events_acknowledge(4));
+  TEST_ASSERT_TRUE(events_acknowledge(3));
+  TEST_ASSERT_EQUAL(0, event_count);
+  TEST_ASSERT_EQUAL(0, EVENT_REGISTER(0, 0));
+}
+
+void test_full_queue_drops_events(void) {
+  for (uint8_t i = 0; i < EVENT_QUEUE_SIZE + 3; i++) {
+    handle_release(&button);
+  }
+  TEST_ASSERT_EQUAL(EVENT_QUEUE_SIZE, read_single_input_register(0x201));
+  TEST_ASSERT_EQUAL(3, read_single_input_register(0x202));
+  TEST_ASSERT_TRUE(events_acknowledge(EVENT_QUEUE_SIZE));
+  handle_release(&button);
+  TEST_ASSERT_EQUAL(EVENT_QUEUE_SIZE, read_single_input_register(0x200));
+  TEST_ASSERT_EQUAL(1, read_single_input_register(0x201));
+}
+
+void test_sequence_wraps(void) {
+  event_sequence = 0xFFFF;
+  handle_release(&button);
+  handle_release(&button);
+  TEST_ASSERT_TRUE(events_acknowledge(1));
+  TEST_ASSERT_EQUAL(0, event_count);
+  TEST_ASSERT_EQUAL(1, event_sequence);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_click_and_output_change);
+  RUN_TEST(test_fade_reports_state_and_final_value);
+  RUN_TEST(test_acknowledge_removes_processed_events);
+  RUN_TEST(test_full_queue_drops_events);
+  RUN_TEST(test_sequence_wraps);
+  return UNITY_END();
+}
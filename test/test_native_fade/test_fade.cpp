@@ -0,0 +1,110 @@
+#include <unity.h>
+#include <stddef.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <fade.h>
+#include "../pin_setting_address.h"
+
+#define PWM_PIN_INDEX 9
+
+/**
+ * Runs the fade tick like the timer interrupt would, returns the number of
+ * ticks until the fade finished.
+ */
+// 8.8 fixed point steps are accurate to about 2%
+#define ASSERT_TICKS(expected, actual) TEST_ASSERT_UINT_WITHIN((expected) / 50 + 1, expected, actual)
+
+unsigned long run_ticks(uint8_t index, unsigned long max_ticks) {
+  unsigned long ticks = 0;
+  while (fade_is_active(index) && ticks < max_ticks) {
+    fade_tick();
+    ticks++;
+  }
+  return ticks;
+}
+
+void setUp() {
+  mock_reset();
+  EEPROM.clear(0);
+  load_digital_pin_settings();
+  memset(fades, 0, sizeof(fade_t) * NR_OF_DIGITAL_PINS);
+  memset(current_values, 0, NR_OF_DIGITAL_PINS);
+  memset(output_states, 0, NR_OF_DIGITAL_PINS * sizeof(struct output_pin_state));
+  write_setting(PIN_SETTING_ADDRESS(PWM_PIN_INDEX, mode), DIGITAL_PIN_MODE_OUTPUT | DIGITAL_PIN_PWM_MASK);
+  write_setting(PIN_SETTING_ADDRESS(PWM_PIN_INDEX, pwm_on_value), 0xFF);
+}
+
+void test_full_scale_fade_duration(void) {
+  fade_start(PWM_PIN_INDEX, 0, 0xFF, 1000);
+  unsigned long ticks = run_ticks(PWM_PIN_INDEX, 100000);
+  ASSERT_TICKS(1000000UL / FADE_TICK_US, ticks);
+  TEST_ASSERT_EQUAL(0xFF, current_values[PWM_PIN_INDEX]);
+  TEST_ASSERT_EQUAL(0xFF, mock_get_analog(digital_pins_numbers[PWM_PIN_INDEX]));
+}
+
+void test_partial_fade_has_constant_rate(void) {
+  fade_start(PWM_PIN_INDEX, 0x40, 0xC0, 2000);
+  unsigned long ticks = run_ticks(PWM_PIN_INDEX, 100000);
+  ASSERT_TICKS(1000000UL / FADE_TICK_US, ticks);
+  fade_start(PWM_PIN_INDEX, 0xC0, 0x00, 2000);
+  ticks = run_ticks(PWM_PIN_INDEX, 100000);
+  ASSERT_TICKS(1500000UL / FADE_TICK_US, ticks);
+  TEST_ASSERT_EQUAL(0, current_values[PWM_PIN_INDEX]);
+}
+
+void test_fade_is_independent_of_loop(void) {
+  digital_pin_context_t ctx;
+  init_digital_pin_context(PWM_PIN_INDEX, &ctx);
+  update_output(&ctx, COMMAND_NONE);
+  update_output(&ctx, COMMAND_FADE_TO_ON);
+  TEST_ASSERT_EQUAL(OUTPUT_STATE_FADE_TO_ON, output_states[PWM_PIN_INDEX].state);
+  unsigned long ticks = run_ticks(PWM_PIN_INDEX, 100000);
+  ASSERT_TICKS((unsigned long) FADE_DEFAULT_TIME * 1000UL / FADE_TICK_US, ticks);
+  TEST_ASSERT_EQUAL(0xFF, current_values[PWM_PIN_INDEX]);
+  update_output(&ctx, COMMAND_NONE);
+  TEST_ASSERT_EQUAL(OUTPUT_STATE_IDLE, output_states[PWM_PIN_INDEX].state);
+}
+
+void test_fade_time_register(void) {
+  write_setting(PIN_SETTING_ADDRESS(PWM_PIN_INDEX, fade_time), 5);
+  digital_pin_context_t ctx;
+  init_digital_pin_context(PWM_PIN_INDEX, &ctx);
+  update_output(&ctx, COMMAND_NONE);
+  update_output(&ctx, COMMAND_FADE_TOGGLE);
+  unsigned long ticks = run_ticks(PWM_PIN_INDEX, 100000);
+  ASSERT_TICKS(5UL * FADE_TIME_UNIT * 1000UL / FADE_TICK_US, ticks);
+}
+
+void test_erased_fade_time_is_the_default(void) {
+  EEPROM.put(pin_setting_start_address(PWM_PIN_INDEX) + offsetof(digital_pin_setting_t, fade_time), (uint8_t) 0xFF);
+  load_digital_pin_settings();
+  TEST_ASSERT_EQUAL(0, digital_pin_settings[PWM_PIN_INDEX].fade_time);
+}
+
+void test_pwm_up_down_stops_on_command(void) {
+  digital_pin_context_t ctx;
+  init_digital_pin_context(PWM_PIN_INDEX, &ctx);
+  update_output(&ctx, COMMAND_NONE);
+  update_output(&ctx, COMMAND_TRIGGER_PWM_UP_DOWN_START);
+  for (int i = 0; i < 100; i++) {
+    fade_tick();
+  }
+  update_output(&ctx, COMMAND_TRIGGER_PWM_UP_DOWN_STOP);
+  TEST_ASSERT_EQUAL(OUTPUT_STATE_PWM_UP_DOWN_IDLE, output_states[PWM_PIN_INDEX].state);
+  uint8_t value = current_values[PWM_PIN_INDEX];
+  TEST_ASSERT_GREATER_THAN(0, value);
+  fade_tick();
+  TEST_ASSERT_EQUAL(value, current_values[PWM_PIN_INDEX]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_full_scale_fade_duration);
+  RUN_TEST(test_partial_fade_has_constant_rate);
+  RUN_TEST(test_fade_is_independent_of_loop);
+  RUN_TEST(test_fade_time_register);
+  RUN_TEST(test_erased_fade_time_is_the_default);
+  RUN_TEST(test_pwm_up_down_stops_on_command);
+  return UNITY_END();
+}
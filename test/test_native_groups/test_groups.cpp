@@ -0,0 +1,73 @@
+#include <unity.h>
+#include <stddef.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include "../pin_setting_address.h"
+
+void configure_output(uint8_t index, uint8_t group, uint8_t group_mask) {
+  write_setting(PIN_SETTING_ADDRESS(index, mode), DIGITAL_PIN_MODE_OUTPUT);
+  write_setting(PIN_SETTING_ADDRESS(index, group), group);
+  write_setting(PIN_SETTING_ADDRESS(index, group_mask), group_mask);
+}
+
+void setUp() {
+  mock_reset();
+  EEPROM.clear(0);
+  load_digital_pin_settings();
+  build_group_index();
+}
+
+void test_group_members_single_group(void) {
+  configure_output(1, 20, 0);
+  configure_output(4, 20, 0);
+  configure_output(5, 21, 0);
+  TEST_ASSERT_EQUAL((1 << 1) | (1 << 4), group_members(20));
+  TEST_ASSERT_EQUAL(1 << 5, group_members(21));
+  TEST_ASSERT_EQUAL(0, group_members(22));
+}
+
+void test_group_members_mask(void) {
+  configure_output(2, 0, 0x05);
+  configure_output(3, 3, 0);
+  TEST_ASSERT_EQUAL(1 << 2, group_members(1));
+  TEST_ASSERT_EQUAL((1 << 2) | (1 << 3), group_members(3));
+}
+
+void test_inputs_are_not_members(void) {
+  configure_output(6, 7, 0);
+  write_setting(PIN_SETTING_ADDRESS(6, mode), DIGITAL_PIN_MODE_INPUT);
+  TEST_ASSERT_EQUAL(0, group_members(7));
+}
+
+void test_click_dispatches_to_group(void) {
+  configure_output(7, 9, 0);
+  configure_output(8, 0, 0x80);
+  write_setting(PIN_SETTING_ADDRESS(0, group), 9);
+  write_setting(PIN_SETTING_ADDRESS(0, click_command), COMMAND_ON);
+  loop_digital_pins();
+  digital_pin_context_t ctx;
+  init_digital_pin_context(0, &ctx);
+  handle_click(&ctx);
+  TEST_ASSERT_EQUAL(1, current_values[7]);
+  TEST_ASSERT_EQUAL(0, current_values[8]);
+}
+
+void test_erased_group_mask_joins_no_group(void) {
+  configure_output(2, 0, 0);
+  EEPROM.put(pin_setting_start_address(2) + offsetof(digital_pin_setting_t, group_mask), (uint8_t) 0xFF);
+  load_digital_pin_settings();
+  build_group_index();
+  TEST_ASSERT_EQUAL(0, digital_pin_settings[2].group_mask);
+  TEST_ASSERT_EQUAL(0, group_members(1));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_group_members_single_group);
+  RUN_TEST(test_group_members_mask);
+  RUN_TEST(test_inputs_are_not_members);
+  RUN_TEST(test_click_dispatches_to_group);
+  RUN_TEST(test_erased_group_mask_joins_no_group);
+  return UNITY_END();
+}
@@ -0,0 +1,152 @@
+#include <unity.h>
+#include <stddef.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <MultiButton.h>
+#include <homectrl.h>
+#include <input.h>
+#include "../pin_setting_address.h"
+
+/**
+ * Feeds recorded bounce traces through MultiButton (the previous input
+ * stage) and through the vertical counter debouncer plus button_update(),
+ * and checks both detect the same sequence of events.
+ *
+ * A trace is a list of (duration in ms, pressed) segments.
+ */
+
+#define MAX_EVENTS 32
+#define BUTTON_PIN_INDEX 0
+
+typedef struct {
+  uint16_t duration;
+  uint8_t pressed;
+} trace_segment_t;
+
+typedef struct {
+  uint8_t events[MAX_EVENTS];
+  uint8_t count;
+} event_log_t;
+
+void log_event(event_log_t *log, uint8_t events) {
+  const uint8_t order[] = {INPUT_EVENT_CLICK, INPUT_EVENT_SINGLE_CLICK, INPUT_EVENT_LONG_CLICK,
+                           INPUT_EVENT_DOUBLE_CLICK, INPUT_EVENT_RELEASE};
+  for (uint8_t i = 0; i < sizeof(order); i++) {
+    if ((events & order[i]) && log->count < MAX_EVENTS) {
+      log->events[log->count++] = order[i];
+    }
+  }
+}
+
+void run_multibutton(const trace_segment_t *trace, uint8_t length, event_log_t *log) {
+  MultiButton button;
+  mock_set_micros(0);
+  for (uint8_t s = 0; s < length; s++) {
+    for (uint16_t t = 0; t < trace[s].duration; t++) {
+      button.update(trace[s].pressed);
+      uint8_t events = 0;
+      events |= button.isClick() ? INPUT_EVENT_CLICK : 0;
+      events |= button.isSingleClick() ? INPUT_EVENT_SINGLE_CLICK : 0;
+      events |= button.isLongClick() ? INPUT_EVENT_LONG_CLICK : 0;
+      events |= button.isDoubleClick() ? INPUT_EVENT_DOUBLE_CLICK : 0;
+      events |= button.isReleased() ? INPUT_EVENT_RELEASE : 0;
+      log_event(log, events);
+      mock_advance_millis(1);
+    }
+  }
+}
+
+void run_vertical_counter(const trace_segment_t *trace, uint8_t length, event_log_t *log) {
+  debouncer_t debouncer;
+  button_t button = {BUTTON_STATE_IDLE, 0};
+  // the button pulls the line low, bit 0 carries the level
+  debouncer_reset(&debouncer, 1);
+  uint16_t now = 0;
+  for (uint8_t s = 0; s < length; s++) {
+    for (uint16_t t = 0; t < trace[s].duration; t++, now++) {
+      pin_mask_t changed = 0;
+      if (now % INPUT_SAMPLE_INTERVAL == 0) {
+        changed = debouncer_sample(&debouncer, trace[s].pressed ? 0 : 1);
+      }
+      if (changed || button_is_timed(&button)) {
+        log_event(log, button_update(&button, !(debouncer.state & 1), now));
+      }
+    }
+  }
+}
+
+void assert_same_events(const trace_segment_t *trace, uint8_t length) {
+  event_log_t expected = {{0}, 0};
+  event_log_t actual = {{0}, 0};
+  run_multibutton(trace, length, &expected);
+  run_vertical_counter(trace, length, &actual);
+  TEST_ASSERT_EQUAL(expected.count, actual.count);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected.events, actual.events, expected.count);
+}
+
+#define TRACE_LENGTH(trace) (sizeof(trace) / sizeof(trace_segment_t))
+
+void test_clean_click(void) {
+  const trace_segment_t trace[] = {{50, 0}, {120, 1}, {600, 0}};
+  assert_same_events(trace, TRACE_LENGTH(trace));
+}
+
+void test_bouncing_click(void) {
+  const trace_segment_t trace[] = {{50, 0}, {1, 1}, {2, 0}, {1, 1}, {1, 0}, {2, 1}, {110, 1},
+                                   {1, 0}, {1, 1}, {2, 0}, {1, 1}, {600, 0}};
+  assert_same_events(trace, TRACE_LENGTH(trace));
+}
+
+void test_double_click(void) {
+  const trace_segment_t trace[] = {{50, 0}, {90, 1}, {1, 0}, {1, 1}, {80, 0}, {2, 1}, {1, 0},
+                                   {90, 1}, {600, 0}};
+  assert_same_events(trace, TRACE_LENGTH(trace));
+}
+
+void test_long_press(void) {
+  const trace_segment_t trace[] = {{50, 0}, {1, 1}, {1, 0}, {800, 1}, {1, 0}, {1, 1}, {600, 0}};
+  assert_same_events(trace, TRACE_LENGTH(trace));
+}
+
+void test_glitch_is_ignored(void) {
+  const trace_segment_t trace[] = {{50, 0}, {3, 1}, {50, 0}, {4, 1}, {600, 0}};
+  assert_same_events(trace, TRACE_LENGTH(trace));
+  event_log_t actual = {{0}, 0};
+  run_vertical_counter(trace, TRACE_LENGTH(trace), &actual);
+  TEST_ASSERT_EQUAL(0, actual.count);
+}
+
+void test_loop_counts_clicks(void) {
+  mock_reset();
+  EEPROM.clear(0);
+  load_digital_pin_settings();
+  write_setting(PIN_SETTING_ADDRESS(BUTTON_PIN_INDEX, mode), DIGITAL_PIN_MODE_INPUT_PULLUP | DIGITAL_PIN_BUTTON_MASK);
+  debouncer_reset(&input_debouncer, input_read_raw());
+  memset(counters, 0, sizeof(digital_pin_counters_t) * NR_OF_DIGITAL_PINS);
+  const trace_segment_t trace[] = {{50, 0}, {1, 1}, {1, 0}, {100, 1}, {600, 0}};
+  for (uint8_t s = 0; s < TRACE_LENGTH(trace); s++) {
+    mock_set_pin(digital_pins_numbers[BUTTON_PIN_INDEX], !trace[s].pressed);
+    for (uint16_t t = 0; t < trace[s].duration; t++) {
+      loop_digital_pins();
+      mock_advance_millis(1);
+    }
+  }
+  TEST_ASSERT_EQUAL(1, counters[BUTTON_PIN_INDEX].click_cnt);
+  TEST_ASSERT_EQUAL(1, counters[BUTTON_PIN_INDEX].single_click_cnt);
+  TEST_ASSERT_EQUAL(1, counters[BUTTON_PIN_INDEX].release_cnt);
+  TEST_ASSERT_EQUAL(0, counters[BUTTON_PIN_INDEX].long_press_cnt);
+}
+
+void setUp() {
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_clean_click);
+  RUN_TEST(test_bouncing_click);
+  RUN_TEST(test_double_click);
+  RUN_TEST(test_long_press);
+  RUN_TEST(test_glitch_is_ignored);
+  RUN_TEST(test_loop_counts_clicks);
+  return UNITY_END();
+}
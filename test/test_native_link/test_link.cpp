@@ -0,0 +1,134 @@
+#include <unity.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <link.h>
+
+#define LINK_CONFIG_NEXT_ADDRESS 3
+#define LINK_APPLY_ADDRESS 0x108
+#define LINK_CONFIRM_ADDRESS 0x109
+#define LINK_TURNAROUND_REGISTER 7
+#define FAST_LINK LINK_CONFIG(5, LINK_PARITY_EVEN)
+
+uint8_t write_register(uint16_t address, uint16_t value) {
+  slave.writeRegisterToBuffer(0, value);
+  return cb_write_holding_register(0x10, address, 1);
+}
+
+void setUp() {
+  mock_reset();
+  EEPROM.clear(0xFF);
+  load_settings();
+  link_setup();
+}
+
+void test_timing(void) {
+  link_timing_t timing;
+  link_timing(LINK_DEFAULT_CONFIG, &timing);
+  TEST_ASSERT_EQUAL(521, timing.char_us);
+  TEST_ASSERT_EQUAL(1823, timing.t35_us);
+  link_timing(LINK_CONFIG(1, LINK_PARITY_EVEN), &timing);
+  TEST_ASSERT_EQUAL(1146, timing.char_us);
+  TEST_ASSERT_EQUAL(4011, timing.t35_us);
+  // fixed t3.5 above 19200 baud
+  link_timing(FAST_LINK, &timing);
+  TEST_ASSERT_EQUAL(96, timing.char_us);
+  TEST_ASSERT_EQUAL(1750, timing.t35_us);
+  TEST_ASSERT_EQUAL(1846, timing.turnaround_us);
+  // the node runs the default link
+  TEST_ASSERT_EQUAL(1823 + 521, read_single_input_register(LINK_TURNAROUND_REGISTER));
+}
+
+void test_validate(void) {
+  TEST_ASSERT_TRUE(link_validate(LINK_DEFAULT_CONFIG));
+  TEST_ASSERT_TRUE(link_validate(LINK_CONFIG(6, LINK_PARITY_ODD)));
+  TEST_ASSERT_FALSE(link_validate(LINK_CONFIG(7, LINK_PARITY_NONE)));
+  TEST_ASSERT_FALSE(link_validate(LINK_CONFIG(0, 3)));
+  TEST_ASSERT_FALSE(link_validate(0xFF));
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_VALUE, write_register(LINK_CONFIG_NEXT_ADDRESS, 0x07));
+  // the running config only changes through the handshake
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_ADDRESS, write_register(2, FAST_LINK));
+}
+
+void test_baud_error(void) {
+  TEST_ASSERT_EQUAL(2, link_baud_error(38400, 8000000));
+  TEST_ASSERT_EQUAL(21, link_baud_error(57600, 8000000));
+  TEST_ASSERT_EQUAL(2, link_baud_error(76800, 8000000));
+  TEST_ASSERT_EQUAL(35, link_baud_error(115200, 8000000));
+  TEST_ASSERT_EQUAL(0, link_baud_error(250000, 8000000));
+  TEST_ASSERT_EQUAL(21, link_baud_error(115200, 16000000));
+  TEST_ASSERT_TRUE(link_baud_error(115200, 8000000) > LINK_MAX_BAUD_ERROR);
+}
+
+void test_erased_settings_boot_default_link(void) {
+  EEPROM.clear(0xFF);
+  // magic present, link bytes from before the link settings
+  EEPROM.update(SETTINGS_OFFSET, MAGIC);
+  load_settings();
+  link_setup();
+  TEST_ASSERT_EQUAL(BAUD_RATE, Serial.baud());
+  TEST_ASSERT_EQUAL(SERIAL_8N1, Serial.config());
+  TEST_ASSERT_FALSE(link_trial_active());
+}
+
+void test_apply_and_confirm(void) {
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(LINK_CONFIG_NEXT_ADDRESS, FAST_LINK));
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(LINK_APPLY_ADDRESS, 1));
+  // the response goes out first
+  TEST_ASSERT_EQUAL(BAUD_RATE, Serial.baud());
+  link_loop();
+  TEST_ASSERT_EQUAL(115200, Serial.baud());
+  TEST_ASSERT_EQUAL(SERIAL_8E1, Serial.config());
+  TEST_ASSERT_TRUE(link_trial_active());
+  TEST_ASSERT_EQUAL(STATUS_OK, write_register(LINK_CONFIRM_ADDRESS, 1));
+  TEST_ASSERT_FALSE(link_trial_active());
+  mock_advance_millis(LINK_TRIAL_TIMEOUT);
+  link_loop();
+  TEST_ASSERT_EQUAL(115200, Serial.baud());
+  // persisted as the new link
+  load_settings();
+  TEST_ASSERT_EQUAL(FAST_LINK, node_settings.link_config);
+  link_setup();
+  TEST_ASSERT_FALSE(link_trial_active());
+  TEST_ASSERT_EQUAL(115200, Serial.baud());
+}
+
+void test_unconfirmed_link_reverts(void) {
+  write_register(LINK_CONFIG_NEXT_ADDRESS, FAST_LINK);
+  write_register(LINK_APPLY_ADDRESS, 1);
+  link_loop();
+  mock_advance_millis(LINK_TRIAL_TIMEOUT - 1);
+  link_loop();
+  TEST_ASSERT_EQUAL(115200, Serial.baud());
+  mock_advance_millis(1);
+  link_loop();
+  TEST_ASSERT_EQUAL(BAUD_RATE, Serial.baud());
+  TEST_ASSERT_FALSE(link_trial_active());
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_VALUE, write_register(LINK_CONFIRM_ADDRESS, 1));
+  // the request is forgotten, the next boot does not try again
+  load_settings();
+  TEST_ASSERT_EQUAL(LINK_DEFAULT_CONFIG, node_settings.link_config_next);
+}
+
+void test_next_link_is_tried_at_boot(void) {
+  write_register(LINK_CONFIG_NEXT_ADDRESS, FAST_LINK);
+  load_settings();
+  link_setup();
+  TEST_ASSERT_TRUE(link_trial_active());
+  TEST_ASSERT_EQUAL(115200, Serial.baud());
+  mock_advance_millis(LINK_TRIAL_TIMEOUT);
+  link_loop();
+  TEST_ASSERT_EQUAL(BAUD_RATE, Serial.baud());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_timing);
+  RUN_TEST(test_validate);
+  RUN_TEST(test_baud_error);
+  RUN_TEST(test_erased_settings_boot_default_link);
+  RUN_TEST(test_apply_and_confirm);
+  RUN_TEST(test_unconfirmed_link_reverts);
+  RUN_TEST(test_next_link_is_tried_at_boot);
+  return UNITY_END();
+}
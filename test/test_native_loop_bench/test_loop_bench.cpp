@@ -0,0 +1,105 @@
+#include <unity.h>
+#include <chrono>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <fade.h>
+#include <timer.h>
+
+/**
+ * Loop-rate benchmark for the host build. Compares a pass that reads every
+ * pin record from EEPROM (the behaviour before the settings cache) with
+ * loop_digital_pins() running from the RAM copy, and times a busy pass
+ * with every output fading and every input toggling. Build with a board
+ * profile, e.g. -DBOARD_MEGA -DBOARD_PIN_COUNT=24, to compare pin counts.
+ */
+
+#define BENCH_PASSES 100000
+
+typedef std::chrono::steady_clock bench_clock;
+
+void setUp() {
+  mock_reset();
+  timer_reset();
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    digital_pin_setting_t setting;
+    memset(&setting, 0, sizeof(setting));
+    setting.mode = (i % 2) ? DIGITAL_PIN_MODE_OUTPUT | DIGITAL_PIN_PWM_MASK
+      : DIGITAL_PIN_MODE_INPUT_PULLUP | DIGITAL_PIN_BUTTON_MASK;
+    setting.group = 1;
+    write_digital_pin_settings_to_eeprom(i, setting);
+  }
+  load_digital_pin_settings();
+  EEPROM.reset_counters();
+}
+
+void legacy_pass() {
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    digital_pin_setting_t setting;
+    read_digital_pin_settings_from_eeprom(i, setting);
+  }
+  loop_digital_pins();
+}
+
+void busy_pass() {
+  static unsigned long passes;
+  if (++passes % 64 == 0) {
+    for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i += 2) {
+      mock_set_pin(digital_pins_numbers[i], (passes / 64 + i) % 2);
+    }
+  }
+  for (uint8_t i = 1; i < NR_OF_DIGITAL_PINS; i += 2) {
+    if (!fade_is_active(i)) {
+      digital_pin_context_t ctx;
+      init_digital_pin_context(i, &ctx);
+      update_output(&ctx, COMMAND_FADE_TOGGLE);
+    }
+  }
+  fade_tick();
+  loop_digital_pins();
+}
+
+double ns_per_pass(void (*pass)()) {
+  bench_clock::time_point start = bench_clock::now();
+  for (long i = 0; i < BENCH_PASSES; i++) {
+    pass();
+    mock_advance_micros(50);
+  }
+  std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+  return elapsed.count() / BENCH_PASSES;
+}
+
+void test_loop_does_not_read_eeprom(void) {
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(0, EEPROM.reads);
+  TEST_ASSERT_EQUAL(0, EEPROM.writes);
+}
+
+void test_bench_loop_pass(void) {
+  double legacy = ns_per_pass(legacy_pass);
+  unsigned long legacy_reads = EEPROM.reads / BENCH_PASSES;
+  EEPROM.reset_counters();
+  double cached = ns_per_pass(loop_digital_pins);
+  unsigned long cached_reads = EEPROM.reads / BENCH_PASSES;
+  printf("%d pins, loop pass with eeprom reads: %8.1f ns, %lu eeprom bytes\n",
+         NR_OF_DIGITAL_PINS, legacy, legacy_reads);
+  printf("%d pins, loop pass with settings cache: %8.1f ns, %lu eeprom bytes\n",
+         NR_OF_DIGITAL_PINS, cached, cached_reads);
+  TEST_ASSERT_EQUAL(NR_OF_DIGITAL_PINS * sizeof(digital_pin_setting_t), legacy_reads);
+  TEST_ASSERT_EQUAL(0, cached_reads);
+}
+
+void test_bench_busy_loop_pass(void) {
+  double busy = ns_per_pass(busy_pass);
+  printf("%d pins, busy loop pass: %8.1f ns, %.1f ns per pin\n",
+         NR_OF_DIGITAL_PINS, busy, busy / NR_OF_DIGITAL_PINS);
+  TEST_ASSERT_EQUAL(0, EEPROM.reads);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_loop_does_not_read_eeprom);
+  RUN_TEST(test_bench_loop_pass);
+  RUN_TEST(test_bench_busy_loop_pass);
+  return UNITY_END();
+}
@@ -0,0 +1,87 @@
+#include <unity.h>
+#include <chrono>
+#include <stddef.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <fade.h>
+#include "../pin_setting_address.h"
+
+/**
+ * Loop cost with 0, 1 and 12 active fades on a node with 12 PWM outputs.
+ * Only outputs on the active list are visited, so an idle node should cost
+ * next to nothing per pass.
+ */
+
+#define BENCH_PASSES 100000
+
+typedef std::chrono::steady_clock bench_clock;
+
+void setUp() {
+  mock_reset();
+  EEPROM.clear(0);
+  load_digital_pin_settings();
+  memset(output_states, 0, NR_OF_DIGITAL_PINS * sizeof(struct output_pin_state));
+  memset(current_values, 0, NR_OF_DIGITAL_PINS);
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    write_setting(PIN_SETTING_ADDRESS(i, mode), DIGITAL_PIN_MODE_OUTPUT | DIGITAL_PIN_PWM_MASK);
+    write_setting(PIN_SETTING_ADDRESS(i, pwm_on_value), 0xFF);
+  }
+  loop_digital_pins();
+}
+
+void start_fades(uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    digital_pin_context_t ctx;
+    init_digital_pin_context(i, &ctx);
+    update_output(&ctx, COMMAND_FADE_TO_ON);
+  }
+}
+
+double ns_per_pass() {
+  bench_clock::time_point start = bench_clock::now();
+  for (long i = 0; i < BENCH_PASSES; i++) {
+    loop_digital_pins();
+  }
+  std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+  return elapsed.count() / BENCH_PASSES;
+}
+
+void bench_active_fades(uint8_t count) {
+  start_fades(count);
+  TEST_ASSERT_EQUAL(count, active_output_count);
+  printf("loop pass with %2d active fades: %8.1f ns\n", count, ns_per_pass());
+  TEST_ASSERT_EQUAL(count, active_output_count);
+}
+
+void test_bench_no_active_fades(void) {
+  bench_active_fades(0);
+}
+
+void test_bench_one_active_fade(void) {
+  bench_active_fades(1);
+}
+
+void test_bench_all_fades_active(void) {
+  bench_active_fades(NR_OF_DIGITAL_PINS);
+}
+
+void test_finished_fade_leaves_active_list(void) {
+  start_fades(1);
+  while (fade_is_active(0)) {
+    fade_tick();
+  }
+  loop_digital_pins();
+  TEST_ASSERT_EQUAL(0, active_output_count);
+  TEST_ASSERT_EQUAL(OUTPUT_STATE_IDLE, output_states[0].state);
+  TEST_ASSERT_EQUAL(0xFF, digital_pin_settings[0].output_value);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_bench_no_active_fades);
+  RUN_TEST(test_bench_one_active_fade);
+  RUN_TEST(test_bench_all_fades_active);
+  RUN_TEST(test_finished_fade_leaves_active_list);
+  return UNITY_END();
+}
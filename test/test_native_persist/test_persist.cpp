@@ -0,0 +1,91 @@
+#include <unity.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <persist.h>
+
+void run_persist_loop(unsigned long ms) {
+  for (unsigned long i = 0; i < ms; i++) {
+    persist_loop();
+    mock_advance_millis(1);
+  }
+}
+
+void setUp() {
+  mock_reset();
+  load_digital_pin_settings();
+  persist_recover();
+  persist_flush_count = 0;
+}
+
+void set_output_value(uint8_t index, uint8_t value) {
+  write_setting(8 + index * sizeof(digital_pin_setting_t) + 2, value);
+}
+
+void test_changes_are_deferred_until_quiet(void) {
+  EEPROM.reset_counters();
+  set_output_value(3, 1);
+  run_persist_loop(PERSIST_QUIET_PERIOD - 10);
+  set_output_value(3, 0);
+  run_persist_loop(PERSIST_QUIET_PERIOD - 10);
+  TEST_ASSERT_EQUAL(0, EEPROM.writes);
+  TEST_ASSERT_EQUAL(1, persist_pending_count());
+  run_persist_loop(100);
+  TEST_ASSERT_EQUAL(0, persist_pending_count());
+  TEST_ASSERT_EQUAL(1, persist_flush_count);
+}
+
+void test_flush_writes_one_byte_per_pass(void) {
+  set_output_value(1, 0x20);
+  mock_advance_millis(PERSIST_QUIET_PERIOD);
+  EEPROM.reset_counters();
+  persist_loop();
+  TEST_ASSERT_LESS_OR_EQUAL(1, EEPROM.writes);
+}
+
+void test_recover_newest_value(void) {
+  set_output_value(5, 0x10);
+  persist_flush();
+  set_output_value(5, 0x30);
+  set_output_value(6, 0x40);
+  persist_flush();
+  load_digital_pin_settings();
+  TEST_ASSERT_EQUAL(0xFF, digital_pin_settings[5].output_value);
+  persist_recover();
+  TEST_ASSERT_EQUAL(0x30, digital_pin_settings[5].output_value);
+  TEST_ASSERT_EQUAL(0x40, digital_pin_settings[6].output_value);
+}
+
+void test_recover_after_wrap(void) {
+  set_output_value(2, 0x55);
+  persist_flush();
+  for (uint16_t i = 0; i < JOURNAL_ENTRIES * 3 + 7; i++) {
+    set_output_value(4, i & 0xFF);
+    persist_flush();
+  }
+  load_digital_pin_settings();
+  persist_recover();
+  TEST_ASSERT_EQUAL(0x55, digital_pin_settings[2].output_value);
+  TEST_ASSERT_EQUAL((JOURNAL_ENTRIES * 3 + 6) & 0xFF, digital_pin_settings[4].output_value);
+}
+
+void test_journal_spreads_writes(void) {
+  EEPROM.reset_counters();
+  for (uint16_t i = 0; i < JOURNAL_ENTRIES; i++) {
+    set_output_value(0, i & 1);
+    persist_flush();
+  }
+  uint8_t base = EEPROM.data[pin_setting_start_address(0) + 2];
+  TEST_ASSERT_TRUE(base == 0xFF || base == 0 || base == 1);
+  TEST_ASSERT_LESS_OR_EQUAL(JOURNAL_ENTRIES * sizeof(journal_entry_t) + 2, EEPROM.writes);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_changes_are_deferred_until_quiet);
+  RUN_TEST(test_flush_writes_one_byte_per_pass);
+  RUN_TEST(test_recover_newest_value);
+  RUN_TEST(test_recover_after_wrap);
+  RUN_TEST(test_journal_spreads_writes);
+  return UNITY_END();
+}
@@ -0,0 +1,59 @@
+#include <unity.h>
+#include <ArduinoMock.h>
+#include <homectrl.h>
+#include <profile.h>
+
+#define PROFILE_REGISTER(offset) read_single_input_register(0x100 + (offset))
+#define STAT_REGISTER(slot, stat) PROFILE_REGISTER(1 + 4 * (slot) + (stat))
+#define HISTOGRAM_REGISTER(bucket) PROFILE_REGISTER(1 + 4 * PROFILE_SLOTS + (bucket))
+
+void setUp() {
+  mock_reset();
+  profile_reset();
+}
+
+void test_stats(void) {
+  profile_record(PROFILE_EEPROM_WRITE, 3300);
+  profile_record(PROFILE_EEPROM_WRITE, 100);
+  profile_record(PROFILE_EEPROM_WRITE, 200);
+  TEST_ASSERT_EQUAL(PROFILE_SLOTS, PROFILE_REGISTER(0));
+  TEST_ASSERT_EQUAL(3, STAT_REGISTER(PROFILE_EEPROM_WRITE, 0));
+  TEST_ASSERT_EQUAL(100, STAT_REGISTER(PROFILE_EEPROM_WRITE, 1));
+  TEST_ASSERT_EQUAL(3300, STAT_REGISTER(PROFILE_EEPROM_WRITE, 2));
+  TEST_ASSERT_EQUAL(1200, STAT_REGISTER(PROFILE_EEPROM_WRITE, 3));
+}
+
+void test_loop_histogram(void) {
+  profile_record_loop(1);
+  profile_record_loop(40);
+  profile_record_loop(63);
+  profile_record_loop(64);
+  profile_record_loop(1000000);
+  TEST_ASSERT_EQUAL(1, HISTOGRAM_REGISTER(0));
+  TEST_ASSERT_EQUAL(2, HISTOGRAM_REGISTER(5));
+  TEST_ASSERT_EQUAL(1, HISTOGRAM_REGISTER(6));
+  TEST_ASSERT_EQUAL(1, HISTOGRAM_REGISTER(PROFILE_HISTOGRAM_BUCKETS - 1));
+  TEST_ASSERT_EQUAL(0xFFFF, STAT_REGISTER(PROFILE_LOOP, 2));
+}
+
+void test_eeprom_writes_are_profiled(void) {
+  write_setting(8 + 1, 4);
+  TEST_ASSERT_EQUAL(1, STAT_REGISTER(PROFILE_EEPROM_WRITE, 0));
+}
+
+void test_reset_on_write(void) {
+  profile_record(PROFILE_REQUEST, 500);
+  slave.writeRegisterToBuffer(0, 1);
+  TEST_ASSERT_EQUAL(STATUS_OK, cb_write_holding_register(0x10, 0x100, 1));
+  TEST_ASSERT_EQUAL(0, STAT_REGISTER(PROFILE_REQUEST, 0));
+  TEST_ASSERT_EQUAL(0, STAT_REGISTER(PROFILE_REQUEST, 2));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_stats);
+  RUN_TEST(test_loop_histogram);
+  RUN_TEST(test_eeprom_writes_are_profiled);
+  RUN_TEST(test_reset_on_write);
+  return UNITY_END();
+}
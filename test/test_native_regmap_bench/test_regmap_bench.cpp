@@ -0,0 +1,266 @@
+#include <unity.h>
+#include <chrono>
+#include <stddef.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+
+/**
+ * Reads of the full register map through Modbus RTU frames, and the time
+ * the read callbacks take to fill the response for a full map read. The
+ * per register lookup is timed as well as a reference for the block copy.
+ */
+
+#define BENCH_PASSES 20000
+#define RESPONSE_TIMEOUT_US 200000
+#define PER_PIN_REGISTERS 12
+#define INPUT_REGISTERS (8 + NR_OF_DIGITAL_PINS * PER_PIN_REGISTERS)
+#define HOLDING_REGISTERS (sizeof(settings_t) + NR_OF_DIGITAL_PINS * sizeof(digital_pin_setting_t))
+#define REGISTERS_PER_REQUEST 100
+
+typedef std::chrono::steady_clock bench_clock;
+
+uint16_t crc16(const uint8_t *data, uint8_t length) {
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+  }
+  return crc;
+}
+
+/**
+ * Sends a read request and polls the slave until it answered. Returns the
+ * exception code, or 0 and the registers in values.
+ */
+uint8_t read_registers(uint8_t fc, uint16_t address, uint16_t length, uint16_t *values) {
+  uint8_t frame[256] = {DEFAULT_SLAVE_ID, fc, (uint8_t) (address >> 8), (uint8_t) address,
+                        (uint8_t) (length >> 8), (uint8_t) length};
+  uint16_t crc = crc16(frame, 6);
+  frame[6] = crc & 0xFF;
+  frame[7] = crc >> 8;
+  mock_serial_feed(frame, 8);
+
+  size_t received = 0;
+  unsigned long start = micros();
+  while (micros() - start < RESPONSE_TIMEOUT_US) {
+    slave.poll();
+    received += mock_serial_take(frame + received, sizeof(frame) - received);
+    if (received >= 5 && (frame[1] & 0x80)) {
+      return frame[2];
+    }
+    if (received >= 5 && received == 5u + frame[2]) {
+      break;
+    }
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(5 + 2 * length, received, "no complete response");
+  TEST_ASSERT_EQUAL(0, crc16(frame, received));
+  for (uint16_t i = 0; i < length; i++) {
+    values[i] = (frame[3 + 2 * i] << 8) | frame[4 + 2 * i];
+  }
+  return 0;
+}
+
+/**
+ * Writes a single holding register. Returns the exception code or 0.
+ */
+uint8_t write_register(uint16_t address, uint16_t value) {
+  uint8_t frame[8] = {DEFAULT_SLAVE_ID, 6, (uint8_t) (address >> 8), (uint8_t) address,
+                      (uint8_t) (value >> 8), (uint8_t) value};
+  uint16_t crc = crc16(frame, 6);
+  frame[6] = crc & 0xFF;
+  frame[7] = crc >> 8;
+  mock_serial_feed(frame, 8);
+
+  size_t received = 0;
+  unsigned long start = micros();
+  while (micros() - start < RESPONSE_TIMEOUT_US && received < 8) {
+    slave.poll();
+    received += mock_serial_take(frame + received, sizeof(frame) - received);
+    if (received >= 5 && (frame[1] & 0x80)) {
+      return frame[2];
+    }
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(8, received, "no complete response");
+  return 0;
+}
+
+/**
+ * Reads registers 0 to count - 1 in requests of at most
+ * REGISTERS_PER_REQUEST registers.
+ */
+void read_map(uint8_t fc, uint16_t count, uint16_t *values) {
+  for (uint16_t address = 0; address < count; address += REGISTERS_PER_REQUEST) {
+    uint16_t length = count - address;
+    if (length > REGISTERS_PER_REQUEST) {
+      length = REGISTERS_PER_REQUEST;
+    }
+    TEST_ASSERT_EQUAL(0, read_registers(fc, address, length, values + address));
+  }
+}
+
+uint32_t counter_value(const uint16_t *values) {
+  return values[0] | ((uint32_t) values[1] << 16);
+}
+
+void setUp() {
+  mock_reset();
+  mock_use_realtime_clock();
+  EEPROM.clear(0);
+  load_settings();
+  load_digital_pin_settings();
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    counters[i].click_cnt = 0x10000 + 1000 + i;
+    counters[i].single_click_cnt = 2000 + i;
+    counters[i].double_click_cnt = 3000 + i;
+    counters[i].long_press_cnt = 4000 + i;
+    counters[i].release_cnt = 5000 + i;
+    digital_pin_settings[i].group = i;
+    digital_pin_settings[i].fade_time = 100 + i;
+  }
+  slave.cbVector[CB_READ_INPUT_REGISTERS] = cb_read_input_register;
+  slave.cbVector[CB_READ_HOLDING_REGISTERS] = cb_read_holding_register;
+  slave.cbVector[CB_WRITE_HOLDING_REGISTERS] = cb_write_holding_register;
+  slave.begin(BAUD_RATE);
+}
+
+void test_full_input_map(void) {
+  uint16_t values[INPUT_REGISTERS];
+  read_map(4, INPUT_REGISTERS, values);
+  TEST_ASSERT_EQUAL(NR_OF_DIGITAL_PINS, values[0]);
+  // link config and turnaround of the default link
+  TEST_ASSERT_EQUAL(0, values[6]);
+  TEST_ASSERT_EQUAL(2344, values[7]);
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    uint16_t *pin = values + 8 + PER_PIN_REGISTERS * i;
+    TEST_ASSERT_EQUAL(digital_pins_numbers[i], pin[0]);
+    TEST_ASSERT_EQUAL(0, pin[1]);
+    TEST_ASSERT_EQUAL(0x10000 + 1000 + i, counter_value(pin + 2));
+    TEST_ASSERT_EQUAL(2000 + i, counter_value(pin + 4));
+    TEST_ASSERT_EQUAL(3000 + i, counter_value(pin + 6));
+    TEST_ASSERT_EQUAL(4000 + i, counter_value(pin + 8));
+    TEST_ASSERT_EQUAL(5000 + i, counter_value(pin + 10));
+  }
+}
+
+void test_unaligned_input_read(void) {
+  uint16_t address = 8 + PER_PIN_REGISTERS * 3 + 9;
+  uint16_t values[17];
+  TEST_ASSERT_EQUAL(0, read_registers(4, address, 17, values));
+  TEST_ASSERT_EQUAL(0, values[0]);
+  TEST_ASSERT_EQUAL(5003, counter_value(values + 1));
+  TEST_ASSERT_EQUAL(digital_pins_numbers[4], values[3]);
+  TEST_ASSERT_EQUAL(0x10000 + 1004, counter_value(values + 5));
+  TEST_ASSERT_EQUAL(5004, counter_value(values + 13));
+  TEST_ASSERT_EQUAL(digital_pins_numbers[5], values[15]);
+  for (uint8_t i = 0; i < 17; i++) {
+    TEST_ASSERT_EQUAL(read_single_input_register(address + i), values[i]);
+  }
+}
+
+void test_uptime(void) {
+  uint16_t values[2];
+  delay(70);
+  uint32_t before = millis();
+  TEST_ASSERT_EQUAL(0, read_registers(4, 1, 2, values));
+  TEST_ASSERT_UINT32_WITHIN(RESPONSE_TIMEOUT_US / 1000, before, counter_value(values));
+  TEST_ASSERT_TRUE(counter_value(values) <= millis());
+}
+
+void test_read_and_clear(void) {
+  uint16_t pin_2 = 8 + PER_PIN_REGISTERS * 2;
+  uint16_t values[8];
+  TEST_ASSERT_EQUAL(0, write_register(0x101, 1));
+  TEST_ASSERT_EQUAL(0, read_registers(3, 0x101, 1, values));
+  TEST_ASSERT_EQUAL(1, values[0]);
+  // click counter read completely, single click counter only its low word
+  TEST_ASSERT_EQUAL(0, read_registers(4, pin_2 + 2, 3, values));
+  TEST_ASSERT_EQUAL(0x10000 + 1002, counter_value(values));
+  TEST_ASSERT_EQUAL(0, counters[2].click_cnt);
+  TEST_ASSERT_EQUAL(2002, counters[2].single_click_cnt);
+  counters[2].click_cnt = 7;
+  TEST_ASSERT_EQUAL(0, read_registers(4, pin_2 + 2, 4, values));
+  TEST_ASSERT_EQUAL(7, counter_value(values));
+  TEST_ASSERT_EQUAL(2002, counter_value(values + 2));
+  TEST_ASSERT_EQUAL(0, counters[2].single_click_cnt);
+  TEST_ASSERT_EQUAL(0, write_register(0x101, 0));
+  TEST_ASSERT_EQUAL(0, read_registers(4, pin_2 + 8, 2, values));
+  TEST_ASSERT_EQUAL(4002, counters[2].long_press_cnt);
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_VALUE, write_register(0x101, 2));
+}
+
+void test_reads_outside_a_window_fail(void) {
+  uint16_t values[2];
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_ADDRESS, read_registers(4, INPUT_REGISTERS - 1, 2, values));
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_ADDRESS, read_registers(4, 0xFF, 2, values));
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_ADDRESS, read_registers(3, HOLDING_REGISTERS, 1, values));
+  // past 0xFFFF, not wrapping into the window at 0
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_ADDRESS, read_registers(4, 0xFFFF, 2, values));
+}
+
+void test_holding_reads_come_from_ram(void) {
+  uint16_t values[HOLDING_REGISTERS];
+  EEPROM.reset_counters();
+  read_map(3, HOLDING_REGISTERS, values);
+  TEST_ASSERT_EQUAL(0, EEPROM.reads);
+  TEST_ASSERT_EQUAL(MAGIC, values[0]);
+  TEST_ASSERT_EQUAL(DEFAULT_SLAVE_ID, values[1]);
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    TEST_ASSERT_EQUAL(i, values[8 + 16 * i + offsetof(digital_pin_setting_t, group)]);
+    TEST_ASSERT_EQUAL(100 + i, values[8 + 16 * i + offsetof(digital_pin_setting_t, fade_time)]);
+  }
+}
+
+/**
+ * Time the callback takes to fill the responses of a full map read.
+ */
+double ns_per_map_read(uint8_t (*callback)(uint8_t, uint16_t, uint16_t), uint8_t fc, uint16_t count) {
+  bench_clock::time_point start = bench_clock::now();
+  for (long i = 0; i < BENCH_PASSES; i++) {
+    for (uint16_t address = 0; address < count; address += REGISTERS_PER_REQUEST) {
+      uint16_t length = count - address;
+      callback(fc, address, length > REGISTERS_PER_REQUEST ? REGISTERS_PER_REQUEST : length);
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+  return elapsed.count() / BENCH_PASSES;
+}
+
+uint8_t read_input_registers_one_by_one(uint8_t fc, uint16_t address, uint16_t length) {
+  for (uint16_t i = 0; i < length; i++) {
+    slave.writeRegisterToBuffer(i, read_single_input_register(address + i));
+  }
+  return STATUS_OK;
+}
+
+uint8_t read_settings_one_by_one(uint8_t fc, uint16_t address, uint16_t length) {
+  for (uint16_t i = 0; i < length; i++) {
+    slave.writeRegisterToBuffer(i, read_setting(address + i));
+  }
+  return STATUS_OK;
+}
+
+void test_bench_full_map_read(void) {
+  printf("%3d input registers, block copy:       %8.1f ns\n", INPUT_REGISTERS,
+         ns_per_map_read(cb_read_input_register, 4, INPUT_REGISTERS));
+  printf("%3d input registers, per register:     %8.1f ns\n", INPUT_REGISTERS,
+         ns_per_map_read(read_input_registers_one_by_one, 4, INPUT_REGISTERS));
+  printf("%3d holding registers, block copy:     %8.1f ns\n", (int) HOLDING_REGISTERS,
+         ns_per_map_read(cb_read_holding_register, 3, HOLDING_REGISTERS));
+  printf("%3d holding registers, EEPROM per byte: %8.1f ns\n", (int) HOLDING_REGISTERS,
+         ns_per_map_read(read_settings_one_by_one, 3, HOLDING_REGISTERS));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_full_input_map);
+  RUN_TEST(test_unaligned_input_read);
+  RUN_TEST(test_uptime);
+  RUN_TEST(test_read_and_clear);
+  RUN_TEST(test_reads_outside_a_window_fail);
+  RUN_TEST(test_holding_reads_come_from_ram);
+  RUN_TEST(test_bench_full_map_read);
+  return UNITY_END();
+}
@@ -0,0 +1,179 @@
+#include <unity.h>
+#include <stddef.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <fade.h>
+#include <scene.h>
+#include "../pin_setting_address.h"
+
+#define SWITCH_PIN_INDEX 0
+#define BUTTON_PIN_INDEX 1
+#define FIRST_DIMMER_INDEX 8
+#define DIMMERS 4
+#define SCENE 2
+
+void run_outputs() {
+  for (uint16_t i = 0; i < 10000 && active_output_count > 0; i++) {
+    fade_tick();
+    loop_digital_pins();
+  }
+}
+
+void store_scene() {
+  while (scene_store_pending()) {
+    scene_loop();
+  }
+}
+
+void set_dimmer(uint8_t index, uint8_t value) {
+  write_setting(PIN_SETTING_ADDRESS(index, pwm_on_value), value);
+  digital_pin_context_t ctx;
+  init_digital_pin_context(index, &ctx);
+  update_output(&ctx, COMMAND_ON);
+}
+
+void setUp() {
+  mock_reset();
+  EEPROM.clear(0xFF);
+  load_settings();
+  load_digital_pin_settings();
+  memset(current_values, 0, NR_OF_DIGITAL_PINS);
+  memset(output_states, 0, NR_OF_DIGITAL_PINS * sizeof(struct output_pin_state));
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    fade_stop(i);
+  }
+  write_setting(PIN_SETTING_ADDRESS(SWITCH_PIN_INDEX, mode), DIGITAL_PIN_MODE_OUTPUT);
+  write_setting(PIN_SETTING_ADDRESS(BUTTON_PIN_INDEX, mode), DIGITAL_PIN_MODE_INPUT_PULLUP | DIGITAL_PIN_BUTTON_MASK);
+  write_setting(PIN_SETTING_ADDRESS(BUTTON_PIN_INDEX, click_command), COMMAND_SCENE_RECALL + SCENE);
+  for (uint8_t i = FIRST_DIMMER_INDEX; i < FIRST_DIMMER_INDEX + DIMMERS; i++) {
+    write_setting(PIN_SETTING_ADDRESS(i, mode), DIGITAL_PIN_MODE_OUTPUT | DIGITAL_PIN_PWM_MASK);
+    write_setting(PIN_SETTING_ADDRESS(i, fade_time), 5 * (i - FIRST_DIMMER_INDEX));
+  }
+  loop_digital_pins();
+}
+
+void capture_test_scene() {
+  digital_pin_context_t ctx;
+  init_digital_pin_context(SWITCH_PIN_INDEX, &ctx);
+  update_output(&ctx, COMMAND_ON);
+  for (uint8_t i = 0; i < DIMMERS; i++) {
+    set_dimmer(FIRST_DIMMER_INDEX + i, 0x40 * i + 0x20);
+  }
+  TEST_ASSERT_TRUE(capture_scene(SCENE));
+  store_scene();
+}
+
+void all_off() {
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    digital_pin_context_t ctx;
+    init_digital_pin_context(i, &ctx);
+    if ((ctx.settings.mode & DIGITAL_PIN_MODE_MASK) == DIGITAL_PIN_MODE_OUTPUT) {
+      update_output(&ctx, COMMAND_OFF);
+    }
+  }
+}
+
+void test_unused_scene_is_not_recalled(void) {
+  TEST_ASSERT_FALSE(recall_scene(SCENE));
+}
+
+void test_capture_and_recall(void) {
+  capture_test_scene();
+  all_off();
+  TEST_ASSERT_TRUE(recall_scene(SCENE));
+  TEST_ASSERT_EQUAL(1, current_values[SWITCH_PIN_INDEX]);
+  for (uint8_t i = 0; i < DIMMERS; i++) {
+    // all dimmers start fading with the same recall
+    TEST_ASSERT_TRUE(fade_is_active(FIRST_DIMMER_INDEX + i));
+    TEST_ASSERT_EQUAL(OUTPUT_STATE_FADE_TO_ON, output_states[FIRST_DIMMER_INDEX + i].state);
+  }
+  run_outputs();
+  for (uint8_t i = 0; i < DIMMERS; i++) {
+    TEST_ASSERT_EQUAL(0x40 * i + 0x20, current_values[FIRST_DIMMER_INDEX + i]);
+    TEST_ASSERT_EQUAL(0x40 * i + 0x20, digital_pin_settings[FIRST_DIMMER_INDEX + i].output_value);
+  }
+}
+
+void test_scene_fade_times(void) {
+  capture_test_scene();
+  all_off();
+  recall_scene(SCENE);
+  uint16_t ticks = 0;
+  // dimmer 1 has the shortest non default fade time, 500 ms full scale
+  while (fade_is_active(FIRST_DIMMER_INDEX + 1)) {
+    fade_tick();
+    ticks++;
+  }
+  TEST_ASSERT_UINT_WITHIN(5, 500UL * 0x60 / 0xFF * 1000 / FADE_TICK_US, ticks);
+}
+
+void test_recall_interrupts_running_fade(void) {
+  capture_test_scene();
+  digital_pin_context_t ctx;
+  init_digital_pin_context(FIRST_DIMMER_INDEX + 3, &ctx);
+  update_output(&ctx, COMMAND_FADE_TO_OFF);
+  fade_tick();
+  recall_scene(SCENE);
+  run_outputs();
+  TEST_ASSERT_EQUAL(0xE0, current_values[FIRST_DIMMER_INDEX + 3]);
+  TEST_ASSERT_EQUAL(OUTPUT_STATE_IDLE, output_states[FIRST_DIMMER_INDEX + 3].state);
+}
+
+void test_button_recalls_scene(void) {
+  capture_test_scene();
+  all_off();
+  digital_pin_context_t button;
+  init_digital_pin_context(BUTTON_PIN_INDEX, &button);
+  handle_click(&button);
+  TEST_ASSERT_EQUAL(1, current_values[SWITCH_PIN_INDEX]);
+  TEST_ASSERT_TRUE(fade_is_active(FIRST_DIMMER_INDEX));
+}
+
+void test_capture_is_written_in_the_background(void) {
+  capture_test_scene();
+  uint16_t address = SCENE_OFFSET + SCENE * sizeof(scene_t);
+  set_dimmer(FIRST_DIMMER_INDEX, 0x99);
+  TEST_ASSERT_TRUE(capture_scene(SCENE));
+  TEST_ASSERT_FALSE(capture_scene(SCENE + 1));
+  uint16_t passes = 0;
+  while (scene_store_pending()) {
+    EEPROM.reset_counters();
+    scene_loop();
+    TEST_ASSERT_LESS_OR_EQUAL(1, EEPROM.writes);
+    // the magic is only valid once the whole scene is written
+    TEST_ASSERT_EQUAL(!scene_store_pending() ? SCENE_MAGIC : 0, EEPROM.data[address]);
+    passes++;
+  }
+  TEST_ASSERT_EQUAL(sizeof(scene_t) + 1, passes);
+  scene_t scene;
+  TEST_ASSERT_TRUE(scene_load(SCENE, &scene));
+  TEST_ASSERT_EQUAL(0x99, scene.level[FIRST_DIMMER_INDEX]);
+  TEST_ASSERT_EQUAL(0xFF, EEPROM.data[address + sizeof(scene_t)]);
+}
+
+void test_old_journal_bytes_are_no_scenes(void) {
+  // the journal of firmware before the crc started where the scenes are
+  for (uint8_t i = 0; i < SCENE_COUNT; i++) {
+    EEPROM.data[SCENE_OFFSET + i * sizeof(scene_t)] = SCENE_MAGIC;
+  }
+  EEPROM.data[SETTINGS_OFFSET] = MAGIC_WITHOUT_CRC;
+  load_settings();
+  TEST_ASSERT_FALSE(recall_scene(SCENE));
+  // only the first boot of the new layout forgets them
+  capture_test_scene();
+  load_settings();
+  TEST_ASSERT_TRUE(recall_scene(SCENE));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_unused_scene_is_not_recalled);
+  RUN_TEST(test_capture_and_recall);
+  RUN_TEST(test_scene_fade_times);
+  RUN_TEST(test_recall_interrupts_running_fade);
+  RUN_TEST(test_button_recalls_scene);
+  RUN_TEST(test_capture_is_written_in_the_background);
+  RUN_TEST(test_old_journal_bytes_are_no_scenes);
+  return UNITY_END();
+}
@@ -0,0 +1,227 @@
+#include <unity.h>
+#include <ArduinoMock.h>
+#include <softpwm.h>
+
+/**
+ * Software PWM frames run against plain bytes standing in for the port
+ * registers. emulate_period() plays Timer2 through one period, calling
+ * the handlers exactly where the overflow and the compare matches fire.
+ *
+ * The budget report counts the interrupts and point runs per period and
+ * prices them with the AVR cost model below, a hand count of the handlers
+ * as avr-gcc -Os compiles them:
+ *
+ * - ISR_CYCLES: vector jump, prologue and epilogue saving the registers
+ *   used, TCNT2 read and OCR2A write, reti
+ * - PERIOD_START_CYCLES: frame swap check and the set loop over the ports
+ * - POINT_CYCLES: one compare point, the clear loop over the ports with a
+ *   load, and, store for every port holding a bit
+ *
+ * A period is 256 steps of 64 cycles, 16384 cycles whatever F_CPU.
+ */
+
+#define ISR_CYCLES 60
+#define PERIOD_START_CYCLES 40
+#define POINT_CYCLES 45
+#define PERIOD_CYCLES (256UL * 64UL)
+
+uint8_t port_b, port_c, port_d;
+volatile uint8_t *test_ports[] = {&port_b, &port_c, &port_d};
+
+typedef struct {
+  uint16_t interrupts;
+  uint16_t points;
+} period_stats_t;
+
+/**
+ * Runs one period and counts the steps every channel in channel_ports and
+ * channel_masks was high.
+ */
+period_stats_t emulate_period(uint8_t channels, volatile uint8_t **channel_ports,
+                              const uint8_t *channel_masks, uint16_t *high_steps) {
+  period_stats_t stats = {1, 0};
+  uint8_t compare = soft_pwm_period_start(0);
+  for (uint8_t c = 0; c < channels; c++) {
+    high_steps[c] = 0;
+  }
+  for (uint16_t now = 0; now < 256; now++) {
+    if (now > 0 && now == compare) {
+      stats.interrupts++;
+      compare = soft_pwm_compare(now);
+    }
+    for (uint8_t c = 0; c < channels; c++) {
+      if (*channel_ports[c] & channel_masks[c]) {
+        high_steps[c]++;
+      }
+    }
+  }
+  stats.points = soft_pwm_frame()->count;
+  return stats;
+}
+
+void setUp() {
+  mock_reset();
+  soft_pwm_reset();
+  port_b = port_c = port_d = 0;
+}
+
+uint8_t attach_channels(uint8_t count, volatile uint8_t **channel_ports, uint8_t *channel_masks) {
+  for (uint8_t c = 0; c < count; c++) {
+    channel_ports[c] = test_ports[c % 3];
+    channel_masks[c] = 1 << (c / 3);
+    TEST_ASSERT_EQUAL(c, soft_pwm_attach(channel_ports[c], channel_masks[c]));
+  }
+  return count;
+}
+
+void test_duty_cycles(void) {
+  volatile uint8_t *channel_ports[6];
+  uint8_t channel_masks[6];
+  const uint8_t duties[] = {0x80, 0x10, 0xF0, 0x01, 0x40, 0xC8};
+  attach_channels(6, channel_ports, channel_masks);
+  for (uint8_t c = 0; c < 6; c++) {
+    soft_pwm_write(c, duties[c]);
+  }
+  soft_pwm_loop();
+  uint16_t high_steps[6];
+  emulate_period(6, channel_ports, channel_masks, high_steps);
+  // the first period still runs the frame the overflow found
+  emulate_period(6, channel_ports, channel_masks, high_steps);
+  for (uint8_t c = 0; c < 6; c++) {
+    // 0x01 is within SOFT_PWM_MIN_GAP of the overflow and ends early
+    TEST_ASSERT_UINT_WITHIN(c == 3 ? SOFT_PWM_MIN_GAP : 0, duties[c], high_steps[c]);
+  }
+}
+
+void test_off_and_full_on(void) {
+  volatile uint8_t *channel_ports[2];
+  uint8_t channel_masks[2];
+  attach_channels(2, channel_ports, channel_masks);
+  soft_pwm_write(0, 0x00);
+  soft_pwm_write(1, 0xFF);
+  soft_pwm_loop();
+  uint16_t high_steps[2];
+  emulate_period(2, channel_ports, channel_masks, high_steps);
+  TEST_ASSERT_EQUAL(0, high_steps[0]);
+  TEST_ASSERT_EQUAL(256, high_steps[1]);
+  // neither needs a compare point
+  TEST_ASSERT_EQUAL(0, soft_pwm_frame()->count);
+}
+
+void test_equal_duties_share_a_point(void) {
+  volatile uint8_t *channel_ports[6];
+  uint8_t channel_masks[6];
+  attach_channels(6, channel_ports, channel_masks);
+  for (uint8_t c = 0; c < 6; c++) {
+    soft_pwm_write(c, c < 4 ? 0x40 : 0x90);
+  }
+  soft_pwm_loop();
+  uint16_t high_steps[6];
+  emulate_period(6, channel_ports, channel_masks, high_steps);
+  const soft_pwm_frame_t *frame = soft_pwm_frame();
+  TEST_ASSERT_EQUAL(2, frame->count);
+  TEST_ASSERT_EQUAL(0x40, frame->points[0].time);
+  // channels 0 and 3 on port b, 1 on port c, 2 on port d
+  TEST_ASSERT_EQUAL(0x03, frame->points[0].clear[0]);
+  TEST_ASSERT_EQUAL(0x01, frame->points[0].clear[1]);
+  TEST_ASSERT_EQUAL(0x01, frame->points[0].clear[2]);
+  TEST_ASSERT_EQUAL(0x90, frame->points[1].time);
+}
+
+void test_new_duty_waits_for_period_start(void) {
+  volatile uint8_t *channel_ports[1];
+  uint8_t channel_masks[1];
+  attach_channels(1, channel_ports, channel_masks);
+  soft_pwm_write(0, 0x20);
+  soft_pwm_loop();
+  soft_pwm_period_start(0);
+  soft_pwm_write(0, 0xA0);
+  soft_pwm_loop();
+  // the running period keeps its frame
+  TEST_ASSERT_EQUAL(0x20, soft_pwm_frame()->points[0].time);
+  soft_pwm_period_start(0);
+  TEST_ASSERT_EQUAL(0xA0, soft_pwm_frame()->points[0].time);
+}
+
+void test_other_port_bits_are_kept(void) {
+  soft_pwm_attach(&port_b, 0x10);
+  soft_pwm_write(0, 0x80);
+  soft_pwm_loop();
+  port_b = 0x81;
+  soft_pwm_period_start(0);
+  TEST_ASSERT_EQUAL(0x91, port_b);
+  soft_pwm_compare(0x80);
+  TEST_ASSERT_EQUAL(0x81, port_b);
+}
+
+void test_detach_leaves_pin_alone(void) {
+  soft_pwm_attach(&port_b, 0x10);
+  soft_pwm_write(0, 0x80);
+  soft_pwm_loop();
+  soft_pwm_period_start(0);
+  soft_pwm_detach(&port_b, 0x10);
+  TEST_ASSERT_EQUAL(0x00, port_b);
+  // now a plain output
+  port_b = 0x10;
+  soft_pwm_compare(0x80);
+  soft_pwm_period_start(0);
+  TEST_ASSERT_EQUAL(0x10, port_b);
+}
+
+void test_channels_and_ports_are_limited(void) {
+  uint8_t other_port = 0;
+  volatile uint8_t *channel_ports[SOFT_PWM_MAX_CHANNELS];
+  uint8_t channel_masks[SOFT_PWM_MAX_CHANNELS];
+  attach_channels(SOFT_PWM_MAX_CHANNELS, channel_ports, channel_masks);
+  TEST_ASSERT_EQUAL(SOFT_PWM_NONE, soft_pwm_attach(&port_b, 0x80));
+  TEST_ASSERT_EQUAL(SOFT_PWM_NONE, soft_pwm_attach(&other_port, 0x01));
+  // attaching again returns the existing channel
+  TEST_ASSERT_EQUAL(4, soft_pwm_attach(&port_c, 0x02));
+}
+
+/**
+ * Worst case: every channel its own duty, all points far enough apart to
+ * need their own interrupt.
+ */
+void report_budget(uint8_t channels) {
+  volatile uint8_t *channel_ports[SOFT_PWM_MAX_CHANNELS];
+  uint8_t channel_masks[SOFT_PWM_MAX_CHANNELS];
+  attach_channels(channels, channel_ports, channel_masks);
+  for (uint8_t c = 0; c < channels; c++) {
+    soft_pwm_write(c, 0x10 + c * 0x12);
+  }
+  soft_pwm_loop();
+  uint16_t high_steps[SOFT_PWM_MAX_CHANNELS];
+  emulate_period(channels, channel_ports, channel_masks, high_steps);
+  period_stats_t stats = emulate_period(channels, channel_ports, channel_masks, high_steps);
+  TEST_ASSERT_EQUAL(channels, stats.points);
+  TEST_ASSERT_EQUAL(channels + 1, stats.interrupts);
+  unsigned long cycles = stats.interrupts * ISR_CYCLES + PERIOD_START_CYCLES + stats.points * POINT_CYCLES;
+  // all duties distinct but within SOFT_PWM_MIN_GAP: one interrupt runs every point
+  unsigned long longest = ISR_CYCLES + channels * POINT_CYCLES;
+  printf("%2d channels: %2d interrupts, %5lu cycles per period (%4.1f%% cpu), "
+         "longest interrupt %4lu cycles\n",
+         channels, stats.interrupts, cycles, 100.0 * cycles / PERIOD_CYCLES, longest);
+}
+
+void test_budget_6_channels(void) {
+  report_budget(6);
+}
+
+void test_budget_12_channels(void) {
+  report_budget(12);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_duty_cycles);
+  RUN_TEST(test_off_and_full_on);
+  RUN_TEST(test_equal_duties_share_a_point);
+  RUN_TEST(test_new_duty_waits_for_period_start);
+  RUN_TEST(test_other_port_bits_are_kept);
+  RUN_TEST(test_detach_leaves_pin_alone);
+  RUN_TEST(test_channels_and_ports_are_limited);
+  RUN_TEST(test_budget_6_channels);
+  RUN_TEST(test_budget_12_channels);
+  return UNITY_END();
+}
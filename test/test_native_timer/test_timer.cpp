@@ -0,0 +1,208 @@
+#include <unity.h>
+#include <stddef.h>
+#include <ArduinoMock.h>
+#include <EEPROM.h>
+#include <homectrl.h>
+#include <fade.h>
+#include <timer.h>
+#include "../pin_setting_address.h"
+
+#define SWITCH_PIN_INDEX 0
+#define INPUT_PIN_INDEX 1
+#define DIMMER_INDEX 8
+// A0 on the pro mini
+#define ANALOG_PIN_INDEX 4
+#define AUTO_OFF_REGISTER(index) (8 + (index) * 12 + 1)
+// not handled by the firmware, fires without side effects on an input pin
+#define TEST_ACTION 0x7F
+
+void run_for(unsigned long ms) {
+  for (unsigned long t = 0; t < ms; t += 100) {
+    mock_advance_millis(100);
+    for (uint8_t i = 0; i < 100000UL / FADE_TICK_US; i++) {
+      fade_tick();
+    }
+    loop_digital_pins();
+  }
+}
+
+void command(uint8_t index, uint8_t command) {
+  digital_pin_context_t ctx;
+  init_digital_pin_context(index, &ctx);
+  update_output(&ctx, command);
+}
+
+void setUp() {
+  mock_reset();
+  EEPROM.clear(0xFF);
+  load_settings();
+  load_digital_pin_settings();
+  memset(current_values, 0, NR_OF_DIGITAL_PINS);
+  memset(output_states, 0, NR_OF_DIGITAL_PINS * sizeof(struct output_pin_state));
+  for (uint8_t i = 0; i < NR_OF_DIGITAL_PINS; i++) {
+    fade_stop(i);
+  }
+  timer_reset();
+  write_setting(PIN_SETTING_ADDRESS(SWITCH_PIN_INDEX, mode), DIGITAL_PIN_MODE_OUTPUT);
+  write_setting(PIN_SETTING_ADDRESS(SWITCH_PIN_INDEX, output_value), 0);
+  write_setting(PIN_SETTING_ADDRESS(SWITCH_PIN_INDEX, auto_off_time), 30);
+  write_setting(PIN_SETTING_ADDRESS(INPUT_PIN_INDEX, mode), DIGITAL_PIN_MODE_INPUT_PULLUP);
+  write_setting(PIN_SETTING_ADDRESS(DIMMER_INDEX, mode), DIGITAL_PIN_MODE_OUTPUT | DIGITAL_PIN_PWM_MASK);
+  write_setting(PIN_SETTING_ADDRESS(DIMMER_INDEX, output_value), 0);
+  write_setting(PIN_SETTING_ADDRESS(DIMMER_INDEX, pwm_on_value), 0x80);
+  write_setting(PIN_SETTING_ADDRESS(DIMMER_INDEX, fade_time), 0);
+  loop_digital_pins();
+}
+
+void test_wheel_fires_after_ticks(void) {
+  // below, at and beyond one turn of the wheel
+  const uint32_t delays[] = {1, 5, TIMER_WHEEL_SLOTS - 1, TIMER_WHEEL_SLOTS,
+                             TIMER_WHEEL_SLOTS + 1, 5 * TIMER_WHEEL_SLOTS + 3};
+  for (uint8_t i = 0; i < sizeof(delays) / sizeof(delays[0]); i++) {
+    timer_start(INPUT_PIN_INDEX, TEST_ACTION, delays[i]);
+    for (uint32_t tick = 0; tick < delays[i]; tick++) {
+      TEST_ASSERT_EQUAL(TEST_ACTION, timer_action(INPUT_PIN_INDEX));
+      TEST_ASSERT_EQUAL(delays[i] - tick, timer_remaining(INPUT_PIN_INDEX));
+      timer_tick();
+    }
+    TEST_ASSERT_EQUAL(TIMER_NONE, timer_action(INPUT_PIN_INDEX));
+    TEST_ASSERT_EQUAL(0, timer_remaining(INPUT_PIN_INDEX));
+  }
+}
+
+void test_wheel_cancel_keeps_slot_neighbours(void) {
+  // all three share one slot
+  timer_start(INPUT_PIN_INDEX, TEST_ACTION, 3);
+  timer_start(INPUT_PIN_INDEX + 1, TEST_ACTION, 3 + TIMER_WHEEL_SLOTS);
+  timer_start(INPUT_PIN_INDEX + 2, TEST_ACTION, 3);
+  timer_cancel(INPUT_PIN_INDEX + 1);
+  timer_cancel(INPUT_PIN_INDEX + 1);
+  for (uint8_t tick = 0; tick < 3; tick++) {
+    timer_tick();
+  }
+  TEST_ASSERT_EQUAL(TIMER_NONE, timer_action(INPUT_PIN_INDEX));
+  TEST_ASSERT_EQUAL(TIMER_NONE, timer_action(INPUT_PIN_INDEX + 1));
+  TEST_ASSERT_EQUAL(TIMER_NONE, timer_action(INPUT_PIN_INDEX + 2));
+}
+
+void test_auto_off(void) {
+  command(SWITCH_PIN_INDEX, COMMAND_ON);
+  TEST_ASSERT_EQUAL(30, read_single_input_register(AUTO_OFF_REGISTER(SWITCH_PIN_INDEX)));
+  run_for(29900);
+  TEST_ASSERT_EQUAL(1, current_values[SWITCH_PIN_INDEX]);
+  TEST_ASSERT_EQUAL(1, read_single_input_register(AUTO_OFF_REGISTER(SWITCH_PIN_INDEX)));
+  run_for(100);
+  TEST_ASSERT_EQUAL(0, current_values[SWITCH_PIN_INDEX]);
+  TEST_ASSERT_EQUAL(0, digital_pin_settings[SWITCH_PIN_INDEX].output_value);
+  TEST_ASSERT_EQUAL(0, read_single_input_register(AUTO_OFF_REGISTER(SWITCH_PIN_INDEX)));
+}
+
+void test_auto_off_in_minutes(void) {
+  write_setting(PIN_SETTING_ADDRESS(SWITCH_PIN_INDEX, auto_off_time), AUTO_OFF_TIME_MINUTES | 2);
+  command(SWITCH_PIN_INDEX, COMMAND_ON);
+  TEST_ASSERT_EQUAL(120, read_single_input_register(AUTO_OFF_REGISTER(SWITCH_PIN_INDEX)));
+  run_for(120000);
+  TEST_ASSERT_EQUAL(0, current_values[SWITCH_PIN_INDEX]);
+}
+
+void test_manual_off_cancels_timer(void) {
+  command(SWITCH_PIN_INDEX, COMMAND_ON);
+  run_for(10000);
+  command(SWITCH_PIN_INDEX, COMMAND_OFF);
+  TEST_ASSERT_EQUAL(0, read_single_input_register(AUTO_OFF_REGISTER(SWITCH_PIN_INDEX)));
+  TEST_ASSERT_EQUAL(TIMER_NONE, timer_action(SWITCH_PIN_INDEX));
+}
+
+void test_retrigger(void) {
+  command(SWITCH_PIN_INDEX, COMMAND_ON);
+  run_for(20000);
+  // without the option the first on command counts
+  command(SWITCH_PIN_INDEX, COMMAND_ON);
+  TEST_ASSERT_EQUAL(10, read_single_input_register(AUTO_OFF_REGISTER(SWITCH_PIN_INDEX)));
+  write_setting(PIN_SETTING_ADDRESS(SWITCH_PIN_INDEX, timer_options), TIMER_OPTION_RETRIGGER);
+  command(SWITCH_PIN_INDEX, COMMAND_ON);
+  TEST_ASSERT_EQUAL(30, read_single_input_register(AUTO_OFF_REGISTER(SWITCH_PIN_INDEX)));
+  run_for(29900);
+  TEST_ASSERT_EQUAL(1, current_values[SWITCH_PIN_INDEX]);
+  run_for(100);
+  TEST_ASSERT_EQUAL(0, current_values[SWITCH_PIN_INDEX]);
+}
+
+void test_warning_blink(void) {
+  uint8_t pin = digital_pins_numbers[SWITCH_PIN_INDEX];
+  write_setting(PIN_SETTING_ADDRESS(SWITCH_PIN_INDEX, timer_options), TIMER_OPTION_WARN);
+  command(SWITCH_PIN_INDEX, COMMAND_ON);
+  run_for(19900);
+  TEST_ASSERT_EQUAL(HIGH, mock_get_pin(pin));
+  run_for(100);
+  // the pin blinks, the output value does not change
+  TEST_ASSERT_EQUAL(LOW, mock_get_pin(pin));
+  TEST_ASSERT_EQUAL(1, current_values[SWITCH_PIN_INDEX]);
+  TEST_ASSERT_EQUAL(10, read_single_input_register(AUTO_OFF_REGISTER(SWITCH_PIN_INDEX)));
+  run_for(500);
+  TEST_ASSERT_EQUAL(HIGH, mock_get_pin(pin));
+  run_for(9400);
+  TEST_ASSERT_EQUAL(HIGH, mock_get_pin(pin));
+  run_for(100);
+  TEST_ASSERT_EQUAL(LOW, mock_get_pin(pin));
+  TEST_ASSERT_EQUAL(0, current_values[SWITCH_PIN_INDEX]);
+}
+
+void test_retrigger_ends_warning_blink(void) {
+  uint8_t pin = digital_pins_numbers[SWITCH_PIN_INDEX];
+  write_setting(PIN_SETTING_ADDRESS(SWITCH_PIN_INDEX, timer_options),
+                TIMER_OPTION_WARN | TIMER_OPTION_RETRIGGER);
+  command(SWITCH_PIN_INDEX, COMMAND_ON);
+  run_for(20000);
+  TEST_ASSERT_EQUAL(LOW, mock_get_pin(pin));
+  command(SWITCH_PIN_INDEX, COMMAND_ON);
+  TEST_ASSERT_EQUAL(HIGH, mock_get_pin(pin));
+  TEST_ASSERT_EQUAL(30, read_single_input_register(AUTO_OFF_REGISTER(SWITCH_PIN_INDEX)));
+}
+
+void test_dimmer_fades_off(void) {
+  write_setting(PIN_SETTING_ADDRESS(DIMMER_INDEX, auto_off_time), 5);
+  write_setting(PIN_SETTING_ADDRESS(DIMMER_INDEX, timer_options), TIMER_OPTION_FADE_OFF);
+  command(DIMMER_INDEX, COMMAND_FADE_TO_ON);
+  TEST_ASSERT_EQUAL(5, read_single_input_register(AUTO_OFF_REGISTER(DIMMER_INDEX)));
+  run_for(5000);
+  TEST_ASSERT_EQUAL(OUTPUT_STATE_FADE_TO_OFF, output_states[DIMMER_INDEX].state);
+  run_for(FADE_DEFAULT_TIME + 100);
+  TEST_ASSERT_EQUAL(0, current_values[DIMMER_INDEX]);
+  TEST_ASSERT_EQUAL(OUTPUT_STATE_IDLE, output_states[DIMMER_INDEX].state);
+}
+
+void test_invalid_timer_options_are_rejected(void) {
+  TEST_ASSERT_EQUAL(STATUS_ILLEGAL_DATA_VALUE,
+                    write_setting(PIN_SETTING_ADDRESS(SWITCH_PIN_INDEX, timer_options), 0x80));
+}
+
+void test_erased_timer_bytes_load_as_no_timer(void) {
+  EEPROM.data[PIN_SETTING_ADDRESS(INPUT_PIN_INDEX, auto_off_time)] = 0xFF;
+  EEPROM.data[PIN_SETTING_ADDRESS(INPUT_PIN_INDEX, timer_options)] = 0xFF;
+  // analog inputs keep their fall level
+  EEPROM.data[PIN_SETTING_ADDRESS(ANALOG_PIN_INDEX, mode)] = DIGITAL_PIN_MODE_ANALOG;
+  EEPROM.data[PIN_SETTING_ADDRESS(ANALOG_PIN_INDEX, analog_fall_level)] = 0x40;
+  EEPROM.data[PIN_SETTING_ADDRESS(ANALOG_PIN_INDEX, timer_options)] = 0xFF;
+  load_digital_pin_settings();
+  TEST_ASSERT_EQUAL(0, digital_pin_settings[INPUT_PIN_INDEX].auto_off_time);
+  TEST_ASSERT_EQUAL(0, digital_pin_settings[INPUT_PIN_INDEX].timer_options);
+  TEST_ASSERT_EQUAL(0x40, digital_pin_settings[ANALOG_PIN_INDEX].analog_fall_level);
+  TEST_ASSERT_EQUAL(0, digital_pin_settings[ANALOG_PIN_INDEX].timer_options);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_wheel_fires_after_ticks);
+  RUN_TEST(test_wheel_cancel_keeps_slot_neighbours);
+  RUN_TEST(test_auto_off);
+  RUN_TEST(test_auto_off_in_minutes);
+  RUN_TEST(test_manual_off_cancels_timer);
+  RUN_TEST(test_retrigger);
+  RUN_TEST(test_warning_blink);
+  RUN_TEST(test_retrigger_ends_warning_blink);
+  RUN_TEST(test_dimmer_fades_off);
+  RUN_TEST(test_invalid_timer_options_are_rejected);
+  RUN_TEST(test_erased_timer_bytes_load_as_no_timer);
+  return UNITY_END();
+}